@@ -0,0 +1,239 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nuria/luabuffer.hpp"
+
+#include <QSharedData>
+#include <QPointer>
+#include <lua.hpp>
+
+#include "nuria/luanativefunction.hpp"
+#include "nuria/luaruntime.hpp"
+
+namespace Nuria {
+
+// User data of a buffer in Lua. 'data' is nullptr once it's detached.
+struct Q_DECL_HIDDEN LuaBufferData {
+	void *data;
+	int length;
+	int type;
+};
+
+class Q_DECL_HIDDEN LuaBufferPrivate : public QSharedData {
+public:
+	~LuaBufferPrivate ()
+	{ detach (); }
+	
+	void detach () {
+		lua_State *env = (runtime.isNull ()) ? nullptr : (lua_State *)runtime->luaState ();
+		if (env && reference > 0) {
+			lua_getref (env, reference);
+			LuaBufferData *buffer = static_cast< LuaBufferData * > (lua_touserdata (env, -1));
+			buffer->data = nullptr;
+			buffer->length = 0;
+			
+			lua_pop (env, 1);
+			luaL_unref (env, LUA_REGISTRYINDEX, reference);
+		}
+		
+		reference = 0;
+		data = nullptr;
+		length = 0;
+	}
+	
+	// 
+	QPointer< LuaRuntime > runtime;
+	LuaBuffer::Type type = LuaBuffer::Double;
+	void *data = nullptr;
+	int length = 0;
+	int reference = 0;
+	
+};
+
+}
+
+static const char *bufferMetaTableName = "_Nuria_Buffer";
+
+static Nuria::LuaBufferData *bufferAt (lua_State *env, int idx) {
+	return static_cast< Nuria::LuaBufferData * > (luaL_checkudata (env, idx, bufferMetaTableName));
+}
+
+// Returns the zero-based index at 'idx', or -1 if it's out of range
+static int bufferIndex (lua_State *env, Nuria::LuaBufferData *buffer, int idx) {
+	if (lua_type (env, idx) != LUA_TNUMBER) {
+		return -1;
+	}
+	
+	int index = lua_tointeger (env, idx) - 1;
+	return (index >= 0 && index < buffer->length) ? index : -1;
+}
+
+static int bufferRead (lua_State *env) {
+	Nuria::LuaBufferData *buffer = bufferAt (env, 1);
+	int i = bufferIndex (env, buffer, 2);
+	if (i < 0) {
+		lua_pushnil (env);
+		return 1;
+	}
+	
+	switch (buffer->type) {
+	case Nuria::LuaBuffer::Double:
+		lua_pushnumber (env, static_cast< double * > (buffer->data)[i]);
+		break;
+	case Nuria::LuaBuffer::Float:
+		lua_pushnumber (env, static_cast< float * > (buffer->data)[i]);
+		break;
+	case Nuria::LuaBuffer::Int32:
+		lua_pushnumber (env, static_cast< qint32 * > (buffer->data)[i]);
+		break;
+	case Nuria::LuaBuffer::Int64:
+		lua_pushnumber (env, static_cast< qint64 * > (buffer->data)[i]);
+		break;
+	case Nuria::LuaBuffer::UInt8:
+		lua_pushnumber (env, static_cast< quint8 * > (buffer->data)[i]);
+		break;
+	}
+	
+	return 1;
+}
+
+static int bufferWrite (lua_State *env) {
+	Nuria::LuaBufferData *buffer = bufferAt (env, 1);
+	int i = bufferIndex (env, buffer, 2);
+	lua_Number value = luaL_checknumber (env, 3);
+	
+	if (i < 0) {
+		return luaL_error (env, "Index out of range of buffer with %d elements", buffer->length);
+	}
+	
+	// Out of range values are clamped, NaN becomes 0
+	switch (buffer->type) {
+	case Nuria::LuaBuffer::Double:
+		static_cast< double * > (buffer->data)[i] = value;
+		break;
+	case Nuria::LuaBuffer::Float:
+		static_cast< float * > (buffer->data)[i] = float (value);
+		break;
+	case Nuria::LuaBuffer::Int32:
+		static_cast< qint32 * > (buffer->data)[i] = Nuria::Internal::luaNumberCast< qint32 > (value);
+		break;
+	case Nuria::LuaBuffer::Int64:
+		static_cast< qint64 * > (buffer->data)[i] = Nuria::Internal::luaNumberCast< qint64 > (value);
+		break;
+	case Nuria::LuaBuffer::UInt8:
+		static_cast< quint8 * > (buffer->data)[i] = Nuria::Internal::luaNumberCast< quint8 > (value);
+		break;
+	}
+	
+	return 0;
+}
+
+static int bufferLength (lua_State *env) {
+	lua_pushinteger (env, bufferAt (env, 1)->length);
+	return 1;
+}
+
+Nuria::LuaBuffer::LuaBuffer ()
+	: d (new LuaBufferPrivate)
+{
+
+}
+
+Nuria::LuaBuffer::LuaBuffer (LuaRuntime *runtime, Type type, void *data, int length)
+	: d (new LuaBufferPrivate)
+{
+	
+	this->d->runtime = runtime;
+	this->d->type = type;
+	this->d->data = data;
+	this->d->length = (data) ? length : 0;
+	
+}
+
+Nuria::LuaBuffer::LuaBuffer (const LuaBuffer &other)
+	: d (other.d)
+{
+
+}
+
+Nuria::LuaBuffer &Nuria::LuaBuffer::operator= (const LuaBuffer &other) {
+	this->d = other.d;
+	return *this;
+}
+
+Nuria::LuaBuffer::~LuaBuffer () {
+
+}
+
+bool Nuria::LuaBuffer::isValid () const {
+	return (!this->d->runtime.isNull () && this->d->data);
+}
+
+Nuria::LuaRuntime *Nuria::LuaBuffer::runtime () const {
+	return this->d->runtime;
+}
+
+Nuria::LuaBuffer::Type Nuria::LuaBuffer::type () const {
+	return this->d->type;
+}
+
+void *Nuria::LuaBuffer::data () const {
+	return this->d->data;
+}
+
+int Nuria::LuaBuffer::length () const {
+	return this->d->length;
+}
+
+void Nuria::LuaBuffer::detach () {
+	this->d->detach ();
+}
+
+void Nuria::LuaBuffer::pushOnStack (LuaRuntime *runtime) const {
+	lua_State *env = (lua_State *)runtime->luaState ();
+	if (!isValid () || this->d->runtime != runtime) {
+		lua_pushnil (env);
+		return;
+	}
+	
+	// Pass the same user data every time
+	if (this->d->reference > 0) {
+		lua_getref (env, this->d->reference);
+		return;
+	}
+	
+	LuaBufferData *buffer = static_cast< LuaBufferData * > (lua_newuserdata (env, sizeof(LuaBufferData)));
+	buffer->data = this->d->data;
+	buffer->length = this->d->length;
+	buffer->type = this->d->type;
+	
+	// Set up the meta table on first use
+	if (luaL_newmetatable (env, bufferMetaTableName)) {
+		lua_pushcfunction (env, &bufferRead);
+		lua_setfield (env, -2, "__index");
+		lua_pushcfunction (env, &bufferWrite);
+		lua_setfield (env, -2, "__newindex");
+		lua_pushcfunction (env, &bufferLength);
+		lua_setfield (env, -2, "__len");
+	}
+	
+	lua_setmetatable (env, -2);
+	
+	// 
+	lua_pushvalue (env, -1);
+	this->d->reference = luaL_ref (env, LUA_REGISTRYINDEX);
+	
+}
@@ -0,0 +1,629 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nuria/luachannel.hpp"
+
+#include <QWaitCondition>
+#include <QElapsedTimer>
+#include <QSharedData>
+#include <QAtomicInt>
+#include <QMutex>
+#include <QVector>
+#include <QHash>
+#include <QPair>
+#include <functional>
+#include <climits>
+#include <lua.hpp>
+
+#include "private/luamsgpack.hpp"
+#include "nuria/luaruntime.hpp"
+#include "nuria/luapack.hpp"
+
+namespace Nuria {
+
+/*
+ * Bounded multi-producer multi-consumer queue after Dmitry Vyukov. Each cell
+ * carries a sequence number telling whether it's ready to be written or
+ * read in the current lap, so producers and consumers only contend on their
+ * respective position.
+ */
+class Q_DECL_HIDDEN LuaChannelPrivate : public QSharedData {
+public:
+	
+	struct Cell {
+		QAtomicInt sequence;
+		QByteArray data;
+	};
+	
+	LuaChannelPrivate (int capacity) {
+		int size = 2;
+		for (; size < capacity && size < (1 << 30); size <<= 1);
+		
+		this->mask = size - 1;
+		this->cells = new Cell[size];
+		for (int i = 0; i < size; i++) {
+			this->cells[i].sequence.store (i);
+		}
+		
+	}
+	
+	~LuaChannelPrivate ()
+	{ delete[] this->cells; }
+	
+	bool tryPush (const QByteArray &data) {
+		uint pos = uint (this->enqueuePos.loadAcquire ());
+		Cell *cell;
+		
+		while (true) {
+			cell = &this->cells[pos & uint (this->mask)];
+			int diff = int (uint (cell->sequence.loadAcquire ()) - pos);
+			
+			if (diff == 0 && this->enqueuePos.testAndSetRelaxed (int (pos), int (pos + 1))) {
+				break;
+			} else if (diff < 0) {
+				return false; // Full
+			}
+			
+			pos = uint (this->enqueuePos.loadAcquire ());
+		}
+		
+		cell->data = data;
+		cell->sequence.storeRelease (int (pos + 1));
+		return true;
+	}
+	
+	bool tryPop (QByteArray &data) {
+		uint pos = uint (this->dequeuePos.loadAcquire ());
+		Cell *cell;
+		
+		while (true) {
+			cell = &this->cells[pos & uint (this->mask)];
+			int diff = int (uint (cell->sequence.loadAcquire ()) - (pos + 1));
+			
+			if (diff == 0 && this->dequeuePos.testAndSetRelaxed (int (pos), int (pos + 1))) {
+				break;
+			} else if (diff < 0) {
+				return false; // Empty
+			}
+			
+			pos = uint (this->dequeuePos.loadAcquire ());
+		}
+		
+		data = cell->data;
+		cell->data = QByteArray ();
+		cell->sequence.storeRelease (int (pos + uint (this->mask) + 1));
+		return true;
+	}
+	
+	// Wakes up a thread waiting in wait() on 'condition'
+	void wake (QAtomicInt &waiting, QWaitCondition &condition) {
+		if (waiting.fetchAndAddOrdered (0) > 0) {
+			QMutexLocker lock (&this->mutex);
+			condition.wakeOne ();
+		}
+		
+	}
+	
+	// Calls 'attempt' until it succeeds, the channel is closed or 'timeout'
+	// has passed.
+	template< typename Func >
+	bool wait (int timeout, QAtomicInt &waiting, QWaitCondition &condition, Func attempt) {
+		QElapsedTimer timer;
+		timer.start ();
+		
+		QMutexLocker lock (&this->mutex);
+		waiting.fetchAndAddOrdered (1);
+		
+		bool success = false;
+		while (!(success = attempt ()) && !this->closed.loadAcquire ()) {
+			unsigned long remaining = ULONG_MAX;
+			if (timeout >= 0) {
+				qint64 left = timeout - timer.elapsed ();
+				if (left <= 0) {
+					break;
+				}
+				
+				remaining = (unsigned long)left;
+			}
+			
+			condition.wait (&this->mutex, remaining);
+		}
+		
+		waiting.fetchAndAddOrdered (-1);
+		return success;
+	}
+	
+	bool push (const QByteArray &data, int timeout) {
+		if (this->closed.loadAcquire ()) {
+			return false;
+		}
+		
+		bool success = tryPush (data);
+		if (!success && timeout != 0) {
+			success = wait (timeout, this->waitingSenders, this->notFull,
+			                [this, &data]() { return tryPush (data); });
+		}
+		
+		if (success) {
+			wake (this->waitingReceivers, this->notEmpty);
+			notifyWatchers ();
+		}
+		
+		return success;
+	}
+	
+	bool pop (QByteArray &data, int timeout) {
+		bool success = tryPop (data);
+		if (!success && timeout != 0 && !this->closed.loadAcquire ()) {
+			success = wait (timeout, this->waitingReceivers, this->notEmpty,
+			                [this, &data]() { return tryPop (data); });
+		}
+		
+		if (success) {
+			wake (this->waitingSenders, this->notFull);
+			notifyWatchers ();
+		}
+		
+		return success;
+	}
+	
+	void close () {
+		this->closed.storeRelease (1);
+		
+		QMutexLocker lock (&this->mutex);
+		this->notEmpty.wakeAll ();
+		this->notFull.wakeAll ();
+		lock.unlock ();
+		
+		notifyWatchers ();
+	}
+	
+	// Calls and removes all watchers. They're called with the lock held,
+	// so once unwatch() returned, the callback isn't running anymore.
+	void notifyWatchers () {
+		if (this->watcherCount.fetchAndAddOrdered (0) == 0) {
+			return;
+		}
+		
+		QMutexLocker lock (&this->watchMutex);
+		for (const auto &watcher : this->watchers) {
+			watcher.second ();
+		}
+		
+		this->watchers.clear ();
+		this->watcherCount.store (0);
+	}
+	
+	int watch (std::function< void () > callback) {
+		QMutexLocker lock (&this->watchMutex);
+		int id = ++this->nextWatcher;
+		this->watchers.append (qMakePair (id, std::move (callback)));
+		this->watcherCount.fetchAndAddOrdered (1);
+		return id;
+	}
+	
+	void unwatch (int id) {
+		QMutexLocker lock (&this->watchMutex);
+		for (int i = 0; i < this->watchers.size (); i++) {
+			if (this->watchers.at (i).first == id) {
+				this->watchers.remove (i);
+				this->watcherCount.fetchAndAddOrdered (-1);
+				break;
+			}
+			
+		}
+		
+	}
+	
+	int count () const {
+		int count = this->enqueuePos.loadAcquire () - this->dequeuePos.loadAcquire ();
+		return qBound (0, count, this->mask + 1);
+	}
+	
+	// 
+	Cell *cells;
+	int mask;
+	QAtomicInt enqueuePos;
+	QAtomicInt dequeuePos;
+	QAtomicInt closed;
+	
+	// Only used by blocking calls
+	QMutex mutex;
+	QWaitCondition notEmpty;
+	QWaitCondition notFull;
+	QAtomicInt waitingSenders;
+	QAtomicInt waitingReceivers;
+	
+	// One-shot callbacks of parked coroutines, see LuaChannel::watch()
+	QMutex watchMutex;
+	QVector< QPair< int, std::function< void () > > > watchers;
+	QAtomicInt watcherCount;
+	int nextWatcher = 0;
+	
+};
+
+// User data of a channel in Lua. Holds a reference on 'd'.
+struct Q_DECL_HIDDEN LuaChannelData {
+	LuaChannelPrivate *d;
+};
+
+}
+
+static const char *channelMetaTableName = "_Nuria_Channel";
+
+// Process-wide named channels
+static QMutex namedChannelsMutex;
+static QHash< QString, Nuria::LuaChannel > namedChannels;
+
+// Implements the waiting methods on top of the C functions. Inside a
+// coroutine, the channel is yielded instead of blocking the thread.
+static const char channelMethodsScript[] =
+	"local methods = ...\n"
+	"local trySend, tryReceive = methods.trySend, methods.tryReceive\n"
+	"local waitSend, waitReceive = methods.waitSend, methods.waitReceive\n"
+	"local running, yield = coroutine.running, coroutine.yield\n"
+	"methods.waitSend, methods.waitReceive = nil, nil\n"
+	"function methods.send (channel, value, timeout)\n"
+	"  while true do\n"
+	"    local ok, err = trySend (channel, value)\n"
+	"    if ok or err then return ok, err end\n"
+	"    if not running () then return waitSend (channel, value, timeout) end\n"
+	"    yield (channel)\n"
+	"  end\n"
+	"end\n"
+	"function methods.receive (channel, timeout)\n"
+	"  while true do\n"
+	"    local ok, value = tryReceive (channel)\n"
+	"    if ok then return value end\n"
+	"    if value then return nil, value end\n"
+	"    if not running () then return waitReceive (channel, timeout) end\n"
+	"    yield (channel)\n"
+	"  end\n"
+	"end\n";
+
+static Nuria::LuaChannelPrivate *channelAt (lua_State *env, int idx) {
+	return static_cast< Nuria::LuaChannelData * > (luaL_checkudata (env, idx, channelMetaTableName))->d;
+}
+
+static Nuria::LuaRuntime *channelRuntime (lua_State *env) {
+	return static_cast< Nuria::LuaRuntime * > (lua_touserdata (env, lua_upvalueindex(1)));
+}
+
+static bool packArgument (lua_State *env, int idx, QByteArray &data) {
+	Nuria::LuaMsgPackEncoder encoder (channelRuntime (env), env, true);
+	if (!encoder.encode (idx)) {
+		lua_pushboolean (env, false);
+		lua_pushstring (env, encoder.errorString ().toUtf8 ().constData ());
+		return false;
+	}
+	
+	data = encoder.result ();
+	return true;
+}
+
+static bool unpackValue (lua_State *env, const QByteArray &data) {
+	Nuria::LuaMsgPackDecoder decoder (env, data.constData (), data.length ());
+	return decoder.decode ();
+}
+
+static int channelSend (lua_State *env, int timeout) {
+	Nuria::LuaChannelPrivate *d = channelAt (env, 1);
+	luaL_checkany (env, 2);
+	
+	QByteArray data;
+	if (!packArgument (env, 2, data)) {
+		return 2;
+	}
+	
+	if (d->push (data, timeout)) {
+		lua_pushboolean (env, true);
+		return 1;
+	}
+	
+	// A full channel isn't an error for trySend()
+	lua_pushboolean (env, false);
+	if (d->closed.loadAcquire ()) {
+		lua_pushliteral (env, "closed");
+	} else if (timeout != 0) {
+		lua_pushliteral (env, "timeout");
+	} else {
+		return 1;
+	}
+	
+	return 2;
+}
+
+static int channelTrySend (lua_State *env) {
+	return channelSend (env, 0);
+}
+
+static int channelWaitSend (lua_State *env) {
+	return channelSend (env, luaL_optint (env, 3, -1));
+}
+
+static int channelTryReceive (lua_State *env) {
+	Nuria::LuaChannelPrivate *d = channelAt (env, 1);
+	
+	QByteArray data;
+	if (d->pop (data, 0)) {
+		lua_pushboolean (env, true);
+		if (!unpackValue (env, data)) {
+			lua_pushnil (env);
+		}
+		
+		return 2;
+	}
+	
+	lua_pushboolean (env, false);
+	if (d->closed.loadAcquire ()) {
+		lua_pushliteral (env, "closed");
+		return 2;
+	}
+	
+	return 1;
+}
+
+static int channelWaitReceive (lua_State *env) {
+	Nuria::LuaChannelPrivate *d = channelAt (env, 1);
+	int timeout = luaL_optint (env, 2, -1);
+	
+	QByteArray data;
+	if (d->pop (data, timeout)) {
+		if (!unpackValue (env, data)) {
+			lua_pushnil (env);
+		}
+		
+		return 1;
+	}
+	
+	lua_pushnil (env);
+	if (d->closed.loadAcquire ()) {
+		lua_pushliteral (env, "closed");
+	} else {
+		lua_pushliteral (env, "timeout");
+	}
+	
+	return 2;
+}
+
+static int channelClose (lua_State *env) {
+	channelAt (env, 1)->close ();
+	return 0;
+}
+
+static int channelIsClosed (lua_State *env) {
+	lua_pushboolean (env, channelAt (env, 1)->closed.loadAcquire ());
+	return 1;
+}
+
+static int channelCount (lua_State *env) {
+	lua_pushinteger (env, channelAt (env, 1)->count ());
+	return 1;
+}
+
+static int channelCapacity (lua_State *env) {
+	lua_pushinteger (env, channelAt (env, 1)->mask + 1);
+	return 1;
+}
+
+static int channelEquals (lua_State *env) {
+	lua_pushboolean (env, channelAt (env, 1) == channelAt (env, 2));
+	return 1;
+}
+
+static int channelCollect (lua_State *env) {
+	Nuria::LuaChannelData *data = static_cast< Nuria::LuaChannelData * > (lua_touserdata (env, 1));
+	if (data->d && !data->d->ref.deref ()) {
+		delete data->d;
+	}
+	
+	data->d = nullptr;
+	return 0;
+}
+
+static void createChannelMetaTable (lua_State *env, Nuria::LuaRuntime *runtime) {
+	static const luaL_Reg methods[] = {
+		{ "trySend", &channelTrySend },
+		{ "tryReceive", &channelTryReceive },
+		{ "waitSend", &channelWaitSend },
+		{ "waitReceive", &channelWaitReceive },
+		{ "close", &channelClose },
+		{ "isClosed", &channelIsClosed },
+		{ "count", &channelCount },
+		{ "capacity", &channelCapacity },
+		{ nullptr, nullptr }
+	};
+	
+	// Methods, with the runtime as upvalue
+	lua_newtable (env);
+	for (const luaL_Reg *cur = methods; cur->name; cur++) {
+		lua_pushlightuserdata (env, runtime);
+		lua_pushcclosure (env, cur->func, 1);
+		lua_setfield (env, -2, cur->name);
+	}
+	
+	// Add send() and receive()
+	luaL_loadbuffer (env, channelMethodsScript, sizeof(channelMethodsScript) - 1, "channel");
+	lua_pushvalue (env, -2);
+	lua_call (env, 1, 0);
+	
+	lua_setfield (env, -2, "__index");
+	
+	lua_pushcfunction (env, &channelCount);
+	lua_setfield (env, -2, "__len");
+	lua_pushcfunction (env, &channelEquals);
+	lua_setfield (env, -2, "__eq");
+	lua_pushcfunction (env, &channelCollect);
+	lua_setfield (env, -2, "__gc");
+}
+
+Nuria::LuaChannel::LuaChannel ()
+	: d (nullptr)
+{
+
+}
+
+Nuria::LuaChannel::LuaChannel (int capacity)
+	: d (new LuaChannelPrivate (capacity))
+{
+
+}
+
+Nuria::LuaChannel::LuaChannel (LuaChannelPrivate *d)
+	: d (d)
+{
+
+}
+
+Nuria::LuaChannel::LuaChannel (const LuaChannel &other)
+	: d (other.d)
+{
+
+}
+
+Nuria::LuaChannel &Nuria::LuaChannel::operator= (const LuaChannel &other) {
+	this->d = other.d;
+	return *this;
+}
+
+Nuria::LuaChannel::~LuaChannel () {
+
+}
+
+Nuria::LuaChannel Nuria::LuaChannel::named (const QString &name, int capacity) {
+	QMutexLocker lock (&namedChannelsMutex);
+	
+	auto it = namedChannels.find (name);
+	if (it == namedChannels.end ()) {
+		it = namedChannels.insert (name, LuaChannel (capacity));
+	}
+	
+	return *it;
+}
+
+bool Nuria::LuaChannel::isValid () const {
+	return this->d;
+}
+
+int Nuria::LuaChannel::capacity () const {
+	return (this->d) ? this->d->mask + 1 : 0;
+}
+
+int Nuria::LuaChannel::count () const {
+	return (this->d) ? this->d->count () : 0;
+}
+
+void Nuria::LuaChannel::close () {
+	if (this->d) {
+		this->d->close ();
+	}
+	
+}
+
+bool Nuria::LuaChannel::isClosed () const {
+	return (!this->d || this->d->closed.loadAcquire ());
+}
+
+bool Nuria::LuaChannel::send (const LuaValue &value, int timeout) {
+	QByteArray data = LuaPack::pack (value, LuaPack::PackStructures);
+	return (!data.isEmpty () && sendData (data, timeout));
+}
+
+Nuria::LuaValue Nuria::LuaChannel::receive (LuaRuntime *runtime, int timeout, bool *ok) {
+	QByteArray data;
+	QString error;
+	LuaValue value;
+	
+	if (receiveData (data, timeout)) {
+		value = LuaPack::unpack (runtime, data, nullptr, &error);
+	} else {
+		error = QStringLiteral("No value");
+	}
+	
+	if (ok) {
+		*ok = error.isEmpty ();
+	}
+	
+	return value;
+}
+
+bool Nuria::LuaChannel::sendData (const QByteArray &data, int timeout) {
+	return (this->d && this->d->push (data, timeout));
+}
+
+bool Nuria::LuaChannel::receiveData (QByteArray &data, int timeout) {
+	return (this->d && this->d->pop (data, timeout));
+}
+
+int Nuria::LuaChannel::watch (std::function< void () > callback) {
+	if (!this->d) {
+		return 0;
+	}
+	
+	int id = this->d->watch (std::move (callback));
+	
+	// A coroutine yields the channel if it's empty or full. If that's not
+	// the case anymore, it changed before the watcher was in place.
+	int count = this->d->count ();
+	if (this->d->closed.loadAcquire () || (count > 0 && count <= this->d->mask)) {
+		this->d->unwatch (id);
+		return 0;
+	}
+	
+	return id;
+}
+
+void Nuria::LuaChannel::unwatch (int id) {
+	if (this->d && id != 0) {
+		this->d->unwatch (id);
+	}
+	
+}
+
+void Nuria::LuaChannel::pushOnStack (LuaRuntime *runtime) const {
+	pushOnStack (runtime, (lua_State *)runtime->luaState ());
+}
+
+void Nuria::LuaChannel::pushOnStack (LuaRuntime *runtime, lua_State *env) const {
+	if (!this->d) {
+		lua_pushnil (env);
+		return;
+	}
+	
+	LuaChannelData *data = static_cast< LuaChannelData * > (lua_newuserdata (env, sizeof(LuaChannelData)));
+	data->d = this->d.data ();
+	data->d->ref.ref ();
+	
+	// Set up the meta table on first use
+	if (luaL_newmetatable (env, channelMetaTableName)) {
+		createChannelMetaTable (env, runtime);
+	}
+	
+	lua_setmetatable (env, -2);
+}
+
+Nuria::LuaChannel Nuria::LuaChannel::fromStack (lua_State *env, int idx) {
+	void *data = lua_touserdata (env, idx);
+	if (!data || !lua_getmetatable (env, idx)) {
+		return LuaChannel ();
+	}
+	
+	luaL_getmetatable (env, channelMetaTableName);
+	bool isChannel = lua_rawequal (env, -1, -2);
+	lua_pop (env, 2);
+	
+	return (isChannel) ? LuaChannel (static_cast< LuaChannelData * > (data)->d) : LuaChannel ();
+}
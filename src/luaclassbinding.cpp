@@ -0,0 +1,94 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nuria/luaclassbinding.hpp"
+
+#include <nuria/metaobject.hpp>
+#include <lua.hpp>
+
+#include "private/luametaobjectwrapper.hpp"
+#include "private/luaruntimeprivate.hpp"
+#include "private/luastructures.hpp"
+#include "nuria/luaruntime.hpp"
+#include "nuria/luaobject.hpp"
+
+void *Nuria::Internal::LuaClassBindingHelper::addField (LuaRuntime *runtime, MetaObject *meta,
+                                                        const QByteArray &name, Getter getter,
+                                                        Setter setter, size_t size) {
+	lua_State *env = (lua_State *)runtime->luaState ();
+	LuaMetaObjectWrapper *wrapper = runtime->d_ptr->findOrCreateWrapper (meta);
+	
+	// Push table of natively bound members and the key
+	lua_getref (env, wrapper->nativesReference ());
+	lua_pushlstring (env, name.constData (), name.length ());
+	
+	// The accessor is followed by the member pointer
+	void *ptr = lua_newuserdata (env, sizeof(LuaNativeAccessor) + size);
+	LuaNativeAccessor *accessor = static_cast< LuaNativeAccessor * > (ptr);
+	accessor->getter = getter;
+	accessor->setter = setter;
+	
+	// Insert and pop the table
+	lua_rawset (env, -3);
+	lua_pop (env, 1);
+	
+	return accessor + 1;
+}
+
+void Nuria::Internal::LuaClassBindingHelper::addMethod (LuaRuntime *runtime, MetaObject *meta,
+                                                         const QByteArray &name) {
+	lua_State *env = (lua_State *)runtime->luaState ();
+	LuaMetaObjectWrapper *wrapper = runtime->d_ptr->findOrCreateWrapper (meta);
+	
+	// The closure is on top of the stack
+	lua_getref (env, wrapper->nativesReference ());
+	lua_pushlstring (env, name.constData (), name.length ());
+	lua_pushvalue (env, -3);
+	lua_rawset (env, -3);
+	
+	// Pop the table and the closure
+	lua_pop (env, 2);
+}
+
+void *Nuria::Internal::LuaClassBindingHelper::instance (lua_State *env, int idx, MetaObject *meta) {
+	LuaRuntime *runtime = LuaNativeHelper::runtime (env);
+	
+	// Make sure that the user data really is a instance of 'meta'
+	LuaWrapperUserData *data = runtime->d_ptr->wrapperData (idx);
+	if (data) {
+		runtime->d_ptr->refreshChildView (env, data);
+	}
+	
+	if (!data || !data->ptr || !runtime->d_ptr->inherits (data->meta, meta)) {
+		luaL_error (env, "Expected instance of %s as first argument", meta->className ().constData ());
+		return nullptr;
+	}
+	
+	return data->ptr;
+}
+
+bool Nuria::Internal::LuaClassBindingHelper::pushView (lua_State *env, int idx, void *member, int type) {
+	LuaRuntime *runtime = LuaNativeHelper::runtime (env);
+	LuaTypeConverter converter = runtime->d_ptr->converter (type);
+	
+	// Only structures without a dedicated converter
+	if (converter.push || !converter.meta || converter.isPointer || !runtime->d_ptr->wrapperData (idx)) {
+		return false;
+	}
+	
+	runtime->d_ptr->pushChildView (member, converter.meta, idx);
+	return true;
+}
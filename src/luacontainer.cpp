@@ -0,0 +1,151 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nuria/luacontainer.hpp"
+
+#include <lua.hpp>
+#include <new>
+
+#include "nuria/luaruntime.hpp"
+
+namespace Nuria {
+
+// User data of a container proxy
+struct Q_DECL_HIDDEN LuaContainerProxy {
+	QVariant container;
+	const Internal::LuaContainerHelper::Operations *operations;
+};
+
+}
+
+static const char *proxyMetaTableName = "_Nuria_ContainerProxy";
+
+static Nuria::LuaContainerProxy *proxyAt (lua_State *env, int idx) {
+	return static_cast< Nuria::LuaContainerProxy * > (luaL_checkudata (env, idx, proxyMetaTableName));
+}
+
+static int proxyIndex (lua_State *env) {
+	Nuria::LuaContainerProxy *proxy = proxyAt (env, 1);
+	if (!proxy->operations->index (env, proxy->container.constData (), 2)) {
+		lua_pushnil (env);
+	}
+	
+	return 1;
+}
+
+static int proxyLength (lua_State *env) {
+	Nuria::LuaContainerProxy *proxy = proxyAt (env, 1);
+	lua_pushinteger (env, proxy->operations->length (proxy->container.constData ()));
+	return 1;
+}
+
+static int proxyNext (lua_State *env) {
+	Nuria::LuaContainerProxy *proxy = proxyAt (env, 1);
+	lua_settop (env, 2);
+	
+	if (!proxy->operations->next (env, proxy->container.constData (), 2)) {
+		lua_pushnil (env);
+		return 1;
+	}
+	
+	return 2;
+}
+
+// Returns a iterator for the generic 'for': proxyNext, the proxy, nil
+static int proxyCall (lua_State *env) {
+	lua_pushvalue (env, lua_upvalueindex(1));
+	lua_pushvalue (env, lua_upvalueindex(2));
+	lua_pushcclosure (env, &proxyNext, 2);
+	lua_pushvalue (env, 1);
+	lua_pushnil (env);
+	return 3;
+}
+
+static int proxyDestroy (lua_State *env) {
+	Nuria::LuaContainerProxy *proxy = static_cast< Nuria::LuaContainerProxy * > (lua_touserdata (env, 1));
+	proxy->~LuaContainerProxy ();
+	return 0;
+}
+
+// The meta methods use the same upvalues as native functions, so elements
+// can be pushed using LuaNativeResult.
+static void pushMetaMethod (lua_State *env, Nuria::LuaRuntime *runtime, const char *name, lua_CFunction func) {
+	lua_pushnil (env);
+	lua_pushlightuserdata (env, runtime);
+	lua_pushcclosure (env, func, 2);
+	lua_setfield (env, -2, name);
+}
+
+void Nuria::Internal::LuaContainerHelper::push (LuaRuntime *runtime, const QVariant &container,
+                                                const Operations *operations) {
+	lua_State *env = (lua_State *)runtime->luaState ();
+	
+	void *ptr = lua_newuserdata (env, sizeof(LuaContainerProxy));
+	new (ptr) LuaContainerProxy { container, operations };
+	
+	// Set up the meta table on first use
+	if (luaL_newmetatable (env, proxyMetaTableName)) {
+		pushMetaMethod (env, runtime, "__index", &proxyIndex);
+		pushMetaMethod (env, runtime, "__len", &proxyLength);
+		pushMetaMethod (env, runtime, "__call", &proxyCall);
+		pushMetaMethod (env, runtime, "__gc", &proxyDestroy);
+	}
+	
+	lua_setmetatable (env, -2);
+}
+
+QVariant Nuria::Internal::LuaContainerHelper::read (LuaRuntime *runtime, int idx, int type) {
+	const QVariant *variant = container ((lua_State *)runtime->luaState (), idx);
+	if (!variant || variant->userType () != type) {
+		return QVariant ();
+	}
+	
+	return *variant;
+}
+
+const QVariant *Nuria::Internal::LuaContainerHelper::container (lua_State *env, int idx) {
+	if (lua_type (env, idx) != LUA_TUSERDATA || !lua_getmetatable (env, idx)) {
+		return nullptr;
+	}
+	
+	// Compare the meta table with ours
+	luaL_getmetatable (env, proxyMetaTableName);
+	bool isProxy = lua_rawequal (env, -1, -2);
+	lua_pop (env, 2);
+	
+	if (!isProxy) {
+		return nullptr;
+	}
+	
+	return &static_cast< LuaContainerProxy * > (lua_touserdata (env, idx))->container;
+}
+
+int Nuria::Internal::LuaContainerHelper::toIndex (lua_State *env, int idx, int length) {
+	if (lua_type (env, idx) != LUA_TNUMBER) {
+		return -1;
+	}
+	
+	int index = lua_tointeger (env, idx) - 1;
+	return (index >= 0 && index < length) ? index : -1;
+}
+
+void Nuria::Internal::LuaContainerHelper::pushIndex (lua_State *env, int index) {
+	lua_pushinteger (env, index + 1);
+}
+
+bool Nuria::Internal::LuaContainerHelper::isNil (lua_State *env, int idx) {
+	return lua_isnil (env, idx);
+}
@@ -0,0 +1,223 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nuria/luaexpression.hpp"
+
+#include <QSharedData>
+#include <QPointer>
+#include <lua.hpp>
+
+#include "private/luastackutils.hpp"
+#include "nuria/luaruntime.hpp"
+
+namespace Nuria {
+
+class Q_DECL_HIDDEN LuaExpressionPrivate : public QSharedData {
+public:
+	~LuaExpressionPrivate () {
+		lua_State *env = (runtime.isNull ()) ? nullptr : (lua_State *)runtime->luaState ();
+		if (env && reference > 0) {
+			luaL_unref (env, LUA_REGISTRYINDEX, reference);
+		}
+		
+	}
+	
+	lua_State *env () const
+	{ return (runtime.isNull ()) ? nullptr : (lua_State *)runtime->luaState (); }
+	
+	// 
+	QPointer< LuaRuntime > runtime;
+	QStringList variables;
+	int reference = 0; // The compiled function
+	
+};
+
+}
+
+// Arguments of evaluateColumns(), passed through lua_cpcall()
+struct ColumnCall {
+	int reference;
+	int variables;
+	const double * const *columns;
+	int rows;
+	double *results;
+};
+
+static bool resultToNumber (lua_State *env, int idx, double &result) {
+	switch (lua_type (env, idx)) {
+	case LUA_TNUMBER:
+		result = lua_tonumber (env, idx);
+		return true;
+	case LUA_TBOOLEAN:
+		result = lua_toboolean (env, idx) ? 1.0 : 0.0;
+		return true;
+	}
+	
+	return false;
+}
+
+static void setError (QString *error, const QString &message) {
+	if (error) {
+		*error = message;
+	}
+	
+}
+
+static int evaluateColumnsImpl (lua_State *env) {
+	ColumnCall *call = static_cast< ColumnCall * > (lua_touserdata (env, 1));
+	luaL_checkstack (env, call->variables + 2, "Too many variables");
+	
+	lua_rawgeti (env, LUA_REGISTRYINDEX, call->reference);
+	int function = lua_gettop (env);
+	for (int i = 0; i < call->rows; i++) {
+		lua_pushvalue (env, function);
+		for (int j = 0; j < call->variables; j++) {
+			lua_pushnumber (env, call->columns[j][i]);
+		}
+		
+		lua_call (env, call->variables, 1);
+		if (!resultToNumber (env, -1, call->results[i])) {
+			return luaL_error (env, "Result of row %d is not a number", i + 1);
+		}
+		
+		lua_pop (env, 1);
+	}
+	
+	return 0;
+}
+
+Nuria::LuaExpression::LuaExpression ()
+	: d (new LuaExpressionPrivate)
+{
+
+}
+
+Nuria::LuaExpression::LuaExpression (const LuaExpression &other)
+	: d (other.d)
+{
+
+}
+
+Nuria::LuaExpression::LuaExpression (LuaRuntime *runtime, int reference, const QStringList &variables)
+	: d (new LuaExpressionPrivate)
+{
+	
+	this->d->runtime = runtime;
+	this->d->reference = reference;
+	this->d->variables = variables;
+}
+
+Nuria::LuaExpression &Nuria::LuaExpression::operator= (const LuaExpression &other) {
+	this->d = other.d;
+	return *this;
+}
+
+Nuria::LuaExpression::~LuaExpression () {
+
+}
+
+bool Nuria::LuaExpression::isValid () const {
+	return (!this->d->runtime.isNull () && this->d->reference > 0);
+}
+
+Nuria::LuaRuntime *Nuria::LuaExpression::runtime () const {
+	return this->d->runtime;
+}
+
+QStringList Nuria::LuaExpression::variables () const {
+	return this->d->variables;
+}
+
+QVariant Nuria::LuaExpression::evaluate (const QVariantList &values, QString *error) const {
+	lua_State *env = this->d->env ();
+	if (!env || this->d->reference < 1) {
+		setError (error, QStringLiteral("Invalid expression"));
+		return QVariant ();
+	}
+	
+	// 
+	int count = qMin (values.length (), this->d->variables.length ());
+	if (!lua_checkstack (env, count + 1)) {
+		setError (error, QStringLiteral("Too many variables"));
+		return QVariant ();
+	}
+	
+	lua_rawgeti (env, LUA_REGISTRYINDEX, this->d->reference);
+	for (int i = 0; i < count; i++) {
+		LuaStackUtils::pushVariantOnStack (this->d->runtime, values.at (i));
+	}
+	
+	if (lua_pcall (env, count, 1, 0) != 0) {
+		setError (error, QString::fromUtf8 (lua_tostring (env, -1)));
+		lua_pop (env, 1);
+		return QVariant ();
+	}
+	
+	QVariant result = LuaStackUtils::variantFromStack (this->d->runtime, -1);
+	lua_pop (env, 1);
+	return result;
+}
+
+double Nuria::LuaExpression::evaluate (const double *values, bool *ok, QString *error) const {
+	lua_State *env = this->d->env ();
+	int count = this->d->variables.length ();
+	double result = 0.0;
+	bool success = false;
+	
+	if (!env || this->d->reference < 1) {
+		setError (error, QStringLiteral("Invalid expression"));
+	} else if (!lua_checkstack (env, count + 1)) {
+		setError (error, QStringLiteral("Too many variables"));
+	} else {
+		lua_rawgeti (env, LUA_REGISTRYINDEX, this->d->reference);
+		for (int i = 0; i < count; i++) {
+			lua_pushnumber (env, values[i]);
+		}
+		
+		if (lua_pcall (env, count, 1, 0) != 0) {
+			setError (error, QString::fromUtf8 (lua_tostring (env, -1)));
+		} else if (!(success = resultToNumber (env, -1, result))) {
+			setError (error, QStringLiteral("Result is not a number"));
+		}
+		
+		lua_pop (env, 1);
+	}
+	
+	if (ok) {
+		*ok = success;
+	}
+	
+	return success ? result : 0.0;
+}
+
+bool Nuria::LuaExpression::evaluateColumns (const double * const *columns, int rows, double *results,
+                                            QString *error) const {
+	lua_State *env = this->d->env ();
+	if (!env || this->d->reference < 1) {
+		setError (error, QStringLiteral("Invalid expression"));
+		return false;
+	}
+	
+	// All rows are evaluated in one protected call
+	ColumnCall call { this->d->reference, this->d->variables.length (), columns, rows, results };
+	if (lua_cpcall (env, evaluateColumnsImpl, &call) != 0) {
+		setError (error, QString::fromUtf8 (lua_tostring (env, -1)));
+		lua_pop (env, 1);
+		return false;
+	}
+	
+	return true;
+}
@@ -0,0 +1,77 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nuria/luajson.hpp"
+
+#include <lua.hpp>
+
+#include "private/luajsoncodec.hpp"
+#include "nuria/luaruntime.hpp"
+
+Nuria::LuaValue Nuria::LuaJson::decode (LuaRuntime *runtime, const QByteArray &json, QString *error) {
+	lua_State *env = (lua_State *)runtime->luaState ();
+	LuaJsonDecoder decoder (env, json.constData (), json.length ());
+	
+	if (!decoder.decode ()) {
+		if (error) {
+			*error = decoder.errorString ();
+		}
+		
+		return LuaValue ();
+	}
+	
+	LuaValue value = LuaValue::fromStack (runtime, -1);
+	lua_pop (env, 1);
+	return value;
+}
+
+QByteArray Nuria::LuaJson::encode (const LuaValue &value, QString *error) {
+	QByteArray result;
+	encodeImpl (value, nullptr, &result, error);
+	return result;
+}
+
+bool Nuria::LuaJson::encode (const LuaValue &value, QIODevice *device, QString *error) {
+	return encodeImpl (value, device, nullptr, error);
+}
+
+bool Nuria::LuaJson::encodeImpl (const LuaValue &value, QIODevice *device, QByteArray *result, QString *error) {
+	LuaRuntime *runtime = value.runtime ();
+	if (!runtime) {
+		if (error) {
+			*error = QStringLiteral("Invalid value");
+		}
+		
+		return false;
+	}
+	
+	lua_State *env = (lua_State *)runtime->luaState ();
+	LuaJsonEncoder encoder (env, device);
+	
+	value.pushOnStack (runtime);
+	bool success = encoder.encode (-1);
+	lua_pop (env, 1);
+	
+	if (!success && error) {
+		*error = encoder.errorString ();
+	}
+	
+	if (success && result) {
+		*result = encoder.result ();
+	}
+	
+	return success;
+}
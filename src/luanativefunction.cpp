@@ -0,0 +1,157 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nuria/luanativefunction.hpp"
+
+#include <cstddef>
+#include <lua.hpp>
+
+#include "private/luacallbacktrampoline.hpp"
+#include "private/luastringutils.hpp"
+#include "private/luabytearray.hpp"
+#include "private/luastackutils.hpp"
+#include "nuria/luaruntime.hpp"
+
+namespace Nuria {
+
+// Header in front of the storage of a native function.
+struct Q_DECL_HIDDEN LuaNativeStorageHeader {
+	Internal::LuaNativeHelper::Destructor destructor;
+};
+
+}
+
+// Keep the storage itself aligned for any type.
+static const size_t headerSize = ((sizeof(Nuria::LuaNativeStorageHeader) + alignof(std::max_align_t) - 1) /
+                                  alignof(std::max_align_t)) * alignof(std::max_align_t);
+
+static int destroyStorage (lua_State *env) {
+	char *data = (char *)lua_touserdata (env, 1);
+	Nuria::LuaNativeStorageHeader *header = (Nuria::LuaNativeStorageHeader *)data;
+	
+	header->destructor (data + headerSize);
+	return 0;
+}
+
+void *Nuria::Internal::LuaNativeHelper::createStorage (LuaRuntime *runtime, size_t size, Destructor destructor) {
+	lua_State *env = (lua_State *)runtime->luaState ();
+	char *data = (char *)lua_newuserdata (env, headerSize + size);
+	
+	LuaNativeStorageHeader *header = (LuaNativeStorageHeader *)data;
+	header->destructor = destructor;
+	
+	// Make Lua call 'destructor' when the storage is collected
+	if (luaL_newmetatable (env, "_Nuria_NativeFunctionStorage")) {
+		lua_pushcfunction (env, &destroyStorage);
+		lua_setfield (env, -2, "__gc");
+	}
+	
+	lua_setmetatable (env, -2);
+	return data + headerSize;
+}
+
+void Nuria::Internal::LuaNativeHelper::pushClosure (LuaRuntime *runtime, Invoker invoker) {
+	lua_State *env = (lua_State *)runtime->luaState ();
+	
+	// Upvalues: The storage (Already on the stack) and the runtime
+	lua_pushlightuserdata (env, runtime);
+	lua_pushcclosure (env, invoker, 2);
+	
+}
+
+void Nuria::Internal::LuaNativeHelper::registerFunction (LuaRuntime *runtime, const QString &name,
+                                                          Invoker invoker) {
+	lua_State *env = (lua_State *)runtime->luaState ();
+	
+	pushClosure (runtime, invoker);
+	lua_setfield (env, LUA_GLOBALSINDEX, qPrintable(name));
+}
+
+void *Nuria::Internal::LuaNativeHelper::storage (lua_State *env) {
+	return (char *)lua_touserdata (env, lua_upvalueindex(1)) + headerSize;
+}
+
+Nuria::LuaRuntime *Nuria::Internal::LuaNativeHelper::runtime (lua_State *env) {
+	return (LuaRuntime *)lua_touserdata (env, lua_upvalueindex(2));
+}
+
+int Nuria::Internal::LuaNativeHelper::argumentCount (lua_State *env) {
+	return lua_gettop (env);
+}
+
+int Nuria::Internal::LuaNativeHelper::argumentCountError (lua_State *env, int expected, int got) {
+	return luaL_error (env, "Failed to invoke function, expected %d arguments, but got %d.",
+	                   expected, got);
+}
+
+double Nuria::Internal::LuaNativeHelper::toNumber (lua_State *env, int idx) {
+	return lua_tonumber (env, idx);
+}
+
+bool Nuria::Internal::LuaNativeHelper::toBoolean (lua_State *env, int idx) {
+	return lua_toboolean (env, idx);
+}
+
+QString Nuria::Internal::LuaNativeHelper::toString (lua_State *env, int idx) {
+	if (lua_isstring (env, idx)) {
+		return LuaStringUtils::toString (env, idx);
+	}
+	
+	LuaByteArray *bytes = LuaByteArray::at (env, idx);
+	return (bytes) ? QString::fromUtf8 (bytes->constData (), bytes->length) : QString ();
+}
+
+QByteArray Nuria::Internal::LuaNativeHelper::toByteArray (lua_State *env, int idx) {
+	QByteArray result;
+	LuaByteArray::read (env, idx, result);
+	return result;
+}
+
+QVariant Nuria::Internal::LuaNativeHelper::toVariant (lua_State *env, int idx, int targetType) {
+	if (lua_type (env, idx) != LUA_TUSERDATA) {
+		return LuaStackUtils::typedVariantFromStack (runtime (env), idx, targetType);
+	}
+	
+	// 
+	LuaValue value = LuaValue::fromStack (runtime (env), idx);
+	
+	// Structures are passed by pointer or copied, depending on 'targetType'
+	if (value.object ().isValid ()) {
+		return LuaCallbackTrampoline::objectToVariant (value.object (), targetType);
+	}
+	
+	return value.toVariant ();
+}
+
+void Nuria::Internal::LuaNativeHelper::pushNumber (lua_State *env, double value) {
+	lua_pushnumber (env, value);
+}
+
+void Nuria::Internal::LuaNativeHelper::pushBoolean (lua_State *env, bool value) {
+	lua_pushboolean (env, value);
+}
+
+void Nuria::Internal::LuaNativeHelper::pushString (lua_State *env, const QString &value) {
+	LuaStringUtils::pushString (env, value);
+}
+
+void Nuria::Internal::LuaNativeHelper::pushByteArray (lua_State *env, const QByteArray &value) {
+	LuaStackUtils::pushByteArrayOnStack (runtime (env), value);
+}
+
+void Nuria::Internal::LuaNativeHelper::pushVariant (lua_State *env, const QVariant &value) {
+	LuaStackUtils::pushVariantOnStack (runtime (env), value);
+}
@@ -126,6 +126,8 @@ void *Nuria::LuaObject::object () const {
 		return data;
 	}
 	
+	LuaRuntime *runtime = this->d->runtime;
+	runtime->d_ptr->refreshChildView ((lua_State *)runtime->luaState (), data);
 	return data->ptr;
 }
 
@@ -170,24 +172,6 @@ Nuria::LuaObject Nuria::LuaObject::fromStructure (void *object, Nuria::MetaObjec
 	return LuaObject (runtime, ref);
 }
 
-static bool variantContainsPointer (const QVariant &variant) {
-	const char *typeName = variant.typeName ();
-	
-	int len = typeName ? qstrlen (typeName) : 0;
-	return (len < 1) ? false : typeName[len - 1] == '*';
-}
-
-static Nuria::MetaObject *metaObjectOfVariant (const QVariant &variant, bool isPointer) {
-	QByteArray name (variant.typeName ());
-	
-	if (isPointer) {
-		name.chop (1);
-	}
-	
-	// 
-	return Nuria::MetaObject::byName (name);
-}
-
 static void *copyVariant (const QVariant &variant, Nuria::MetaObject *meta) {
 	
 	// Find copy ctor
@@ -200,17 +184,24 @@ static void *copyVariant (const QVariant &variant, Nuria::MetaObject *meta) {
 
 Nuria::LuaObject Nuria::LuaObject::fromVariant (const QVariant &variant, Nuria::LuaRuntime *runtime,
 						bool takeOwnership) {
-	bool isPointer = variantContainsPointer (variant);
-	MetaObject *meta = metaObjectOfVariant (variant, isPointer);
+	LuaTypeConverter type = runtime->d_ptr->converter (variant.userType ());
+	MetaObject *meta = type.meta;
 	
 	// No meta object found?
 	if (!meta) {
 		return LuaObject ();
 	}
 	
+	// Values are copied straight into their user data if possible
+	LuaRuntimePrivate *d = runtime->d_ptr;
+	if (!type.isPointer && d->canStoreInline (meta)) {
+		d->pushInlineObject (variant.constData (), meta, d->findOrCreateWrapper (meta)->reference ());
+		return LuaObject (runtime, luaL_ref ((lua_State *)runtime->luaState (), LUA_REGISTRYINDEX));
+	}
+	
 	// 
 	void *ptr = nullptr;
-	if (isPointer) {
+	if (type.isPointer) {
 		QVariant v = variant;
 		ptr = Variant::stealPointer (v);
 	} else {
@@ -223,26 +214,8 @@ Nuria::LuaObject Nuria::LuaObject::fromVariant (const QVariant &variant, Nuria::
 }
 
 Nuria::MetaObject *Nuria::LuaObject::findMetaObjectOfData (Nuria::LuaRuntime *runtime, int idx) {
-	lua_State *env = (lua_State *)runtime->luaState ();
-	
-	// Find meta table of the table at 'idx'
-	if (lua_getmetatable (env, idx) == 0) {
-		return nullptr;
-	}
-	
-	// It has a meta table. Look for "_nuria_metaobject"
-	lua_pushliteral (env, "_nuria_metaobject");
-	lua_gettable (env, -2);
-	
-	// Get meta object if it's a 'light user data'
-	MetaObject *meta = nullptr;
-	if (lua_type (env, -1) == LUA_TLIGHTUSERDATA) {
-		meta = (MetaObject *)lua_topointer (env, -1);
-	}
-	
-	// Clean stack
-	lua_pop (env, 2);
-	return meta;
+	LuaWrapperUserData *data = runtime->d_ptr->wrapperData (idx);
+	return (data) ? data->meta : nullptr;
 }
 
 void Nuria::LuaObject::pushOnStack () {
@@ -0,0 +1,91 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nuria/luapack.hpp"
+
+#include <lua.hpp>
+
+#include "private/luamsgpack.hpp"
+#include "nuria/luaruntime.hpp"
+
+QByteArray Nuria::LuaPack::pack (const LuaValue &value, Options options, QString *error) {
+	LuaRuntime *runtime = value.runtime ();
+	if (!runtime) {
+		if (error) {
+			*error = QStringLiteral("Invalid value");
+		}
+		
+		return QByteArray ();
+	}
+	
+	lua_State *env = (lua_State *)runtime->luaState ();
+	LuaMsgPackEncoder encoder (runtime, env, options.testFlag (PackStructures));
+	
+	value.pushOnStack (runtime);
+	bool success = encoder.encode (-1);
+	lua_pop (env, 1);
+	
+	if (!success) {
+		if (error) {
+			*error = encoder.errorString ();
+		}
+		
+		return QByteArray ();
+	}
+	
+	return encoder.result ();
+}
+
+Nuria::LuaValue Nuria::LuaPack::unpack (LuaRuntime *runtime, const QByteArray &data, int *offset,
+                                        QString *error) {
+	lua_State *env = (lua_State *)runtime->luaState ();
+	int start = (offset) ? *offset : 0;
+	
+	if (start < 0 || start >= data.length ()) {
+		if (error) {
+			*error = QStringLiteral("Offset out of range");
+		}
+		
+		return LuaValue ();
+	}
+	
+	LuaMsgPackDecoder decoder (env, data.constData (), data.length (), start);
+	if (!decoder.decode ()) {
+		if (error) {
+			*error = decoder.errorString ();
+		}
+		
+		return LuaValue ();
+	}
+	
+	// Without offset, the whole data has to be consumed
+	if (!offset && decoder.offset () != data.length ()) {
+		lua_pop (env, 1);
+		if (error) {
+			*error = QStringLiteral("Unexpected data after the value");
+		}
+		
+		return LuaValue ();
+	}
+	
+	if (offset) {
+		*offset = decoder.offset ();
+	}
+	
+	LuaValue value = LuaValue::fromStack (runtime, -1);
+	lua_pop (env, 1);
+	return value;
+}
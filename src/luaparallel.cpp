@@ -0,0 +1,109 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nuria/luaparallel.hpp"
+
+#include "private/luaparallelworker.hpp"
+
+// Chunks per thread. More chunks balance uneven workloads better.
+static const int chunksPerThread = 8;
+
+QVariantList Nuria::LuaParallel::map (const QByteArray &script, const QByteArray &function,
+                                      const QVariantList &input, int threads, QString *error) {
+	QVector< QVariant > results;
+	if (!run (script, function, QByteArray (), input, threads, results, error)) {
+		return QVariantList ();
+	}
+	
+	return results.toList ();
+}
+
+QVariant Nuria::LuaParallel::mapReduce (const QByteArray &script, const QByteArray &mapFunction,
+                                        const QByteArray &reduceFunction, const QVariantList &input,
+                                        int threads, QString *error) {
+	QVector< QVariant > results;
+	if (reduceFunction.isEmpty () || input.isEmpty ()) {
+		return QVariant ();
+	}
+	
+	if (!run (script, mapFunction, reduceFunction, input, threads, results, error)) {
+		return QVariant ();
+	}
+	
+	return results.value (0);
+}
+
+bool Nuria::LuaParallel::run (const QByteArray &script, const QByteArray &mapFunction,
+                              const QByteArray &reduceFunction, const QVariantList &input,
+                              int threads, QVector< QVariant > &results, QString *error) {
+	if (input.isEmpty ()) {
+		return true;
+	}
+	
+	if (threads < 1) {
+		threads = qMax (QThread::idealThreadCount (), 1);
+	}
+	
+	// 
+	bool reduce = !reduceFunction.isEmpty ();
+	int chunkSize = qMax ((input.length () + threads * chunksPerThread - 1) / (threads * chunksPerThread), 1);
+	int chunkCount = (input.length () + chunkSize - 1) / chunkSize;
+	threads = qMin (threads, chunkCount);
+	
+	QVector< QVariant > partials (reduce ? chunkCount : 0);
+	results.resize (reduce ? 0 : input.length ());
+	
+	LuaParallelJob job;
+	job.script = script;
+	job.mapFunction = mapFunction;
+	job.reduceFunction = reduceFunction;
+	job.input = &input;
+	job.results = results.data ();
+	job.partials = partials.data ();
+	job.chunkSize = chunkSize;
+	job.chunkCount = chunkCount;
+	
+	// Run and wait for all workers
+	QVector< LuaParallelWorker * > workers;
+	for (int i = 0; i < threads; i++) {
+		LuaParallelWorker *worker = new LuaParallelWorker (&job);
+		workers.append (worker);
+		worker->start ();
+	}
+	
+	for (LuaParallelWorker *worker : workers) {
+		worker->wait ();
+	}
+	
+	qDeleteAll (workers);
+	
+	// Combine the chunks
+	QVariant reduced;
+	if (job.failed.load () == 0 && reduce && LuaParallelWorker::reducePartials (&job, reduced)) {
+		results.append (reduced);
+	}
+	
+	if (job.failed.load () != 0) {
+		if (error) {
+			*error = job.error;
+		}
+		
+		results.clear ();
+		return false;
+	}
+	
+	return true;
+}
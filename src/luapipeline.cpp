@@ -0,0 +1,179 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nuria/luapipeline.hpp"
+
+#include <QDateTime>
+
+#include "private/luapipelinestage.hpp"
+
+namespace Nuria {
+class Q_DECL_HIDDEN LuaPipelinePrivate {
+public:
+	
+	int batchSize;
+	int queueCapacity;
+	bool started = false;
+	bool finished = false;
+	
+	QVector< LuaPipelineStage * > stages;
+	
+	// queues[i] is the input of stages[i], the last one is the output
+	QVector< LuaBatchQueue * > queues;
+	QVariantList pending;
+	
+};
+}
+
+Nuria::LuaPipeline::LuaPipeline (int batchSize, int queueCapacity)
+	: d_ptr (new LuaPipelinePrivate)
+{
+	
+	this->d_ptr->batchSize = qMax (batchSize, 1);
+	this->d_ptr->queueCapacity = qMax (queueCapacity, 1);
+}
+
+Nuria::LuaPipeline::~LuaPipeline () {
+	
+	// Closing all queues makes every stage exit soon
+	for (LuaBatchQueue *queue : this->d_ptr->queues) {
+		queue->close ();
+	}
+	
+	for (LuaPipelineStage *stage : this->d_ptr->stages) {
+		stage->wait ();
+	}
+	
+	qDeleteAll (this->d_ptr->stages);
+	qDeleteAll (this->d_ptr->queues);
+	delete this->d_ptr;
+}
+
+void Nuria::LuaPipeline::addStage (const QByteArray &name, const QByteArray &script, const QByteArray &function) {
+	if (!this->d_ptr->started) {
+		this->d_ptr->stages.append (new LuaPipelineStage (name, script, function));
+	}
+	
+}
+
+bool Nuria::LuaPipeline::start () {
+	if (this->d_ptr->started || this->d_ptr->stages.isEmpty ()) {
+		return false;
+	}
+	
+	// Connect the stages
+	int count = this->d_ptr->stages.size ();
+	for (int i = 0; i <= count; i++) {
+		this->d_ptr->queues.append (new LuaBatchQueue (this->d_ptr->queueCapacity));
+	}
+	
+	for (int i = 0; i < count; i++) {
+		LuaPipelineStage *stage = this->d_ptr->stages.at (i);
+		stage->input = this->d_ptr->queues.at (i);
+		stage->output = this->d_ptr->queues.at (i + 1);
+		stage->start ();
+	}
+	
+	this->d_ptr->started = true;
+	return true;
+}
+
+bool Nuria::LuaPipeline::push (const QVariant &record) {
+	if (!this->d_ptr->started || this->d_ptr->finished) {
+		return false;
+	}
+	
+	this->d_ptr->pending.append (record);
+	if (this->d_ptr->pending.length () < this->d_ptr->batchSize) {
+		return true;
+	}
+	
+	return flush ();
+}
+
+bool Nuria::LuaPipeline::flush () {
+	if (!this->d_ptr->started || this->d_ptr->finished) {
+		return false;
+	}
+	
+	if (this->d_ptr->pending.isEmpty ()) {
+		return true;
+	}
+	
+	QVariantList batch;
+	batch.swap (this->d_ptr->pending);
+	this->d_ptr->pending.reserve (this->d_ptr->batchSize);
+	return this->d_ptr->queues.first ()->push (std::move (batch));
+}
+
+void Nuria::LuaPipeline::finish () {
+	if (!this->d_ptr->started || this->d_ptr->finished) {
+		return;
+	}
+	
+	flush ();
+	this->d_ptr->finished = true;
+	this->d_ptr->queues.first ()->close ();
+}
+
+bool Nuria::LuaPipeline::take (QVariantList &records) {
+	if (!this->d_ptr->started) {
+		return false;
+	}
+	
+	return this->d_ptr->queues.last ()->pop (records);
+}
+
+QVector< Nuria::LuaPipeline::StageStatistics > Nuria::LuaPipeline::statistics () const {
+	QVector< StageStatistics > list;
+	list.reserve (this->d_ptr->stages.size ());
+	
+	qint64 now = QDateTime::currentMSecsSinceEpoch ();
+	for (int i = 0; i < this->d_ptr->stages.size (); i++) {
+		LuaPipelineStage *stage = this->d_ptr->stages.at (i);
+		LuaBatchQueue *queue = this->d_ptr->queues.value (i);
+		
+		qint64 startTime = stage->startTime.load ();
+		double elapsed = (startTime > 0) ? double (now - startTime) / 1000.0 : 0.0;
+		
+		StageStatistics stats;
+		stats.name = stage->name;
+		stats.queued = queue ? queue->size () : 0;
+		stats.capacity = this->d_ptr->queueCapacity;
+		stats.batches = stage->batches.load ();
+		stats.recordsIn = stage->recordsIn.load ();
+		stats.recordsOut = stage->recordsOut.load ();
+		stats.errors = stage->errors.load ();
+		stats.throughput = (elapsed > 0) ? double (stats.recordsIn) / elapsed : 0.0;
+		stats.utilisation = (elapsed > 0) ? qMin (double (stage->busyTime.load ()) / (elapsed * 1e9), 1.0) : 0.0;
+		list.append (stats);
+	}
+	
+	return list;
+}
+
+QString Nuria::LuaPipeline::errorString () const {
+	QString error;
+	for (LuaPipelineStage *stage : this->d_ptr->stages) {
+		QString message = stage->lastError ();
+		if (!message.isEmpty ()) {
+			error = message;
+		}
+		
+	}
+	
+	return error;
+}
@@ -15,11 +15,15 @@
  */
 
 #include "nuria/luaruntime.hpp"
+#include "nuria/luabuffer.hpp"
 
 #include <nuria/metaobject.hpp>
 #include <nuria/callback.hpp>
 #include <nuria/logger.hpp>
+#include <QRegularExpression>
+#include <QSemaphore>
 #include <QIODevice>
+#include <QThread>
 #include <QPointer>
 #include <QVariant>
 #include <lua.hpp>
@@ -30,6 +34,7 @@
 #include "private/luaruntimeprivate.hpp"
 #include "private/luastackutils.hpp"
 #include "private/luastructures.hpp"
+#include "private/luatransfer.hpp"
 
 Nuria::LuaRuntime::LuaRuntime (LuaLibs libraries, QObject *parent)
 	: QObject (parent), d_ptr (new LuaRuntimePrivate)
@@ -46,6 +51,14 @@ Nuria::LuaRuntime::LuaRuntime (LuaLibs libraries, QObject *parent)
 }
 
 Nuria::LuaRuntime::~LuaRuntime () {
+	
+	// Don't leave invoke() callers waiting
+	runPostedClosures ();
+	
+	// Values outliving the runtime can't reach their tables afterwards
+	this->d_ptr->lastResults.clear ();
+	LuaValue::snapshotTables (this);
+	
 	lua_close (this->d_ptr->env);
 	qDeleteAll (this->d_ptr->wrappers);
 	this->d_ptr->env = nullptr;
@@ -53,6 +66,10 @@ Nuria::LuaRuntime::~LuaRuntime () {
 }
 
 bool Nuria::LuaRuntime::execute (const QByteArray &script) {
+	// The results belong to the runtime thread, don't touch them
+	if (!checkThread ("execute")) {
+		return false;
+	}
 	
 	// Parse script. Pushes the compiled chunk onto the stack.
 	int r = luaL_loadstring (this->d_ptr->env, script.constData ());
@@ -66,6 +83,10 @@ bool Nuria::LuaRuntime::execute (const QByteArray &script) {
 }
 
 bool Nuria::LuaRuntime::executeStream (QIODevice *device) {
+	if (!checkThread ("executeStream")) {
+		return false;
+	}
+	
 	if (!device->isOpen () || !device->isReadable ()) {
 		setLastResultError (this->d_ptr->lastResults, luaErrorToString (LUA_ERRFILE));
 		return false;
@@ -87,6 +108,10 @@ Nuria::LuaValue Nuria::LuaRuntime::lastResult () const {
 }
 
 Nuria::LuaValue Nuria::LuaRuntime::global (const QString &name) {
+	if (!checkThread ("global")) {
+		return LuaValue ();
+	}
+	
 	lua_getfield (this->d_ptr->env, LUA_GLOBALSINDEX, qPrintable(name));
 	LuaValue value = LuaValue::fromStack (this, -1);
 	lua_pop (this->d_ptr->env, 1);
@@ -95,20 +120,52 @@ Nuria::LuaValue Nuria::LuaRuntime::global (const QString &name) {
 }
 
 void Nuria::LuaRuntime::setGlobal (const QString &name, const QVariant &value) {
+	if (!checkThread ("setGlobal")) {
+		return;
+	}
+	
 	LuaStackUtils::pushVariantOnStack (this, value);
 	lua_setfield (this->d_ptr->env, LUA_GLOBALSINDEX, qPrintable(name));
 }
 
 void Nuria::LuaRuntime::setGlobal (const QString &name, const Nuria::LuaValue &value) {
-	if (value.type () != LuaValue::Table) {
-		LuaStackUtils::pushVariantOnStack (this, value.toVariant ());
+	if (!checkThread ("setGlobal")) {
+		return;
 	}
 	
+	value.pushOnStack (this);
 	lua_setfield (this->d_ptr->env, LUA_GLOBALSINDEX, qPrintable(name));
 	
 }
 
+void Nuria::LuaRuntime::registerConverter (int metaTypeId, PushConverter push, ReadConverter read) {
+	LuaTypeConverter converter = this->d_ptr->converter (metaTypeId);
+	converter.push = push;
+	converter.read = read;
+	this->d_ptr->converters[metaTypeId] = converter;
+}
+
+void Nuria::LuaRuntime::setByteArrayThreshold (int bytes) {
+	this->d_ptr->byteArrayThreshold = bytes;
+}
+
+int Nuria::LuaRuntime::byteArrayThreshold () const {
+	return this->d_ptr->byteArrayThreshold;
+}
+
+void Nuria::LuaRuntime::setStringConversion (StringConversion conversion) {
+	this->d_ptr->stringConversion = conversion;
+}
+
+Nuria::LuaRuntime::StringConversion Nuria::LuaRuntime::stringConversion () const {
+	return this->d_ptr->stringConversion;
+}
+
 bool Nuria::LuaRuntime::hasGlobal (const QString &name) {
+	if (!checkThread ("hasGlobal")) {
+		return false;
+	}
+	
 	lua_getfield (this->d_ptr->env, LUA_GLOBALSINDEX, qPrintable(name));
 	bool exists = !lua_isnil (this->d_ptr->env, -1);
 	lua_pop (this->d_ptr->env, 1);
@@ -116,6 +173,163 @@ bool Nuria::LuaRuntime::hasGlobal (const QString &name) {
 	return exists;
 }
 
+Nuria::LuaValue Nuria::LuaRuntime::transfer (const LuaValue &value, LuaRuntime *target, QString *error) {
+	LuaRuntime *source = value.runtime ();
+	if (!source || source == target) {
+		return value;
+	}
+	
+	// 
+	value.pushOnStack (source);
+	LuaTransfer transfer (source, target);
+	bool success = transfer.transfer (-1);
+	lua_pop (source->d_ptr->env, 1);
+	
+	if (!success) {
+		if (error) {
+			*error = transfer.errorString ();
+		}
+		
+		return LuaValue ();
+	}
+	
+	LuaValue result = LuaValue::fromStack (target, -1);
+	lua_pop (target->d_ptr->env, 1);
+	return result;
+}
+
+// Calls 'fn' for the first 'count' elements of 'input', storing the results
+// in 'output'. Inputs converted to nil leave holes, so '#input' can't be used.
+static const char batchDriverScript[] =
+	"return function (fn, count, input, output)\n"
+	"  output = output or {}\n"
+	"  for i = 1, count do output[i] = fn (input[i]) end\n"
+	"  return output\n"
+	"end";
+
+bool Nuria::LuaRuntime::pushBatchDriver (const QString &function, QString *error) {
+	lua_State *env = this->d_ptr->env;
+	
+	// The driver is compiled once per runtime
+	if (this->d_ptr->batchDriverRef == LUA_NOREF) {
+		luaL_loadbuffer (env, batchDriverScript, sizeof(batchDriverScript) - 1, "batch");
+		lua_call (env, 0, 1);
+		this->d_ptr->batchDriverRef = luaL_ref (env, LUA_REGISTRYINDEX);
+	}
+	
+	lua_rawgeti (env, LUA_REGISTRYINDEX, this->d_ptr->batchDriverRef);
+	lua_getfield (env, LUA_GLOBALSINDEX, qPrintable(function));
+	if (lua_type (env, -1) != LUA_TFUNCTION) {
+		lua_pop (env, 2);
+		if (error) {
+			*error = QStringLiteral("'%1' is not a function").arg (function);
+		}
+		
+		return false;
+	}
+	
+	return true;
+}
+
+QVariantList Nuria::LuaRuntime::callBatch (const QString &function, const QVariantList &inputs, QString *error) {
+	if (!checkThread ("callBatch") || !pushBatchDriver (function, error)) {
+		return QVariantList ();
+	}
+	
+	// Call
+	lua_State *env = this->d_ptr->env;
+	lua_pushinteger (env, inputs.length ());
+	LuaStackUtils::pushVariantListOnStack (this, inputs);
+	if (lua_pcall (env, 3, 1, 0) != 0) {
+		if (error) {
+			*error = QString::fromUtf8 (lua_tostring (env, -1));
+		}
+		
+		lua_pop (env, 1);
+		return QVariantList ();
+	}
+	
+	// Read results. nil results leave holes in the table.
+	QVariantList results;
+	results.reserve (inputs.length ());
+	for (int i = 1; i <= inputs.length (); i++) {
+		lua_rawgeti (env, -1, i);
+		results.append (LuaStackUtils::variantFromStack (this, -1));
+		lua_pop (env, 1);
+	}
+	
+	lua_pop (env, 1);
+	return results;
+}
+
+bool Nuria::LuaRuntime::callBatch (const QString &function, const LuaBuffer &inputs, const LuaBuffer &outputs,
+                                   QString *error) {
+	if (outputs.length () < inputs.length ()) {
+		if (error) {
+			*error = QStringLiteral("Output buffer is too small");
+		}
+		
+		return false;
+	}
+	
+	if (!checkThread ("callBatch") || !pushBatchDriver (function, error)) {
+		return false;
+	}
+	
+	// Call
+	lua_State *env = this->d_ptr->env;
+	lua_pushinteger (env, inputs.length ());
+	LuaStackUtils::pushLuaBufferOnStack (this, inputs);
+	LuaStackUtils::pushLuaBufferOnStack (this, outputs);
+	if (lua_pcall (env, 4, 1, 0) != 0) {
+		if (error) {
+			*error = QString::fromUtf8 (lua_tostring (env, -1));
+		}
+		
+		lua_pop (env, 1);
+		return false;
+	}
+	
+	lua_pop (env, 1);
+	return true;
+}
+
+Nuria::LuaExpression Nuria::LuaRuntime::compileExpression (const QString &expression, const QStringList &variables,
+                                                          QString *error) {
+	static const QRegularExpression identifier (QStringLiteral("^[A-Za-z_][A-Za-z0-9_]*$"));
+	if (!checkThread ("compileExpression")) {
+		return LuaExpression ();
+	}
+	
+	for (const QString &name : variables) {
+		if (!identifier.match (name).hasMatch ()) {
+			if (error) {
+				*error = QStringLiteral("Invalid variable name '%1'").arg (name);
+			}
+			
+			return LuaExpression ();
+		}
+		
+	}
+	
+	// The chunk returns the function evaluating the expression
+	QByteArray chunk = "return function (" + variables.join (QLatin1Char (',')).toLatin1 () +
+	                   ") return " + expression.toUtf8 () + "\nend";
+	
+	lua_State *env = this->d_ptr->env;
+	if (luaL_loadbuffer (env, chunk.constData (), chunk.length (), "expression") != 0 ||
+	    lua_pcall (env, 0, 1, 0) != 0) {
+		if (error) {
+			*error = QString::fromUtf8 (lua_tostring (env, -1));
+		}
+		
+		lua_pop (env, 1);
+		return LuaExpression ();
+	}
+	
+	return LuaExpression (this, luaL_ref (env, LUA_REGISTRYINDEX), variables);
+}
+
 static bool buildOrFindTablePath (lua_State *env, const QList< QByteArray > &path) {
 	int count = path.length () - 1;
 	
@@ -191,11 +405,15 @@ void Nuria::LuaRuntime::registerMetaObject (Nuria::MetaObject *metaObject, const
 }
 
 void Nuria::LuaRuntime::collectGarbage () {
+	if (!checkThread ("collectGarbage")) {
+		return;
+	}
+	
 	lua_gc (this->d_ptr->env, LUA_GCCOLLECT, 0);
 }
 
 Nuria::LuaRuntime::Ownership Nuria::LuaRuntime::objectOwnership (void *object) {
-	LuaWrapperUserData *data = this->d_ptr->objects.value (object);
+	LuaWrapperUserData *data = this->d_ptr->objects.find (object);
 	if (!data) {
 		return OwnedByLua;
 	}
@@ -204,8 +422,8 @@ Nuria::LuaRuntime::Ownership Nuria::LuaRuntime::objectOwnership (void *object) {
 }
 
 void Nuria::LuaRuntime::setObjectOwnership (void *object, Ownership ownership) {
-	LuaWrapperUserData *data = this->d_ptr->objects.value (object);
-	if (data) {
+	LuaWrapperUserData *data = this->d_ptr->objects.find (object);
+	if (data && !data->inlined) {
 		data->owned = (ownership == OwnedByLua);
 	}
 	
@@ -220,6 +438,54 @@ void *Nuria::LuaRuntime::luaState () {
 	return this->d_ptr->env;
 }
 
+bool Nuria::LuaRuntime::isInOwnThread () const {
+	return (QThread::currentThread () == thread ());
+}
+
+void Nuria::LuaRuntime::post (std::function< void() > closure) {
+	if (this->d_ptr->postedClosures.push (std::move (closure))) {
+		QMetaObject::invokeMethod (this, "runPostedClosures", Qt::QueuedConnection);
+	}
+	
+}
+
+void Nuria::LuaRuntime::invoke (std::function< void() > closure) {
+	if (isInOwnThread ()) {
+		closure ();
+		return;
+	}
+	
+	QSemaphore done;
+	post ([&closure, &done]() {
+		closure ();
+		done.release ();
+	});
+	
+	done.acquire ();
+}
+
+void Nuria::LuaRuntime::runPostedClosures () {
+	LuaInvokeQueue &queue = this->d_ptr->postedClosures;
+	LuaInvokeQueue::Closure closure;
+	
+	// Run everything posted until now in one go
+	queue.beginDrain ();
+	while (queue.take (closure)) {
+		closure ();
+	}
+	
+}
+
+bool Nuria::LuaRuntime::checkThread (const char *method) {
+	if (isInOwnThread ()) {
+		return true;
+	}
+	
+	nError() << "LuaRuntime::" << method << "called from thread" << QThread::currentThread ()
+	         << "- The runtime lives in" << thread () << ". Use post() or invoke() instead.";
+	return false;
+}
+
 void Nuria::LuaRuntime::createObjectsReferenceTable () {
 	
 	// Object table
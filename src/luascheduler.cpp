@@ -0,0 +1,110 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nuria/luascheduler.hpp"
+
+#include <QDateTime>
+
+#include "private/luaschedulerworker.hpp"
+
+Nuria::LuaScheduler::LuaScheduler (int workers, Setup setup, QObject *parent)
+	: QObject (parent), d_ptr (new LuaSchedulerPrivate)
+{
+	
+	if (workers < 1) {
+		workers = qMax (QThread::idealThreadCount (), 1);
+	}
+	
+	this->d_ptr->q_ptr = this;
+	this->d_ptr->setup = std::move (setup);
+	
+	// All workers must exist before the first one starts stealing
+	for (int i = 0; i < workers; i++) {
+		this->d_ptr->workers.append (new LuaSchedulerWorker (this->d_ptr, i));
+	}
+	
+	for (LuaSchedulerWorker *worker : this->d_ptr->workers) {
+		worker->start ();
+	}
+	
+}
+
+Nuria::LuaScheduler::~LuaScheduler () {
+	stop ();
+	qDeleteAll (this->d_ptr->workers);
+	delete this->d_ptr;
+}
+
+int Nuria::LuaScheduler::workerCount () const {
+	return this->d_ptr->workers.size ();
+}
+
+int Nuria::LuaScheduler::spawn (const QByteArray &script) {
+	if (this->d_ptr->stopping.load () != 0) {
+		return -1;
+	}
+	
+	// 
+	int id = this->d_ptr->nextId.fetchAndAddRelaxed (1);
+	int index = this->d_ptr->nextWorker.fetchAndAddRelaxed (1);
+	LuaSchedulerWorker *worker = this->d_ptr->workers.at (uint (index) % uint (workerCount ()));
+	
+	worker->deque.push (LuaPendingTask { id, script });
+	this->d_ptr->pending.ref ();
+	
+	// Wake idle workers. Any of them may take the task.
+	QMutexLocker locker (&this->d_ptr->mutex);
+	this->d_ptr->wakeUp.wakeAll ();
+	return id;
+}
+
+QVector< Nuria::LuaScheduler::WorkerStatistics > Nuria::LuaScheduler::statistics () const {
+	QVector< WorkerStatistics > list;
+	list.reserve (workerCount ());
+	
+	qint64 now = QDateTime::currentMSecsSinceEpoch ();
+	for (LuaSchedulerWorker *worker : this->d_ptr->workers) {
+		qint64 elapsed = (now - worker->startTime.load ()) * 1000000;
+		double busy = double (worker->busyTime.load ());
+		
+		WorkerStatistics stats;
+		stats.queued = worker->deque.size ();
+		stats.running = worker->running.load ();
+		stats.started = worker->started.load ();
+		stats.finished = worker->finished.load ();
+		stats.steals = worker->steals.load ();
+		stats.utilisation = (elapsed > 0) ? qMin (busy / double (elapsed), 1.0) : 0.0;
+		list.append (stats);
+	}
+	
+	return list;
+}
+
+void Nuria::LuaScheduler::stop () {
+	if (!this->d_ptr->stopping.testAndSetOrdered (0, 1)) {
+		return;
+	}
+	
+	// 
+	this->d_ptr->mutex.lock ();
+	this->d_ptr->wakeUp.wakeAll ();
+	this->d_ptr->mutex.unlock ();
+	
+	for (LuaSchedulerWorker *worker : this->d_ptr->workers) {
+		worker->wait ();
+	}
+	
+}
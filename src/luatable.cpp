@@ -0,0 +1,290 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nuria/luatable.hpp"
+
+#include <QSharedData>
+#include <QPointer>
+#include <lua.hpp>
+
+#include "private/luastackutils.hpp"
+#include "nuria/luaruntime.hpp"
+#include "nuria/luavalue.hpp"
+
+namespace Nuria {
+
+class Q_DECL_HIDDEN LuaTablePrivate : public QSharedData {
+public:
+	~LuaTablePrivate () {
+		if (reference < 1 || runtime.isNull ())
+			return;
+		
+		lua_State *env = (lua_State *)runtime->luaState ();
+		if (env)
+			lua_unref (env, reference);
+		
+	}
+	
+	// 
+	QPointer< LuaRuntime > runtime;
+	int reference = 0;
+	
+};
+
+class Q_DECL_HIDDEN LuaTableIteratorPrivate : public QSharedData {
+public:
+	~LuaTableIteratorPrivate () {
+		if (keyRef < 1 || !table.isValid ())
+			return;
+		
+		lua_State *env = (lua_State *)table.runtime ()->luaState ();
+		if (env)
+			lua_unref (env, keyRef);
+		
+	}
+	
+	// 
+	LuaTable table;
+	int keyRef = 0; // Reference to the current key, 0 before the first
+	bool atEnd = false;
+	LuaValue key;
+	LuaValue value;
+	
+};
+
+}
+
+Nuria::LuaTable::LuaTable ()
+	: d (new LuaTablePrivate)
+{
+
+}
+
+Nuria::LuaTable::LuaTable (const LuaTable &other)
+	: d (other.d)
+{
+
+}
+
+Nuria::LuaTable::LuaTable (LuaRuntime *runtime, int ref)
+	: d (new LuaTablePrivate)
+{
+	
+	this->d->runtime = runtime;
+	this->d->reference = ref;
+	
+}
+
+Nuria::LuaTable &Nuria::LuaTable::operator= (const LuaTable &other) {
+	this->d = other.d;
+	return *this;
+}
+
+Nuria::LuaTable::~LuaTable () {
+
+}
+
+bool Nuria::LuaTable::isValid () const {
+	return (!this->d->runtime.isNull () && this->d->reference > 0);
+}
+
+Nuria::LuaRuntime *Nuria::LuaTable::runtime () const {
+	return this->d->runtime;
+}
+
+int Nuria::LuaTable::reference () const {
+	return this->d->reference;
+}
+
+int Nuria::LuaTable::length () const {
+	if (!isValid ()) {
+		return 0;
+	}
+	
+	// 
+	lua_State *env = (lua_State *)this->d->runtime->luaState ();
+	pushOnStack ();
+	int length = lua_objlen (env, -1);
+	lua_pop (env, 1);
+	
+	return length;
+}
+
+bool Nuria::LuaTable::contains (const QString &key) const {
+	if (!isValid ()) {
+		return false;
+	}
+	
+	// 
+	lua_State *env = (lua_State *)this->d->runtime->luaState ();
+	QByteArray name = key.toUtf8 ();
+	
+	pushOnStack ();
+	lua_pushlstring (env, name.constData (), name.length ());
+	lua_rawget (env, -2);
+	bool result = !lua_isnil (env, -1);
+	lua_pop (env, 2);
+	
+	return result;
+}
+
+Nuria::LuaValue Nuria::LuaTable::get (const QString &key) const {
+	if (!isValid ()) {
+		return LuaValue ();
+	}
+	
+	// 
+	lua_State *env = (lua_State *)this->d->runtime->luaState ();
+	QByteArray name = key.toUtf8 ();
+	
+	pushOnStack ();
+	lua_pushlstring (env, name.constData (), name.length ());
+	lua_rawget (env, -2);
+	LuaValue value = LuaValue::fromStack (this->d->runtime, -1);
+	lua_pop (env, 2);
+	
+	return value;
+}
+
+Nuria::LuaValue Nuria::LuaTable::get (int index) const {
+	if (!isValid ()) {
+		return LuaValue ();
+	}
+	
+	// 
+	lua_State *env = (lua_State *)this->d->runtime->luaState ();
+	pushOnStack ();
+	lua_rawgeti (env, -1, index);
+	LuaValue value = LuaValue::fromStack (this->d->runtime, -1);
+	lua_pop (env, 2);
+	
+	return value;
+}
+
+Nuria::LuaTableIterator Nuria::LuaTable::iterator () const {
+	return LuaTableIterator (*this);
+}
+
+QVariant Nuria::LuaTable::toVariant () const {
+	if (!isValid ()) {
+		return QVariant ();
+	}
+	
+	// 
+	lua_State *env = (lua_State *)this->d->runtime->luaState ();
+	pushOnStack ();
+	QVariant result = LuaStackUtils::tableFromStack (this->d->runtime, -1, false,
+	                                                this->d->runtime->stringConversion ());
+	lua_pop (env, 1);
+	
+	return result;
+}
+
+QVariant Nuria::LuaTable::variant (const QString &key) const {
+	return get (key).toVariant ();
+}
+
+QVariant Nuria::LuaTable::variant (int index) const {
+	return get (index).toVariant ();
+}
+
+void Nuria::LuaTable::pushOnStack () const {
+	lua_State *env = (lua_State *)this->d->runtime->luaState ();
+	
+	if (this->d->reference < 1) {
+		lua_pushnil (env);
+		return;
+	}
+	
+	// 
+	lua_getref (env, this->d->reference);
+}
+
+Nuria::LuaTableIterator::LuaTableIterator ()
+	: d (new LuaTableIteratorPrivate)
+{
+	this->d->atEnd = true;
+}
+
+Nuria::LuaTableIterator::LuaTableIterator (const LuaTableIterator &other)
+	: d (other.d)
+{
+
+}
+
+Nuria::LuaTableIterator::LuaTableIterator (const LuaTable &table)
+	: d (new LuaTableIteratorPrivate)
+{
+	this->d->table = table;
+	this->d->atEnd = !table.isValid ();
+}
+
+Nuria::LuaTableIterator &Nuria::LuaTableIterator::operator= (const LuaTableIterator &other) {
+	this->d = other.d;
+	return *this;
+}
+
+Nuria::LuaTableIterator::~LuaTableIterator () {
+
+}
+
+bool Nuria::LuaTableIterator::next () {
+	if (this->d->atEnd || !this->d->table.isValid ()) {
+		return false;
+	}
+	
+	// 
+	LuaRuntime *runtime = this->d->table.runtime ();
+	lua_State *env = (lua_State *)runtime->luaState ();
+	
+	// Push the table and the previous key
+	this->d->table.pushOnStack ();
+	if (this->d->keyRef > 0) {
+		lua_getref (env, this->d->keyRef);
+		lua_unref (env, this->d->keyRef);
+		this->d->keyRef = 0;
+	} else {
+		lua_pushnil (env);
+	}
+	
+	// End reached?
+	if (lua_next (env, -2) == 0) {
+		lua_pop (env, 1);
+		this->d->atEnd = true;
+		this->d->key = LuaValue ();
+		this->d->value = LuaValue ();
+		return false;
+	}
+	
+	// -1 = Value, -2 = Key, -3 = The table
+	this->d->key = LuaValue::fromStack (runtime, -2);
+	this->d->value = LuaValue::fromStack (runtime, -1);
+	lua_pop (env, 1);
+	
+	// Keep the key for the next call, this pops it.
+	this->d->keyRef = luaL_ref (env, LUA_REGISTRYINDEX);
+	lua_pop (env, 1);
+	
+	return true;
+}
+
+Nuria::LuaValue Nuria::LuaTableIterator::key () const {
+	return this->d->key;
+}
+
+Nuria::LuaValue Nuria::LuaTableIterator::value () const {
+	return this->d->value;
+}
@@ -0,0 +1,160 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nuria/luatablebuilder.hpp"
+
+#include <lua.hpp>
+
+#include "private/luastringutils.hpp"
+#include "private/luastackutils.hpp"
+#include "nuria/luaruntime.hpp"
+#include "nuria/luavalue.hpp"
+
+Nuria::LuaTableBuilder::LuaTableBuilder (LuaRuntime *runtime, int arraySize, int fieldCount)
+	: runtime (runtime), env ((lua_State *)runtime->luaState ())
+{
+	
+	lua_createtable (this->env, arraySize, fieldCount);
+	this->lengths.append (0);
+	
+}
+
+Nuria::LuaTableBuilder::LuaTableBuilder (const LuaTable &table)
+	: runtime (table.runtime ()), env ((lua_State *)runtime->luaState ())
+{
+	
+	table.pushOnStack ();
+	this->lengths.append (int (lua_objlen (this->env, -1)));
+	
+}
+
+Nuria::LuaTableBuilder::~LuaTableBuilder () {
+	
+	// The root table and a key and table per nested one
+	if (!this->lengths.isEmpty ()) {
+		lua_pop (this->env, this->lengths.length () * 2 - 1);
+	}
+	
+}
+
+Nuria::LuaTableBuilder &Nuria::LuaTableBuilder::beginTable (const char *key, int arraySize, int fieldCount) {
+	lua_pushstring (this->env, key);
+	lua_createtable (this->env, arraySize, fieldCount);
+	this->lengths.append (0);
+	return *this;
+}
+
+Nuria::LuaTableBuilder &Nuria::LuaTableBuilder::beginTable (const QString &key, int arraySize, int fieldCount) {
+	LuaStackUtils::pushKeyOnStack (this->runtime, key);
+	lua_createtable (this->env, arraySize, fieldCount);
+	this->lengths.append (0);
+	return *this;
+}
+
+Nuria::LuaTableBuilder &Nuria::LuaTableBuilder::beginTable (int arraySize, int fieldCount) {
+	int &length = this->lengths.last ();
+	lua_pushinteger (this->env, ++length);
+	lua_createtable (this->env, arraySize, fieldCount);
+	this->lengths.append (0);
+	return *this;
+}
+
+Nuria::LuaTableBuilder &Nuria::LuaTableBuilder::endTable () {
+	
+	// Don't end the root table
+	if (this->lengths.length () < 2) {
+		return *this;
+	}
+	
+	// -3 = Parent table, -2 = Key, -1 = The table
+	lua_rawset (this->env, -3);
+	this->lengths.removeLast ();
+	return *this;
+}
+
+Nuria::LuaTable Nuria::LuaTableBuilder::table () {
+	if (this->lengths.isEmpty ()) {
+		return LuaTable ();
+	}
+	
+	// 
+	while (this->lengths.length () > 1) {
+		endTable ();
+	}
+	
+	this->lengths.clear ();
+	return LuaTable (this->runtime, luaL_ref (this->env, LUA_REGISTRYINDEX));
+}
+
+void Nuria::LuaTableBuilder::pushValue (bool value) {
+	lua_pushboolean (this->env, value);
+}
+
+void Nuria::LuaTableBuilder::pushValue (double value) {
+	lua_pushnumber (this->env, value);
+}
+
+void Nuria::LuaTableBuilder::pushValue (const char *value) {
+	lua_pushstring (this->env, value);
+}
+
+void Nuria::LuaTableBuilder::pushValue (const QString &value) {
+	LuaStringUtils::pushString (this->env, value);
+}
+
+void Nuria::LuaTableBuilder::pushValue (const QByteArray &value) {
+	lua_pushlstring (this->env, value.constData (), value.length ());
+}
+
+void Nuria::LuaTableBuilder::pushValue (const QVariant &value) {
+	LuaStackUtils::pushVariantOnStack (this->runtime, value);
+}
+
+void Nuria::LuaTableBuilder::pushValue (const LuaTable &value) {
+	LuaStackUtils::pushLuaTableOnStack (this->runtime, value);
+}
+
+void Nuria::LuaTableBuilder::pushValue (const LuaValue &value) {
+	value.pushOnStack (this->runtime);
+}
+
+void Nuria::LuaTableBuilder::setField (const char *key) {
+	lua_setfield (this->env, -2, key);
+}
+
+void Nuria::LuaTableBuilder::setField (const QByteArray &key) {
+	lua_pushlstring (this->env, key.constData (), key.length ());
+	lua_insert (this->env, -2);
+	lua_rawset (this->env, -3);
+}
+
+void Nuria::LuaTableBuilder::setField (const QString &key) {
+	LuaStackUtils::pushKeyOnStack (this->runtime, key);
+	lua_insert (this->env, -2);
+	lua_rawset (this->env, -3);
+}
+
+void Nuria::LuaTableBuilder::setIndex (int index) {
+	lua_rawseti (this->env, -2, index);
+	
+	int &length = this->lengths.last ();
+	length = qMax (length, index);
+}
+
+void Nuria::LuaTableBuilder::appendTop () {
+	int &length = this->lengths.last ();
+	lua_rawseti (this->env, -2, ++length);
+}
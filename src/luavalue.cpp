@@ -20,6 +20,7 @@
 #include <QPointer>
 #include <lua.hpp>
 
+#include "private/luaruntimeprivate.hpp"
 #include "private/luastackutils.hpp"
 #include "nuria/luaruntime.hpp"
 #include "nuria/luaobject.hpp"
@@ -27,15 +28,33 @@
 namespace Nuria {
 class Q_DECL_HIDDEN LuaValuePrivate : public QSharedData {
 public:
+	~LuaValuePrivate () {
+		if (this->table.isValid ()) {
+			this->runtime->d_ptr->pendingTables.remove (this);
+		}
+		
+	}
 	
 	QPointer< LuaRuntime > runtime = nullptr;
 	LuaValue::Type type = LuaValue::Nil;
 	QVariant value;
+	QByteArray bytes; // Raw bytes of a Lua string
+	LuaRuntime::StringConversion conversion = LuaRuntime::ToQString; // Policy when it was read
 	LuaObject object;
+	LuaTable table;
 	
 };
 }
 
+// Converts the table of 'd' using the string policy of when it was read
+static QVariant tableToVariant (Nuria::LuaValuePrivate *d) {
+	lua_State *env = (lua_State *)d->runtime->luaState ();
+	Nuria::LuaStackUtils::pushLuaTableOnStack (d->runtime, d->table);
+	QVariant result = Nuria::LuaStackUtils::tableFromStack (d->runtime, -1, false, d->conversion);
+	lua_pop (env, 1);
+	return result;
+}
+
 Nuria::LuaValue::LuaValue ()
 	: d (new LuaValuePrivate)
 {
@@ -107,11 +126,33 @@ QVariant Nuria::LuaValue::toVariant () const {
 		return this->d->value;
 	}
 	
+	// The table may have changed since, so convert it now
+	if (this->d->table.isValid ()) {
+		return tableToVariant (this->d.data ());
+	}
+	
+	// Strings are decoded on access
+	if (this->d->type == String) {
+		return LuaStackUtils::stringFromBytes (this->d->conversion, this->d->bytes);
+	}
+	
 	// 
 	return QVariant::fromValue (this->d->object);
 	
 }
 
+QByteArray Nuria::LuaValue::toByteArray () const {
+	if (this->d->type == String && !this->d->bytes.isNull ()) {
+		return this->d->bytes;
+	}
+	
+	return toVariant ().toByteArray ();
+}
+
+Nuria::LuaTable Nuria::LuaValue::table () const {
+	return this->d->table;
+}
+
 Nuria::LuaObject Nuria::LuaValue::object () const {
 	return this->d->object;
 }
@@ -119,6 +160,16 @@ Nuria::LuaObject Nuria::LuaValue::object () const {
 Nuria::LuaValue::Type Nuria::LuaValue::qtTypeToLua (int type) {
 	switch (type) {
 	case QMetaType::Int:
+	case QMetaType::UInt:
+	case QMetaType::LongLong:
+	case QMetaType::ULongLong:
+	case QMetaType::Long:
+	case QMetaType::ULong:
+	case QMetaType::Short:
+	case QMetaType::UShort:
+	case QMetaType::Char:
+	case QMetaType::SChar:
+	case QMetaType::UChar:
 	case QMetaType::Float:
 	case QMetaType::Double:
 		return Number;
@@ -126,9 +177,17 @@ Nuria::LuaValue::Type Nuria::LuaValue::qtTypeToLua (int type) {
 		return Boolean;
 	case QMetaType::QString:
 	case QMetaType::QByteArray:
+	case QMetaType::QChar:
+	case QMetaType::QDateTime:
+	case QMetaType::QDate:
+	case QMetaType::QTime:
+	case QMetaType::QUrl:
+	case QMetaType::QUuid:
 		return String;
+	case QMetaType::QStringList:
 	case QMetaType::QVariantList:
 	case QMetaType::QVariantMap:
+	case QMetaType::QVariantHash:
 		return Table;
 	}
 	
@@ -149,7 +208,20 @@ void Nuria::LuaValue::initValue (int idx) {
 	
 	// 
 	this->d->type = Type (lua_type (env, idx));
-	if (this->d->type != UserData || !LuaObject::findMetaObjectOfData (this->d->runtime, idx)) {
+	this->d->conversion = this->d->runtime->stringConversion ();
+	if (this->d->type == Table) {
+		
+		// Tables are referenced and only converted on access
+		lua_pushvalue (env, idx);
+		this->d->table = LuaTable (this->d->runtime, luaL_ref (env, LUA_REGISTRYINDEX));
+		this->d->runtime->d_ptr->pendingTables.insert (this->d.data ());
+	} else if (this->d->type == String) {
+		
+		// Strings are copied as-is and only decoded on access
+		size_t len = 0;
+		const char *str = lua_tolstring (env, idx, &len);
+		this->d->bytes = QByteArray (str, int (len));
+	} else if (this->d->type != UserData || !LuaObject::findMetaObjectOfData (this->d->runtime, idx)) {
 		this->d->value = LuaStackUtils::variantFromStack (this->d->runtime, idx);
 	} else {
 		
@@ -159,6 +231,17 @@ void Nuria::LuaValue::initValue (int idx) {
 	
 }
 
+void Nuria::LuaValue::snapshotTables (LuaRuntime *runtime) {
+	QSet< LuaValuePrivate * > pending;
+	pending.swap (runtime->d_ptr->pendingTables);
+	
+	for (LuaValuePrivate *value : pending) {
+		value->value = tableToVariant (value);
+		value->table = LuaTable ();
+	}
+	
+}
+
 void Nuria::LuaValue::setLuaObject (int idx) {
 	lua_State *env = (lua_State *)this->d->runtime->luaState ();
 	
@@ -169,3 +252,19 @@ void Nuria::LuaValue::setLuaObject (int idx) {
 	// 
 	this->d->object = LuaObject (this->d->runtime, ref);
 }
+
+void Nuria::LuaValue::pushOnStack (LuaRuntime *runtime) const {
+	bool sameRuntime = (this->d->runtime == runtime);
+	
+	// References are only valid in their runtime
+	if (sameRuntime && this->d->table.isValid ()) {
+		this->d->table.pushOnStack ();
+	} else if (sameRuntime && this->d->object.isValid ()) {
+		LuaStackUtils::pushLuaObjectOnStack (this->d->object);
+	} else if (this->d->type == String && !this->d->bytes.isNull ()) {
+		lua_pushlstring ((lua_State *)runtime->luaState (), this->d->bytes.constData (), this->d->bytes.length ());
+	} else {
+		LuaStackUtils::pushVariantOnStack (runtime, toVariant ());
+	}
+	
+}
@@ -0,0 +1,139 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NURIA_LUABUFFER_HPP
+#define NURIA_LUABUFFER_HPP
+
+#include <QSharedDataPointer>
+#include <QMetaType>
+#include "lua_global.hpp"
+
+namespace Nuria {
+
+class LuaBufferPrivate;
+class LuaStackUtils;
+class LuaRuntime;
+
+/**
+ * \brief Exposes a contiguous numeric C++ buffer to Lua without copying.
+ * 
+ * Instead of converting a buffer into a Lua table element by element, a
+ * LuaBuffer makes the memory itself accessible to Lua. In Lua, the buffer
+ * behaves like a array: It's indexed starting at 1 and its length can be
+ * read using the \c # operator. Reads and writes go directly to the C++
+ * memory and are bounds-checked:
+ * 
+ * \code
+ * QVector< double > samples = ...;
+ * LuaBuffer buffer = LuaBuffer::wrap (&runtime, samples.data (), samples.size ());
+ * runtime.setGlobal ("samples", QVariant::fromValue (buffer));
+ * runtime.execute ("for i = 1, #samples do samples[i] = samples[i] * 2 end");
+ * \endcode
+ * 
+ * The memory stays owned by C++. Lua only has access to it as long as a
+ * LuaBuffer handle exists, or until detach() is called. Afterwards, the
+ * buffer appears empty to Lua. Make sure to keep a handle alive while Lua
+ * uses the buffer, and that the memory isn't reallocated in the meantime.
+ */
+class NURIA_LUA_EXPORT LuaBuffer {
+public:
+	
+	/** Element types. */
+	enum Type {
+		Double = 0,
+		Float = 1,
+		Int32 = 2,
+		Int64 = 3,
+		UInt8 = 4
+	};
+	
+	/** Constructs a invalid instance. */
+	LuaBuffer ();
+	
+	/**
+	 * Exposes \a length elements of type \a type at \a data in
+	 * \a runtime.
+	 */
+	LuaBuffer (LuaRuntime *runtime, Type type, void *data, int length);
+	
+	/** Copy constructor. */
+	LuaBuffer (const LuaBuffer &other);
+	
+	/** Assignment operator. */
+	LuaBuffer &operator= (const LuaBuffer &other);
+	
+	/**
+	 * Destructor. If this was the last handle to the buffer, Lua loses
+	 * access to it.
+	 */
+	~LuaBuffer ();
+	
+	/** Returns \c true if this buffer is accessible from Lua. */
+	bool isValid () const;
+	
+	/** Returns the associated runtime. */
+	LuaRuntime *runtime () const;
+	
+	/** Returns the element type. */
+	Type type () const;
+	
+	/** Returns the pointer to the first element. */
+	void *data () const;
+	
+	/** Returns the element count. */
+	int length () const;
+	
+	/**
+	 * Revokes access to the buffer from Lua. Call this before freeing or
+	 * reallocating the memory while handles are still in use.
+	 */
+	void detach ();
+	
+	/** Convenience method to wrap \a length elements at \a data. */
+	static LuaBuffer wrap (LuaRuntime *runtime, double *data, int length)
+	{ return LuaBuffer (runtime, Double, data, length); }
+	
+	/** \overload */
+	static LuaBuffer wrap (LuaRuntime *runtime, float *data, int length)
+	{ return LuaBuffer (runtime, Float, data, length); }
+	
+	/** \overload */
+	static LuaBuffer wrap (LuaRuntime *runtime, qint32 *data, int length)
+	{ return LuaBuffer (runtime, Int32, data, length); }
+	
+	/** \overload */
+	static LuaBuffer wrap (LuaRuntime *runtime, qint64 *data, int length)
+	{ return LuaBuffer (runtime, Int64, data, length); }
+	
+	/** \overload */
+	static LuaBuffer wrap (LuaRuntime *runtime, quint8 *data, int length)
+	{ return LuaBuffer (runtime, UInt8, data, length); }
+	
+private:
+	friend class LuaStackUtils;
+	
+	void pushOnStack (LuaRuntime *runtime) const;
+	
+	// 
+	QExplicitlySharedDataPointer< LuaBufferPrivate > d;
+	
+};
+
+}
+
+Q_DECLARE_METATYPE(Nuria::LuaBuffer)
+
+#endif // NURIA_LUABUFFER_HPP
@@ -0,0 +1,170 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NURIA_LUACHANNEL_HPP
+#define NURIA_LUACHANNEL_HPP
+
+#include <QSharedDataPointer>
+#include <QMetaType>
+#include <functional>
+#include "lua_global.hpp"
+#include "luavalue.hpp"
+
+struct lua_State;
+
+namespace Nuria {
+
+class LuaSchedulerWorker;
+class LuaChannelPrivate;
+class LuaStackUtils;
+class LuaRuntime;
+
+/**
+ * \brief Bounded queue passing Lua values between runtimes and threads.
+ * 
+ * A channel carries values serialized with LuaPack, so any value LuaPack
+ * supports can be sent, including wrapped structures, which arrive as
+ * table of their fields. The queue itself is lock-free and can be used by
+ * any number of senders and receivers at the same time. Only blocking
+ * calls on a full or empty channel wait on a lock.
+ * 
+ * Scripts create or look up channels using \c Nuria.channel:
+ * 
+ * \code
+ * local jobs = Nuria.channel ('jobs', 256) -- Named, shared by all runtimes
+ * local results = Nuria.channel (16) -- Anonymous
+ * 
+ * jobs:send ({ id = 1 })
+ * local job, err = jobs:receive ()
+ * \endcode
+ * 
+ * The channel offers these methods in Lua:
+ *  - \c send (value [, timeout]) Returns \c true, or \c false and a reason.
+ *  - \c receive ([timeout]) Returns the value, or \c nil and a reason.
+ *  - \c trySend (value) Like send(), but never waits.
+ *  - \c tryReceive () Returns \c true and the value, or \c false.
+ *  - \c close (), \c isClosed (), \c count () and \c capacity ()
+ * 
+ * Timeouts are in milliseconds. Without one, send() and receive() wait
+ * until they succeed or the channel is closed. When called from within a
+ * coroutine, they yield the channel instead of blocking the thread and try
+ * again when resumed. In this case, the timeout is ignored.
+ * 
+ * Channels can also be passed to Lua using QVariant::fromValue().
+ */
+class NURIA_LUA_EXPORT LuaChannel {
+public:
+	
+	/** Constructs a invalid instance. */
+	LuaChannel ();
+	
+	/**
+	 * Creates a channel holding up to \a capacity values. The capacity
+	 * is rounded up to the next power of two.
+	 */
+	explicit LuaChannel (int capacity);
+	
+	/** Copy constructor. */
+	LuaChannel (const LuaChannel &other);
+	
+	/** Assignment operator. */
+	LuaChannel &operator= (const LuaChannel &other);
+	
+	/** Destructor. */
+	~LuaChannel ();
+	
+	/**
+	 * Returns the channel called \a name, creating it with \a capacity if
+	 * it doesn't exist yet. Named channels are shared process-wide and
+	 * live until the application exits.
+	 */
+	static LuaChannel named (const QString &name, int capacity = 1024);
+	
+	/** Returns \c true if this is a channel. */
+	bool isValid () const;
+	
+	/** Returns the maximum count of queued values. */
+	int capacity () const;
+	
+	/**
+	 * Returns the count of queued values. As other threads may access the
+	 * channel concurrently, this is only a snapshot.
+	 */
+	int count () const;
+	
+	/**
+	 * Closes the channel. Sending fails afterwards, receiving succeeds
+	 * until the channel is empty. All waiting threads are woken up.
+	 */
+	void close ();
+	
+	/** Returns \c true if the channel has been closed. */
+	bool isClosed () const;
+	
+	/**
+	 * Sends \a value, waiting up to \a timeout msec while the channel is
+	 * full. A \a timeout of \c 0 doesn't wait, \c -1 waits forever.
+	 * Returns \c false if \a value can't be serialized, on timeout or if
+	 * the channel is closed.
+	 */
+	bool send (const LuaValue &value, int timeout = -1);
+	
+	/**
+	 * Receives a value into \a runtime, waiting up to \a timeout msec while
+	 * the channel is empty. On failure, an invalid value is returned and
+	 * \a ok is set to \c false if not \c nullptr.
+	 */
+	LuaValue receive (LuaRuntime *runtime, int timeout = -1, bool *ok = nullptr);
+	
+	/**
+	 * Sends the already serialized \a data. Use this to feed a channel
+	 * from a thread without LuaRuntime. \sa LuaPack::pack()
+	 */
+	bool sendData (const QByteArray &data, int timeout = -1);
+	
+	/** Receives a value without deserializing it. \sa LuaPack::unpack() */
+	bool receiveData (QByteArray &data, int timeout = -1);
+	
+private:
+	friend class LuaSchedulerWorker;
+	friend class LuaStackUtils;
+	
+	LuaChannel (LuaChannelPrivate *d);
+	
+	/**
+	 * Calls \a callback once, the next time a value is sent or received or
+	 * the channel is closed. The callback runs in the thread doing so.
+	 * Returns the id for unwatch(), or \c 0 without registering it if the
+	 * channel is neither empty nor full anymore, or closed, so a coroutine
+	 * which yielded the channel can retry right away.
+	 */
+	int watch (std::function< void () > callback);
+	void unwatch (int id);
+	
+	void pushOnStack (LuaRuntime *runtime) const;
+	void pushOnStack (LuaRuntime *runtime, lua_State *env) const;
+	static LuaChannel fromStack (lua_State *env, int idx);
+	
+	// 
+	QExplicitlySharedDataPointer< LuaChannelPrivate > d;
+	
+};
+
+}
+
+Q_DECLARE_METATYPE(Nuria::LuaChannel)
+
+#endif // NURIA_LUACHANNEL_HPP
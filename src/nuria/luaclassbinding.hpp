@@ -0,0 +1,230 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NURIA_LUACLASSBINDING_HPP
+#define NURIA_LUACLASSBINDING_HPP
+
+#include <cstring>
+
+#include "luanativefunction.hpp"
+#include "lua_global.hpp"
+
+namespace Nuria {
+
+class LuaRuntime;
+class MetaObject;
+
+namespace Internal {
+
+/**
+ * \internal
+ * \brief Non-template part of LuaClassBinding.
+ */
+class NURIA_LUA_EXPORT LuaClassBindingHelper {
+public:
+	
+	typedef int (*Getter) (lua_State *env, void *instance, const void *member);
+	typedef void (*Setter) (lua_State *env, void *instance, const void *member, int idx);
+	
+	/**
+	 * Adds a native field accessor to the wrapper of \a meta. Returns a
+	 * pointer to \a size bytes of storage for the member pointer.
+	 */
+	static void *addField (LuaRuntime *runtime, MetaObject *meta, const QByteArray &name,
+	                       Getter getter, Setter setter, size_t size);
+	
+	/** Pops the closure from the stack and adds it as method \a name. */
+	static void addMethod (LuaRuntime *runtime, MetaObject *meta, const QByteArray &name);
+	
+	/**
+	 * Returns the C++ object of the user data at \a idx. Raises a Lua
+	 * error if it's not an instance of \a meta.
+	 */
+	static void *instance (lua_State *env, int idx, MetaObject *meta);
+	
+	/**
+	 * Pushes a view onto \a member, a structure of type \a type inside of
+	 * the instance at \a idx. Returns \c false if \a type isn't exposed
+	 * as structure, in which case nothing was pushed.
+	 */
+	static bool pushView (lua_State *env, int idx, void *member, int type);
+	
+};
+
+// Accessors for a field 'M T::*'
+template< typename T, typename M >
+struct LuaNativeField {
+	typedef M T::*Member;
+	
+	static int get (lua_State *env, void *instance, const void *member) {
+		Member ptr = *static_cast< const Member * > (member);
+		M &value = static_cast< T * > (instance)->*ptr;
+		
+		// Structures are accessed in-place instead of being copied
+		if (!pushView (env, value, std::is_class< M > ())) {
+			LuaNativeResult< M >::push (env, value);
+		}
+		
+		return 1;
+	}
+	
+	static void set (lua_State *env, void *instance, const void *member, int idx) {
+		Member ptr = *static_cast< const Member * > (member);
+		static_cast< T * > (instance)->*ptr = LuaNativeArgument< M >::read (env, idx);
+	}
+	
+private:
+	
+	static bool pushView (lua_State *env, M &value, std::true_type)
+	{ return LuaClassBindingHelper::pushView (env, 1, &value, qMetaTypeId< M > ()); }
+	
+	static bool pushView (lua_State *, M &, std::false_type)
+	{ return false; }
+	
+};
+
+/**
+ * \internal
+ * Generates a lua_CFunction for a member method \a Method of \a T. The
+ * instance is expected as first argument, as passed by 'object:method()'.
+ */
+template< typename T, typename Method, typename Ret, typename ... Args >
+class LuaNativeMethod {
+public:
+	
+	struct Storage {
+		Method method;
+		MetaObject *meta;
+	};
+	
+	static int invoke (lua_State *env) {
+		int count = LuaNativeHelper::argumentCount (env) - 1;
+		if (count != int (sizeof... (Args))) {
+			return LuaNativeHelper::argumentCountError (env, sizeof... (Args), count);
+		}
+		
+		// 
+		Storage *storage = static_cast< Storage * > (LuaNativeHelper::storage (env));
+		T *object = static_cast< T * > (LuaClassBindingHelper::instance (env, 1, storage->meta));
+		return call (env, object, storage->method, std::is_void< Ret > (),
+		             typename LuaMakeIndices< sizeof... (Args) >::type ());
+	}
+	
+	static void pushMethod (LuaRuntime *runtime, MetaObject *meta, Method method) {
+		void *storage = LuaNativeHelper::createStorage (runtime, sizeof(Storage), &destroy);
+		new (storage) Storage { method, meta };
+		LuaNativeHelper::pushClosure (runtime, &invoke);
+	}
+	
+private:
+	
+	template< int ... Indices >
+	static int call (lua_State *env, T *object, Method method, std::true_type, LuaIndices< Indices ... >) {
+		Q_UNUSED(env) // Without arguments
+		(object->*method) (LuaNativeArgument< typename std::decay< Args >::type >::read (env, Indices + 2) ...);
+		return 0;
+	}
+	
+	template< int ... Indices >
+	static int call (lua_State *env, T *object, Method method, std::false_type, LuaIndices< Indices ... >) {
+		typedef typename std::decay< Ret >::type Result;
+		LuaNativeResult< Result >::push (env, (object->*method) (LuaNativeArgument< typename std::decay< Args >::type >
+		                                                         ::read (env, Indices + 2) ...));
+		return 1;
+	}
+	
+	static void destroy (void *) { }
+	
+};
+	
+} // namespace Internal
+
+/**
+ * \brief Compile-time Lua bindings for fields and methods of a class.
+ * 
+ * By default, accesses from Lua to C++ structures are resolved at run-time
+ * through the Nuria::MetaObject of the type, boxing every value into a
+ * QVariant. LuaClassBinding lets you generate specialised accessors for the
+ * hot fields and methods of \a T instead, which access the members directly:
+ * 
+ * \code
+ * LuaClassBinding< Point > (&runtime, MetaObject::byName ("Point"))
+ *         .field ("x", &Point::x)
+ *         .field ("y", &Point::y)
+ *         .method ("length", &Point::length);
+ * \endcode
+ * 
+ * Natively bound names take precedence over the MetaObject, all other
+ * fields and methods are still available through the MetaObject.
+ * 
+ * \note Binding a method replaces all overloads of it with the same name.
+ * To bind an overloaded method, cast it to the wanted signature first.
+ */
+template< typename T >
+class LuaClassBinding {
+public:
+	
+	/** Binds members of \a T, which is described by \a metaObject. */
+	LuaClassBinding (LuaRuntime *runtime, MetaObject *metaObject)
+		: runtime (runtime), metaObject (metaObject)
+	{ }
+	
+	/** Binds the field \a member as \a name. */
+	template< typename M >
+	LuaClassBinding &field (const QByteArray &name, M T::*member) {
+		typedef Internal::LuaNativeField< T, M > Field;
+		void *storage = Internal::LuaClassBindingHelper::addField (this->runtime, this->metaObject, name,
+		                                                           &Field::get, &Field::set, sizeof(member));
+		std::memcpy (storage, &member, sizeof(member));
+		return *this;
+	}
+	
+	/** Binds the member method \a method as \a name. */
+	template< typename Ret, typename ... Args >
+	LuaClassBinding &method (const QByteArray &name, Ret (T::*method)(Args ...)) {
+		typedef Ret (T::*Method)(Args ...);
+		Internal::LuaNativeMethod< T, Method, Ret, Args ... >::pushMethod (this->runtime, this->metaObject, method);
+		Internal::LuaClassBindingHelper::addMethod (this->runtime, this->metaObject, name);
+		return *this;
+	}
+	
+	/** \overload */
+	template< typename Ret, typename ... Args >
+	LuaClassBinding &method (const QByteArray &name, Ret (T::*method)(Args ...) const) {
+		typedef Ret (T::*Method)(Args ...) const;
+		Internal::LuaNativeMethod< T, Method, Ret, Args ... >::pushMethod (this->runtime, this->metaObject, method);
+		Internal::LuaClassBindingHelper::addMethod (this->runtime, this->metaObject, name);
+		return *this;
+	}
+	
+	/** Binds the static method \a method as \a name. */
+	template< typename Ret, typename ... Args >
+	LuaClassBinding &method (const QByteArray &name, Ret (*method)(Args ...)) {
+		typedef Ret (*Method)(Args ...);
+		Internal::LuaNativeFunction< Method, Ret, Args ... >::pushFunction (this->runtime, method);
+		Internal::LuaClassBindingHelper::addMethod (this->runtime, this->metaObject, name);
+		return *this;
+	}
+	
+private:
+	LuaRuntime *runtime;
+	MetaObject *metaObject;
+	
+};
+	
+} // namespace Nuria
+
+#endif // NURIA_LUACLASSBINDING_HPP
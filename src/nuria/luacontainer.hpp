@@ -0,0 +1,247 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NURIA_LUACONTAINER_HPP
+#define NURIA_LUACONTAINER_HPP
+
+#include <QVector>
+#include <QList>
+#include <QHash>
+
+#include "luanativefunction.hpp"
+#include "luaruntime.hpp"
+#include "lua_global.hpp"
+
+namespace Nuria {
+
+namespace Internal {
+
+/**
+ * \internal
+ * \brief Non-template part of LuaContainer.
+ * 
+ * Containers are passed to Lua as proxy user data holding a (implicitly
+ * shared) copy of the container in a QVariant. Accesses are routed through
+ * a table of Operations, which is generated per container type.
+ */
+class NURIA_LUA_EXPORT LuaContainerHelper {
+public:
+	
+	struct Operations {
+		
+		// Returns the element count
+		int (*length) (const void *container);
+		
+		// Pushes the element with the key at 'idx'. Returns false if there
+		// is no such element, in which case nothing was pushed.
+		bool (*index) (lua_State *env, const void *container, int idx);
+		
+		// Pushes the key and element following the key at 'idx', or the
+		// first element if it's nil. Returns false at the end.
+		bool (*next) (lua_State *env, const void *container, int idx);
+		
+	};
+	
+	/** Pushes a proxy for \a container onto the stack of \a runtime. */
+	static void push (LuaRuntime *runtime, const QVariant &container, const Operations *operations);
+	
+	/**
+	 * Returns the container of the proxy at \a idx if it's of type
+	 * \a type. Returns a invalid QVariant otherwise.
+	 */
+	static QVariant read (LuaRuntime *runtime, int idx, int type);
+	
+	/**
+	 * Returns a pointer to the container of the proxy at \a idx, or
+	 * \c nullptr if \a idx is not a container proxy.
+	 */
+	static const QVariant *container (lua_State *env, int idx);
+	
+	/**
+	 * Returns the Lua index at \a idx as index into a list of \a length
+	 * elements, or \c -1 if it's out of range.
+	 */
+	static int toIndex (lua_State *env, int idx, int length);
+	
+	/** Pushes the list index \a index as Lua index. */
+	static void pushIndex (lua_State *env, int index);
+	
+	static bool isNil (lua_State *env, int idx);
+	
+};
+
+// Operations for random access containers like QList and QVector
+template< typename Container, typename T >
+struct LuaListOperations {
+	static const Container &get (const void *container)
+	{ return *static_cast< const Container * > (container); }
+	
+	static int length (const void *container)
+	{ return get (container).size (); }
+	
+	static bool index (lua_State *env, const void *container, int idx) {
+		const Container &list = get (container);
+		int i = LuaContainerHelper::toIndex (env, idx, list.size ());
+		if (i < 0) {
+			return false;
+		}
+		
+		LuaNativeResult< T >::push (env, list.at (i));
+		return true;
+	}
+	
+	static bool next (lua_State *env, const void *container, int idx) {
+		const Container &list = get (container);
+		int i = 0;
+		
+		// Continue after the previous index
+		if (!LuaContainerHelper::isNil (env, idx)) {
+			i = LuaContainerHelper::toIndex (env, idx, list.size ());
+			if (i < 0) {
+				return false;
+			}
+			
+			i++;
+		}
+		
+		if (i >= list.size ()) {
+			return false;
+		}
+		
+		LuaContainerHelper::pushIndex (env, i);
+		LuaNativeResult< T >::push (env, list.at (i));
+		return true;
+	}
+	
+	static const LuaContainerHelper::Operations *operations () {
+		static const LuaContainerHelper::Operations ops = { &length, &index, &next };
+		return &ops;
+	}
+	
+};
+
+// Operations for QHash< QString, T >
+template< typename Container, typename T >
+struct LuaHashOperations {
+	static const Container &get (const void *container)
+	{ return *static_cast< const Container * > (container); }
+	
+	static int length (const void *container)
+	{ return get (container).size (); }
+	
+	static bool index (lua_State *env, const void *container, int idx) {
+		const Container &hash = get (container);
+		auto it = hash.constFind (LuaNativeArgument< QString >::read (env, idx));
+		if (it == hash.constEnd ()) {
+			return false;
+		}
+		
+		LuaNativeResult< T >::push (env, *it);
+		return true;
+	}
+	
+	static bool next (lua_State *env, const void *container, int idx) {
+		const Container &hash = get (container);
+		auto it = hash.constBegin ();
+		
+		// Continue after the previous key
+		if (!LuaContainerHelper::isNil (env, idx)) {
+			it = hash.constFind (LuaNativeArgument< QString >::read (env, idx));
+			if (it != hash.constEnd ()) {
+				++it;
+			}
+			
+		}
+		
+		if (it == hash.constEnd ()) {
+			return false;
+		}
+		
+		LuaNativeResult< QString >::push (env, it.key ());
+		LuaNativeResult< T >::push (env, it.value ());
+		return true;
+	}
+	
+	static const LuaContainerHelper::Operations *operations () {
+		static const LuaContainerHelper::Operations ops = { &length, &index, &next };
+		return &ops;
+	}
+	
+};
+
+template< typename Container >
+struct LuaContainerTraits;
+
+template< typename T >
+struct LuaContainerTraits< QList< T > > : public LuaListOperations< QList< T >, T > { };
+
+template< typename T >
+struct LuaContainerTraits< QVector< T > > : public LuaListOperations< QVector< T >, T > { };
+
+template< typename T >
+struct LuaContainerTraits< QHash< QString, T > > : public LuaHashOperations< QHash< QString, T >, T > { };
+	
+} // namespace Internal
+
+/**
+ * \brief Lazy Lua access to Qt containers.
+ * 
+ * By default, containers are converted into Lua tables when they're passed
+ * to Lua, wrapping every single element. After registering a container
+ * type, it's instead passed as proxy sharing the storage of the container
+ * (Through implicit sharing), making this an O(1) operation. Elements are
+ * converted on access:
+ * 
+ * \code
+ * LuaContainer< QVector< Point > >::registerContainer (&runtime);
+ * runtime.setGlobal ("points", QVariant::fromValue (points));
+ * runtime.execute ("for i, point in points () do print (i, point.x) end");
+ * \endcode
+ * 
+ * Supported are QList<T>, QVector<T> and QHash<QString, T>, where \a T may
+ * also be a pointer type. Lists are indexed from 1, like Lua tables. The
+ * length operator (\c #) returns the element count, calling the proxy
+ * returns an iterator for the generic \c for.
+ * 
+ * Proxies are read-only. Passing a proxy back to a C++ function expecting
+ * the container type passes the container itself.
+ * 
+ * \note \a Container must be known to Qt through Q_DECLARE_METATYPE.
+ */
+template< typename Container >
+class LuaContainer {
+public:
+	
+	/** Registers \a Container in \a runtime. */
+	static void registerContainer (LuaRuntime *runtime) {
+		runtime->registerConverter (qMetaTypeId< Container > (), &push, &read);
+	}
+	
+private:
+	
+	static void push (LuaRuntime *runtime, const QVariant &value) {
+		Internal::LuaContainerHelper::push (runtime, value, Internal::LuaContainerTraits< Container >::operations ());
+	}
+	
+	static QVariant read (LuaRuntime *runtime, int idx) {
+		return Internal::LuaContainerHelper::read (runtime, idx, qMetaTypeId< Container > ());
+	}
+	
+};
+	
+} // namespace Nuria
+
+#endif // NURIA_LUACONTAINER_HPP
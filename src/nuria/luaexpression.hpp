@@ -0,0 +1,114 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NURIA_LUAEXPRESSION_HPP
+#define NURIA_LUAEXPRESSION_HPP
+
+#include <QSharedDataPointer>
+#include <QStringList>
+#include <QVariant>
+#include "lua_global.hpp"
+
+namespace Nuria {
+
+class LuaExpressionPrivate;
+class LuaRuntime;
+
+/**
+ * \brief A compiled Lua expression with positional variables.
+ * 
+ * Instances are created by LuaRuntime::compileExpression(). The expression
+ * is compiled once into a function, whose parameters are the variables in
+ * the order they were passed in. Evaluating it is a single function call,
+ * without compiling code or touching globals:
+ * 
+ * \code
+ * LuaExpression expr = runtime.compileExpression ("a * b + c > threshold",
+ *                                                 { "a", "b", "c", "threshold" });
+ * double values[] = { 2, 3, 4, 9 };
+ * bool match = expr.evaluate (values);
+ * \endcode
+ * 
+ * The numeric overloads pass the values as numbers straight from the given
+ * arrays. Their result is converted into a double, with \c true and
+ * \c false being \c 1 and \c 0. evaluateColumns() evaluates the expression
+ * for many rows at once inside a single protected call.
+ * 
+ * Other names used in the expression refer to globals of the runtime. An
+ * expression is only valid as long as its runtime exists, and must be used
+ * from the thread of the runtime.
+ */
+class NURIA_LUA_EXPORT LuaExpression {
+public:
+	
+	/** Constructs a invalid instance. */
+	LuaExpression ();
+	
+	/** Copy constructor. */
+	LuaExpression (const LuaExpression &other);
+	
+	/** Assignment operator. */
+	LuaExpression &operator= (const LuaExpression &other);
+	
+	/** Destructor. */
+	~LuaExpression ();
+	
+	/** Returns \c true if the expression has been compiled successfully. */
+	bool isValid () const;
+	
+	/** Returns the associated runtime. */
+	LuaRuntime *runtime () const;
+	
+	/** Returns the names of the variables, in order. */
+	QStringList variables () const;
+	
+	/**
+	 * Evaluates the expression with \a values as variables. Missing
+	 * values are \c nil. On failure, an invalid QVariant is returned and
+	 * \a error is set if not \c nullptr.
+	 */
+	QVariant evaluate (const QVariantList &values, QString *error = nullptr) const;
+	
+	/**
+	 * Evaluates the expression with the numbers in \a values, which must
+	 * contain a value for each variable. If the expression fails or its
+	 * result isn't a number or boolean, \c 0 is returned, \a ok is set
+	 * to \c false and \a error to the reason, each if not \c nullptr.
+	 */
+	double evaluate (const double *values, bool *ok = nullptr, QString *error = nullptr) const;
+	
+	/**
+	 * Evaluates the expression for \a rows rows. \a columns contains an
+	 * array of \a rows numbers for each variable. The result of row \c i
+	 * is stored in \c results[i]. Returns \c true on success, else \a error
+	 * is set if not \c nullptr.
+	 */
+	bool evaluateColumns (const double * const *columns, int rows, double *results,
+	                      QString *error = nullptr) const;
+	
+private:
+	friend class LuaRuntime;
+	
+	LuaExpression (LuaRuntime *runtime, int reference, const QStringList &variables);
+	
+	// 
+	QExplicitlySharedDataPointer< LuaExpressionPrivate > d;
+	
+};
+
+}
+
+#endif // NURIA_LUAEXPRESSION_HPP
@@ -0,0 +1,79 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NURIA_LUAJSON_HPP
+#define NURIA_LUAJSON_HPP
+
+#include <QByteArray>
+#include <QString>
+#include "lua_global.hpp"
+#include "luavalue.hpp"
+
+class QIODevice;
+
+namespace Nuria {
+
+class LuaRuntime;
+
+/**
+ * \brief Native JSON codec for Lua values.
+ * 
+ * Documents are parsed directly into Lua tables and serialized directly from
+ * them, without going through QVariant or QJsonDocument. The same codec is
+ * available to scripts as \c Nuria.json:
+ * 
+ * \code
+ * local data = Nuria.json.decode ('{"list": [1, 2, 3]}')
+ * local text, error = Nuria.json.encode (data)
+ * \endcode
+ * 
+ * On failure, both functions return \c nil and an error message.
+ * 
+ * JSON \c null is decoded to \c Nuria.json.null, as \c nil can't be stored
+ * in a table. When encoding, both \c nil and \c Nuria.json.null are written
+ * as \c null. Tables whose keys are exactly 1 to \c #table are written as
+ * arrays, all other tables as objects. Empty tables are written as \c {}.
+ */
+class NURIA_LUA_EXPORT LuaJson {
+public:
+	
+	/**
+	 * Parses \a json into a value of \a runtime. On failure, an invalid
+	 * value is returned and \a error is set if not \c nullptr.
+	 */
+	static LuaValue decode (LuaRuntime *runtime, const QByteArray &json, QString *error = nullptr);
+	
+	/**
+	 * Serializes \a value into JSON. On failure, an empty QByteArray is
+	 * returned and \a error is set if not \c nullptr.
+	 */
+	static QByteArray encode (const LuaValue &value, QString *error = nullptr);
+	
+	/**
+	 * Serializes \a value into \a device. The output is written in chunks
+	 * while encoding, so large documents aren't kept in memory as a whole.
+	 * Returns \c true on success.
+	 */
+	static bool encode (const LuaValue &value, QIODevice *device, QString *error = nullptr);
+	
+private:
+	static bool encodeImpl (const LuaValue &value, QIODevice *device, QByteArray *result, QString *error);
+	
+};
+
+}
+
+#endif // NURIA_LUAJSON_HPP
@@ -0,0 +1,269 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NURIA_LUANATIVEFUNCTION_HPP
+#define NURIA_LUANATIVEFUNCTION_HPP
+
+#include <type_traits>
+#include <QByteArray>
+#include <limits>
+#include <QVariant>
+#include <QString>
+#include <utility>
+#include <new>
+
+#include "lua_global.hpp"
+
+struct lua_State;
+
+namespace Nuria {
+
+class LuaRuntime;
+
+namespace Internal {
+
+/**
+ * \internal
+ * \brief Non-template part of the native function bindings.
+ * 
+ * The templates below generate one lua_CFunction per C++ signature. To keep
+ * Lua out of the public headers, all stack accesses are routed through this
+ * class. Closures created by registerFunction() carry the storage of the
+ * C++ function as first and the LuaRuntime as second upvalue.
+ */
+class NURIA_LUA_EXPORT LuaNativeHelper {
+public:
+	
+	typedef int (*Invoker) (lua_State *env);
+	typedef void (*Destructor) (void *storage);
+	
+	/**
+	 * Pushes a new storage user data of \a size bytes onto the stack and
+	 * returns a pointer to it. \a destructor is called when Lua collects
+	 * it.
+	 */
+	static void *createStorage (LuaRuntime *runtime, size_t size, Destructor destructor);
+	
+	/**
+	 * Pops the storage from the stack and replaces it with a C closure
+	 * calling \a invoker.
+	 */
+	static void pushClosure (LuaRuntime *runtime, Invoker invoker);
+	
+	/** Like pushClosure(), but stores the closure as global \a name. */
+	static void registerFunction (LuaRuntime *runtime, const QString &name, Invoker invoker);
+	
+	static void *storage (lua_State *env);
+	static LuaRuntime *runtime (lua_State *env);
+	static int argumentCount (lua_State *env);
+	static int argumentCountError (lua_State *env, int expected, int got);
+	
+	static double toNumber (lua_State *env, int idx);
+	static bool toBoolean (lua_State *env, int idx);
+	static QString toString (lua_State *env, int idx);
+	static QByteArray toByteArray (lua_State *env, int idx);
+	static QVariant toVariant (lua_State *env, int idx, int targetType);
+	
+	static void pushNumber (lua_State *env, double value);
+	static void pushBoolean (lua_State *env, bool value);
+	static void pushString (lua_State *env, const QString &value);
+	static void pushByteArray (lua_State *env, const QByteArray &value);
+	static void pushVariant (lua_State *env, const QVariant &value);
+	
+};
+
+// Converts a Lua number to T. Casting NaN or an out-of-range floating point
+// value to an integer is undefined, so integers are clamped into their range
+// first. NaN becomes 0.
+template< typename T >
+inline T luaNumberCast (double value, std::true_type) {
+	typedef std::numeric_limits< T > Limits;
+	if (value != value) {
+		return T (0);
+	} else if (value <= double (Limits::min ())) {
+		return Limits::min ();
+	} else if (value >= double (Limits::max ())) {
+		return Limits::max ();
+	}
+	
+	return T (value);
+}
+
+template< typename T >
+inline T luaNumberCast (double value, std::false_type)
+{ return T (value); }
+
+template< typename T >
+inline T luaNumberCast (double value)
+{ return luaNumberCast< T > (value, std::is_integral< T > ()); }
+
+// Reads a argument of type T from the Lua stack.
+template< typename T, typename = void >
+struct LuaNativeArgument {
+	static T read (lua_State *env, int idx) {
+		return LuaNativeHelper::toVariant (env, idx, qMetaTypeId< T > ()).template value< T > ();
+	}
+	
+};
+
+template< typename T >
+struct LuaNativeArgument< T, typename std::enable_if< std::is_arithmetic< T >::value >::type > {
+	static T read (lua_State *env, int idx)
+	{ return luaNumberCast< T > (LuaNativeHelper::toNumber (env, idx)); }
+};
+
+template< >
+struct LuaNativeArgument< bool, void > {
+	static bool read (lua_State *env, int idx)
+	{ return LuaNativeHelper::toBoolean (env, idx); }
+};
+
+template< >
+struct LuaNativeArgument< QString, void > {
+	static QString read (lua_State *env, int idx)
+	{ return LuaNativeHelper::toString (env, idx); }
+};
+
+template< >
+struct LuaNativeArgument< QByteArray, void > {
+	static QByteArray read (lua_State *env, int idx)
+	{ return LuaNativeHelper::toByteArray (env, idx); }
+};
+
+template< >
+struct LuaNativeArgument< QVariant, void > {
+	static QVariant read (lua_State *env, int idx)
+	{ return LuaNativeHelper::toVariant (env, idx, QMetaType::UnknownType); }
+};
+
+// Pushes a value of type T onto the Lua stack.
+template< typename T, typename = void >
+struct LuaNativeResult {
+	static void push (lua_State *env, const T &value)
+	{ LuaNativeHelper::pushVariant (env, QVariant::fromValue (value)); }
+};
+
+template< typename T >
+struct LuaNativeResult< T, typename std::enable_if< std::is_arithmetic< T >::value >::type > {
+	static void push (lua_State *env, T value)
+	{ LuaNativeHelper::pushNumber (env, double (value)); }
+};
+
+template< >
+struct LuaNativeResult< bool, void > {
+	static void push (lua_State *env, bool value)
+	{ LuaNativeHelper::pushBoolean (env, value); }
+};
+
+template< >
+struct LuaNativeResult< QString, void > {
+	static void push (lua_State *env, const QString &value)
+	{ LuaNativeHelper::pushString (env, value); }
+};
+
+template< >
+struct LuaNativeResult< QByteArray, void > {
+	static void push (lua_State *env, const QByteArray &value)
+	{ LuaNativeHelper::pushByteArray (env, value); }
+};
+
+template< >
+struct LuaNativeResult< QVariant, void > {
+	static void push (lua_State *env, const QVariant &value)
+	{ LuaNativeHelper::pushVariant (env, value); }
+};
+
+// C++11 replacement for std::index_sequence
+template< int ... Indices > struct LuaIndices { };
+
+template< int N, int ... Indices >
+struct LuaMakeIndices : LuaMakeIndices< N - 1, N - 1, Indices ... > { };
+
+template< int ... Indices >
+struct LuaMakeIndices< 0, Indices ... > { typedef LuaIndices< Indices ... > type; };
+
+/**
+ * \internal
+ * Generates a lua_CFunction for a callable \a Func returning \a Ret and
+ * taking \a Args.
+ */
+template< typename Func, typename Ret, typename ... Args >
+class LuaNativeFunction {
+public:
+	
+	static int invoke (lua_State *env) {
+		int count = LuaNativeHelper::argumentCount (env);
+		if (count != int (sizeof... (Args))) {
+			return LuaNativeHelper::argumentCountError (env, sizeof... (Args), count);
+		}
+		
+		// 
+		Func &func = *static_cast< Func * > (LuaNativeHelper::storage (env));
+		return call (env, func, std::is_void< Ret > (), typename LuaMakeIndices< sizeof... (Args) >::type ());
+	}
+	
+	static void pushFunction (LuaRuntime *runtime, Func func) {
+		void *storage = LuaNativeHelper::createStorage (runtime, sizeof(Func), &destroy);
+		new (storage) Func (std::move (func));
+		LuaNativeHelper::pushClosure (runtime, &invoke);
+	}
+	
+	static void registerFunction (LuaRuntime *runtime, const QString &name, Func func) {
+		void *storage = LuaNativeHelper::createStorage (runtime, sizeof(Func), &destroy);
+		new (storage) Func (std::move (func));
+		LuaNativeHelper::registerFunction (runtime, name, &invoke);
+	}
+	
+private:
+	
+	template< int ... Indices >
+	static int call (lua_State *env, Func &func, std::true_type, LuaIndices< Indices ... >) {
+		Q_UNUSED(env) // Without arguments
+		func (LuaNativeArgument< typename std::decay< Args >::type >::read (env, Indices + 1) ...);
+		return 0;
+	}
+	
+	template< int ... Indices >
+	static int call (lua_State *env, Func &func, std::false_type, LuaIndices< Indices ... >) {
+		typedef typename std::decay< Ret >::type Result;
+		LuaNativeResult< Result >::push (env, func (LuaNativeArgument< typename std::decay< Args >::type >
+		                                            ::read (env, Indices + 1) ...));
+		return 1;
+	}
+	
+	static void destroy (void *storage) {
+		static_cast< Func * > (storage)->~Func ();
+	}
+	
+};
+
+// Deduces the signature of a lambda (Or any other functor)
+template< typename T > struct LuaNativeSignature;
+
+template< typename Class, typename Ret, typename ... Args >
+struct LuaNativeSignature< Ret (Class::*)(Args ...) const > {
+	template< typename Func > using Function = LuaNativeFunction< Func, Ret, Args ... >;
+};
+
+template< typename Class, typename Ret, typename ... Args >
+struct LuaNativeSignature< Ret (Class::*)(Args ...) > {
+	template< typename Func > using Function = LuaNativeFunction< Func, Ret, Args ... >;
+};
+	
+} // namespace Internal
+} // namespace Nuria
+
+#endif // NURIA_LUANATIVEFUNCTION_HPP
@@ -23,6 +23,7 @@
 
 namespace Nuria {
 
+namespace Internal { class LuaClassBindingHelper; }
 class LuaObjectPrivate;
 class LuaStackUtils;
 class LuaRuntime;
@@ -116,6 +117,7 @@ public:
 				      bool takeOwnership = false);
 	
 private:
+	friend class Internal::LuaClassBindingHelper;
 	friend class LuaMetaObjectWrapper;
 	friend class LuaStackUtils;
 	friend class LuaRuntime;
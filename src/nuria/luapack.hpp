@@ -0,0 +1,94 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NURIA_LUAPACK_HPP
+#define NURIA_LUAPACK_HPP
+
+#include <QByteArray>
+#include <QString>
+#include "lua_global.hpp"
+#include "luavalue.hpp"
+
+namespace Nuria {
+
+class LuaRuntime;
+
+/**
+ * \brief Compact binary codec for Lua values using MessagePack.
+ * 
+ * Supports \c nil, booleans, numbers, strings, byte arrays and nested tables.
+ * Numbers with an integral value are stored as integers using the smallest
+ * fitting encoding. Tables whose keys are exactly 1 to \c #table are stored
+ * as arrays, all other tables as maps. Wrapped structures can optionally be
+ * stored as map of their fields, see PackStructures. When unpacked, they are
+ * plain tables.
+ * 
+ * The codec is available to scripts as \c Nuria.pack and \c Nuria.unpack:
+ * 
+ * \code
+ * local data = Nuria.pack ({ name = 'foo', values = { 1, 2, 3 } })
+ * local value, next = Nuria.unpack (data)
+ * \endcode
+ * 
+ * \c Nuria.pack (value [, packStructures]) returns the data.
+ * \c Nuria.unpack (data [, position]) decodes the value at \c position,
+ * which defaults to \c 1, and returns it along with the position after it.
+ * This way, multiple values packed after each other can be read one at a
+ * time. On failure, both return \c nil and an error message.
+ */
+class NURIA_LUA_EXPORT LuaPack {
+public:
+	
+	/** Options for pack(). */
+	enum Option {
+		NoOptions = 0x0,
+		
+		/**
+		 * Store wrapped structures as map of their fields. Without it,
+		 * packing a structure fails.
+		 */
+		PackStructures = 0x1
+	};
+	
+	Q_DECLARE_FLAGS(Options, Option)
+	
+	/**
+	 * Encodes \a value. On failure, an empty QByteArray is returned and
+	 * \a error is set if not \c nullptr.
+	 */
+	static QByteArray pack (const LuaValue &value, Options options = NoOptions,
+	                        QString *error = nullptr);
+	
+	/**
+	 * Decodes a value of \a data into \a runtime.
+	 * 
+	 * If \a offset is \c nullptr, \a data must contain exactly one value.
+	 * Else, the value at \a offset is decoded and \a offset is advanced to
+	 * the byte after it. Use this to read a stream of values.
+	 * 
+	 * On failure, an invalid value is returned and \a error is set if not
+	 * \c nullptr.
+	 */
+	static LuaValue unpack (LuaRuntime *runtime, const QByteArray &data, int *offset = nullptr,
+	                        QString *error = nullptr);
+	
+};
+
+}
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(Nuria::LuaPack::Options)
+
+#endif // NURIA_LUAPACK_HPP
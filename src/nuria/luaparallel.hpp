@@ -0,0 +1,84 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NURIA_LUAPARALLEL_HPP
+#define NURIA_LUAPARALLEL_HPP
+
+#include <QVariantList>
+#include <QByteArray>
+#include <QVector>
+#include <QString>
+#include "lua_global.hpp"
+
+namespace Nuria {
+
+/**
+ * \brief Runs a Lua function over a list of values on multiple threads.
+ * 
+ * Every thread owns a LuaRuntime, into which \a script is loaded once. The
+ * script defines the functions by assigning them to globals:
+ * 
+ * \code
+ * QVariantList squares = LuaParallel::map ("function square (x) return x * x end",
+ *                                          "square", numbers);
+ * \endcode
+ * 
+ * The input is split into chunks, which the threads take one after another,
+ * so a slow chunk doesn't hold back the others. Results keep the order of
+ * the input. Values are passed in and out of the runtimes as QVariant, so
+ * they must be convertible like any other value passed to Lua.
+ * 
+ * On the first error, all threads stop and \a error is set if not
+ * \c nullptr.
+ */
+class NURIA_LUA_EXPORT LuaParallel {
+public:
+	
+	/**
+	 * Calls the global function \a function for each value of \a input
+	 * and returns the first result of each call. \a threads runtimes are
+	 * used, if it's \c 0, one per CPU core.
+	 * On failure, an empty list is returned.
+	 */
+	static QVariantList map (const QByteArray &script, const QByteArray &function,
+	                         const QVariantList &input, int threads = 0,
+	                         QString *error = nullptr);
+	
+	/**
+	 * Maps each value of \a input using \a mapFunction and folds the
+	 * results using \a reduceFunction, which is called as
+	 * \c reduce(accumulator,value) and returns the new accumulator. If
+	 * \a mapFunction is empty, the input values are folded as-is.
+	 * 
+	 * Each chunk is folded in its thread, then the results of the chunks
+	 * are folded in order. Thus, \a reduceFunction must be associative.
+	 * 
+	 * Returns an invalid QVariant if \a input is empty or on failure.
+	 */
+	static QVariant mapReduce (const QByteArray &script, const QByteArray &mapFunction,
+	                           const QByteArray &reduceFunction, const QVariantList &input,
+	                           int threads = 0, QString *error = nullptr);
+	
+private:
+	static bool run (const QByteArray &script, const QByteArray &mapFunction,
+	                 const QByteArray &reduceFunction, const QVariantList &input,
+	                 int threads, QVector< QVariant > &results, QString *error);
+	
+};
+
+}
+
+#endif // NURIA_LUAPARALLEL_HPP
@@ -0,0 +1,155 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NURIA_LUAPIPELINE_HPP
+#define NURIA_LUAPIPELINE_HPP
+
+#include <QVariantList>
+#include <QByteArray>
+#include <QVector>
+#include <QString>
+#include "lua_global.hpp"
+
+namespace Nuria {
+
+class LuaPipelinePrivate;
+
+/**
+ * \brief Runs records through a chain of Lua stages, each in its own thread.
+ * 
+ * Every stage owns a LuaRuntime running in a dedicated thread. A stage is a
+ * global function defined by a script, which is called for each record and
+ * returns the record passed on to the next stage. Returning \c nil drops the
+ * record:
+ * 
+ * \code
+ * LuaPipeline pipeline;
+ * pipeline.addStage ("parse", parseScript, "parse");
+ * pipeline.addStage ("filter", "function keep (r) if r.valid then return r end end", "keep");
+ * pipeline.start ();
+ * 
+ * // Take the output in another thread, as push() waits once the queues are full
+ * std::thread consumer ([&pipeline]() {
+ * 	QVariantList records;
+ * 	while (pipeline.take (records)) { ... }
+ * });
+ * 
+ * for (const QVariant &line : lines) pipeline.push (line);
+ * pipeline.finish ();
+ * consumer.join ();
+ * \endcode
+ * 
+ * Records are moved between stages in batches of \a batchSize. The queues
+ * between stages hold up to \a queueCapacity batches. When a queue is full,
+ * the stage in front of it waits, so a slow stage throttles the ones before
+ * it instead of letting the queues grow. The statistics() show where
+ * batches pile up.
+ * 
+ * push() and take() must not be called from the same thread once the queues
+ * can fill up, as take() is what makes room for push(). Both are not
+ * thread-safe themselves.
+ * 
+ * Errors don't stop the pipeline: a batch failing in a stage is dropped,
+ * counted and the error is available through errorString().
+ */
+class NURIA_LUA_EXPORT LuaPipeline {
+public:
+	
+	/** Statistics of a stage, see statistics(). */
+	struct StageStatistics {
+		
+		/** Name of the stage. */
+		QByteArray name;
+		
+		/** Batches waiting in the input queue of the stage. */
+		int queued;
+		
+		/** Capacity of the input queue in batches. */
+		int capacity;
+		
+		/** Count of processed batches. */
+		qint64 batches;
+		
+		/** Count of records passed in and out of the stage. */
+		qint64 recordsIn;
+		qint64 recordsOut;
+		
+		/** Count of failed batches. */
+		qint64 errors;
+		
+		/** Records processed per second since the start. */
+		double throughput;
+		
+		/** Fraction of the time the stage was running Lua code. */
+		double utilisation;
+		
+	};
+	
+	/** Constructor. */
+	explicit LuaPipeline (int batchSize = 256, int queueCapacity = 16);
+	
+	/** Finishes the pipeline, dropping records not taken yet. */
+	~LuaPipeline ();
+	
+	/**
+	 * Appends a stage, which calls the global \a function defined by
+	 * \a script. Must be called before start().
+	 */
+	void addStage (const QByteArray &name, const QByteArray &script, const QByteArray &function);
+	
+	/** Starts the threads. Returns \c false if there are no stages. */
+	bool start ();
+	
+	/**
+	 * Queues \a record. Records are sent to the first stage once a batch
+	 * is full. Blocks while the first queue is full. Returns \c false if
+	 * the pipeline isn't running.
+	 */
+	bool push (const QVariant &record);
+	
+	/** Sends the records queued by push() without waiting for a full batch. */
+	bool flush ();
+	
+	/**
+	 * Flushes and signals the end of input. The stages exit after
+	 * processing the remaining batches.
+	 */
+	void finish ();
+	
+	/**
+	 * Waits for the next batch of output records and stores it in
+	 * \a records. Returns \c false once the pipeline has finished and all
+	 * output has been taken.
+	 */
+	bool take (QVariantList &records);
+	
+	/** Returns the statistics of all stages. Thread-safe. */
+	QVector< StageStatistics > statistics () const;
+	
+	/** Returns the last error of any stage. */
+	QString errorString () const;
+	
+private:
+	Q_DISABLE_COPY(LuaPipeline)
+	
+	// 
+	LuaPipelinePrivate *d_ptr;
+	
+};
+
+}
+
+#endif // NURIA_LUAPIPELINE_HPP
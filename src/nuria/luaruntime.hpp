@@ -21,6 +21,8 @@
 #include <QObject>
 
 #include <nuria/metaobject.hpp>
+#include "luanativefunction.hpp"
+#include "luaexpression.hpp"
 #include "lua_global.hpp"
 #include "luavalue.hpp"
 
@@ -28,12 +30,19 @@ class QIODevice;
 
 namespace Nuria {
 
-namespace Internal { class Delegate; }
+namespace Internal {
+class LuaClassBindingHelper;
+class Delegate;
+}
 class LuaCallbackTrampoline;
 class LuaMetaObjectWrapper;
 class LuaBuiltinFunctions;
+class LuaMsgPackEncoder;
+class LuaTransfer;
 class LuaRuntimePrivate;
 class LuaMetaObject;
+class LuaStackUtils;
+class LuaBuffer;
 class Callback;
 
 /**
@@ -67,11 +76,21 @@ class Callback;
  * handler using setObjectHandler() to install a runtime-wide function which is
  * called whenever LUA collected a C++ object.
  * 
+ * \par Native functions
+ * Plain C++ functions and lambdas can be exposed to Lua using
+ * registerFunction(). Other than a Nuria::Callback stored in a QVariant,
+ * this generates a dedicated Lua C function for the signature at compile
+ * time, which reads the arguments directly off the Lua stack:
+ * \code
+ * runtime.registerFunction ("add", [](int a, int b) { return a + b; });
+ * \endcode
+ * 
  * \par Class interoperability
  * Using Nuria::MetaObject, it's possible to use C++ classes inside Lua. You can
  * pass C++ objects (That is, a void pointer with a MetaObject) to Lua or expose
  * MetaObjects directly to Lua, which enable Lua scripts to construct instances
- * at will.
+ * at will. For hot paths, LuaClassBinding can be used to bind single fields
+ * and methods natively.
  * 
  */
 class NURIA_LUA_EXPORT LuaRuntime : public QObject {
@@ -119,6 +138,22 @@ public:
 	
 	Q_DECLARE_FLAGS(OwnershipFlags, Ownership)
 	
+	/**
+	 * Conversion of Lua strings into a QVariant, if the target type is not
+	 * known.
+	 */
+	enum StringConversion {
+		
+		/** Strings are decoded from UTF-8 into a QString. */
+		ToQString = 0,
+		
+		/**
+		 * Strings are returned as QByteArray as-is. This saves decoding
+		 * them if the bytes are passed on anyway, e.g. into a socket.
+		 */
+		ToByteArray = 1
+	};
+	
 	/**
 	 * Constructor.
 	 * Loads all \a libraries into the environment (These are provided by
@@ -134,7 +169,8 @@ public:
 	 * Returns \c false if an error occured, like a syntax error.
 	 * 
 	 * If the call failed, lastResult() will return a string containing a
-	 * human-readable error message.
+	 * human-readable error message. Calls from a foreign thread only log a
+	 * warning and return \c false, leaving lastResult() untouched.
 	 * 
 	 * After \a script has returned, lastResult() will return the result of
 	 * it. If there were multiple results, then lastResult() will return
@@ -177,6 +213,140 @@ public:
 	/** Returns \c true if there's a global variable called \a name. */
 	bool hasGlobal (const QString &name);
 	
+	/**
+	 * Copies \a value into \a target and returns the copy. Tables are
+	 * copied deeply and directly from one Lua state into the other,
+	 * preserving shared sub-tables and cycles. Meta tables of tables are
+	 * not copied. Byte arrays share their data.
+	 * 
+	 * Wrapped objects owned by C++ are shared by both runtimes. Structures
+	 * owned by the runtime of \a value are copied, and the copy is owned
+	 * by \a target. QObjects owned by the runtime of \a value, functions
+	 * and coroutines can't be transferred.
+	 * 
+	 * On failure, an invalid value is returned and \a error is set if not
+	 * \c nullptr. Both runtimes must be used from the calling thread.
+	 */
+	static LuaValue transfer (const LuaValue &value, LuaRuntime *target, QString *error = nullptr);
+	
+	/**
+	 * Calls the global function \a function once for each value of
+	 * \a inputs and returns the first result of each call, in order. A
+	 * call returning \c nil results in an invalid QVariant.
+	 * 
+	 * The inputs are passed to Lua as a single table and the function is
+	 * called in a Lua loop, all inside one protected call. This makes
+	 * calling a function for many values far cheaper than calling it for
+	 * each value from C++. On failure, an empty list is returned and
+	 * \a error is set if not \c nullptr.
+	 */
+	QVariantList callBatch (const QString &function, const QVariantList &inputs, QString *error = nullptr);
+	
+	/**
+	 * Calls \a function for each element of \a inputs and stores the
+	 * results in the same index of \a outputs, which must have at least as
+	 * many elements as \a inputs. The function has to return a number.
+	 * Both buffers are accessed in-place, so no values are converted from
+	 * or to QVariant. Returns \c true on success.
+	 */
+	bool callBatch (const QString &function, const LuaBuffer &inputs, const LuaBuffer &outputs,
+	                QString *error = nullptr);
+	
+	/**
+	 * Compiles \a expression into a function taking \a variables as
+	 * parameters, in order. Each variable must be a valid Lua identifier.
+	 * On failure, an invalid expression is returned and \a error is set
+	 * if not \c nullptr.
+	 * 
+	 * \sa LuaExpression
+	 */
+	LuaExpression compileExpression (const QString &expression, const QStringList &variables,
+	                                 QString *error = nullptr);
+	
+	/**
+	 * Converter pushing \a value onto the Lua stack of \a runtime. Use
+	 * luaState() to access the stack. The converter must push exactly one
+	 * value.
+	 */
+	typedef void (*PushConverter) (LuaRuntime *runtime, const QVariant &value);
+	
+	/**
+	 * Converter reading the value at stack index \a idx of \a runtime into
+	 * a QVariant of the type the converter was registered for. The stack
+	 * must not be changed.
+	 */
+	typedef QVariant (*ReadConverter) (LuaRuntime *runtime, int idx);
+	
+	/**
+	 * Registers converters for the Qt type \a metaTypeId. \a push is used
+	 * whenever a QVariant of this type is passed to Lua. \a read, if not
+	 * \c nullptr, is used when a value from Lua is expected to be of this
+	 * type, e.g. when writing it into a field of a structure.
+	 * 
+	 * Converters are looked up by type id in constant time. Built-in
+	 * converters exist for all numeric and string-like Qt types, which
+	 * can be overridden by this method.
+	 */
+	void registerConverter (int metaTypeId, PushConverter push, ReadConverter read = nullptr);
+	
+	/**
+	 * Sets the size in bytes from which QByteArrays are passed to Lua as
+	 * byte array instead of a Lua string. A byte array shares the data
+	 * with the QByteArray instead of copying it into Lua. It offers the
+	 * methods \c len, \c byte, \c sub, \c find and \c string, which
+	 * behave like their counterparts from the string library. Use
+	 * \c tostring() to turn it into a Lua string.
+	 * 
+	 * \note A byte array is user data, not a string: \c type() returns
+	 * \c "userdata", it doesn't compare equal to string literals and the
+	 * remaining \c string functions don't accept it. Only enable this for
+	 * scripts which expect it.
+	 * 
+	 * The default is \c -1, which always passes Lua strings.
+	 */
+	void setByteArrayThreshold (int bytes);
+	
+	/** Returns the byte array threshold. */
+	int byteArrayThreshold () const;
+	
+	/**
+	 * Sets how strings from Lua are converted into a QVariant. This
+	 * affects LuaValue::toVariant() and all other conversions where the
+	 * target type is not known. The default is \c ToQString.
+	 * 
+	 * \sa LuaValue::toByteArray()
+	 */
+	void setStringConversion (StringConversion conversion);
+	
+	/** Returns the string conversion policy. */
+	StringConversion stringConversion () const;
+	
+	/**
+	 * Exposes \a function as global function \a name to Lua. Arguments
+	 * and the result are converted at compile time: Numbers, booleans,
+	 * QString and QByteArray are read from and pushed onto the Lua stack
+	 * directly. All other types are converted through QVariant.
+	 * 
+	 * Calling the function from Lua with the wrong argument count raises
+	 * a Lua error.
+	 */
+	template< typename Ret, typename ... Args >
+	void registerFunction (const QString &name, Ret (*function)(Args ...)) {
+		Internal::LuaNativeFunction< Ret (*)(Args ...), Ret, Args ... >::registerFunction (this, name, function);
+	}
+	
+	/**
+	 * \overload
+	 * Exposes the lambda (Or functor) \a lambda as global function \a name
+	 * to Lua. \a lambda is copied into the Lua runtime and destroyed when
+	 * it's garbage collected.
+	 */
+	template< typename Lambda >
+	void registerFunction (const QString &name, Lambda lambda) {
+		typedef Internal::LuaNativeSignature< decltype(&Lambda::operator()) > Signature;
+		Signature::template Function< Lambda >::registerFunction (this, name, std::move (lambda));
+	}
+	
 	/**
 	 * Registers \a metaObject for usage in the runtime. After this, the
 	 * class can be used in LUA. The type will be stored as userdata inside
@@ -209,6 +379,11 @@ public:
 	/**
 	 * Changes the ownership of \a object to \a ownership.
 	 * If \a object is not known to LUA, this function has no effect.
+	 * 
+	 * \note Structures copied into Lua by value are stored inside the
+	 * memory Lua allocated for them, thus they always stay owned by Lua.
+	 * When C++ takes them from Lua, it gets a copy instead and a warning
+	 * is logged.
 	 */
 	void setObjectOwnership (void *object, Ownership ownership);
 	
@@ -223,7 +398,8 @@ public:
 	 * \a ownership indicates who owns the object, \a object is the affected
 	 * object with its \a metaObject. If \a ownership is \c OwnedByLua, the
 	 * \a object will be destroyed if the handler returns \c true. In any
-	 * other case \a object is not touched.
+	 * other case \a object is not touched. Structures stored inside their
+	 * Lua memory are always destroyed, see setObjectOwnership().
 	 */
 	typedef std::function< bool(Ownership, void *, MetaObject *) > ObjectHandler;
 	
@@ -237,6 +413,40 @@ public:
 	 */
 	void setObjectHandler (ObjectHandler handler, OwnershipFlags flags = OwnershipFlags (OwnedByLua | OwnedByCpp));
 	
+	/**
+	 * Returns \c true if this method is called from the thread the
+	 * runtime lives in.
+	 * 
+	 * A LuaRuntime may only be used from its own thread, see
+	 * QObject::thread(). execute(), global(), setGlobal(), hasGlobal() and
+	 * collectGarbage() refuse to work when called from another thread.
+	 * Use post() or invoke() instead.
+	 */
+	bool isInOwnThread () const;
+	
+	/**
+	 * Queues \a closure to be run in the thread of the runtime and returns
+	 * immediately. This is safe to call from any thread as long as the
+	 * runtime is alive. The caller has to make sure it isn't destroyed
+	 * concurrently: Once the destructor started, posting is undefined.
+	 * Closures posted before are run by the destructor.
+	 * 
+	 * Closures are kept in a lock-free queue and run in the order they
+	 * were posted. The thread is woken up once for any number of closures
+	 * posted in a row, so it needs a running event loop.
+	 */
+	void post (std::function< void() > closure);
+	
+	/**
+	 * Runs \a closure in the thread of the runtime and waits for it to
+	 * finish. If called from the thread of the runtime, \a closure is run
+	 * directly.
+	 * 
+	 * \warning This blocks until the thread of the runtime processes its
+	 * events. Don't call it while that thread is waiting for the caller.
+	 */
+	void invoke (std::function< void() > closure);
+	
 	/**
 	 * Returns the internal LUA runtime. The returned pointer is of type
 	 * lua_State*. To make use of it, you'll need to #include "lua.hpp".
@@ -246,19 +456,31 @@ public:
 	 */
 	void *luaState ();
 	
+private slots:
+	
+	void runPostedClosures ();
+	
 private:
 	friend class LuaCallbackTrampoline;
 	friend class LuaMetaObjectWrapper;
 	friend class LuaBuiltinFunctions;
+	friend class LuaMsgPackEncoder;
+	friend class LuaTransfer;
+	friend class Internal::LuaClassBindingHelper;
 	friend class Internal::Delegate;
 	friend class LuaMetaObject;
+	friend class LuaStackUtils;
 	friend class LuaObject;
+	friend class LuaValue;
+	friend class LuaValuePrivate;
 	
 	// 
 	void createObjectsReferenceTable ();
 	
 	bool pcall (int argCount, LuaValues &results);
 	
+	bool checkThread (const char *method);
+	bool pushBatchDriver (const QString &function, QString *error);
 	void setLastResultError (LuaValues &values, const QString &message);
 	static QString luaErrorToString (int error);
 	void createLuaInstance ();
@@ -0,0 +1,139 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NURIA_LUASCHEDULER_HPP
+#define NURIA_LUASCHEDULER_HPP
+
+#include <functional>
+#include <QVariant>
+#include <QObject>
+#include <QVector>
+
+#include "lua_global.hpp"
+
+namespace Nuria {
+
+class LuaSchedulerPrivate;
+class LuaSchedulerWorker;
+class LuaRuntime;
+
+/**
+ * \brief Runs Lua scripts as coroutines on a pool of worker threads.
+ * 
+ * Each worker thread owns a LuaRuntime and runs many tasks, switching between
+ * them whenever a task yields. This suits large numbers of long-lived tasks,
+ * like per-connection state machines, which spend most of their time waiting:
+ * 
+ * \code
+ * LuaScheduler scheduler (4);
+ * scheduler.spawn ("local c = Nuria.channel ('requests')\n"
+ *                  "while true do handle (c:receive ()) end");
+ * \endcode
+ * 
+ * A task is a chunk of Lua code, which is run as coroutine. When it yields,
+ * e.g. by calling \c coroutine.yield() or by receiving from an empty
+ * LuaChannel, the worker continues with the next task and resumes the
+ * yielded one later. Tasks waiting for a channel are resumed once a value
+ * is sent to or received from it, or it's closed. Workers with tasks
+ * which yielded anything else poll them every millisecond.
+ * 
+ * New tasks are distributed round-robin onto the workers. Every worker keeps
+ * its tasks which haven't started yet in a deque, from which idle workers
+ * steal. Once started, a task stays in the runtime of its worker.
+ * 
+ * The runtimes are created with all libraries and can be prepared using the
+ * \a setup function passed to the constructor, which is called in the worker
+ * thread right after creating the runtime.
+ */
+class NURIA_LUA_EXPORT LuaScheduler : public QObject {
+	Q_OBJECT
+public:
+	
+	/** Function setting up the runtime of a worker. */
+	typedef std::function< void(LuaRuntime *) > Setup;
+	
+	/** Statistics of a worker, see statistics(). */
+	struct WorkerStatistics {
+		
+		/** Tasks waiting to be started. */
+		int queued;
+		
+		/** Started tasks, which haven't finished yet. */
+		int running;
+		
+		/** Count of started tasks. */
+		qint64 started;
+		
+		/** Count of finished tasks, including failed ones. */
+		qint64 finished;
+		
+		/** Count of tasks stolen from other workers. */
+		qint64 steals;
+		
+		/** Fraction of the time the worker was running tasks. */
+		double utilisation;
+		
+	};
+	
+	/**
+	 * Starts \a workers worker threads. If \a workers is \c 0, a worker is
+	 * started per CPU core. \a setup is called for each runtime.
+	 */
+	explicit LuaScheduler (int workers = 0, Setup setup = nullptr, QObject *parent = nullptr);
+	
+	/** Stops the scheduler. \sa stop() */
+	~LuaScheduler () override;
+	
+	/** Returns the count of workers. */
+	int workerCount () const;
+	
+	/**
+	 * Queues \a script to be run as task and returns the id of the task.
+	 * Returns \c -1 if the scheduler has been stopped. Thread-safe.
+	 */
+	int spawn (const QByteArray &script);
+	
+	/** Returns the statistics of all workers. Thread-safe. */
+	QVector< WorkerStatistics > statistics () const;
+	
+	/**
+	 * Stops all workers and waits for them to exit. Tasks which haven't
+	 * finished yet are dropped.
+	 */
+	void stop ();
+
+signals:
+	
+	/**
+	 * The task \a task has returned \a result, which is its first return
+	 * value. Emitted from the worker thread.
+	 */
+	void taskFinished (int task, const QVariant &result);
+	
+	/** The task \a task failed with \a error. Emitted from the worker thread. */
+	void taskFailed (int task, const QString &error);
+	
+private:
+	friend class LuaSchedulerWorker;
+	
+	// 
+	LuaSchedulerPrivate *d_ptr;
+	
+};
+
+}
+
+#endif // NURIA_LUASCHEDULER_HPP
@@ -0,0 +1,194 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NURIA_LUATABLE_HPP
+#define NURIA_LUATABLE_HPP
+
+#include <QSharedDataPointer>
+#include <QVariant>
+#include "lua_global.hpp"
+
+namespace Nuria {
+
+class LuaTableIteratorPrivate;
+class LuaTableBuilder;
+class LuaTablePrivate;
+class LuaStackUtils;
+class LuaTableIterator;
+class LuaRuntime;
+class LuaValue;
+
+/**
+ * \brief Handle to a table living in Lua.
+ * 
+ * Tables returned from Lua are not converted into a QVariant right away.
+ * Instead, LuaValue keeps a reference to the table, which can be accessed
+ * through this class. Values are only converted when they're accessed:
+ * 
+ * \code
+ * runtime.execute ("return { name = 'foo', items = { ... } }");
+ * LuaTable result = runtime.lastResult ().table ();
+ * QString name = result.value< QString > ("name");
+ * int count = result.get ("items").table ().length ();
+ * \endcode
+ * 
+ * A LuaTable is only valid as long as its runtime exists. It references the
+ * table itself, thus changes made to it in Lua are visible through it.
+ * 
+ * \sa LuaTableIterator, toVariant()
+ */
+class NURIA_LUA_EXPORT LuaTable {
+public:
+	
+	/** Constructs a invalid instance. */
+	LuaTable ();
+	
+	/** Copy constructor. */
+	LuaTable (const LuaTable &other);
+	
+	/** Assignment operator. */
+	LuaTable &operator= (const LuaTable &other);
+	
+	/** Destructor. */
+	~LuaTable ();
+	
+	/** Returns \c true if this instance is valid. */
+	bool isValid () const;
+	
+	/** Returns the associated LuaRuntime. */
+	LuaRuntime *runtime () const;
+	
+	/** Returns the internal LUA reference. */
+	int reference () const;
+	
+	/**
+	 * Returns the length of the array part of the table, like the \c #
+	 * operator in Lua does.
+	 */
+	int length () const;
+	
+	/** Returns \c true if there's a non-nil value for \a key. */
+	bool contains (const QString &key) const;
+	
+	/** Returns the value of \a key. */
+	LuaValue get (const QString &key) const;
+	
+	/** Returns the value at \a index, which starts at \c 1 like in Lua. */
+	LuaValue get (int index) const;
+	
+	/**
+	 * Returns the value of \a key converted to \a T. If there's no such
+	 * value, \a defaultValue is returned.
+	 */
+	template< typename T >
+	T value (const QString &key, const T &defaultValue = T ()) const {
+		QVariant v = variant (key);
+		return (v.isValid ()) ? v.value< T > () : defaultValue;
+	}
+	
+	/** \overload */
+	template< typename T >
+	T value (int index, const T &defaultValue = T ()) const {
+		QVariant v = variant (index);
+		return (v.isValid ()) ? v.value< T > () : defaultValue;
+	}
+	
+	/** Returns a iterator over all key/value pairs of the table. */
+	LuaTableIterator iterator () const;
+	
+	/**
+	 * Converts the whole table into a QVariant. Tables with only sequential
+	 * integer keys result in a QVariantList, all others in a QVariantMap.
+	 */
+	QVariant toVariant () const;
+	
+private:
+	friend class LuaTableIterator;
+	friend class LuaTableBuilder;
+	friend class LuaStackUtils;
+	friend class LuaRuntime;
+	friend class LuaValue;
+	
+	LuaTable (LuaRuntime *runtime, int ref);
+	
+	QVariant variant (const QString &key) const;
+	QVariant variant (int index) const;
+	void pushOnStack () const;
+	
+	// 
+	QSharedDataPointer< LuaTablePrivate > d;
+	
+};
+
+/**
+ * \brief Streaming iterator over a LuaTable.
+ * 
+ * Iterates over all pairs of a table in the order of Lua's \c next(). Keys
+ * and values are only converted when they're accessed:
+ * 
+ * \code
+ * LuaTableIterator it = table.iterator ();
+ * while (it.next ()) {
+ *         qDebug() << it.key ().toVariant () << it.value ().toVariant ();
+ * }
+ * \endcode
+ * 
+ * Copies of a iterator share their position.
+ * 
+ * \note Don't add keys to the table while iterating over it.
+ */
+class NURIA_LUA_EXPORT LuaTableIterator {
+public:
+	
+	/** Constructs a invalid iterator. */
+	LuaTableIterator ();
+	
+	/** Copy constructor. */
+	LuaTableIterator (const LuaTableIterator &other);
+	
+	/** Assignment operator. */
+	LuaTableIterator &operator= (const LuaTableIterator &other);
+	
+	/** Destructor. */
+	~LuaTableIterator ();
+	
+	/**
+	 * Advances to the next pair. Returns \c false if there is none, else
+	 * \c true. Must be called once before accessing the first pair.
+	 */
+	bool next ();
+	
+	/** Returns the key of the current pair. */
+	LuaValue key () const;
+	
+	/** Returns the value of the current pair. */
+	LuaValue value () const;
+	
+private:
+	friend class LuaTable;
+	
+	LuaTableIterator (const LuaTable &table);
+	
+	// 
+	QExplicitlySharedDataPointer< LuaTableIteratorPrivate > d;
+	
+};
+
+}
+
+Q_DECLARE_METATYPE(Nuria::LuaTable)
+
+#endif // NURIA_LUATABLE_HPP
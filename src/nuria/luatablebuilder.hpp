@@ -0,0 +1,176 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NURIA_LUATABLEBUILDER_HPP
+#define NURIA_LUATABLEBUILDER_HPP
+
+#include <type_traits>
+#include <QByteArray>
+#include <QVariant>
+#include <QVector>
+#include <QString>
+
+#include "lua_global.hpp"
+#include "luatable.hpp"
+
+struct lua_State;
+
+namespace Nuria {
+
+class LuaRuntime;
+class LuaValue;
+
+/**
+ * \brief Builds Lua tables directly from C++.
+ * 
+ * Instead of building a QVariantMap or QVariantList first, which is then
+ * converted into a Lua table, LuaTableBuilder writes into the table right
+ * away. Tables are pre-allocated using the given size hints:
+ * 
+ * \code
+ * LuaTableBuilder builder (&runtime, 0, 3);
+ * builder.set ("method", "GET")
+ *        .set ("port", 8080)
+ *        .beginTable ("headers", 0, 1)
+ *            .set ("Host", host)
+ *        .endTable ()
+ *        .beginTable ("values", count)
+ *            .appendArray (values, count)
+ *        .endTable ();
+ * 
+ * runtime.setGlobal ("request", QVariant::fromValue (builder.table ()));
+ * \endcode
+ * 
+ * The table is built on the Lua stack of \a runtime, thus the runtime must
+ * not be used by anything else until table() was called. Keys passed as
+ * <tt>const char *</tt> are expected to be UTF-8 encoded.
+ * 
+ * Values can be booleans, numbers, strings, QVariants, LuaTables and
+ * LuaValues. Existing tables can be changed by passing them to the
+ * constructor, in which case table() returns the same table.
+ */
+class NURIA_LUA_EXPORT LuaTableBuilder {
+public:
+	
+	/**
+	 * Creates a new table in \a runtime with space for \a arraySize array
+	 * elements and \a fieldCount other fields.
+	 */
+	LuaTableBuilder (LuaRuntime *runtime, int arraySize = 0, int fieldCount = 0);
+	
+	/**
+	 * Writes into the existing \a table, which must be valid. Appended
+	 * elements follow its current array part.
+	 */
+	LuaTableBuilder (const LuaTable &table);
+	
+	/** Destructor. Drops the table if table() wasn't called. */
+	~LuaTableBuilder ();
+	
+	/** Sets \a key of the current table to \a value. */
+	template< typename T >
+	LuaTableBuilder &set (const char *key, const T &value)
+	{ pushValue (value); setField (key); return *this; }
+	
+	/** \overload */
+	template< typename T >
+	LuaTableBuilder &set (const QByteArray &key, const T &value)
+	{ pushValue (value); setField (key); return *this; }
+	
+	/** \overload */
+	template< typename T >
+	LuaTableBuilder &set (const QString &key, const T &value)
+	{ pushValue (value); setField (key); return *this; }
+	
+	/**
+	 * Sets the element at \a index (Starting at 1) of the current table.
+	 * Following append() calls continue after the highest index set.
+	 */
+	template< typename T >
+	LuaTableBuilder &set (int index, const T &value)
+	{ pushValue (value); setIndex (index); return *this; }
+	
+	/** Appends \a value to the array part of the current table. */
+	template< typename T >
+	LuaTableBuilder &append (const T &value)
+	{ pushValue (value); appendTop (); return *this; }
+	
+	/** Appends \a count elements from \a data to the current table. */
+	template< typename T >
+	LuaTableBuilder &appendArray (const T *data, int count) {
+		for (int i = 0; i < count; i++) {
+			pushValue (data[i]);
+			appendTop ();
+		}
+		
+		return *this;
+	}
+	
+	/**
+	 * Starts a new table stored as \a key in the current table. All
+	 * following calls operate on the new table until endTable().
+	 */
+	LuaTableBuilder &beginTable (const char *key, int arraySize = 0, int fieldCount = 0);
+	
+	/** \overload */
+	LuaTableBuilder &beginTable (const QString &key, int arraySize = 0, int fieldCount = 0);
+	
+	/** Starts a new table, which is appended to the current table. */
+	LuaTableBuilder &beginTable (int arraySize = 0, int fieldCount = 0);
+	
+	/** Ends the table started by the last beginTable() call. */
+	LuaTableBuilder &endTable ();
+	
+	/**
+	 * Finishes building and returns the table. Open nested tables are
+	 * ended first. Returns a invalid LuaTable if called more than once.
+	 */
+	LuaTable table ();
+	
+private:
+	Q_DISABLE_COPY(LuaTableBuilder)
+	
+	void pushValue (bool value);
+	void pushValue (double value);
+	void pushValue (const char *value);
+	void pushValue (const QString &value);
+	void pushValue (const QByteArray &value);
+	void pushValue (const QVariant &value);
+	void pushValue (const LuaTable &value);
+	void pushValue (const LuaValue &value);
+	
+	template< typename T >
+	typename std::enable_if< std::is_arithmetic< T >::value >::type pushValue (T value)
+	{ pushValue (double (value)); }
+	
+	void setField (const char *key);
+	void setField (const QByteArray &key);
+	void setField (const QString &key);
+	void setIndex (int index);
+	void appendTop ();
+	
+	// 
+	LuaRuntime *runtime;
+	lua_State *env;
+	
+	// Highest array index per open table, the root one being first
+	QVector< int > lengths;
+	
+};
+
+}
+
+#endif // NURIA_LUATABLEBUILDER_HPP
@@ -23,13 +23,17 @@
 
 #include "lua_global.hpp"
 #include "luaobject.hpp"
+#include "luatable.hpp"
 
 namespace Nuria {
 
 class LuaMetaObjectWrapper;
+class LuaTableBuilder;
 class LuaValuePrivate;
 class LuaMetaObject;
 class LuaStackUtils;
+class LuaJson;
+class LuaPack;
 class LuaRuntime;
 class MetaObject;
 class LuaObject;
@@ -79,9 +83,28 @@ public:
 	/** Returns \c true if this instance is valid. */
 	bool isValid () const;
 	
-	/** Converts the value into a QVariant. */
+	/**
+	 * Converts the value into a QVariant. Tables are converted on each
+	 * call, see LuaTable::toVariant(). When the runtime is destroyed, they
+	 * are converted one last time, so the value stays usable. Strings are
+	 * converted as LuaRuntime::stringConversion() was set when the value
+	 * was read from Lua.
+	 */
 	QVariant toVariant () const;
 	
+	/**
+	 * Returns the value as QByteArray. For strings, the bytes are returned
+	 * as-is without decoding them, regardless of
+	 * LuaRuntime::stringConversion().
+	 */
+	QByteArray toByteArray () const;
+	
+	/**
+	 * Returns the LuaTable if this value is a table from LUA. If it's not,
+	 * the returned instance is invalid.
+	 */
+	LuaTable table () const;
+	
 	/**
 	 * Returns the LuaObject if this value is a LUA user-data pointing to
 	 * a type with a Nuria::MetaObject. If this isn't an object, the
@@ -104,7 +127,10 @@ public:
 	
 private:
 	friend class LuaMetaObjectWrapper;
+	friend class LuaTableBuilder;
 	friend class LuaMetaObject;
+	friend class LuaJson;
+	friend class LuaPack;
 	friend class LuaStackUtils;
 	friend class LuaRuntime;
 	friend class LuaObject;
@@ -112,6 +138,10 @@ private:
 	// 
 	void initValue (int idx);
 	void setLuaObject (int idx);
+	void pushOnStack (LuaRuntime *runtime) const;
+	
+	/** Converts the tables of all values of \a runtime, which is going away. */
+	static void snapshotTables (LuaRuntime *runtime);
 	
 	// 
 	QExplicitlySharedDataPointer< LuaValuePrivate > d;
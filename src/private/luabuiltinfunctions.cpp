@@ -20,6 +20,11 @@
 #include "luaruntimeprivate.hpp"
 #include "../nuria/luaruntime.hpp"
 #include "luastructures.hpp"
+#include "luajsoncodec.hpp"
+#include "luamsgpack.hpp"
+#include "luabytearray.hpp"
+#include "luastackutils.hpp"
+#include "../nuria/luachannel.hpp"
 #include <lua.hpp>
 
 int Nuria::LuaBuiltinFunctions::createNuriaTable (Nuria::LuaRuntime *runtime) {
@@ -41,6 +46,9 @@ void Nuria::LuaBuiltinFunctions::insertBuiltins (Nuria::LuaRuntime *runtime, int
 	
 	lua_getref (env, tableRef);
 	addNuriaConnectFunction (runtime);
+	addNuriaJsonTable (runtime);
+	addNuriaPackFunctions (runtime);
+	addNuriaChannelFunction (runtime);
 	lua_pop (env, 1);
 }
 
@@ -56,6 +64,29 @@ void Nuria::LuaBuiltinFunctions::addNuriaConnectFunction (Nuria::LuaRuntime *run
 	insertFunction ("connect", &LuaBuiltinFunctions::implNuriaConnect, runtime);
 }
 
+void Nuria::LuaBuiltinFunctions::addNuriaJsonTable (Nuria::LuaRuntime *runtime) {
+	lua_State *env = (lua_State *)runtime->luaState ();
+	
+	lua_createtable (env, 0, 3);
+	insertFunction ("decode", &LuaBuiltinFunctions::implJsonDecode, runtime);
+	insertFunction ("encode", &LuaBuiltinFunctions::implJsonEncode, runtime);
+	
+	// Sentinel for JSON null
+	lua_pushlightuserdata (env, nullptr);
+	lua_setfield (env, -2, "null");
+	
+	lua_setfield (env, -2, "json");
+}
+
+void Nuria::LuaBuiltinFunctions::addNuriaPackFunctions (Nuria::LuaRuntime *runtime) {
+	insertFunction ("pack", &LuaBuiltinFunctions::implPack, runtime);
+	insertFunction ("unpack", &LuaBuiltinFunctions::implUnpack, runtime);
+}
+
+void Nuria::LuaBuiltinFunctions::addNuriaChannelFunction (Nuria::LuaRuntime *runtime) {
+	insertFunction ("channel", &LuaBuiltinFunctions::implChannel, runtime);
+}
+
 void Nuria::LuaBuiltinFunctions::insertFunction (const char *name, lua_CFunction func, Nuria::LuaRuntime *runtime) {
 	lua_State *env = (lua_State *)runtime->luaState ();
 	
@@ -71,3 +102,100 @@ void Nuria::LuaBuiltinFunctions::insertFunction (const char *name, lua_CFunction
 int Nuria::LuaBuiltinFunctions::implNuriaConnect (lua_State *env) {
 	return luaL_error (env, "Nuria.connect() isn't implemented yet.");
 }
+
+int Nuria::LuaBuiltinFunctions::implJsonDecode (lua_State *env) {
+	QByteArray data;
+	const char *input = nullptr;
+	size_t length = 0;
+	
+	// Strings are parsed in place, they stay alive at index 1 meanwhile
+	if (lua_type (env, 1) == LUA_TSTRING) {
+		input = lua_tolstring (env, 1, &length);
+	} else if (LuaByteArray::read (env, 1, data)) {
+		input = data.constData ();
+		length = size_t (data.length ());
+	} else {
+		return luaL_argerror (env, 1, "string expected");
+	}
+	
+	LuaJsonDecoder decoder (env, input, int (length));
+	if (!decoder.decode ()) {
+		lua_pushnil (env);
+		lua_pushstring (env, decoder.errorString ().toUtf8 ().constData ());
+		return 2;
+	}
+	
+	return 1;
+}
+
+int Nuria::LuaBuiltinFunctions::implJsonEncode (lua_State *env) {
+	luaL_checkany (env, 1);
+	lua_settop (env, 1);
+	
+	LuaJsonEncoder encoder (env);
+	if (!encoder.encode (1)) {
+		lua_pushnil (env);
+		lua_pushstring (env, encoder.errorString ().toUtf8 ().constData ());
+		return 2;
+	}
+	
+	QByteArray result = encoder.result ();
+	lua_pushlstring (env, result.constData (), result.length ());
+	return 1;
+}
+
+int Nuria::LuaBuiltinFunctions::implPack (lua_State *env) {
+	LuaRuntime *runtime = (LuaRuntime *)lua_touserdata (env, lua_upvalueindex(1));
+	luaL_checkany (env, 1);
+	bool packStructures = lua_toboolean (env, 2);
+	lua_settop (env, 1);
+	
+	LuaMsgPackEncoder encoder (runtime, env, packStructures);
+	if (!encoder.encode (1)) {
+		lua_pushnil (env);
+		lua_pushstring (env, encoder.errorString ().toUtf8 ().constData ());
+		return 2;
+	}
+	
+	QByteArray result = encoder.result ();
+	lua_pushlstring (env, result.constData (), result.length ());
+	return 1;
+}
+
+int Nuria::LuaBuiltinFunctions::implUnpack (lua_State *env) {
+	QByteArray data;
+	if (!LuaByteArray::read (env, 1, data)) {
+		return luaL_argerror (env, 1, "string expected");
+	}
+	
+	int position = luaL_optint (env, 2, 1);
+	luaL_argcheck (env, position >= 1 && position <= data.length (), 2, "position out of range");
+	
+	LuaMsgPackDecoder decoder (env, data.constData (), data.length (), position - 1);
+	if (!decoder.decode ()) {
+		lua_pushnil (env);
+		lua_pushstring (env, decoder.errorString ().toUtf8 ().constData ());
+		return 2;
+	}
+	
+	lua_pushinteger (env, decoder.offset () + 1);
+	return 2;
+}
+
+int Nuria::LuaBuiltinFunctions::implChannel (lua_State *env) {
+	LuaRuntime *runtime = (LuaRuntime *)lua_touserdata (env, lua_upvalueindex(1));
+	LuaChannel channel;
+	
+	// Nuria.channel ([name,] [capacity])
+	if (lua_type (env, 1) == LUA_TSTRING) {
+		size_t length = 0;
+		const char *name = lua_tolstring (env, 1, &length);
+		channel = LuaChannel::named (QString::fromUtf8 (name, int (length)), luaL_optint (env, 2, 1024));
+	} else {
+		channel = LuaChannel (luaL_optint (env, 1, 1024));
+	}
+	
+	// 'env' may be a coroutine, push onto its stack
+	LuaStackUtils::pushLuaChannelOnStack (runtime, env, channel);
+	return 1;
+}
@@ -33,11 +33,19 @@ public:
 	static void insertBuiltins (LuaRuntime *runtime, int tableRef);
 	static void insertNuriaTableIntoEnvironment (LuaRuntime *runtime, int tableRef);
 	static void addNuriaConnectFunction (LuaRuntime *runtime);
+	static void addNuriaJsonTable (LuaRuntime *runtime);
+	static void addNuriaPackFunctions (LuaRuntime *runtime);
+	static void addNuriaChannelFunction (LuaRuntime *runtime);
 	static void insertFunction (const char *name, lua_CFunction func, LuaRuntime *runtime);
 	
 private:
 	
 	static int implNuriaConnect (lua_State *env);
+	static int implJsonDecode (lua_State *env);
+	static int implJsonEncode (lua_State *env);
+	static int implPack (lua_State *env);
+	static int implUnpack (lua_State *env);
+	static int implChannel (lua_State *env);
 	
 };
 
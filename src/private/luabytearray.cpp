@@ -0,0 +1,227 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "luabytearray.hpp"
+
+#include <cstring>
+#include <new>
+
+static const char *bytesMetaTableName = "_Nuria_ByteArray";
+
+static Nuria::LuaByteArray *bytesAt (lua_State *env, int idx) {
+	return static_cast< Nuria::LuaByteArray * > (luaL_checkudata (env, idx, bytesMetaTableName));
+}
+
+// Turns the Lua index at 'idx' into a 1-based position like string.sub()
+static int position (lua_State *env, int idx, int length, int defaultValue) {
+	int pos = luaL_optint (env, idx, defaultValue);
+	return (pos < 0) ? length + pos + 1 : pos;
+}
+
+// Clamps the 1-based range [start, end] to 'length' bytes, storing it as
+// zero-based offset and byte count. Returns false if it's empty.
+static bool clampRange (int start, int end, int length, int &offset, int &count) {
+	start = qMax (start, 1);
+	end = qMin (end, length);
+	
+	offset = start - 1;
+	count = qMax (end - offset, 0);
+	return (count > 0);
+}
+
+// Reads the range [i, j] at 'idx' and 'idx + 1', see clampRange().
+static bool range (lua_State *env, Nuria::LuaByteArray *bytes, int idx, int &offset, int &count) {
+	int start = position (env, idx, bytes->length, 1);
+	int end = position (env, idx + 1, bytes->length, -1);
+	return clampRange (start, end, bytes->length, offset, count);
+}
+
+static int bytesLength (lua_State *env) {
+	lua_pushinteger (env, bytesAt (env, 1)->length);
+	return 1;
+}
+
+static int bytesByte (lua_State *env) {
+	Nuria::LuaByteArray *bytes = bytesAt (env, 1);
+	int i = position (env, 2, bytes->length, 1);
+	int j = position (env, 3, bytes->length, i);
+	
+	int offset, length;
+	if (!clampRange (i, j, bytes->length, offset, length)) {
+		return 0;
+	}
+	
+	luaL_checkstack (env, length, "Too many results");
+	const uchar *data = reinterpret_cast< const uchar * > (bytes->constData ());
+	for (int k = 0; k < length; k++) {
+		lua_pushinteger (env, data[offset + k]);
+	}
+	
+	return length;
+}
+
+static int bytesSub (lua_State *env) {
+	Nuria::LuaByteArray *bytes = bytesAt (env, 1);
+	
+	int offset, length;
+	range (env, bytes, 2, offset, length);
+	
+	Nuria::LuaByteArray::push (env, bytes->data, bytes->offset + offset, length);
+	return 1;
+}
+
+static int bytesFind (lua_State *env) {
+	Nuria::LuaByteArray *bytes = bytesAt (env, 1);
+	QByteArray needle;
+	if (!Nuria::LuaByteArray::read (env, 2, needle)) {
+		return luaL_argerror (env, 2, "string or byte array expected");
+	}
+	
+	int init = qMax (position (env, 3, bytes->length, 1), 1);
+	if (init > bytes->length + 1) {
+		lua_pushnil (env);
+		return 1;
+	}
+	
+	QByteArray haystack = QByteArray::fromRawData (bytes->constData (), bytes->length);
+	int found = haystack.indexOf (needle, init - 1);
+	if (found < 0) {
+		lua_pushnil (env);
+		return 1;
+	}
+	
+	lua_pushinteger (env, found + 1);
+	lua_pushinteger (env, found + needle.length ());
+	return 2;
+}
+
+static int bytesString (lua_State *env) {
+	Nuria::LuaByteArray *bytes = bytesAt (env, 1);
+	
+	int offset, length;
+	range (env, bytes, 2, offset, length);
+	
+	lua_pushlstring (env, bytes->constData () + offset, length);
+	return 1;
+}
+
+static int bytesConcat (lua_State *env) {
+	QByteArray left, right;
+	if (!Nuria::LuaByteArray::read (env, 1, left) || !Nuria::LuaByteArray::read (env, 2, right)) {
+		return luaL_error (env, "Attempt to concatenate a byte array with a non-string value");
+	}
+	
+	left.append (right);
+	lua_pushlstring (env, left.constData (), left.length ());
+	return 1;
+}
+
+static int bytesEquals (lua_State *env) {
+	Nuria::LuaByteArray *left = bytesAt (env, 1);
+	Nuria::LuaByteArray *right = bytesAt (env, 2);
+	
+	bool equal = (left->length == right->length &&
+	              ::memcmp (left->constData (), right->constData (), left->length) == 0);
+	lua_pushboolean (env, equal);
+	return 1;
+}
+
+static int bytesDestroy (lua_State *env) {
+	Nuria::LuaByteArray *bytes = static_cast< Nuria::LuaByteArray * > (lua_touserdata (env, 1));
+	bytes->~LuaByteArray ();
+	return 0;
+}
+
+static void createMetaTable (lua_State *env) {
+	static const luaL_Reg methods[] = {
+		{ "len", &bytesLength },
+		{ "byte", &bytesByte },
+		{ "sub", &bytesSub },
+		{ "find", &bytesFind },
+		{ "string", &bytesString },
+		{ nullptr, nullptr }
+	};
+	
+	lua_newtable (env);
+	luaL_register (env, nullptr, methods);
+	lua_setfield (env, -2, "__index");
+	
+	lua_pushcfunction (env, &bytesLength);
+	lua_setfield (env, -2, "__len");
+	lua_pushcfunction (env, &bytesString);
+	lua_setfield (env, -2, "__tostring");
+	lua_pushcfunction (env, &bytesConcat);
+	lua_setfield (env, -2, "__concat");
+	lua_pushcfunction (env, &bytesEquals);
+	lua_setfield (env, -2, "__eq");
+	lua_pushcfunction (env, &bytesDestroy);
+	lua_setfield (env, -2, "__gc");
+}
+
+void Nuria::LuaByteArray::push (lua_State *env, const QByteArray &data, int offset, int length) {
+	if (length < 0) {
+		length = data.length () - offset;
+	}
+	
+	void *ptr = lua_newuserdata (env, sizeof(LuaByteArray));
+	new (ptr) LuaByteArray { data, offset, length };
+	
+	// Set up the meta table on first use
+	if (luaL_newmetatable (env, bytesMetaTableName)) {
+		createMetaTable (env);
+	}
+	
+	lua_setmetatable (env, -2);
+}
+
+Nuria::LuaByteArray *Nuria::LuaByteArray::at (lua_State *env, int idx) {
+	if (lua_type (env, idx) != LUA_TUSERDATA || !lua_getmetatable (env, idx)) {
+		return nullptr;
+	}
+	
+	// Compare the meta table with ours
+	luaL_getmetatable (env, bytesMetaTableName);
+	bool isBytes = lua_rawequal (env, -1, -2);
+	lua_pop (env, 2);
+	
+	return (isBytes) ? static_cast< LuaByteArray * > (lua_touserdata (env, idx)) : nullptr;
+}
+
+bool Nuria::LuaByteArray::read (lua_State *env, int idx, QByteArray &result) {
+	int type = lua_type (env, idx);
+	if (type == LUA_TSTRING || type == LUA_TNUMBER) {
+		size_t len = 0;
+		const char *str = lua_tolstring (env, idx, &len);
+		result = QByteArray (str, len);
+		return true;
+	}
+	
+	LuaByteArray *bytes = at (env, idx);
+	if (bytes) {
+		result = bytes->bytes ();
+		return true;
+	}
+	
+	return false;
+}
+
+QByteArray Nuria::LuaByteArray::bytes () const {
+	if (this->offset == 0 && this->length == this->data.length ()) {
+		return this->data;
+	}
+	
+	return QByteArray (constData (), this->length);
+}
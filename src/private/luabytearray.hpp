@@ -0,0 +1,66 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NURIA_LUABYTEARRAY_HPP
+#define NURIA_LUABYTEARRAY_HPP
+
+#include <QByteArray>
+#include <lua.hpp>
+
+namespace Nuria {
+
+/*
+ * Byte buffer user data. Large QByteArrays are passed to Lua as this instead
+ * of a Lua string, sharing the data through implicit sharing. Sub-views
+ * share the same QByteArray.
+ * 
+ * In Lua, the buffer offers len(), byte(i [, j]), sub(i [, j]),
+ * find(needle [, init]) and string([i [, j]]) with the semantics of the
+ * matching functions of the string library. tostring() and the # and ..
+ * operators work as expected.
+ */
+class Q_DECL_HIDDEN LuaByteArray {
+public:
+	
+	/** Pushes a view on \a length bytes of \a data starting at \a offset. */
+	static void push (lua_State *env, const QByteArray &data, int offset = 0, int length = -1);
+	
+	/** Returns the buffer at \a idx, or \c nullptr if it's not one. */
+	static LuaByteArray *at (lua_State *env, int idx);
+	
+	/**
+	 * Returns the bytes of the string or buffer at \a idx in \a result.
+	 * Returns \c false if \a idx is neither.
+	 */
+	static bool read (lua_State *env, int idx, QByteArray &result);
+	
+	/** Returns the viewed bytes. Doesn't copy if the view is complete. */
+	QByteArray bytes () const;
+	
+	/** Returns a pointer to the first viewed byte. */
+	const char *constData () const
+	{ return this->data.constData () + this->offset; }
+	
+	// 
+	QByteArray data;
+	int offset;
+	int length;
+	
+};
+
+}
+
+#endif // NURIA_LUABYTEARRAY_HPP
@@ -16,6 +16,7 @@
 
 #include "luacallbacktrampoline.hpp"
 
+#include "luaruntimeprivate.hpp"
 #include "luastackutils.hpp"
 #include "../nuria/luaruntime.hpp"
 #include "../nuria/luavalue.hpp"
@@ -75,13 +76,7 @@ public:
 	
 	// TODO: Isn't this logic somewhere else already used? Can it be merged?
 	static QVariant objectToVariant (LuaObject object, int targetType) {
-		const char *name = QMetaType::typeName (targetType);
-		if (name && name[qstrlen (name) - 1] == '*') {
-			return object.toVariant ();
-		}
-		
-		return object.copy ();
-		
+		return LuaCallbackTrampoline::objectToVariant (object, targetType);
 	}
 	
 	static QVariantList valuesToList (const LuaValues &values, const QList< int > &types) {
@@ -177,13 +172,26 @@ int Nuria::LuaCallbackTrampoline::destroyCallbackUserData (lua_State *env) {
 }
 
 QVariant Nuria::LuaCallbackTrampoline::objectToVariant (const LuaObject &object, int targetType) {
-	const char *name = QMetaType::typeName (targetType);
-	if (name && name[qstrlen (name) - 1] == '*') {
-		return object.toVariant ();
+	LuaRuntime *runtime = object.runtime ();
+	if (!runtime) {
+		return QVariant ();
 	}
 	
-	return object.copy ();
+	// 
+	LuaTypeConverter target = runtime->d_ptr->converter (targetType);
+	if (!target.isPointer) {
+		return object.copy ();
+	}
+	
+	// Pass derived structures as pointer to the expected base class. Only
+	// valid for the primary base class, as no pointer adjustment is done.
+	void *ptr = object.object ();
+	MetaObject *meta = object.metaObject ();
+	if (ptr && target.meta && meta != target.meta && runtime->d_ptr->inherits (meta, target.meta)) {
+		return QVariant (targetType, &ptr);
+	}
 	
+	return object.toVariant ();
 }
 
 QVariantList Nuria::LuaCallbackTrampoline::valuesToList (const Nuria::LuaValues &values, const QList< int > &types) {
@@ -0,0 +1,63 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "luainvokequeue.hpp"
+
+Nuria::LuaInvokeQueue::LuaInvokeQueue ()
+	: tail (new Node)
+{
+	
+	// The queue always contains the already consumed 'tail' node
+	this->head.store (this->tail);
+	
+}
+
+Nuria::LuaInvokeQueue::~LuaInvokeQueue () {
+	Closure closure;
+	while (take (closure));
+	delete this->tail;
+}
+
+bool Nuria::LuaInvokeQueue::push (Closure closure) {
+	Node *node = new Node;
+	node->closure = std::move (closure);
+	
+	// Link the node. Until 'next' of the previous node is set, the consumer
+	// sees the queue as empty, but then the wake-up below is still pending.
+	Node *previous = this->head.fetchAndStoreOrdered (node);
+	previous->next.storeRelease (node);
+	
+	return this->scheduled.testAndSetOrdered (0, 1);
+}
+
+void Nuria::LuaInvokeQueue::beginDrain () {
+	this->scheduled.fetchAndStoreOrdered (0);
+}
+
+bool Nuria::LuaInvokeQueue::take (Closure &closure) {
+	Node *next = this->tail->next.loadAcquire ();
+	if (!next) {
+		return false;
+	}
+	
+	// 'next' becomes the consumed node
+	closure = std::move (next->closure);
+	next->closure = Closure ();
+	
+	delete this->tail;
+	this->tail = next;
+	return true;
+}
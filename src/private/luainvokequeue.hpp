@@ -0,0 +1,67 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NURIA_LUAINVOKEQUEUE_HPP
+#define NURIA_LUAINVOKEQUEUE_HPP
+
+#include <QAtomicPointer>
+#include <QAtomicInt>
+#include <functional>
+
+namespace Nuria {
+
+/*
+ * Unbounded lock-free multi-producer single-consumer queue of closures after
+ * Dmitry Vyukov. Producers only swap the head pointer, the consumer owns the
+ * tail. Used to marshal calls to the thread of a LuaRuntime.
+ */
+class Q_DECL_HIDDEN LuaInvokeQueue {
+public:
+	typedef std::function< void() > Closure;
+	
+	LuaInvokeQueue ();
+	~LuaInvokeQueue ();
+	
+	/**
+	 * Appends \a closure. Returns \c true if the consumer has to be woken
+	 * up, which is the case for the first closure after beginDrain().
+	 */
+	bool push (Closure closure);
+	
+	/**
+	 * Marks the queue as drained. Call this before taking closures, so
+	 * closures pushed in the meantime trigger another wake-up.
+	 */
+	void beginDrain ();
+	
+	/** Takes the oldest closure. Returns \c false if there's none. */
+	bool take (Closure &closure);
+	
+private:
+	struct Node {
+		QAtomicPointer< Node > next;
+		Closure closure;
+	};
+	
+	QAtomicPointer< Node > head; // Last pushed node, written by producers
+	Node *tail; // Consumed node, only used by the consumer
+	QAtomicInt scheduled;
+	
+};
+
+}
+
+#endif // NURIA_LUAINVOKEQUEUE_HPP
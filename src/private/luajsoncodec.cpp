@@ -0,0 +1,774 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "luajsoncodec.hpp"
+
+#include <QIODevice>
+#include <cstring>
+#include <QChar>
+#include <cmath>
+
+#include "luastackutils.hpp"
+#include "luabytearray.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Maximum nesting of arrays and objects
+static const int maxDepth = 200;
+
+// Count of values (Or pairs) kept on the stack before they're moved into
+// the table. Containers with less elements get an exact size hint.
+static const int batchSize = 64;
+
+// The encoder writes to the device in chunks of this size
+static const int chunkSize = 64 * 1024;
+
+static inline bool isSpace (char c) {
+	return (c == ' ' || c == '\n' || c == '\r' || c == '\t');
+}
+
+static inline bool isDigit (char c) {
+	return (c >= '0' && c <= '9');
+}
+
+static inline bool isSpecial (char c) {
+	return (c == '"' || c == '\\' || uchar (c) < 0x20);
+}
+
+#ifdef __SSE2__
+static inline int firstSetBit (uint mask) {
+#ifdef __GNUC__
+	return __builtin_ctz (mask);
+#else
+	int bit = 0;
+	for (; !(mask & 1); mask >>= 1, bit++);
+	return bit;
+#endif
+}
+#endif
+
+// Returns the first quote, backslash or control character in [pos, end),
+// or 'end'.
+static const char *findSpecial (const char *pos, const char *end) {
+#ifdef __SSE2__
+	const __m128i quote = _mm_set1_epi8 ('"');
+	const __m128i backslash = _mm_set1_epi8 ('\\');
+	const __m128i control = _mm_set1_epi8 (0x1f);
+	
+	for (; end - pos >= 16; pos += 16) {
+		__m128i chunk = _mm_loadu_si128 (reinterpret_cast< const __m128i * > (pos));
+		__m128i special = _mm_or_si128 (_mm_cmpeq_epi8 (chunk, quote), _mm_cmpeq_epi8 (chunk, backslash));
+		special = _mm_or_si128 (special, _mm_cmpeq_epi8 (_mm_max_epu8 (chunk, control), control));
+		
+		int mask = _mm_movemask_epi8 (special);
+		if (mask) {
+			return pos + firstSetBit (mask);
+		}
+		
+	}
+#endif
+	
+	for (; pos < end && !isSpecial (*pos); pos++);
+	return pos;
+}
+
+static void appendUtf8 (QByteArray &out, uint code) {
+	if (code < 0x80) {
+		out.append (char (code));
+	} else if (code < 0x800) {
+		out.append (char (0xc0 | (code >> 6)));
+		out.append (char (0x80 | (code & 0x3f)));
+	} else if (code < 0x10000) {
+		out.append (char (0xe0 | (code >> 12)));
+		out.append (char (0x80 | ((code >> 6) & 0x3f)));
+		out.append (char (0x80 | (code & 0x3f)));
+	} else {
+		out.append (char (0xf0 | (code >> 18)));
+		out.append (char (0x80 | ((code >> 12) & 0x3f)));
+		out.append (char (0x80 | ((code >> 6) & 0x3f)));
+		out.append (char (0x80 | (code & 0x3f)));
+	}
+	
+}
+
+static int hexValue (char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+// Reads four hex digits at 'pos'. Returns -1 if they're invalid.
+static int readHex4 (const char *pos, const char *end) {
+	if (end - pos < 4) {
+		return -1;
+	}
+	
+	int value = 0;
+	for (int i = 0; i < 4; i++) {
+		int digit = hexValue (pos[i]);
+		if (digit < 0) {
+			return -1;
+		}
+		
+		value = (value << 4) | digit;
+	}
+	
+	return value;
+}
+
+Nuria::LuaJsonDecoder::LuaJsonDecoder (lua_State *env, const char *data, int length)
+	: env (env), begin (data), pos (data), end (data + length)
+{
+	
+	this->scratch.reserve (256);
+	
+}
+
+bool Nuria::LuaJsonDecoder::decode () {
+	int top = lua_gettop (this->env);
+	
+	if (!parseValue (0)) {
+		lua_settop (this->env, top);
+		return false;
+	}
+	
+	// Only whitespace may follow
+	skipWhitespace ();
+	if (this->pos != this->end) {
+		lua_settop (this->env, top);
+		return fail ("Unexpected data after the document");
+	}
+	
+	return true;
+}
+
+bool Nuria::LuaJsonDecoder::parseValue (int depth) {
+	skipWhitespace ();
+	if (this->pos >= this->end) {
+		return fail ("Unexpected end of document");
+	}
+	
+	switch (*this->pos) {
+	case '{': return parseObject (depth + 1);
+	case '[': return parseArray (depth + 1);
+	case '"': return parseString ();
+	case 't':
+		if (!parseLiteral ("true", 4)) return false;
+		lua_pushboolean (this->env, true);
+		return true;
+	case 'f':
+		if (!parseLiteral ("false", 5)) return false;
+		lua_pushboolean (this->env, false);
+		return true;
+	case 'n':
+		if (!parseLiteral ("null", 4)) return false;
+		lua_pushlightuserdata (this->env, nullptr);
+		return true;
+	}
+	
+	if (*this->pos == '-' || isDigit (*this->pos)) {
+		return parseNumber ();
+	}
+	
+	return fail ("Unexpected character");
+}
+
+bool Nuria::LuaJsonDecoder::parseArray (int depth) {
+	if (depth > maxDepth) {
+		return fail ("Document is nested too deeply");
+	}
+	
+	this->pos++; // '['
+	int table = lua_gettop (this->env) + 1;
+	bool created = false;
+	int count = 0;
+	int pending = 0;
+	
+	skipWhitespace ();
+	if (this->pos < this->end && *this->pos == ']') {
+		this->pos++;
+		lua_createtable (this->env, 0, 0);
+		return true;
+	}
+	
+	while (true) {
+		if (!lua_checkstack (this->env, 2)) {
+			return fail ("Document is nested too deeply");
+		}
+		
+		if (!parseValue (depth)) {
+			return false;
+		}
+		
+		if (++pending == batchSize) {
+			flushArray (table, created, count, pending);
+		}
+		
+		skipWhitespace ();
+		if (this->pos >= this->end) {
+			return fail ("Unterminated array");
+		}
+		
+		char c = *this->pos++;
+		if (c == ']') {
+			break;
+		} else if (c != ',') {
+			this->pos--;
+			return fail ("Expected ',' or ']'");
+		}
+		
+	}
+	
+	flushArray (table, created, count, pending);
+	return true;
+}
+
+void Nuria::LuaJsonDecoder::flushArray (int table, bool &created, int &count, int &pending) {
+	if (!created) {
+		lua_createtable (this->env, pending, 0);
+		lua_insert (this->env, table);
+		created = true;
+	}
+	
+	// The values are on the stack above the table, the last one on top
+	for (int i = pending; i > 0; i--) {
+		lua_rawseti (this->env, table, count + i);
+	}
+	
+	count += pending;
+	pending = 0;
+}
+
+bool Nuria::LuaJsonDecoder::parseObject (int depth) {
+	if (depth > maxDepth) {
+		return fail ("Document is nested too deeply");
+	}
+	
+	this->pos++; // '{'
+	int table = lua_gettop (this->env) + 1;
+	bool created = false;
+	int pending = 0;
+	
+	skipWhitespace ();
+	if (this->pos < this->end && *this->pos == '}') {
+		this->pos++;
+		lua_createtable (this->env, 0, 0);
+		return true;
+	}
+	
+	while (true) {
+		if (!lua_checkstack (this->env, 4)) {
+			return fail ("Document is nested too deeply");
+		}
+		
+		// Key
+		skipWhitespace ();
+		if (this->pos >= this->end || *this->pos != '"') {
+			return fail ("Expected a string as key");
+		}
+		
+		if (!parseString ()) {
+			return false;
+		}
+		
+		skipWhitespace ();
+		if (this->pos >= this->end || *this->pos != ':') {
+			return fail ("Expected ':'");
+		}
+		
+		// Value
+		this->pos++;
+		if (!parseValue (depth)) {
+			return false;
+		}
+		
+		if (++pending == batchSize) {
+			flushObject (table, created, pending);
+		}
+		
+		skipWhitespace ();
+		if (this->pos >= this->end) {
+			return fail ("Unterminated object");
+		}
+		
+		char c = *this->pos++;
+		if (c == '}') {
+			break;
+		} else if (c != ',') {
+			this->pos--;
+			return fail ("Expected ',' or '}'");
+		}
+		
+	}
+	
+	flushObject (table, created, pending);
+	return true;
+}
+
+void Nuria::LuaJsonDecoder::flushObject (int table, bool &created, int &pending) {
+	if (!created) {
+		lua_createtable (this->env, 0, pending);
+		lua_insert (this->env, table);
+		created = true;
+	}
+	
+	// Set the pairs in document order, so the last duplicate key wins
+	for (int i = 0; i < pending; i++) {
+		lua_pushvalue (this->env, table + 1 + i * 2);
+		lua_pushvalue (this->env, table + 2 + i * 2);
+		lua_rawset (this->env, table);
+	}
+	
+	lua_settop (this->env, table);
+	pending = 0;
+}
+
+bool Nuria::LuaJsonDecoder::parseString () {
+	const char *start = ++this->pos; // Skip '"'
+	this->pos = findSpecial (this->pos, this->end);
+	
+	if (this->pos >= this->end) {
+		return fail ("Unterminated string");
+	}
+	
+	// Strings without escape sequences are pushed right away
+	if (*this->pos == '"') {
+		lua_pushlstring (this->env, start, this->pos - start);
+		this->pos++;
+		return true;
+	}
+	
+	// Decode escape sequences
+	this->scratch.resize (0);
+	this->scratch.append (start, int (this->pos - start));
+	
+	while (true) {
+		if (this->pos >= this->end) {
+			return fail ("Unterminated string");
+		}
+		
+		char c = *this->pos;
+		if (c == '"') {
+			this->pos++;
+			break;
+		} else if (c == '\\') {
+			if (!parseEscape ()) {
+				return false;
+			}
+			
+		} else if (uchar (c) < 0x20) {
+			return fail ("Control character in string");
+		} else {
+			const char *run = this->pos;
+			this->pos = findSpecial (this->pos, this->end);
+			this->scratch.append (run, int (this->pos - run));
+		}
+		
+	}
+	
+	lua_pushlstring (this->env, this->scratch.constData (), this->scratch.length ());
+	return true;
+}
+
+bool Nuria::LuaJsonDecoder::parseEscape () {
+	this->pos++; // '\'
+	if (this->pos >= this->end) {
+		return fail ("Unterminated string");
+	}
+	
+	switch (*this->pos++) {
+	case '"': this->scratch.append ('"'); return true;
+	case '\\': this->scratch.append ('\\'); return true;
+	case '/': this->scratch.append ('/'); return true;
+	case 'b': this->scratch.append ('\b'); return true;
+	case 'f': this->scratch.append ('\f'); return true;
+	case 'n': this->scratch.append ('\n'); return true;
+	case 'r': this->scratch.append ('\r'); return true;
+	case 't': this->scratch.append ('\t'); return true;
+	case 'u': break;
+	default:
+		this->pos--;
+		return fail ("Invalid escape sequence");
+	}
+	
+	int code = readHex4 (this->pos, this->end);
+	if (code < 0) {
+		return fail ("Invalid unicode escape sequence");
+	}
+	
+	this->pos += 4;
+	
+	// Combine surrogate pairs, replace lone surrogates
+	if (QChar::isHighSurrogate (uint (code)) && this->end - this->pos >= 6 &&
+	    this->pos[0] == '\\' && this->pos[1] == 'u') {
+		int low = readHex4 (this->pos + 2, this->end);
+		if (low >= 0 && QChar::isLowSurrogate (uint (low))) {
+			code = int (QChar::surrogateToUcs4 (ushort (code), ushort (low)));
+			this->pos += 6;
+		}
+		
+	}
+	
+	if (code <= 0xffff && QChar::isSurrogate (uint (code))) {
+		code = QChar::ReplacementCharacter;
+	}
+	
+	appendUtf8 (this->scratch, uint (code));
+	return true;
+}
+
+bool Nuria::LuaJsonDecoder::parseNumber () {
+	const char *start = this->pos;
+	bool negative = (*this->pos == '-');
+	if (negative) {
+		this->pos++;
+	}
+	
+	// Integer part
+	const char *digits = this->pos;
+	if (this->pos < this->end && *this->pos == '0') {
+		this->pos++;
+	} else if (this->pos < this->end && isDigit (*this->pos)) {
+		for (; this->pos < this->end && isDigit (*this->pos); this->pos++);
+	} else {
+		return fail ("Invalid number");
+	}
+	
+	int digitCount = int (this->pos - digits);
+	bool integral = true;
+	
+	// Fraction
+	if (this->pos < this->end && *this->pos == '.') {
+		integral = false;
+		if (++this->pos >= this->end || !isDigit (*this->pos)) {
+			return fail ("Invalid number");
+		}
+		
+		for (; this->pos < this->end && isDigit (*this->pos); this->pos++);
+	}
+	
+	// Exponent
+	if (this->pos < this->end && (*this->pos == 'e' || *this->pos == 'E')) {
+		integral = false;
+		if (++this->pos < this->end && (*this->pos == '+' || *this->pos == '-')) {
+			this->pos++;
+		}
+		
+		if (this->pos >= this->end || !isDigit (*this->pos)) {
+			return fail ("Invalid number");
+		}
+		
+		for (; this->pos < this->end && isDigit (*this->pos); this->pos++);
+	}
+	
+	// Integers which are exactly representable are parsed directly
+	if (integral && digitCount <= 15) {
+		qint64 value = 0;
+		for (const char *c = digits; c < this->pos; c++) {
+			value = value * 10 + (*c - '0');
+		}
+		
+		lua_pushnumber (this->env, lua_Number (negative ? -value : value));
+		return true;
+	}
+	
+	bool ok = false;
+	double value = QByteArray::fromRawData (start, int (this->pos - start)).toDouble (&ok);
+	if (!ok) {
+		return fail ("Invalid number");
+	}
+	
+	lua_pushnumber (this->env, value);
+	return true;
+}
+
+bool Nuria::LuaJsonDecoder::parseLiteral (const char *literal, int length) {
+	if (this->end - this->pos < length || ::memcmp (this->pos, literal, length) != 0) {
+		return fail ("Invalid literal");
+	}
+	
+	this->pos += length;
+	return true;
+}
+
+void Nuria::LuaJsonDecoder::skipWhitespace () {
+#ifdef __SSE2__
+	const __m128i space = _mm_set1_epi8 (' ');
+	const __m128i newline = _mm_set1_epi8 ('\n');
+	const __m128i carriageReturn = _mm_set1_epi8 ('\r');
+	const __m128i tab = _mm_set1_epi8 ('\t');
+	
+	// Skip long runs, like indentation, sixteen bytes at a time
+	while (this->end - this->pos >= 16 && isSpace (*this->pos)) {
+		__m128i chunk = _mm_loadu_si128 (reinterpret_cast< const __m128i * > (this->pos));
+		__m128i ws = _mm_or_si128 (_mm_cmpeq_epi8 (chunk, space), _mm_cmpeq_epi8 (chunk, newline));
+		ws = _mm_or_si128 (ws, _mm_or_si128 (_mm_cmpeq_epi8 (chunk, carriageReturn),
+		                                     _mm_cmpeq_epi8 (chunk, tab)));
+		
+		int mask = ~_mm_movemask_epi8 (ws) & 0xffff;
+		if (mask) {
+			this->pos += firstSetBit (mask);
+			return;
+		}
+		
+		this->pos += 16;
+	}
+#endif
+	
+	for (; this->pos < this->end && isSpace (*this->pos); this->pos++);
+}
+
+bool Nuria::LuaJsonDecoder::fail (const char *message) {
+	this->error = QStringLiteral("%1 at offset %2").arg (QLatin1String (message))
+	              .arg (this->pos - this->begin);
+	return false;
+}
+
+Nuria::LuaJsonEncoder::LuaJsonEncoder (lua_State *env, QIODevice *device)
+	: env (env), device (device)
+{
+	
+	this->buffer.reserve ((device) ? chunkSize + 256 : 256);
+	
+}
+
+bool Nuria::LuaJsonEncoder::encode (int idx) {
+	int top = lua_gettop (this->env);
+	if (idx < 0 && idx > LUA_REGISTRYINDEX) {
+		idx = top + idx + 1;
+	}
+	
+	bool success = encodeValue (idx, 0);
+	lua_settop (this->env, top);
+	
+	return (success && flush ());
+}
+
+bool Nuria::LuaJsonEncoder::encodeValue (int idx, int depth) {
+	int type = lua_type (this->env, idx);
+	
+	switch (type) {
+	case LUA_TNIL:
+		append ("null", 4);
+		return true;
+	case LUA_TBOOLEAN:
+		if (lua_toboolean (this->env, idx)) {
+			append ("true", 4);
+		} else {
+			append ("false", 5);
+		}
+		
+		return true;
+	case LUA_TNUMBER:
+		return encodeNumber (lua_tonumber (this->env, idx));
+	case LUA_TSTRING: {
+		size_t length = 0;
+		const char *str = lua_tolstring (this->env, idx, &length);
+		encodeString (str, length);
+		return true;
+	}
+	case LUA_TTABLE:
+		return encodeTable (idx, depth + 1);
+	case LUA_TLIGHTUSERDATA:
+		if (!lua_touserdata (this->env, idx)) {
+			append ("null", 4);
+			return true;
+		}
+		
+		break;
+	case LUA_TUSERDATA: {
+		LuaByteArray *bytes = LuaByteArray::at (this->env, idx);
+		if (bytes) {
+			encodeString (bytes->constData (), size_t (bytes->length));
+			return true;
+		}
+		
+	} break;
+	}
+	
+	return fail (QStringLiteral("Can't encode a value of type %1")
+	             .arg (QLatin1String (lua_typename (this->env, type))));
+}
+
+bool Nuria::LuaJsonEncoder::encodeTable (int idx, int depth) {
+	if (depth > maxDepth) {
+		return fail (QStringLiteral("Table is nested too deeply or contains a cycle"));
+	}
+	
+	if (!lua_checkstack (this->env, 3)) {
+		return fail (QStringLiteral("Out of stack space"));
+	}
+	
+	// Array
+	int length = 0;
+	if (LuaStackUtils::isSequence (this->env, idx, length)) {
+		append ('[');
+		for (int i = 1; i <= length; i++) {
+			if (i > 1) {
+				append (',');
+			}
+			
+			lua_rawgeti (this->env, idx, i);
+			if (!encodeValue (lua_gettop (this->env), depth)) {
+				return false;
+			}
+			
+			lua_pop (this->env, 1);
+		}
+		
+		append (']');
+		return true;
+	}
+	
+	// Object
+	bool first = true;
+	append ('{');
+	
+	lua_pushnil (this->env);
+	while (lua_next (this->env, idx) != 0) {
+		if (!first) {
+			append (',');
+		}
+		
+		// Don't use lua_tostring() on the key, it would confuse lua_next()
+		int keyType = lua_type (this->env, -2);
+		if (keyType == LUA_TSTRING) {
+			size_t keyLength = 0;
+			const char *key = lua_tolstring (this->env, -2, &keyLength);
+			encodeString (key, keyLength);
+		} else if (keyType == LUA_TNUMBER) {
+			append ('"');
+			encodeNumber (lua_tonumber (this->env, -2));
+			append ('"');
+		} else {
+			return fail (QStringLiteral("Can't encode a key of type %1")
+			             .arg (QLatin1String (lua_typename (this->env, keyType))));
+		}
+		
+		append (':');
+		if (!encodeValue (lua_gettop (this->env), depth)) {
+			return false;
+		}
+		
+		lua_pop (this->env, 1);
+		first = false;
+	}
+	
+	append ('}');
+	return true;
+}
+
+bool Nuria::LuaJsonEncoder::encodeNumber (lua_Number value) {
+	if (!std::isfinite (value)) {
+		return fail (QStringLiteral("Can't encode NaN or infinity"));
+	}
+	
+	// Write integers directly
+	if (value == std::floor (value) && std::fabs (value) < 9007199254740992.0) {
+		char digits[24];
+		char *cur = digits + sizeof(digits);
+		qint64 integer = qint64 (value);
+		quint64 magnitude = quint64 ((integer < 0) ? -integer : integer);
+		
+		do {
+			*--cur = char ('0' + magnitude % 10);
+			magnitude /= 10;
+		} while (magnitude);
+		
+		if (integer < 0) {
+			*--cur = '-';
+		}
+		
+		append (cur, int (digits + sizeof(digits) - cur));
+		return true;
+	}
+	
+	QByteArray number = QByteArray::number (value, 'g', 17);
+	append (number.constData (), number.length ());
+	return true;
+}
+
+void Nuria::LuaJsonEncoder::encodeString (const char *str, size_t length) {
+	static const char hex[] = "0123456789abcdef";
+	const char *end = str + length;
+	
+	append ('"');
+	while (str < end) {
+		
+		// Copy runs of characters which don't need escaping in one go
+		const char *run = str;
+		str = findSpecial (str, end);
+		append (run, int (str - run));
+		
+		if (str >= end) {
+			break;
+		}
+		
+		char c = *str++;
+		switch (c) {
+		case '"': append ("\\\"", 2); break;
+		case '\\': append ("\\\\", 2); break;
+		case '\n': append ("\\n", 2); break;
+		case '\r': append ("\\r", 2); break;
+		case '\t': append ("\\t", 2); break;
+		case '\b': append ("\\b", 2); break;
+		case '\f': append ("\\f", 2); break;
+		default: {
+			char escaped[] = { '\\', 'u', '0', '0', hex[(c >> 4) & 0xf], hex[c & 0xf] };
+			append (escaped, 6);
+		}
+		}
+		
+	}
+	
+	append ('"');
+}
+
+void Nuria::LuaJsonEncoder::append (const char *data, int length) {
+	this->buffer.append (data, length);
+	if (this->device && this->buffer.length () >= chunkSize) {
+		flush ();
+	}
+	
+}
+
+void Nuria::LuaJsonEncoder::append (char c) {
+	this->buffer.append (c);
+}
+
+bool Nuria::LuaJsonEncoder::flush () {
+	if (!this->device || this->buffer.isEmpty ()) {
+		return this->error.isEmpty ();
+	}
+	
+	if (this->device->write (this->buffer) != this->buffer.length ()) {
+		return fail (QStringLiteral("Failed to write: %1").arg (this->device->errorString ()));
+	}
+	
+	this->buffer.resize (0);
+	return this->error.isEmpty ();
+}
+
+bool Nuria::LuaJsonEncoder::fail (const QString &message) {
+	if (this->error.isEmpty ()) {
+		this->error = message;
+	}
+	
+	return false;
+}
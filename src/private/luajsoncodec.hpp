@@ -0,0 +1,110 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NURIA_LUAJSONCODEC_HPP
+#define NURIA_LUAJSONCODEC_HPP
+
+#include <QByteArray>
+#include <QString>
+#include <lua.hpp>
+
+class QIODevice;
+
+namespace Nuria {
+
+/*
+ * Parses JSON straight into Lua values. JSON null is represented by a light
+ * user data pointing to NULL, so it can be stored in tables.
+ */
+class Q_DECL_HIDDEN LuaJsonDecoder {
+public:
+	
+	LuaJsonDecoder (lua_State *env, const char *data, int length);
+	
+	/**
+	 * Parses the document and pushes the result. On failure, nothing is
+	 * pushed and \c false is returned.
+	 */
+	bool decode ();
+	
+	QString errorString () const
+	{ return this->error; }
+	
+private:
+	bool parseValue (int depth);
+	bool parseArray (int depth);
+	bool parseObject (int depth);
+	bool parseString ();
+	bool parseEscape ();
+	bool parseNumber ();
+	bool parseLiteral (const char *literal, int length);
+	void skipWhitespace ();
+	void flushArray (int table, bool &created, int &count, int &pending);
+	void flushObject (int table, bool &created, int &pending);
+	bool fail (const char *message);
+	
+	// 
+	lua_State *env;
+	const char *begin;
+	const char *pos;
+	const char *end;
+	QByteArray scratch;
+	QString error;
+	
+};
+
+/*
+ * Serializes Lua values into JSON. Tables with only sequential integer keys
+ * are written as arrays, all other tables as objects. Output is collected in
+ * a buffer, which is written to the device whenever it grows large if one
+ * was given.
+ */
+class Q_DECL_HIDDEN LuaJsonEncoder {
+public:
+	
+	LuaJsonEncoder (lua_State *env, QIODevice *device = nullptr);
+	
+	/** Encodes the value at \a idx. Returns \c false on failure. */
+	bool encode (int idx);
+	
+	/** Returns the output not yet written to the device. */
+	QByteArray result () const
+	{ return this->buffer; }
+	
+	QString errorString () const
+	{ return this->error; }
+	
+private:
+	bool encodeValue (int idx, int depth);
+	bool encodeTable (int idx, int depth);
+	bool encodeNumber (lua_Number value);
+	void encodeString (const char *str, size_t length);
+	void append (const char *data, int length);
+	void append (char c);
+	bool flush ();
+	bool fail (const QString &message);
+	
+	// 
+	lua_State *env;
+	QIODevice *device;
+	QByteArray buffer;
+	QString error;
+	
+};
+
+}
+
+#endif // NURIA_LUAJSONCODEC_HPP
@@ -36,6 +36,9 @@ public:
 	
 	// Reference to the metatable
 	int metaRef = 0;
+	
+	// Reference to the table of natively bound members
+	int nativesRef = 0;
 	bool registered = false;
 	
 };
@@ -70,32 +73,74 @@ namespace Internal {
 class Delegate {
 public:
 	
+	// Pushes the natively bound member called like the key at 2. The
+	// table of native members is the first upvalue.
+	static int pushNativeMember (lua_State *env) {
+		lua_pushvalue (env, 2);
+		lua_rawget (env, lua_upvalueindex(1));
+		return lua_type (env, -1);
+	}
+	
 	// Delegate for __index (Read access)
 	static int delegateRead (lua_State *env) {
-		Nuria::LuaRuntime *runtime = (Nuria::LuaRuntime *)lua_touserdata (env, lua_upvalueindex(1));
-		void *inst = lua_touserdata (env, -2);
-		const char *field = luaL_checkstring (env, -1);
+		Nuria::LuaRuntime *runtime = (Nuria::LuaRuntime *)lua_touserdata (env, lua_upvalueindex(2));
+		LuaWrapperUserData *data = (LuaWrapperUserData *)lua_touserdata (env, 1);
+		runtime->d_ptr->refreshChildView (env, data);
 		
-		LuaMetaObjectWrapper::pushFieldOnStack (runtime, inst, field);
+		// Natively bound members take precedence over the MetaObject
+		int type = pushNativeMember (env);
+		if (type == LUA_TFUNCTION) {
+			return 1;
+		} else if (type == LUA_TUSERDATA && data->ptr) {
+			LuaNativeAccessor *accessor = (LuaNativeAccessor *)lua_touserdata (env, -1);
+			return accessor->getter (env, data->ptr, accessor + 1);
+		}
+		
+		// 
+		lua_pop (env, 1);
+		const char *field = luaL_checkstring (env, 2);
+		LuaMetaObjectWrapper::pushFieldOnStack (runtime, data, field);
 		return 1;
 	}
 	
 	// Delegate for __newindex (Write access)
 	static int delegateWrite (lua_State *env) {
-		Nuria::LuaRuntime *runtime = (Nuria::LuaRuntime *)lua_touserdata (env, lua_upvalueindex(1));
-		void *inst = lua_touserdata (env, -3);
-		const char *field = luaL_checkstring (env, -2);
-		// -1 = The new value
+		Nuria::LuaRuntime *runtime = (Nuria::LuaRuntime *)lua_touserdata (env, lua_upvalueindex(2));
+		LuaWrapperUserData *data = (LuaWrapperUserData *)lua_touserdata (env, 1);
+		runtime->d_ptr->refreshChildView (env, data);
+		// 3 = The new value
+		
+		if (pushNativeMember (env) == LUA_TUSERDATA && data->ptr) {
+			LuaNativeAccessor *accessor = (LuaNativeAccessor *)lua_touserdata (env, -1);
+			accessor->setter (env, data->ptr, accessor + 1, 3);
+		} else {
+			lua_pop (env, 1);
+			const char *field = luaL_checkstring (env, 2);
+			LuaMetaObjectWrapper::setFieldFromStack (runtime, data, field);
+		}
 		
-		LuaMetaObjectWrapper::setFieldFromStack (runtime, inst, field);
+		// Propagate the change to the parents
+		runtime->d_ptr->writeBackChildView (env, data);
 		return 0;
 	}
 	
 	static void destroyRecursive (lua_State *env, LuaRuntime *runtime, LuaWrapperUserData *data) {
+		if (data->parentRef > 0) { // Is this a child view?
+			delete data->mirror;
+			lua_unref (env, data->parentRef);
+			return;
+		}
+		
+		// 
 		runtime->d_ptr->removeObject (data);
 		runtime->d_ptr->checkQObjectOwnership (runtime, data);
 		
-		if (data->ptr && runtime->d_ptr->invokeGarbageHandler (data->owned, data->ptr, data->meta)) {
+		if (data->inlined) {
+			
+			// The memory goes away with the user data, the handler can't keep it
+			runtime->d_ptr->invokeGarbageHandler (true, data->ptr, data->meta);
+			QMetaType::destruct (data->meta->metaTypeId (), data->ptr);
+		} else if (data->ptr && runtime->d_ptr->invokeGarbageHandler (data->owned, data->ptr, data->meta)) {
 			if (data->reference > 0) { // Is this a sub-class?
 				LuaWrapperUserData *parent = (LuaWrapperUserData *)data->ptr;
 				destroyRecursive (env, runtime, parent);
@@ -155,6 +200,21 @@ static void pushClosureIntoTable (lua_State *env, const char *literalName, lua_C
 	lua_settable (env, -3);
 }
 
+static void pushAccessorIntoTable (lua_State *env, const char *literalName, lua_CFunction func,
+                                   Nuria::LuaRuntime *runtime, int nativesRef) {
+	
+	// Push key
+	lua_pushstring (env, literalName);
+	
+	// Push value (Closure with the table of native members)
+	lua_getref (env, nativesRef);
+	lua_pushlightuserdata (env, runtime);
+	lua_pushcclosure (env, func, 2);
+	
+	// Insert
+	lua_settable (env, -3);
+}
+
 void Nuria::LuaMetaObjectWrapper::populateMetaTable () {
 	lua_State *env = (lua_State *)this->d_ptr->runtime->luaState ();
 	MetaObject *metaObject = this->d_ptr->metaObject;
@@ -168,9 +228,13 @@ void Nuria::LuaMetaObjectWrapper::populateMetaTable () {
 	lua_pushlightuserdata (env, metaObject);
 	lua_settable (env, -3);
 	
+	// Table of natively bound members, see LuaClassBinding
+	lua_createtable (env, 0, 0);
+	this->d_ptr->nativesRef = luaL_ref (env, LUA_REGISTRYINDEX);
+	
 	// Insert the meta methods
-	pushClosureIntoTable (env, "__index", &Internal::Delegate::delegateRead, runtime);
-	pushClosureIntoTable (env, "__newindex", &Internal::Delegate::delegateWrite, runtime);
+	pushAccessorIntoTable (env, "__index", &Internal::Delegate::delegateRead, runtime, this->d_ptr->nativesRef);
+	pushAccessorIntoTable (env, "__newindex", &Internal::Delegate::delegateWrite, runtime, this->d_ptr->nativesRef);
 	pushClosureIntoTable (env, "__gc", &Internal::Delegate::delegateDestroy, runtime);
 	pushClosureIntoTable (env, "__call", &Internal::Delegate::delegateDeclarativeCreation, runtime);
 	
@@ -183,6 +247,10 @@ int Nuria::LuaMetaObjectWrapper::reference () const {
 	return this->d_ptr->metaRef;
 }
 
+int Nuria::LuaMetaObjectWrapper::nativesReference () const {
+	return this->d_ptr->nativesRef;
+}
+
 bool Nuria::LuaMetaObjectWrapper::isRegistered () const {
 	return this->d_ptr->registered;
 }
@@ -191,6 +259,17 @@ void Nuria::LuaMetaObjectWrapper::setRegistered (bool registered) {
 	this->d_ptr->registered = registered;
 }
 
+static int fieldIndex (Nuria::MetaObject *meta, const QByteArray &name) {
+	for (int i = 0, count = meta->fieldCount (); i < count; i++) {
+		if (meta->field (i).name () == name) {
+			return i;
+		}
+		
+	}
+	
+	return -1;
+}
+
 void Nuria::LuaMetaObjectWrapper::pushFieldOnStack (LuaRuntime *runtime, void *inst, const char *name) {
 	QByteArray n = QByteArray::fromRawData (name, qstrlen (name));
 	if (!pushMethod (runtime, inst, n) && !pushField (runtime, inst, n)) {
@@ -207,7 +286,7 @@ void Nuria::LuaMetaObjectWrapper::setFieldFromStack (LuaRuntime *runtime, void *
 	MetaField field = data->meta->fieldByName (n);
 	
 	if (field.isValid ()) {
-		QVariant value = LuaValue::fromStack (runtime, -1).toVariant ();
+		QVariant value = LuaStackUtils::typedVariantFromStack (runtime, -1, field.typeId ());
 		field.write (data->ptr, value);
 	}
 	
@@ -252,7 +331,21 @@ bool Nuria::LuaMetaObjectWrapper::pushField (LuaRuntime *runtime, void *inst, co
 	
 	// Push value
 	void *ptr = (data->ptr) ? data->ptr : data;
-	LuaStackUtils::pushVariantOnStack (runtime, field.read (ptr));
+	QVariant value = field.read (ptr);
+	
+	// Structures stored by value are exposed as view, keeping the parent at
+	// stack index 1 alive. MetaField doesn't expose the address of a field,
+	// so the view mirrors the value read above. It's re-read on each access
+	// and written back after each change. Fields bound through
+	// LuaClassBinding::field() don't get here, their views point into the
+	// parent directly.
+	LuaTypeConverter type = runtime->d_ptr->converter (value.userType ());
+	if (data->ptr && data->reference == 0 && type.meta && !type.isPointer && !type.push) {
+		runtime->d_ptr->pushFieldView (value, type.meta, 1, fieldIndex (data->meta, name));
+		return true;
+	}
+	
+	LuaStackUtils::pushVariantOnStack (runtime, value);
 	return true;
 }
 
@@ -309,16 +402,60 @@ int Nuria::LuaMetaObjectWrapper::invokeMethod (void *state) {
 		arguments.append (args.at (i).toVariant ());
 	}
 	
-	// Invoke callback
+	// Invoke callback. Member methods may change a child view.
+	runtime->d_ptr->refreshChildView (env, data);
 	Nuria::Callback cb = method.callback (data->ptr);
 	QVariant result = cb.invoke (arguments);
 	
+	if (!isStatic) {
+		runtime->d_ptr->writeBackChildView (env, data);
+	}
+	
 	// Return result
 	pushInvocationResult (runtime, data->meta, idx, result);
 	return 1;
 	
 }
 
+// Returns \c true if the table at \a idx only maps names to plain values,
+// which can be written to fields without Nuria::Serializer.
+static bool isFlatTable (lua_State *env, int idx) {
+	lua_pushnil (env);
+	while (lua_next (env, idx)) {
+		int type = lua_type (env, -1);
+		if (lua_type (env, -2) != LUA_TSTRING ||
+		    (type != LUA_TNUMBER && type != LUA_TSTRING && type != LUA_TBOOLEAN)) {
+			lua_pop (env, 2);
+			return false;
+		}
+		
+		lua_pop (env, 1);
+	}
+	
+	return true;
+}
+
+void Nuria::LuaMetaObjectWrapper::pushInlineInstance (LuaRuntime *runtime, lua_State *env, MetaObject *meta) {
+	LuaMetaObjectWrapper *wrapper = runtime->d_ptr->findOrCreateWrapper (meta);
+	runtime->d_ptr->pushInlineObject (nullptr, meta, wrapper->reference ());
+	LuaWrapperUserData *data = (LuaWrapperUserData *)lua_touserdata (env, -1);
+	
+	// Assign all fields like 'inst.name = value' would
+	lua_pushnil (env);
+	while (lua_next (env, 2)) {
+		size_t len = 0;
+		const char *name = lua_tolstring (env, -2, &len);
+		MetaField field = meta->fieldByName (QByteArray::fromRawData (name, int (len)));
+		
+		if (field.isValid ()) {
+			field.write (data->ptr, LuaStackUtils::typedVariantFromStack (runtime, -1, field.typeId ()));
+		}
+		
+		lua_pop (env, 1);
+	}
+	
+}
+
 int Nuria::LuaMetaObjectWrapper::declarativeCreate (LuaRuntime *runtime, lua_State *env, MetaObject *meta) {
 	// Lua calls this function as func(self, argument), where argument has
 	// to be a table in our case.
@@ -326,8 +463,15 @@ int Nuria::LuaMetaObjectWrapper::declarativeCreate (LuaRuntime *runtime, lua_Sta
 		return luaL_error (env, "Declarative creation expects a table as only argument.");
 	}
 	
+	// Flat tables are assigned field by field to an instance constructed
+	// right inside its user data.
+	if (runtime->d_ptr->canStoreInline (meta) && isFlatTable (env, 2)) {
+		pushInlineInstance (runtime, env, meta);
+		return 1;
+	}
+	
 	// Convert table, taking ownership of all objects inside.
-	QVariant argData = LuaStackUtils::tableFromStack (runtime, 2, true);
+	QVariant argData = LuaStackUtils::tableFromStack (runtime, 2, true, runtime->stringConversion ());
 	if (argData.userType () == QMetaType::QVariantList) {
 		return luaL_error (env, "The passed table must be associative data, not an array.");
 	}
@@ -62,6 +62,13 @@ public:
 	/** Returns the LUA reference to the meta table. */
 	int reference () const;
 	
+	/**
+	 * Returns the LUA reference to the table of natively bound members.
+	 * Keys are member names, values are either a C function for methods
+	 * or a user data with a LuaNativeAccessor for fields.
+	 */
+	int nativesReference () const;
+	
 	/** Returns \c true if this wrapper is registered by name to LUA. */
 	bool isRegistered () const;
 	
@@ -79,6 +86,7 @@ private:
 	
 	static int invokeMethod (void *state);
 	static int declarativeCreate (LuaRuntime *runtime, lua_State *env, MetaObject *meta);
+	static void pushInlineInstance (LuaRuntime *runtime, lua_State *env, MetaObject *meta);
 	static void pushInvocationResult (LuaRuntime *runtime, MetaObject *meta,
 					  int funcIdx, QVariant &result);
 	static bool findPossibleMethodsByArgCount (MetaObject *meta, int count, int &begin, int &end);
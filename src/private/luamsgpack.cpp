@@ -0,0 +1,457 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "luamsgpack.hpp"
+
+#include <cstring>
+#include <cmath>
+
+#include "../nuria/luaruntime.hpp"
+#include "luaruntimeprivate.hpp"
+#include "luastackutils.hpp"
+#include "luastructures.hpp"
+#include "luabytearray.hpp"
+
+// Maximum nesting of tables
+static const int maxDepth = 200;
+
+Nuria::LuaMsgPackEncoder::LuaMsgPackEncoder (LuaRuntime *runtime, lua_State *env, bool packStructures)
+	: runtime (runtime), env (env), packStructures (packStructures)
+{
+	
+	this->buffer.reserve (256);
+	
+}
+
+bool Nuria::LuaMsgPackEncoder::encode (int idx) {
+	int top = lua_gettop (this->env);
+	if (idx < 0 && idx > LUA_REGISTRYINDEX) {
+		idx = top + idx + 1;
+	}
+	
+	bool success = encodeValue (idx, 0);
+	lua_settop (this->env, top);
+	
+	return success;
+}
+
+bool Nuria::LuaMsgPackEncoder::encodeValue (int idx, int depth) {
+	int type = lua_type (this->env, idx);
+	
+	switch (type) {
+	case LUA_TNIL:
+		writeByte (0xc0);
+		return true;
+	case LUA_TBOOLEAN:
+		writeByte (lua_toboolean (this->env, idx) ? 0xc3 : 0xc2);
+		return true;
+	case LUA_TNUMBER:
+		encodeNumber (lua_tonumber (this->env, idx));
+		return true;
+	case LUA_TSTRING: {
+		size_t length = 0;
+		const char *str = lua_tolstring (this->env, idx, &length);
+		encodeBytes (str, length, false);
+		return true;
+	}
+	case LUA_TTABLE:
+		return encodeTable (idx, depth + 1);
+	case LUA_TLIGHTUSERDATA:
+		
+		// Nuria.json.null
+		if (!lua_touserdata (this->env, idx)) {
+			writeByte (0xc0);
+			return true;
+		}
+		
+		break;
+	case LUA_TUSERDATA: {
+		LuaByteArray *bytes = LuaByteArray::at (this->env, idx);
+		if (bytes) {
+			encodeBytes (bytes->constData (), size_t (bytes->length), true);
+			return true;
+		}
+		
+		if (this->packStructures && this->runtime->d_ptr->wrapperData (this->env, idx)) {
+			return encodeStructure (idx, depth + 1);
+		}
+		
+	} break;
+	}
+	
+	return fail (QStringLiteral("Can't pack a value of type %1")
+	             .arg (QLatin1String (lua_typename (this->env, type))));
+}
+
+bool Nuria::LuaMsgPackEncoder::encodeTable (int idx, int depth) {
+	if (depth > maxDepth) {
+		return fail (QStringLiteral("Table is nested too deeply or contains a cycle"));
+	}
+	
+	if (!lua_checkstack (this->env, 3)) {
+		return fail (QStringLiteral("Out of stack space"));
+	}
+	
+	// Array
+	int length = 0;
+	int count = 0;
+	if (LuaStackUtils::isSequence (this->env, idx, length, &count)) {
+		encodeHeader (0x90, 16, 0xdc, quint32 (length));
+		for (int i = 1; i <= length; i++) {
+			lua_rawgeti (this->env, idx, i);
+			if (!encodeValue (lua_gettop (this->env), depth)) {
+				return false;
+			}
+			
+			lua_pop (this->env, 1);
+		}
+		
+		return true;
+	}
+	
+	// Map
+	encodeHeader (0x80, 16, 0xde, quint32 (count));
+	
+	lua_pushnil (this->env);
+	while (lua_next (this->env, idx) != 0) {
+		int top = lua_gettop (this->env);
+		if (!encodeValue (top - 1, depth) || !encodeValue (top, depth)) {
+			return false;
+		}
+		
+		lua_pop (this->env, 1);
+	}
+	
+	return true;
+}
+
+bool Nuria::LuaMsgPackEncoder::encodeStructure (int idx, int depth) {
+	if (depth > maxDepth) {
+		return fail (QStringLiteral("Structure is nested too deeply"));
+	}
+	
+	if (!lua_checkstack (this->env, 2)) {
+		return fail (QStringLiteral("Out of stack space"));
+	}
+	
+	// Write all fields as map
+	LuaWrapperUserData *data = this->runtime->d_ptr->wrapperData (this->env, idx);
+	this->runtime->d_ptr->refreshChildView (this->env, data);
+	MetaObject *meta = data->meta;
+	void *ptr = (data->ptr) ? data->ptr : data;
+	int count = meta->fieldCount ();
+	
+	encodeHeader (0x80, 16, 0xde, quint32 (count));
+	for (int i = 0; i < count; i++) {
+		MetaField field = meta->field (i);
+		QByteArray name = field.name ();
+		encodeBytes (name.constData (), size_t (name.length ()), false);
+		
+		pushFieldValue (field.read (ptr));
+		if (!encodeValue (lua_gettop (this->env), depth)) {
+			return false;
+		}
+		
+		lua_pop (this->env, 1);
+	}
+	
+	return true;
+}
+
+void Nuria::LuaMsgPackEncoder::pushFieldValue (const QVariant &value) {
+	lua_State *main = (lua_State *)this->runtime->luaState ();
+	
+	// Values are converted on the main thread, move them over if needed
+	LuaStackUtils::pushVariantOnStack (this->runtime, value);
+	if (main != this->env) {
+		lua_xmove (main, this->env, 1);
+	}
+	
+}
+
+void Nuria::LuaMsgPackEncoder::encodeNumber (lua_Number value) {
+	bool integral = (value == std::floor (value) &&
+	                 value >= -9223372036854775808.0 && value < 18446744073709551616.0);
+	
+	// Integers are written using the smallest format
+	if (integral && value >= 0) {
+		quint64 u = quint64 (value);
+		if (u < 0x80) writeByte (quint8 (u));
+		else if (u <= 0xff) { writeByte (0xcc); writeUInt (u, 1); }
+		else if (u <= 0xffff) { writeByte (0xcd); writeUInt (u, 2); }
+		else if (u <= 0xffffffffULL) { writeByte (0xce); writeUInt (u, 4); }
+		else { writeByte (0xcf); writeUInt (u, 8); }
+		return;
+	} else if (integral) {
+		qint64 i = qint64 (value);
+		if (i >= -32) writeByte (quint8 (i));
+		else if (i >= -128) { writeByte (0xd0); writeUInt (quint64 (i), 1); }
+		else if (i >= -32768) { writeByte (0xd1); writeUInt (quint64 (i), 2); }
+		else if (i >= -2147483648LL) { writeByte (0xd2); writeUInt (quint64 (i), 4); }
+		else { writeByte (0xd3); writeUInt (quint64 (i), 8); }
+		return;
+	}
+	
+	// Use float32 if it doesn't lose precision
+	float single = float (value);
+	if (double (single) == value) {
+		quint32 bits;
+		::memcpy (&bits, &single, sizeof(bits));
+		writeByte (0xca);
+		writeUInt (bits, 4);
+		return;
+	}
+	
+	quint64 bits;
+	::memcpy (&bits, &value, sizeof(bits));
+	writeByte (0xcb);
+	writeUInt (bits, 8);
+}
+
+void Nuria::LuaMsgPackEncoder::encodeBytes (const char *data, size_t length, bool binary) {
+	if (binary) {
+		if (length <= 0xff) { writeByte (0xc4); writeUInt (length, 1); }
+		else if (length <= 0xffff) { writeByte (0xc5); writeUInt (length, 2); }
+		else { writeByte (0xc6); writeUInt (length, 4); }
+	} else {
+		if (length < 32) writeByte (quint8 (0xa0 | length));
+		else if (length <= 0xff) { writeByte (0xd9); writeUInt (length, 1); }
+		else if (length <= 0xffff) { writeByte (0xda); writeUInt (length, 2); }
+		else { writeByte (0xdb); writeUInt (length, 4); }
+	}
+	
+	this->buffer.append (data, int (length));
+}
+
+void Nuria::LuaMsgPackEncoder::encodeHeader (quint8 fix, int fixLimit, quint8 base, quint32 count) {
+	if (count < quint32 (fixLimit)) {
+		writeByte (quint8 (fix | count));
+	} else if (count <= 0xffff) {
+		writeByte (base);
+		writeUInt (count, 2);
+	} else {
+		writeByte (base + 1);
+		writeUInt (count, 4);
+	}
+	
+}
+
+void Nuria::LuaMsgPackEncoder::writeByte (quint8 byte) {
+	this->buffer.append (char (byte));
+}
+
+void Nuria::LuaMsgPackEncoder::writeUInt (quint64 value, int bytes) {
+	char data[8];
+	for (int i = bytes - 1; i >= 0; i--, value >>= 8) {
+		data[i] = char (value & 0xff);
+	}
+	
+	this->buffer.append (data, bytes);
+}
+
+bool Nuria::LuaMsgPackEncoder::fail (const QString &message) {
+	this->error = message;
+	return false;
+}
+
+Nuria::LuaMsgPackDecoder::LuaMsgPackDecoder (lua_State *env, const char *data, int length, int offset)
+	: env (env), begin ((const uchar *)data), pos ((const uchar *)data + offset),
+	  end ((const uchar *)data + length)
+{
+
+}
+
+bool Nuria::LuaMsgPackDecoder::decode () {
+	int top = lua_gettop (this->env);
+	const uchar *start = this->pos;
+	
+	if (!decodeValue (0)) {
+		lua_settop (this->env, top);
+		this->pos = start;
+		return false;
+	}
+	
+	return true;
+}
+
+bool Nuria::LuaMsgPackDecoder::decodeValue (int depth) {
+	if (this->pos >= this->end) {
+		return fail ("Unexpected end of data");
+	}
+	
+	quint8 type = *this->pos++;
+	quint64 value = 0;
+	
+	// Fixed formats
+	if (type <= 0x7f) {
+		lua_pushnumber (this->env, type);
+		return true;
+	} else if (type >= 0xe0) {
+		lua_pushnumber (this->env, qint8 (type));
+		return true;
+	} else if (type <= 0x8f) {
+		return decodeMap (type & 0x0f, depth + 1);
+	} else if (type <= 0x9f) {
+		return decodeArray (type & 0x0f, depth + 1);
+	} else if (type <= 0xbf) {
+		return decodeString (type & 0x1f);
+	}
+	
+	switch (type) {
+	case 0xc0:
+		lua_pushnil (this->env);
+		return true;
+	case 0xc2:
+	case 0xc3:
+		lua_pushboolean (this->env, type == 0xc3);
+		return true;
+	case 0xc4: case 0xd9:
+		return readUInt (1, value) && decodeString (quint32 (value));
+	case 0xc5: case 0xda:
+		return readUInt (2, value) && decodeString (quint32 (value));
+	case 0xc6: case 0xdb:
+		return readUInt (4, value) && decodeString (quint32 (value));
+	case 0xca: {
+		if (!readUInt (4, value)) return false;
+		quint32 bits = quint32 (value);
+		float single;
+		::memcpy (&single, &bits, sizeof(single));
+		lua_pushnumber (this->env, single);
+	} return true;
+	case 0xcb: {
+		if (!readUInt (8, value)) return false;
+		double number;
+		::memcpy (&number, &value, sizeof(number));
+		lua_pushnumber (this->env, number);
+	} return true;
+	case 0xcc: case 0xcd: case 0xce: case 0xcf:
+		if (!readUInt (1 << (type - 0xcc), value)) return false;
+		lua_pushnumber (this->env, lua_Number (value));
+		return true;
+	case 0xd0:
+		if (!readUInt (1, value)) return false;
+		lua_pushnumber (this->env, qint8 (value));
+		return true;
+	case 0xd1:
+		if (!readUInt (2, value)) return false;
+		lua_pushnumber (this->env, qint16 (value));
+		return true;
+	case 0xd2:
+		if (!readUInt (4, value)) return false;
+		lua_pushnumber (this->env, qint32 (value));
+		return true;
+	case 0xd3:
+		if (!readUInt (8, value)) return false;
+		lua_pushnumber (this->env, lua_Number (qint64 (value)));
+		return true;
+	case 0xdc:
+		return readUInt (2, value) && decodeArray (quint32 (value), depth + 1);
+	case 0xdd:
+		return readUInt (4, value) && decodeArray (quint32 (value), depth + 1);
+	case 0xde:
+		return readUInt (2, value) && decodeMap (quint32 (value), depth + 1);
+	case 0xdf:
+		return readUInt (4, value) && decodeMap (quint32 (value), depth + 1);
+	case 0xc7: case 0xc8: case 0xc9:
+	case 0xd4: case 0xd5: case 0xd6: case 0xd7: case 0xd8:
+		this->pos--;
+		return fail ("Extension types are not supported");
+	}
+	
+	this->pos--;
+	return fail ("Invalid type");
+}
+
+bool Nuria::LuaMsgPackDecoder::decodeArray (quint32 count, int depth) {
+	
+	// Every element takes at least one byte
+	if (depth > maxDepth || !lua_checkstack (this->env, 2)) {
+		return fail ("Data is nested too deeply");
+	} else if (count > quint32 (this->end - this->pos)) {
+		return fail ("Unexpected end of data");
+	}
+	
+	lua_createtable (this->env, int (count), 0);
+	for (quint32 i = 1; i <= count; i++) {
+		if (!decodeValue (depth)) {
+			return false;
+		}
+		
+		lua_rawseti (this->env, -2, int (i));
+	}
+	
+	return true;
+}
+
+bool Nuria::LuaMsgPackDecoder::decodeMap (quint32 count, int depth) {
+	
+	// Every pair takes at least two bytes
+	if (depth > maxDepth || !lua_checkstack (this->env, 3)) {
+		return fail ("Data is nested too deeply");
+	} else if (count > quint32 (this->end - this->pos) / 2) {
+		return fail ("Unexpected end of data");
+	}
+	
+	lua_createtable (this->env, 0, int (count));
+	for (quint32 i = 0; i < count; i++) {
+		if (!decodeValue (depth)) {
+			return false;
+		}
+		
+		// Lua doesn't allow nil and NaN as key
+		if (lua_isnil (this->env, -1) ||
+		    (lua_type (this->env, -1) == LUA_TNUMBER && std::isnan (lua_tonumber (this->env, -1)))) {
+			return fail ("Invalid map key");
+		}
+		
+		if (!decodeValue (depth)) {
+			return false;
+		}
+		
+		lua_rawset (this->env, -3);
+	}
+	
+	return true;
+}
+
+bool Nuria::LuaMsgPackDecoder::decodeString (quint32 length) {
+	if (length > quint32 (this->end - this->pos)) {
+		return fail ("Unexpected end of data");
+	}
+	
+	lua_pushlstring (this->env, (const char *)this->pos, length);
+	this->pos += length;
+	return true;
+}
+
+bool Nuria::LuaMsgPackDecoder::readUInt (int bytes, quint64 &value) {
+	if (this->end - this->pos < bytes) {
+		return fail ("Unexpected end of data");
+	}
+	
+	value = 0;
+	for (int i = 0; i < bytes; i++) {
+		value = (value << 8) | *this->pos++;
+	}
+	
+	return true;
+}
+
+bool Nuria::LuaMsgPackDecoder::fail (const char *message) {
+	this->error = QStringLiteral("%1 at offset %2").arg (QLatin1String (message))
+	              .arg (this->pos - this->begin);
+	return false;
+}
@@ -0,0 +1,119 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NURIA_LUAMSGPACK_HPP
+#define NURIA_LUAMSGPACK_HPP
+
+#include <QByteArray>
+#include <QVariant>
+#include <QString>
+#include <lua.hpp>
+
+namespace Nuria {
+
+class LuaRuntime;
+
+/*
+ * Serializes Lua values into MessagePack. Numbers with an integral value are
+ * written as the smallest fitting integer, all others as float64. Tables
+ * with only the keys 1 to #table are written as array, all other tables as
+ * map. Byte arrays are written as binary.
+ * 
+ * If 'packStructures' is set, wrapped structures are written as map of their
+ * fields. Otherwise they're an error.
+ */
+class Q_DECL_HIDDEN LuaMsgPackEncoder {
+public:
+	
+	/**
+	 * Encodes values on the stack of \a env, which may be any thread of
+	 * the Lua state of \a runtime.
+	 */
+	LuaMsgPackEncoder (LuaRuntime *runtime, lua_State *env, bool packStructures);
+	
+	/** Encodes the value at \a idx. Returns \c false on failure. */
+	bool encode (int idx);
+	
+	QByteArray result () const
+	{ return this->buffer; }
+	
+	QString errorString () const
+	{ return this->error; }
+	
+private:
+	bool encodeValue (int idx, int depth);
+	bool encodeTable (int idx, int depth);
+	bool encodeStructure (int idx, int depth);
+	void pushFieldValue (const QVariant &value);
+	void encodeNumber (lua_Number value);
+	void encodeBytes (const char *data, size_t length, bool binary);
+	void encodeHeader (quint8 fix, int fixLimit, quint8 base, quint32 count);
+	void writeByte (quint8 byte);
+	void writeUInt (quint64 value, int bytes);
+	bool fail (const QString &message);
+	
+	// 
+	LuaRuntime *runtime;
+	lua_State *env;
+	bool packStructures;
+	QByteArray buffer;
+	QString error;
+	
+};
+
+/*
+ * Decodes a single MessagePack value starting at a given offset. Strings and
+ * binaries both become Lua strings, nil map values are dropped. Extension
+ * types are not supported.
+ */
+class Q_DECL_HIDDEN LuaMsgPackDecoder {
+public:
+	
+	LuaMsgPackDecoder (lua_State *env, const char *data, int length, int offset = 0);
+	
+	/**
+	 * Decodes the next value and pushes it. On failure, nothing is pushed
+	 * and \c false is returned.
+	 */
+	bool decode ();
+	
+	/** Returns the offset after the last decoded value. */
+	int offset () const
+	{ return int (this->pos - this->begin); }
+	
+	QString errorString () const
+	{ return this->error; }
+	
+private:
+	bool decodeValue (int depth);
+	bool decodeArray (quint32 count, int depth);
+	bool decodeMap (quint32 count, int depth);
+	bool decodeString (quint32 length);
+	bool readUInt (int bytes, quint64 &value);
+	bool fail (const char *message);
+	
+	// 
+	lua_State *env;
+	const uchar *begin;
+	const uchar *pos;
+	const uchar *end;
+	QString error;
+	
+};
+
+}
+
+#endif // NURIA_LUAMSGPACK_HPP
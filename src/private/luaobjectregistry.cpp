@@ -0,0 +1,102 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "luaobjectregistry.hpp"
+
+// Initial capacity, must be a power of two
+static const int initialCapacity = 64;
+
+Nuria::LuaObjectRegistry::LuaObjectRegistry ()
+	: entries (initialCapacity, Entry { nullptr, nullptr }), mask (initialCapacity - 1)
+{
+
+}
+
+void Nuria::LuaObjectRegistry::insert (void *object, LuaWrapperUserData *data) {
+	
+	// Keep the load factor below 1/2
+	if ((this->count + 1) * 2 > this->entries.size ()) {
+		grow ();
+	}
+	
+	int i = indexOf (object);
+	Entry *entries = this->entries.data ();
+	while (entries[i].object && entries[i].object != object) {
+		i = (i + 1) & this->mask;
+	}
+	
+	if (!entries[i].object) {
+		this->count++;
+	}
+	
+	entries[i] = Entry { object, data };
+}
+
+void Nuria::LuaObjectRegistry::remove (void *object) {
+	Entry *entries = this->entries.data ();
+	int i = indexOf (object);
+	
+	while (entries[i].object != object) {
+		if (!entries[i].object) {
+			return;
+		}
+		
+		i = (i + 1) & this->mask;
+	}
+	
+	// Move following entries of the probe sequence into the gap
+	for (int j = (i + 1) & this->mask; entries[j].object; j = (j + 1) & this->mask) {
+		int home = indexOf (entries[j].object);
+		bool movable = (i <= j) ? (home <= i || home > j) : (home <= i && home > j);
+		if (movable) {
+			entries[i] = entries[j];
+			i = j;
+		}
+		
+	}
+	
+	entries[i] = Entry { nullptr, nullptr };
+	this->count--;
+}
+
+int Nuria::LuaObjectRegistry::acquireSlot () {
+	if (this->freeSlots.isEmpty ()) {
+		return this->nextSlot++;
+	}
+	
+	int slot = this->freeSlots.last ();
+	this->freeSlots.removeLast ();
+	return slot;
+}
+
+void Nuria::LuaObjectRegistry::releaseSlot (int slot) {
+	this->freeSlots.append (slot);
+}
+
+void Nuria::LuaObjectRegistry::grow () {
+	QVector< Entry > old (this->entries.size () * 2, Entry { nullptr, nullptr });
+	old.swap (this->entries);
+	this->mask = this->entries.size () - 1;
+	this->count = 0;
+	
+	for (const Entry &entry : old) {
+		if (entry.object) {
+			insert (entry.object, entry.data);
+		}
+		
+	}
+	
+}
@@ -0,0 +1,90 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NURIA_LUAOBJECTREGISTRY_HPP
+#define NURIA_LUAOBJECTREGISTRY_HPP
+
+#include <QVector>
+
+namespace Nuria {
+
+class LuaWrapperUserData;
+
+/*
+ * Maps C++ objects to their user data in Lua. This is an open-addressing
+ * hash table using linear probing. Removal shifts following entries back
+ * instead of leaving tombstones, so look-ups never slow down over time.
+ * 
+ * Besides, it hands out slots: Each registered user data is stored at its
+ * slot in a weak Lua table, from which it's pushed again using a plain
+ * array access.
+ */
+class Q_DECL_HIDDEN LuaObjectRegistry {
+public:
+	
+	LuaObjectRegistry ();
+	
+	/** Returns the user data of \a object, or \c nullptr. */
+	LuaWrapperUserData *find (void *object) const {
+		if (this->count == 0) {
+			return nullptr;
+		}
+		
+		for (int i = indexOf (object);; i = (i + 1) & this->mask) {
+			const Entry &entry = this->entries.at (i);
+			if (entry.object == object) return entry.data;
+			if (!entry.object) return nullptr;
+		}
+		
+	}
+	
+	void insert (void *object, LuaWrapperUserData *data);
+	void remove (void *object);
+	
+	/** Returns the count of registered objects. */
+	int size () const
+	{ return this->count; }
+	
+	/** Returns a free slot, slots start at 1. */
+	int acquireSlot ();
+	void releaseSlot (int slot);
+	
+private:
+	struct Entry {
+		void *object;
+		LuaWrapperUserData *data;
+	};
+	
+	int indexOf (void *object) const {
+		quint64 hash = quint64 (quintptr (object)) * Q_UINT64_C(0x9E3779B97F4A7C15);
+		return int (hash >> 32) & this->mask;
+	}
+	
+	void grow ();
+	
+	// 
+	QVector< Entry > entries;
+	int mask;
+	int count = 0;
+	
+	QVector< int > freeSlots;
+	int nextSlot = 1;
+	
+};
+
+}
+
+#endif // NURIA_LUAOBJECTREGISTRY_HPP
@@ -0,0 +1,165 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "luaparallelworker.hpp"
+
+#include <lua.hpp>
+
+#include "../nuria/luaruntime.hpp"
+#include "../nuria/luavalue.hpp"
+#include "luastackutils.hpp"
+
+// Stack slots of the functions after prepare()
+enum { MapFunction = 1, ReduceFunction = 2 };
+
+void Nuria::LuaParallelJob::fail (const QString &message) {
+	QMutexLocker locker (&this->errorMutex);
+	if (this->failed.testAndSetOrdered (0, 1)) {
+		this->error = message;
+	}
+	
+}
+
+Nuria::LuaParallelWorker::LuaParallelWorker (LuaParallelJob *job)
+	: job (job)
+{
+
+}
+
+static bool pushGlobalFunction (Nuria::LuaParallelJob *job, lua_State *env, const QByteArray &name) {
+	if (name.isEmpty ()) {
+		lua_pushnil (env);
+		return true;
+	}
+	
+	lua_getglobal (env, name.constData ());
+	if (lua_type (env, -1) != LUA_TFUNCTION) {
+		job->fail (QStringLiteral("'%1' is not a function").arg (QString::fromUtf8 (name)));
+		return false;
+	}
+	
+	return true;
+}
+
+static QString popError (lua_State *env) {
+	QString message = QString::fromUtf8 (lua_tostring (env, -1));
+	lua_pop (env, 1);
+	return message;
+}
+
+bool Nuria::LuaParallelWorker::prepare (LuaParallelJob *job, LuaRuntime *runtime) {
+	lua_State *env = (lua_State *)runtime->luaState ();
+	lua_settop (env, 0);
+	
+	// Compile and run the script once, it defines the functions
+	const QByteArray &script = job->script;
+	if (luaL_loadbuffer (env, script.constData (), script.length (), "parallel") != 0 ||
+	    lua_pcall (env, 0, 0, 0) != 0) {
+		job->fail (popError (env));
+		return false;
+	}
+	
+	return pushGlobalFunction (job, env, job->mapFunction) &&
+	       pushGlobalFunction (job, env, job->reduceFunction);
+}
+
+void Nuria::LuaParallelWorker::run () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	if (!prepare (this->job, &runtime)) {
+		return;
+	}
+	
+	// Take chunks until all are done
+	while (this->job->failed.load () == 0) {
+		int chunk = this->job->nextChunk.fetchAndAddRelaxed (1);
+		if (chunk >= this->job->chunkCount || !runChunk (&runtime, chunk)) {
+			break;
+		}
+		
+	}
+	
+}
+
+bool Nuria::LuaParallelWorker::runChunk (LuaRuntime *runtime, int chunk) {
+	lua_State *env = (lua_State *)runtime->luaState ();
+	const QVariantList &input = *this->job->input;
+	bool map = !this->job->mapFunction.isEmpty ();
+	bool reduce = !this->job->reduceFunction.isEmpty ();
+	
+	int begin = chunk * this->job->chunkSize;
+	int end = qMin (begin + this->job->chunkSize, input.length ());
+	for (int i = begin; i < end; i++) {
+		if (map) {
+			lua_pushvalue (env, MapFunction);
+			LuaStackUtils::pushVariantOnStack (runtime, input.at (i));
+			if (lua_pcall (env, 1, 1, 0) != 0) {
+				this->job->fail (popError (env));
+				return false;
+			}
+			
+		} else {
+			LuaStackUtils::pushVariantOnStack (runtime, input.at (i));
+		}
+		
+		// Store the mapped value, or fold it into the accumulator
+		if (!reduce) {
+			this->job->results[i] = LuaValue::fromStack (runtime, -1).toVariant ();
+			lua_pop (env, 1);
+		} else if (i > begin) {
+			lua_pushvalue (env, ReduceFunction);
+			lua_insert (env, -3);
+			if (lua_pcall (env, 2, 1, 0) != 0) {
+				this->job->fail (popError (env));
+				return false;
+			}
+			
+		}
+		
+	}
+	
+	// The accumulator is left on the stack
+	if (reduce) {
+		this->job->partials[chunk] = LuaValue::fromStack (runtime, -1).toVariant ();
+		lua_pop (env, 1);
+	}
+	
+	return true;
+}
+
+bool Nuria::LuaParallelWorker::reducePartials (LuaParallelJob *job, QVariant &result) {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	if (!prepare (job, &runtime)) {
+		return false;
+	}
+	
+	// Fold the partial results in order
+	lua_State *env = (lua_State *)runtime.luaState ();
+	LuaStackUtils::pushVariantOnStack (&runtime, job->partials[0]);
+	for (int i = 1; i < job->chunkCount; i++) {
+		lua_pushvalue (env, ReduceFunction);
+		lua_insert (env, -2);
+		LuaStackUtils::pushVariantOnStack (&runtime, job->partials[i]);
+		if (lua_pcall (env, 2, 1, 0) != 0) {
+			job->fail (popError (env));
+			return false;
+		}
+		
+	}
+	
+	result = LuaValue::fromStack (&runtime, -1).toVariant ();
+	lua_pop (env, 1);
+	return true;
+}
@@ -0,0 +1,84 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NURIA_LUAPARALLELWORKER_HPP
+#define NURIA_LUAPARALLELWORKER_HPP
+
+#include <QVariantList>
+#include <QByteArray>
+#include <QAtomicInt>
+#include <QVector>
+#include <QThread>
+#include <QMutex>
+
+namespace Nuria {
+
+class LuaRuntime;
+
+/*
+ * State shared by all workers of a LuaParallel call. Chunks are handed out
+ * through 'nextChunk', so faster workers take more of them. Each chunk
+ * writes into its own slots of 'results' or 'partials', which are allocated
+ * up-front, so no locking is needed there.
+ */
+struct Q_DECL_HIDDEN LuaParallelJob {
+	QByteArray script;
+	QByteArray mapFunction; // May be empty when reducing
+	QByteArray reduceFunction; // Empty when only mapping
+	
+	const QVariantList *input;
+	QVariant *results; // Mapped values, if not reducing
+	QVariant *partials; // Reduced value per chunk, if reducing
+	
+	int chunkSize;
+	int chunkCount;
+	QAtomicInt nextChunk;
+	
+	// First error, stops all workers
+	QAtomicInt failed;
+	QMutex errorMutex;
+	QString error;
+	
+	void fail (const QString &message);
+	
+};
+
+class Q_DECL_HIDDEN LuaParallelWorker : public QThread {
+public:
+	
+	LuaParallelWorker (LuaParallelJob *job);
+	
+	/**
+	 * Reduces the partial results of all chunks in the calling thread.
+	 * Returns \c false on failure.
+	 */
+	static bool reducePartials (LuaParallelJob *job, QVariant &result);
+	
+protected:
+	void run () override;
+	
+private:
+	static bool prepare (LuaParallelJob *job, LuaRuntime *runtime);
+	bool runChunk (LuaRuntime *runtime, int chunk);
+	
+	// 
+	LuaParallelJob *job;
+	
+};
+
+}
+
+#endif // NURIA_LUAPARALLELWORKER_HPP
@@ -0,0 +1,192 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "luapipelinestage.hpp"
+
+#include <QElapsedTimer>
+#include <QDateTime>
+#include <lua.hpp>
+
+#include "../nuria/luaruntime.hpp"
+#include "../nuria/luavalue.hpp"
+#include "luastackutils.hpp"
+
+// Takes the stage function and returns the driver, which maps a batch.
+// Records for which the stage function returns nil are dropped. The count
+// is passed in, as records converted to nil leave holes in the batch.
+static const char driverScript[] =
+	"local fn = ...\n"
+	"return function (batch, count)\n"
+	"  local out, n = {}, 0\n"
+	"  for i = 1, count do\n"
+	"    local v = fn (batch[i])\n"
+	"    if v ~= nil then n = n + 1; out[n] = v end\n"
+	"  end\n"
+	"  return out, n\n"
+	"end";
+
+// Stack slot of the driver after prepare()
+enum { DriverFunction = 1 };
+
+Nuria::LuaBatchQueue::LuaBatchQueue (int capacity)
+	: limit (qMax (capacity, 1))
+{
+
+}
+
+bool Nuria::LuaBatchQueue::push (QVariantList batch) {
+	QMutexLocker locker (&this->mutex);
+	while (!this->closed && this->batches.size () >= this->limit) {
+		this->notFull.wait (&this->mutex);
+	}
+	
+	if (this->closed) {
+		return false;
+	}
+	
+	this->batches.enqueue (std::move (batch));
+	this->notEmpty.wakeOne ();
+	return true;
+}
+
+bool Nuria::LuaBatchQueue::pop (QVariantList &batch) {
+	QMutexLocker locker (&this->mutex);
+	while (!this->closed && this->batches.isEmpty ()) {
+		this->notEmpty.wait (&this->mutex);
+	}
+	
+	if (this->batches.isEmpty ()) {
+		return false;
+	}
+	
+	batch = this->batches.dequeue ();
+	this->notFull.wakeOne ();
+	return true;
+}
+
+void Nuria::LuaBatchQueue::close () {
+	QMutexLocker locker (&this->mutex);
+	this->closed = true;
+	this->notEmpty.wakeAll ();
+	this->notFull.wakeAll ();
+}
+
+int Nuria::LuaBatchQueue::size () const {
+	QMutexLocker locker (&this->mutex);
+	return this->batches.size ();
+}
+
+Nuria::LuaPipelineStage::LuaPipelineStage (const QByteArray &name, const QByteArray &script,
+                                           const QByteArray &function)
+	: name (name), script (script), function (function), batches (0), recordsIn (0),
+	  recordsOut (0), errors (0), busyTime (0), startTime (0)
+{
+
+}
+
+QString Nuria::LuaPipelineStage::lastError () const {
+	QMutexLocker locker (&this->errorMutex);
+	return this->error;
+}
+
+void Nuria::LuaPipelineStage::run () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	bool ready = prepare (&runtime);
+	this->startTime.store (QDateTime::currentMSecsSinceEpoch ());
+	
+	// A broken stage still drains its input, so upstream stages don't stall
+	QElapsedTimer timer;
+	QVariantList batch;
+	QVariantList result;
+	while (this->input->pop (batch)) {
+		if (!ready) {
+			this->errors.fetchAndAddRelaxed (1);
+			continue;
+		}
+		
+		timer.start ();
+		bool success = process (&runtime, batch, result);
+		this->busyTime.fetchAndAddRelaxed (timer.nsecsElapsed ());
+		
+		if (success && !result.isEmpty () && !this->output->push (std::move (result))) {
+			break;
+		}
+		
+		result.clear ();
+	}
+	
+	this->output->close ();
+}
+
+bool Nuria::LuaPipelineStage::prepare (LuaRuntime *runtime) {
+	lua_State *env = (lua_State *)runtime->luaState ();
+	lua_settop (env, 0);
+	
+	// Run the script, which defines the stage function
+	if (luaL_loadbuffer (env, this->script.constData (), this->script.length (), this->name.constData ()) != 0 ||
+	    lua_pcall (env, 0, 0, 0) != 0) {
+		setError (QString::fromUtf8 (lua_tostring (env, -1)));
+		lua_settop (env, 0);
+		return false;
+	}
+	
+	// 
+	luaL_loadbuffer (env, driverScript, sizeof(driverScript) - 1, "driver");
+	lua_getglobal (env, this->function.constData ());
+	if (lua_type (env, -1) != LUA_TFUNCTION) {
+		setError (QStringLiteral("'%1' is not a function").arg (QString::fromUtf8 (this->function)));
+		lua_settop (env, 0);
+		return false;
+	}
+	
+	lua_call (env, 1, 1);
+	return true;
+}
+
+bool Nuria::LuaPipelineStage::process (LuaRuntime *runtime, const QVariantList &batch, QVariantList &result) {
+	lua_State *env = (lua_State *)runtime->luaState ();
+	
+	this->batches.fetchAndAddRelaxed (1);
+	this->recordsIn.fetchAndAddRelaxed (batch.length ());
+	
+	lua_pushvalue (env, DriverFunction);
+	LuaStackUtils::pushVariantListOnStack (runtime, batch);
+	lua_pushinteger (env, batch.length ());
+	if (lua_pcall (env, 2, 2, 0) != 0) {
+		setError (QString::fromUtf8 (lua_tostring (env, -1)));
+		this->errors.fetchAndAddRelaxed (1);
+		lua_pop (env, 1);
+		return false;
+	}
+	
+	// Results are at -2, their count at -1
+	int count = int (lua_tointeger (env, -1));
+	result.reserve (count);
+	for (int i = 1; i <= count; i++) {
+		lua_rawgeti (env, -2, i);
+		result.append (LuaValue::fromStack (runtime, -1).toVariant ());
+		lua_pop (env, 1);
+	}
+	
+	lua_pop (env, 2);
+	this->recordsOut.fetchAndAddRelaxed (count);
+	return true;
+}
+
+void Nuria::LuaPipelineStage::setError (const QString &message) {
+	QMutexLocker locker (&this->errorMutex);
+	this->error = message;
+}
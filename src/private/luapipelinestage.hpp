@@ -0,0 +1,102 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NURIA_LUAPIPELINESTAGE_HPP
+#define NURIA_LUAPIPELINESTAGE_HPP
+
+#include <QWaitCondition>
+#include <QAtomicInteger>
+#include <QVariantList>
+#include <QByteArray>
+#include <QThread>
+#include <QMutex>
+#include <QQueue>
+
+namespace Nuria {
+
+class LuaRuntime;
+
+/*
+ * Bounded queue of record batches between two stages. push() blocks while
+ * the queue is full, which stalls the upstream stage until the downstream
+ * one caught up. After close(), push() fails and pop() drains the queue.
+ */
+class Q_DECL_HIDDEN LuaBatchQueue {
+public:
+	
+	LuaBatchQueue (int capacity);
+	
+	bool push (QVariantList batch);
+	bool pop (QVariantList &batch);
+	void close ();
+	
+	int size () const;
+	int capacity () const
+	{ return this->limit; }
+	
+private:
+	mutable QMutex mutex;
+	QWaitCondition notEmpty;
+	QWaitCondition notFull;
+	QQueue< QVariantList > batches;
+	int limit;
+	bool closed = false;
+	
+};
+
+/*
+ * Thread running a stage. The stage function is called for each record of
+ * a batch by a Lua driver function, so a batch crosses into Lua only once.
+ */
+class Q_DECL_HIDDEN LuaPipelineStage : public QThread {
+public:
+	
+	LuaPipelineStage (const QByteArray &name, const QByteArray &script, const QByteArray &function);
+	
+	QByteArray name;
+	QByteArray script;
+	QByteArray function;
+	
+	LuaBatchQueue *input = nullptr;
+	LuaBatchQueue *output = nullptr;
+	
+	// Statistics, written by the stage only
+	QAtomicInteger< qint64 > batches;
+	QAtomicInteger< qint64 > recordsIn;
+	QAtomicInteger< qint64 > recordsOut;
+	QAtomicInteger< qint64 > errors;
+	QAtomicInteger< qint64 > busyTime; // nsec
+	QAtomicInteger< qint64 > startTime; // msec since epoch
+	
+	QString lastError () const;
+	
+protected:
+	void run () override;
+	
+private:
+	bool prepare (LuaRuntime *runtime);
+	bool process (LuaRuntime *runtime, const QVariantList &batch, QVariantList &result);
+	void setError (const QString &message);
+	
+	// 
+	mutable QMutex errorMutex;
+	QString error;
+	
+};
+
+}
+
+#endif // NURIA_LUAPIPELINESTAGE_HPP
@@ -17,6 +17,15 @@
 #include "luaruntimeprivate.hpp"
 
 #include "luametaobjectwrapper.hpp"
+#include "luastringutils.hpp"
+
+// Limits of the key cache
+static const int maxCachedKeys = 1024;
+static const int maxCachedKeyLength = 64;
+
+// Alignment of objects stored inside their user data. Lua only guarantees
+// the alignment of a double for user data.
+static const size_t inlineAlignment = 16;
 
 Nuria::LuaMetaObjectWrapper *Nuria::LuaRuntimePrivate::findWrapper (Nuria::MetaObject *metaObject) {
 	return this->wrappers.value (metaObject);
@@ -32,36 +41,136 @@ Nuria::LuaMetaObjectWrapper *Nuria::LuaRuntimePrivate::findOrCreateWrapper (Nuri
 	wrapper = new LuaMetaObjectWrapper (metaObject, this->q_ptr);
 	wrapper->populateMetaTable ();
 	this->wrappers.insert (metaObject, wrapper);
+	
+	// Remember the meta table for wrapperData()
+	lua_getref (this->env, wrapper->reference ());
+	this->wrapperMetaTables.insert (lua_topointer (this->env, -1));
+	lua_pop (this->env, 1);
+	
 	return wrapper;
 }
 
-void Nuria::LuaRuntimePrivate::addObject (void *userData) {
-	LuaWrapperUserData *data = reinterpret_cast< LuaWrapperUserData * > (userData);
+Nuria::LuaWrapperUserData *Nuria::LuaRuntimePrivate::wrapperData (lua_State *state, int idx) {
+	if (lua_type (state, idx) != LUA_TUSERDATA ||
+	    lua_objlen (state, idx) < sizeof(LuaWrapperUserData)) {
+		return nullptr;
+	}
+	
+	// Check the tag first, this rules out nearly all foreign user data
+	LuaWrapperUserData *data = (LuaWrapperUserData *)lua_touserdata (state, idx);
+	if (data->magic != LuaWrapperUserData::Magic || !lua_getmetatable (state, idx)) {
+		return nullptr;
+	}
+	
+	// Only trust it if its meta table is one of ours
+	const void *metaTable = lua_topointer (state, -1);
+	lua_pop (state, 1);
+	
+	if (!this->wrapperMetaTables.contains (metaTable)) {
+		return nullptr;
+	}
+	
+	return data;
+}
+
+void Nuria::LuaRuntimePrivate::pushKey (const QString &key) {
+	auto it = this->keyCache.find (key);
+	if (it != this->keyCache.end ()) {
+		it->used = true;
+		lua_rawgeti (this->env, LUA_REGISTRYINDEX, it->ref);
+		return;
+	}
+	
+	LuaStringUtils::pushString (this->env, key);
+	if (key.length () > maxCachedKeyLength) {
+		return;
+	}
+	
+	// Intern the key, evicting one which wasn't used lately if it's full
+	lua_pushvalue (this->env, -1);
+	LuaCachedKey cached { luaL_ref (this->env, LUA_REGISTRYINDEX), false };
+	
+	if (this->keyClock.size () < maxCachedKeys) {
+		this->keyClock.append (key);
+		this->keyCache.insert (key, cached);
+		return;
+	}
 	
-	if (data->ptr) {
-		this->objects.insert (data->ptr, data);
+	while (true) {
+		LuaCachedKey &candidate = this->keyCache[this->keyClock.at (this->keyClockHand)];
+		if (!candidate.used) {
+			break;
+		}
+		
+		candidate.used = false;
+		this->keyClockHand = (this->keyClockHand + 1) % maxCachedKeys;
 	}
 	
+	QString &slot = this->keyClock[this->keyClockHand];
+	luaL_unref (this->env, LUA_REGISTRYINDEX, this->keyCache.take (slot).ref);
+	
+	slot = key;
+	this->keyCache.insert (key, cached);
+	this->keyClockHand = (this->keyClockHand + 1) % maxCachedKeys;
 }
 
-bool Nuria::LuaRuntimePrivate::hasObject (void *object) {
-	return this->objects.contains (object);
+bool Nuria::LuaRuntimePrivate::inherits (MetaObject *meta, MetaObject *base) {
+	if (meta == base) {
+		return true;
+	}
+	
+	if (!meta || !base) {
+		return false;
+	}
+	
+	// Cached?
+	auto key = qMakePair (meta, base);
+	auto it = this->inheritance.constFind (key);
+	if (it != this->inheritance.constEnd ()) {
+		return *it;
+	}
+	
+	// Walk the parents
+	bool result = false;
+	for (int i = 0, count = meta->parents (); i < count && !result; i++) {
+		result = inherits (MetaObject::byName (meta->parent (i)), base);
+	}
+	
+	this->inheritance.insert (key, result);
+	return result;
 }
 
-void *Nuria::LuaRuntimePrivate::userDataOfObject (void *object) {
-	return this->objects.value (object);
+void Nuria::LuaRuntimePrivate::addObject (LuaWrapperUserData *data) {
+	data->slot = this->objects.acquireSlot ();
+	this->objects.insert (data->ptr, data);
+	
+	// Store it in its slot, leaving it on the stack
+	lua_rawgeti (this->env, LUA_REGISTRYINDEX, this->objectsTable);
+	lua_pushvalue (this->env, -2);
+	lua_rawseti (this->env, -2, data->slot);
+	lua_pop (this->env, 1);
 }
 
-void Nuria::LuaRuntimePrivate::removeObject (void *object) {
-	this->objects.remove (object);
+void Nuria::LuaRuntimePrivate::removeObject (LuaWrapperUserData *data) {
+	if (data->slot < 1) {
+		return;
+	}
 	
-	// Remove 'object' out of reference table
-	// TODO: LUA probably did this for us. Maybe we can optimize this.
-	lua_getref (this->env, this->objectsTable);
-	lua_pushlightuserdata (this->env, object);
+	// The object may have been pushed again by now, under a new user data
+	if (this->objects.find (data->ptr) == data) {
+		this->objects.remove (data->ptr);
+	}
+	
+	// Lua 5.1 already removed the user data from the weak table when it
+	// was marked for finalization. Clear the slot anyway, so it's empty
+	// for sure before it's handed out again.
+	lua_rawgeti (this->env, LUA_REGISTRYINDEX, this->objectsTable);
 	lua_pushnil (this->env);
-	lua_settable (this->env, -3);
+	lua_rawseti (this->env, -2, data->slot);
+	lua_pop (this->env, 1);
 	
+	this->objects.releaseSlot (data->slot);
+	data->slot = 0;
 }
 
 bool Nuria::LuaRuntimePrivate::checkQObjectOwnership (LuaRuntime *runtime, LuaWrapperUserData *data) {
@@ -74,56 +183,67 @@ bool Nuria::LuaRuntimePrivate::checkQObjectOwnership (LuaRuntime *runtime, LuaWr
 }
 
 static Nuria::LuaWrapperUserData *newUserData (lua_State *env, void *object, int ref,
-                                               Nuria::MetaObject *meta, bool owned) {
+                                               Nuria::MetaObject *meta, bool owned,
+                                               size_t size = sizeof(Nuria::LuaWrapperUserData)) {
 	Nuria::LuaWrapperUserData *data;
-	data = (Nuria::LuaWrapperUserData *)lua_newuserdata (env, sizeof(Nuria::LuaWrapperUserData));
+	data = (Nuria::LuaWrapperUserData *)lua_newuserdata (env, size);
 	
+	data->magic = Nuria::LuaWrapperUserData::Magic;
 	data->meta = meta;
 	data->ptr = object;
 	data->owned = owned;
+	data->inlined = false;
 	data->reference = ref;
+	data->slot = 0;
+	data->parentRef = 0;
+	data->parentField = -1;
+	data->parentOffset = 0;
+	data->mirror = nullptr;
 	
 	return data;
 }
 
 void Nuria::LuaRuntimePrivate::pushOrCreateUserDataObject (void *object, Nuria::MetaObject *meta,
                                                            int metaTable, bool owned, int ref) {
-	LuaWrapperUserData *delegate = this->objects.value (object);
+	LuaWrapperUserData *delegate = this->objects.find (object);
 	
 //	nDebug() << "Pushing" << object << "- Already known to LUA:" << (delegate ? "yes" : "no");
 	
-	// Push objects table and 'object' onto stack
-	lua_getref (this->env, this->objectsTable);
-	lua_pushlightuserdata (this->env, object);
-	
-	// Is this object already known?
+	// Is this object already known? Then push it out of its slot.
 	if (delegate) {
-		
-		// Get reference out of the objects table in LUA
-		lua_gettable (this->env, -2);
+		lua_rawgeti (this->env, LUA_REGISTRYINDEX, this->objectsTable);
+		lua_rawgeti (this->env, -1, delegate->slot);
 		lua_replace (this->env, -2);
-		return;
+		if (!lua_isnil (this->env, -1)) {
+			return;
+		}
+		
+		// Lua 5.1 clears user data waiting for its finalizer from weak
+		// values, while it's still registered until the finalizer runs.
+		// Take the object away from the dying user data and start over.
+		lua_pop (this->env, 1);
+		this->objects.remove (object);
+		
+		// Inline objects are freed with their user data, push a copy
+		if (delegate->inlined) {
+			pushInlineObject (object, meta, metaTable);
+			return;
+		}
+		
+		owned = owned || delegate->owned;
+		delegate->owned = false;
+		delegate->ptr = nullptr;
 	}
 	
 	// Create new delegate structure
 	delegate = newUserData (this->env, object, ref, meta, owned);
-	this->objects.insert (object, delegate);
+	addObject (delegate);
 	
 	// Set up ownership
 	if (owned && checkQObjectOwnership (this->q_ptr, delegate)) {
 		static_cast< QObject * > (object)->setParent (this->q_ptr);
 	}
 	
-	// Copy 'delegate' before the table in the stack, we leave it there as return value
-	lua_pushvalue (this->env, -1);
-	lua_insert (this->env, lua_gettop (this->env) - 3);
-	
-	// Tell LUA about it. -3 = the table, -2 = lightuserdata -> 'object', -1 = 'delegate'
-	lua_settable (this->env, -3);
-	
-	// Pop the table from the stack and leave the copy of 'delegate' there.
-	lua_pop (this->env, 1);
-	
 	// Push wrapper onto stack and make it the userdatas metatable
 	lua_getref (this->env, metaTable);
 	lua_setmetatable (this->env, -2);
@@ -141,6 +261,117 @@ void Nuria::LuaRuntimePrivate::pushWrapperObject (Nuria::MetaObject *meta, int m
 	
 }
 
+bool Nuria::LuaRuntimePrivate::canStoreInline (MetaObject *meta) {
+	int type = meta->metaTypeId ();
+	return (type != QMetaType::UnknownType && QMetaType::sizeOf (type) > 0 &&
+	        !QMetaType::metaObjectForType (meta->pointerMetaTypeId ()));
+}
+
+// Pushes user data with room for an instance of 'type' behind it. 'ptr'
+// points to the still uninitialized instance.
+static Nuria::LuaWrapperUserData *newInlineUserData (lua_State *env, Nuria::MetaObject *meta) {
+	size_t size = sizeof(Nuria::LuaWrapperUserData) + inlineAlignment - 1 +
+	              size_t (QMetaType::sizeOf (meta->metaTypeId ()));
+	Nuria::LuaWrapperUserData *data = newUserData (env, nullptr, 0, meta, true, size);
+	
+	quintptr storage = quintptr (data + 1);
+	storage = (storage + inlineAlignment - 1) & ~quintptr (inlineAlignment - 1);
+	data->ptr = reinterpret_cast< void * > (storage);
+	data->inlined = true;
+	return data;
+}
+
+void Nuria::LuaRuntimePrivate::pushInlineObject (const void *object, MetaObject *meta, int metaTable) {
+	LuaWrapperUserData *data = newInlineUserData (this->env, meta);
+	QMetaType::construct (meta->metaTypeId (), data->ptr, object);
+	addObject (data);
+	
+	lua_getref (this->env, metaTable);
+	lua_setmetatable (this->env, -2);
+}
+
+// Pushes a view of 'meta' keeping the value at 'parentIdx' alive.
+static Nuria::LuaWrapperUserData *newChildView (lua_State *env, void *object, Nuria::MetaObject *meta,
+                                                int parentIdx, int metaTable) {
+	
+	// Views are not put into the objects table, as a field at offset 0
+	// shares its address with the parent.
+	Nuria::LuaWrapperUserData *data = newUserData (env, object, 0, meta, false);
+	
+	lua_pushvalue (env, parentIdx);
+	data->parentRef = luaL_ref (env, LUA_REGISTRYINDEX);
+	
+	// Set meta-table
+	lua_getref (env, metaTable);
+	lua_setmetatable (env, -2);
+	return data;
+}
+
+void Nuria::LuaRuntimePrivate::pushChildView (void *member, MetaObject *meta, int parentIdx) {
+	LuaMetaObjectWrapper *wrapper = findOrCreateWrapper (meta);
+	
+	LuaWrapperUserData *parent = (LuaWrapperUserData *)lua_touserdata (this->env, parentIdx);
+	LuaWrapperUserData *data = newChildView (this->env, member, meta, parentIdx, wrapper->reference ());
+	data->parentOffset = size_t ((char *)member - (char *)parent->ptr);
+}
+
+void Nuria::LuaRuntimePrivate::pushFieldView (QVariant &value, MetaObject *meta,
+                                              int parentIdx, int parentField) {
+	LuaMetaObjectWrapper *wrapper = findOrCreateWrapper (meta);
+	
+	// Take the value over, so it's not shared and data() doesn't copy it
+	QVariant *mirror = new QVariant;
+	mirror->swap (value);
+	LuaWrapperUserData *data = newChildView (this->env, mirror->data (), meta, parentIdx,
+	                                         wrapper->reference ());
+	data->parentField = parentField;
+	data->mirror = mirror;
+}
+
+// Returns the parent of the child view 'data', which is kept alive by it.
+static Nuria::LuaWrapperUserData *parentOf (lua_State *env, Nuria::LuaWrapperUserData *data) {
+	lua_getref (env, data->parentRef);
+	Nuria::LuaWrapperUserData *parent = (Nuria::LuaWrapperUserData *)lua_touserdata (env, -1);
+	lua_pop (env, 1);
+	return parent;
+}
+
+void Nuria::LuaRuntimePrivate::refreshChildView (lua_State *state, LuaWrapperUserData *data) {
+	if (data->parentRef == 0) {
+		return;
+	}
+	
+	// Views pointing into their parent follow it, it may have been moved
+	LuaWrapperUserData *parent = parentOf (state, data);
+	refreshChildView (state, parent);
+	if (data->parentField < 0) {
+		data->ptr = (char *)parent->ptr + data->parentOffset;
+		return;
+	}
+	
+	// Take over the freshly read value, views into the mirror follow it
+	QVariant value = parent->meta->field (data->parentField).read (parent->ptr);
+	if (value.userType () == data->meta->metaTypeId ()) {
+		data->mirror->swap (value);
+		data->ptr = data->mirror->data ();
+	}
+	
+}
+
+void Nuria::LuaRuntimePrivate::writeBackChildView (lua_State *state, LuaWrapperUserData *data) {
+	if (data->parentRef == 0) {
+		return;
+	}
+	
+	LuaWrapperUserData *parent = parentOf (state, data);
+	if (data->parentField >= 0) {
+		parent->meta->field (data->parentField).write (parent->ptr, *data->mirror);
+	}
+	
+	// The parent may itself mirror a field
+	writeBackChildView (state, parent);
+}
+
 bool Nuria::LuaRuntimePrivate::invokeGarbageHandler (bool owned, void *object, MetaObject *meta) {
 	LuaRuntime::Ownership o = (owned) ? LuaRuntime::OwnedByLua : LuaRuntime::OwnedByCpp;
 	if ((this->handlerFlags & o) == 0) {
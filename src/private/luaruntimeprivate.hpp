@@ -17,12 +17,29 @@
 #ifndef NURIA_LUARUNTIMEPRIVATE_HPP
 #define NURIA_LUARUNTIMEPRIVATE_HPP
 
+#include "luatypeconverters.hpp"
 #include "luastructures.hpp"
+#include "luaobjectregistry.hpp"
+#include "luainvokequeue.hpp"
 #include "../nuria/luaruntime.hpp"
 #include "../nuria/luavalue.hpp"
 #include <lua.hpp>
+#include <QHash>
+#include <QVector>
+#include <QPair>
+#include <QSet>
 
 namespace Nuria {
+class LuaValuePrivate;
+
+/* Interned key, see LuaRuntimePrivate::pushKey(). */
+class Q_DECL_HIDDEN LuaCachedKey {
+public:
+	
+	int ref; // Registry reference of the Lua string
+	bool used; // Was it pushed since the clock hand passed it?
+	
+};
 
 class Q_DECL_HIDDEN LuaRuntimePrivate {
 public:
@@ -32,24 +49,119 @@ public:
 	LuaMetaObjectWrapper *findWrapper (MetaObject *metaObject);
 	LuaMetaObjectWrapper *findOrCreateWrapper (MetaObject *metaObject);
 	
-	void addObject (void *userData);
-	bool hasObject (void *object);
-	void *userDataOfObject (void *object);
-	void removeObject (void *object);
+	/** Registers the user data \a data at the top of the stack. */
+	void addObject (LuaWrapperUserData *data);
+	
+	/** Unregisters \a data, called when it's collected. */
+	void removeObject (LuaWrapperUserData *data);
 	
 	bool checkQObjectOwnership(LuaRuntime *runtime, LuaWrapperUserData *data);
 	void pushOrCreateUserDataObject (void *object, MetaObject *meta,
 					 int metaTable, bool owned, int ref = 0);
 	void pushWrapperObject (MetaObject *meta, int metaTable);
 	
+	/**
+	 * Returns \c true if instances of \a meta can be stored inside their
+	 * user data. This is the case for value types, but not for QObjects.
+	 */
+	bool canStoreInline (MetaObject *meta);
+	
+	/**
+	 * Pushes a copy of \a object, which is constructed right behind the
+	 * LuaWrapperUserData in the same allocation. It's owned by Lua and
+	 * destructed in place when collected. If \a object is \c nullptr,
+	 * the instance is default-constructed.
+	 */
+	void pushInlineObject (const void *object, MetaObject *meta, int metaTable);
+	
+	/**
+	 * Pushes a view onto \a member, which is a field of the structure at
+	 * \a parentIdx. The view keeps the parent alive and points into its
+	 * storage through the offset of \a member, so it never copies.
+	 */
+	void pushChildView (void *member, MetaObject *meta, int parentIdx);
+	
+	/**
+	 * Pushes a view onto the field \a parentField of the structure at
+	 * \a parentIdx, whose address is unknown. The view takes over
+	 * \a value, which mirrors the field, see refreshChildView().
+	 */
+	void pushFieldView (QVariant &value, MetaObject *meta, int parentIdx, int parentField);
+	
+	/**
+	 * Updates the child view \a data from its parent, which is refreshed
+	 * first: Views into the parent re-apply their offset, as the parent
+	 * may have moved, and mirrors re-read their field. Must be called
+	 * before 'ptr' of user data is used. Does nothing for user data which
+	 * isn't a child view.
+	 */
+	void refreshChildView (lua_State *state, LuaWrapperUserData *data);
+	
+	/**
+	 * Writes the field mirrored by the child view \a data into its parent,
+	 * and so on up to the root. Call refreshChildView() before changing it.
+	 */
+	void writeBackChildView (lua_State *state, LuaWrapperUserData *data);
+	
 	bool invokeGarbageHandler (bool owned, void *object, MetaObject *meta);	
 	
+	/**
+	 * Returns the wrapper of the value at \a idx if it's user data created
+	 * by us, else \c nullptr. Call refreshChildView() before using its
+	 * 'ptr'. \a state is the Lua thread whose stack \a idx refers to.
+	 */
+	LuaWrapperUserData *wrapperData (lua_State *state, int idx);
+	
+	LuaWrapperUserData *wrapperData (int idx)
+	{ return wrapperData (this->env, idx); }
+	
+	/**
+	 * Pushes \a key onto the stack. Short keys are interned: They're
+	 * encoded once and kept in the registry, so pushing them again is a
+	 * simple look-up instead of encoding and hashing it in Lua again.
+	 * 
+	 * The cache is bounded. Once it's full, a clock sweep evicts a key
+	 * which wasn't pushed since the last pass, so one-off keys don't keep
+	 * hot keys out for good.
+	 */
+	void pushKey (const QString &key);
+	
+	/** Returns \c true if \a meta is \a base or derives from it. */
+	bool inherits (MetaObject *meta, MetaObject *base);
+	
+	/**
+	 * Returns the converter for the Qt type \a type. It's returned by
+	 * value, as registering a converter may grow the table.
+	 */
+	LuaTypeConverter converter (int type) {
+		if (type >= this->converters.size ()) {
+			this->converters.resize (type + 1);
+		}
+		
+		LuaTypeConverter &result = this->converters[type];
+		if (!result.resolved) {
+			LuaBuiltinConverters::resolve (type, result);
+		}
+		
+		return result;
+	}
+	
 	// Variables
 	lua_State *env = nullptr;
 	LuaValues lastResults;
 	QMap< MetaObject *, LuaMetaObjectWrapper * > wrappers;
-	QMap< void *, LuaWrapperUserData * > objects;
-	int objectsTable;
+	LuaObjectRegistry objects;
+	QSet< const void * > wrapperMetaTables;
+	QHash< QPair< MetaObject *, MetaObject * >, bool > inheritance;
+	int objectsTable; // Weak table of user data by slot, see LuaObjectRegistry
+	LuaTypeConverters converters = LuaBuiltinConverters::create ();
+	int byteArrayThreshold = -1; // Disabled by default
+	LuaRuntime::StringConversion stringConversion = LuaRuntime::ToQString;
+	QHash< QString, LuaCachedKey > keyCache;
+	QVector< QString > keyClock; // Cached keys in clock order
+	int keyClockHand = 0;
+	LuaInvokeQueue postedClosures;
+	QSet< LuaValuePrivate * > pendingTables; // Values with an unconverted table, see LuaValue
 	
 	// 
 	LuaRuntime::ObjectHandler objectHandler;
@@ -57,6 +169,7 @@ public:
 	
 	// 
 	int nuriaTableRef;
+	int batchDriverRef = LUA_NOREF; // See LuaRuntime::callBatch()
 	
 	
 };
@@ -0,0 +1,265 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "luaschedulerworker.hpp"
+
+#include <QElapsedTimer>
+#include <QDateTime>
+#include <lua.hpp>
+
+#include "../nuria/luaruntime.hpp"
+#include "../nuria/luavalue.hpp"
+
+void Nuria::LuaTaskDeque::push (LuaPendingTask task) {
+	QMutexLocker locker (&this->mutex);
+	this->tasks.push_back (std::move (task));
+}
+
+bool Nuria::LuaTaskDeque::take (LuaPendingTask &task) {
+	QMutexLocker locker (&this->mutex);
+	if (this->tasks.empty ()) {
+		return false;
+	}
+	
+	task = std::move (this->tasks.back ());
+	this->tasks.pop_back ();
+	return true;
+}
+
+bool Nuria::LuaTaskDeque::steal (LuaPendingTask &task) {
+	QMutexLocker locker (&this->mutex);
+	if (this->tasks.empty ()) {
+		return false;
+	}
+	
+	task = std::move (this->tasks.front ());
+	this->tasks.pop_front ();
+	return true;
+}
+
+int Nuria::LuaTaskDeque::size () const {
+	QMutexLocker locker (&this->mutex);
+	return int (this->tasks.size ());
+}
+
+Nuria::LuaSchedulerWorker::LuaSchedulerWorker (LuaSchedulerPrivate *scheduler, int index)
+	: running (0), started (0), finished (0), steals (0), busyTime (0),
+	  startTime (QDateTime::currentMSecsSinceEpoch ()), scheduler (scheduler), index (index)
+{
+
+}
+
+void Nuria::LuaSchedulerWorker::run () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	if (this->scheduler->setup) {
+		this->scheduler->setup (&runtime);
+	}
+	
+	// 
+	QElapsedTimer timer;
+	LuaPendingTask pending;
+	while (this->scheduler->stopping.load () == 0) {
+		timer.start ();
+		wakeParkedTasks ();
+		
+		// Give each started task a chance to run
+		int count = this->runQueue.size ();
+		for (int i = 0; i < count; i++) {
+			LuaRunningTask task = this->runQueue.dequeue ();
+			if (resumeTask (&runtime, task)) {
+				this->runQueue.enqueue (task);
+			}
+			
+		}
+		
+		// Start a new task
+		bool gotTask = takeTask (pending);
+		if (gotTask) {
+			startTask (&runtime, pending);
+		}
+		
+		this->busyTime.fetchAndAddRelaxed (timer.nsecsElapsed ());
+		if (!gotTask) {
+			idle (!this->runQueue.isEmpty ());
+		}
+		
+	}
+	
+	// Drop unfinished tasks, closing the runtime collects them. Channels
+	// may outlive this worker, so remove the watchers first.
+	for (LuaRunningTask &task : this->parked) {
+		task.channel.unwatch (task.watcher);
+	}
+	
+	this->running.store (0);
+	this->runQueue.clear ();
+	this->parked.clear ();
+	
+}
+
+bool Nuria::LuaSchedulerWorker::takeTask (LuaPendingTask &task) {
+	if (this->scheduler->pending.load () == 0) {
+		return false;
+	}
+	
+	// Prefer own tasks
+	if (this->deque.take (task)) {
+		this->scheduler->pending.deref ();
+		return true;
+	}
+	
+	// Steal from the other workers, starting at the next one
+	int count = this->scheduler->workers.size ();
+	for (int i = 1; i < count; i++) {
+		LuaSchedulerWorker *victim = this->scheduler->workers.at ((this->index + i) % count);
+		if (victim->deque.steal (task)) {
+			this->scheduler->pending.deref ();
+			this->steals.fetchAndAddRelaxed (1);
+			return true;
+		}
+		
+	}
+	
+	return false;
+}
+
+void Nuria::LuaSchedulerWorker::startTask (LuaRuntime *runtime, const LuaPendingTask &task) {
+	lua_State *env = (lua_State *)runtime->luaState ();
+	this->started.fetchAndAddRelaxed (1);
+	
+	// Compile the script into the new thread
+	lua_State *thread = lua_newthread (env);
+	int r = luaL_loadbuffer (thread, task.script.constData (), task.script.length (), "task");
+	if (r != 0) {
+		QString message = QString::fromUtf8 (lua_tostring (thread, -1));
+		lua_pop (env, 1);
+		
+		this->finished.fetchAndAddRelaxed (1);
+		emit this->scheduler->q_ptr->taskFailed (task.id, message);
+		return;
+	}
+	
+	// The thread stays alive as long as it's referenced
+	LuaRunningTask running { task.id, thread, luaL_ref (env, LUA_REGISTRYINDEX), LuaChannel (), 0 };
+	this->running.ref ();
+	
+	if (resumeTask (runtime, running)) {
+		this->runQueue.enqueue (running);
+	}
+	
+}
+
+bool Nuria::LuaSchedulerWorker::resumeTask (LuaRuntime *runtime, LuaRunningTask &task) {
+	lua_State *env = (lua_State *)runtime->luaState ();
+	
+	// Tasks yielding a channel wait for it, all others are polled
+	int r = lua_resume (task.thread, 0);
+	if (r == LUA_YIELD) {
+		task.channel = LuaChannel::fromStack (task.thread, 1);
+		lua_settop (task.thread, 0);
+		return !parkTask (task);
+	}
+	
+	// Finished or failed
+	if (r == 0) {
+		QVariant result;
+		if (lua_gettop (task.thread) > 0) {
+			lua_xmove (task.thread, env, 1);
+			result = LuaValue::fromStack (runtime, -1).toVariant ();
+			lua_pop (env, 1);
+		}
+		
+		emit this->scheduler->q_ptr->taskFinished (task.id, result);
+	} else {
+		QString message = QString::fromUtf8 (lua_tostring (task.thread, -1));
+		emit this->scheduler->q_ptr->taskFailed (task.id, message);
+	}
+	
+	// 
+	luaL_unref (env, LUA_REGISTRYINDEX, task.reference);
+	this->running.deref ();
+	this->finished.fetchAndAddRelaxed (1);
+	return false;
+}
+
+bool Nuria::LuaSchedulerWorker::parkTask (LuaRunningTask &task) {
+	if (!task.channel.isValid ()) {
+		return false;
+	}
+	
+	// Called by the thread sending or receiving. Spurious wake ups are
+	// fine, the task yields the channel again.
+	int id = task.id;
+	task.watcher = task.channel.watch ([this, id]() {
+		QMutexLocker wokenLocker (&this->wokenMutex);
+		this->woken.append (id);
+		wokenLocker.unlock ();
+		
+		QMutexLocker locker (&this->scheduler->mutex);
+		this->scheduler->wakeUp.wakeAll ();
+	});
+	
+	if (task.watcher == 0) {
+		task.channel = LuaChannel ();
+		return false;
+	}
+	
+	this->parked.insert (id, task);
+	return true;
+}
+
+void Nuria::LuaSchedulerWorker::wakeParkedTasks () {
+	QVector< int > ids;
+	
+	QMutexLocker locker (&this->wokenMutex);
+	ids.swap (this->woken);
+	locker.unlock ();
+	
+	for (int id : ids) {
+		auto it = this->parked.find (id);
+		if (it != this->parked.end ()) {
+			it->channel = LuaChannel ();
+			this->runQueue.enqueue (*it);
+			this->parked.erase (it);
+		}
+		
+	}
+	
+}
+
+void Nuria::LuaSchedulerWorker::idle (bool hasRunningTasks) {
+	QMutexLocker locker (&this->scheduler->mutex);
+	if (this->scheduler->pending.load () != 0 || this->scheduler->stopping.load () != 0) {
+		return;
+	}
+	
+	// Don't sleep if a channel woke a task meanwhile
+	QMutexLocker wokenLocker (&this->wokenMutex);
+	bool hasWokenTasks = !this->woken.isEmpty ();
+	wokenLocker.unlock ();
+	
+	if (hasWokenTasks) {
+		return;
+	}
+	
+	// Tasks which yielded something else than a channel are polled
+	if (hasRunningTasks) {
+		this->scheduler->wakeUp.wait (&this->scheduler->mutex, 1);
+	} else {
+		this->scheduler->wakeUp.wait (&this->scheduler->mutex);
+	}
+	
+}
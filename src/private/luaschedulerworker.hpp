@@ -0,0 +1,132 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NURIA_LUASCHEDULERWORKER_HPP
+#define NURIA_LUASCHEDULERWORKER_HPP
+
+#include <QWaitCondition>
+#include <QAtomicInteger>
+#include <QByteArray>
+#include <QThread>
+#include <QVector>
+#include <QMutex>
+#include <QQueue>
+#include <QHash>
+#include <deque>
+
+#include "../nuria/luascheduler.hpp"
+#include "../nuria/luachannel.hpp"
+
+struct lua_State;
+
+namespace Nuria {
+
+class LuaSchedulerWorker;
+
+// A task which hasn't been started yet
+struct Q_DECL_HIDDEN LuaPendingTask {
+	int id;
+	QByteArray script;
+};
+
+// A started task, living as coroutine in the runtime of a worker
+struct Q_DECL_HIDDEN LuaRunningTask {
+	int id;
+	lua_State *thread;
+	int reference; // Keeps 'thread' alive
+	LuaChannel channel; // Channel the task is parked on, if any
+	int watcher; // See LuaChannel::watch()
+};
+
+/*
+ * Deque of pending tasks of a worker. The worker pushes and takes at the
+ * bottom, thieves take from the top, so the worker keeps the recently added
+ * tasks while thieves take the oldest ones. Each deque has its own lock,
+ * which is only contended while stealing.
+ */
+class Q_DECL_HIDDEN LuaTaskDeque {
+public:
+	
+	void push (LuaPendingTask task);
+	bool take (LuaPendingTask &task);
+	bool steal (LuaPendingTask &task);
+	int size () const;
+	
+private:
+	mutable QMutex mutex;
+	std::deque< LuaPendingTask > tasks;
+	
+};
+
+class Q_DECL_HIDDEN LuaSchedulerPrivate {
+public:
+	LuaScheduler *q_ptr;
+	LuaScheduler::Setup setup;
+	QVector< LuaSchedulerWorker * > workers;
+	
+	QAtomicInt nextId;
+	QAtomicInt nextWorker;
+	QAtomicInt pending; // Count of pending tasks of all workers
+	QAtomicInt stopping;
+	
+	// Idle workers wait on this for new tasks
+	QMutex mutex;
+	QWaitCondition wakeUp;
+	
+};
+
+class Q_DECL_HIDDEN LuaSchedulerWorker : public QThread {
+public:
+	
+	LuaSchedulerWorker (LuaSchedulerPrivate *scheduler, int index);
+	
+	LuaTaskDeque deque;
+	
+	// Statistics, written by the worker only
+	QAtomicInt running;
+	QAtomicInteger< qint64 > started;
+	QAtomicInteger< qint64 > finished;
+	QAtomicInteger< qint64 > steals;
+	QAtomicInteger< qint64 > busyTime; // nsec
+	QAtomicInteger< qint64 > startTime; // msec since epoch
+	
+protected:
+	void run () override;
+	
+private:
+	bool takeTask (LuaPendingTask &task);
+	void startTask (LuaRuntime *runtime, const LuaPendingTask &task);
+	bool resumeTask (LuaRuntime *runtime, LuaRunningTask &task);
+	bool parkTask (LuaRunningTask &task);
+	void wakeParkedTasks ();
+	void idle (bool hasRunningTasks);
+	
+	// 
+	LuaSchedulerPrivate *scheduler;
+	int index;
+	QQueue< LuaRunningTask > runQueue;
+	
+	// Tasks waiting for a channel, by id. Channels put the ids of tasks to
+	// resume into 'woken' from any thread.
+	QHash< int, LuaRunningTask > parked;
+	QMutex wokenMutex;
+	QVector< int > woken;
+	
+};
+
+}
+
+#endif // NURIA_LUASCHEDULERWORKER_HPP
@@ -17,9 +17,15 @@
 #include "luastackutils.hpp"
 
 #include "luacallbacktrampoline.hpp"
+#include "luabytearray.hpp"
+#include "luastringutils.hpp"
 #include "../nuria/luaruntime.hpp"
 #include "luaruntimeprivate.hpp"
+#include "../nuria/luacontainer.hpp"
+#include "../nuria/luabuffer.hpp"
+#include "../nuria/luachannel.hpp"
 #include <nuria/callback.hpp>
+#include <algorithm>
 
 Nuria::LuaValues Nuria::LuaStackUtils::popResultsFromStack (LuaRuntime *runtime, int oldTop) {
 	
@@ -68,49 +74,13 @@ void Nuria::LuaStackUtils::pushManyVariantsOnStack (LuaRuntime *runtime, const Q
 }
 
 void Nuria::LuaStackUtils::pushVariantOnStack (LuaRuntime *runtime, const QVariant &variant) {
-	lua_State *env = (lua_State *)runtime->luaState ();
-	int type = variant.userType ();
+	LuaTypeConverter converter = runtime->d_ptr->converter (variant.userType ());
 	
-	switch (type) {
-	default:
-		if (type == qMetaTypeId< Callback > ()) {
-			LuaCallbackTrampoline::pushCallbackOnStack (runtime, variant.value< Callback > ());
-			return;
-		} else if (type == qMetaTypeId< LuaObject > ()) {
-			variant.value< LuaObject > ().pushOnStack ();
-		}
-		
-		// 
+	// Built-in or user-registered converter?
+	if (converter.push) {
+		converter.push (runtime, variant);
+	} else {
 		pushCObjectOnStack (runtime, variant);
-		break;
-		
-	case QMetaType::Int:
-	case QMetaType::Float:
-	case QMetaType::Double:
-		lua_pushnumber (env, variant.toDouble ());
-		break;
-		
-	case QMetaType::Bool:
-		lua_pushboolean (env, variant.toBool ());
-		break;
-		
-	case QMetaType::QString:
-		lua_pushstring (env, variant.toString ().toUtf8 ().constData ());
-		break;
-		
-	case QMetaType::QByteArray: {
-		QByteArray data = variant.toByteArray ();
-		lua_pushlstring (env, data.constData (), data.length ());
-	} break;
-		
-	case QMetaType::QVariantList:
-		pushVariantListOnStack (runtime, variant.toList ());
-		break;
-		
-	case QMetaType::QVariantMap:
-		pushVariantMapOnStack (runtime, variant.toMap ());
-		break;
-		
 	}
 	
 }
@@ -126,8 +96,7 @@ void Nuria::LuaStackUtils::pushVariantMapOnStack (LuaRuntime *runtime, const QVa
 	for (; it != end; ++it) {
 		
 		// Push key
-		QByteArray key = it.key ().toUtf8 ();
-		lua_pushstring (env, key.constData ()); // Key at -2
+		runtime->d_ptr->pushKey (it.key ()); // Key at -2
 		
 		// Push value and create table element
 		pushVariantOnStack (runtime, it.value ()); // Value at -1
@@ -149,7 +118,7 @@ void Nuria::LuaStackUtils::pushVariantListOnStack (LuaRuntime *runtime, const QV
 }
 
 void Nuria::LuaStackUtils::pushCObjectOnStack (LuaRuntime *runtime, const QVariant &variant) {
-	LuaObject obj = LuaValue (runtime, variant).object ();
+	LuaObject obj = LuaObject::fromVariant (variant, runtime);
 	
 	if (obj.isValid ()) {
 		obj.pushOnStack ();
@@ -159,6 +128,48 @@ void Nuria::LuaStackUtils::pushCObjectOnStack (LuaRuntime *runtime, const QVaria
 	
 }
 
+void Nuria::LuaStackUtils::pushLuaObjectOnStack (LuaObject object) {
+	object.pushOnStack ();
+}
+
+void Nuria::LuaStackUtils::pushLuaTableOnStack (LuaRuntime *runtime, const LuaTable &table) {
+	if (table.runtime () == runtime) {
+		table.pushOnStack ();
+	} else {
+		pushVariantOnStack (runtime, table.toVariant ());
+	}
+	
+}
+
+void Nuria::LuaStackUtils::pushLuaBufferOnStack (LuaRuntime *runtime, const LuaBuffer &buffer) {
+	buffer.pushOnStack (runtime);
+}
+
+void Nuria::LuaStackUtils::pushLuaChannelOnStack (LuaRuntime *runtime, const LuaChannel &channel) {
+	channel.pushOnStack (runtime);
+}
+
+void Nuria::LuaStackUtils::pushLuaChannelOnStack (LuaRuntime *runtime, lua_State *env, const LuaChannel &channel) {
+	channel.pushOnStack (runtime, env);
+}
+
+void Nuria::LuaStackUtils::pushByteArrayOnStack (LuaRuntime *runtime, const QByteArray &data) {
+	lua_State *env = (lua_State *)runtime->luaState ();
+	int threshold = runtime->d_ptr->byteArrayThreshold;
+	
+	// Share large payloads instead of copying them into Lua
+	if (threshold >= 0 && data.length () >= threshold) {
+		LuaByteArray::push (env, data);
+	} else {
+		lua_pushlstring (env, data.constData (), data.length ());
+	}
+	
+}
+
+void Nuria::LuaStackUtils::pushKeyOnStack (LuaRuntime *runtime, const QString &key) {
+	runtime->d_ptr->pushKey (key);
+}
+
 QVariant Nuria::LuaStackUtils::luaValuesToVariant (const Nuria::LuaValues &values) {
 	
 	if (values.isEmpty ()) {
@@ -181,6 +192,11 @@ QVariant Nuria::LuaStackUtils::luaValuesToVariant (const Nuria::LuaValues &value
 
 #include <nuria/logger.hpp>
 QVariant Nuria::LuaStackUtils::variantFromStack (LuaRuntime *runtime, int idx, bool takeOwnership) {
+	return variantFromStack (runtime, idx, takeOwnership, runtime->d_ptr->stringConversion);
+}
+
+QVariant Nuria::LuaStackUtils::variantFromStack (LuaRuntime *runtime, int idx, bool takeOwnership,
+                                                 LuaRuntime::StringConversion conversion) {
 	lua_State *env = (lua_State *)runtime->luaState ();
 	int type = lua_type (env, idx);
 	
@@ -188,16 +204,34 @@ QVariant Nuria::LuaStackUtils::variantFromStack (LuaRuntime *runtime, int idx, b
 	case LUA_TNIL: return QVariant ();
 	case LUA_TNUMBER: return lua_tonumber (env, idx);
 	case LUA_TBOOLEAN: return bool (lua_toboolean (env, idx));
-	case LUA_TSTRING: {
-		size_t len = 0;
-		const char *str = lua_tolstring (env, idx, &len);
-		return (str) ? QString::fromUtf8 (str, len) : QVariant ();
-	}
-	case LUA_TTABLE: return tableFromStack (runtime, idx, takeOwnership);
+	case LUA_TSTRING: return stringFromStack (runtime, idx, conversion);
+	case LUA_TTABLE: return tableFromStack (runtime, idx, takeOwnership, conversion);
 	case LUA_TFUNCTION: return LuaCallbackTrampoline::functionFromStack (runtime, idx);
 	case LUA_TUSERDATA: {
-		void *ptr = const_cast< void * > (lua_topointer (env, idx));
-		LuaWrapperUserData *data = (LuaWrapperUserData *)ptr;
+		LuaWrapperUserData *data = runtime->d_ptr->wrapperData (idx);
+		if (!data) { // Byte array, channel or container proxy?
+			LuaByteArray *bytes = LuaByteArray::at (env, idx);
+			if (bytes) {
+				return bytes->bytes ();
+			}
+			
+			LuaChannel channel = LuaChannel::fromStack (env, idx);
+			if (channel.isValid ()) {
+				return QVariant::fromValue (channel);
+			}
+			
+			const QVariant *container = Internal::LuaContainerHelper::container (env, idx);
+			return (container) ? *container : QVariant ();
+		}
+		
+		runtime->d_ptr->refreshChildView (env, data);
+		
+		// Objects stored inside their user data can't be taken, pass a copy
+		if (takeOwnership && data->inlined) {
+			void *copy = QMetaType::create (data->meta->metaTypeId (), data->ptr);
+			return QVariant (data->meta->pointerMetaTypeId (), &copy);
+		}
+		
 		if (takeOwnership) { data->owned = false; }
 		return QVariant (data->meta->pointerMetaTypeId (), &data->ptr);
 	}
@@ -210,57 +244,152 @@ QVariant Nuria::LuaStackUtils::variantFromStack (LuaRuntime *runtime, int idx, b
 	return QVariant ();
 }
 
-QVariant Nuria::LuaStackUtils::tableFromStack (LuaRuntime *runtime, int idx, bool takeOwnership) {
+QVariant Nuria::LuaStackUtils::stringFromStack (LuaRuntime *runtime, int idx,
+                                                LuaRuntime::StringConversion conversion) {
+	lua_State *env = (lua_State *)runtime->luaState ();
+	if (conversion == LuaRuntime::ToQString) {
+		return LuaStringUtils::toString (env, idx);
+	}
+	
+	size_t len = 0;
+	const char *str = lua_tolstring (env, idx, &len);
+	return QByteArray (str, int (len));
+}
+
+QVariant Nuria::LuaStackUtils::stringFromBytes (LuaRuntime::StringConversion conversion, const QByteArray &bytes) {
+	if (conversion == LuaRuntime::ToByteArray) {
+		return bytes;
+	}
+	
+	return QString::fromUtf8 (bytes);
+}
+
+QVariant Nuria::LuaStackUtils::typedVariantFromStack (LuaRuntime *runtime, int idx, int targetType) {
+	LuaTypeConverter converter = runtime->d_ptr->converter (targetType);
+	
+	if (converter.read) {
+		return converter.read (runtime, idx);
+	}
+	
+	return LuaValue::fromStack (runtime, idx).toVariant ();
+}
+
+QVariant Nuria::LuaStackUtils::tableFromStack (LuaRuntime *runtime, int idx, bool takeOwnership,
+                                               LuaRuntime::StringConversion conversion) {
 	QVariantList list;
-	QVariantMap map;
+	LuaTablePairs pairs;
 	
-	traverseTable (runtime, map, list, idx, takeOwnership);
+	traverseTable (runtime, pairs, list, idx, takeOwnership, conversion);
 	
 	// Is it a map?
-	if (!map.isEmpty ()) {
-		mergeTable (map, list);
-		return map;
+	if (!pairs.isEmpty ()) {
+		mergeTable (pairs, list);
+		return pairsToMap (pairs);
 	}
 	
 	// It's a list
 	return list;
 }
 
-void Nuria::LuaStackUtils::traverseTable (LuaRuntime *runtime, QVariantMap &map, QVariantList &list, int idx,
-                                          bool takeOwnership) {
+void Nuria::LuaStackUtils::traverseTable (LuaRuntime *runtime, LuaTablePairs &pairs, QVariantList &list, int idx,
+                                          bool takeOwnership, LuaRuntime::StringConversion conversion) {
 	lua_State *env = (lua_State *)runtime->luaState ();
-	double num = 0.f;
+	if (idx < 0 && idx > LUA_REGISTRYINDEX) {
+		idx = lua_gettop (env) + idx + 1;
+	}
 	
-	// 
-	lua_pushvalue (env, idx); // -2 = the table
+	// Read the array part directly. Stop at the first hole, as the length
+	// is only guaranteed to be a border.
+	int length = int (lua_objlen (env, idx));
+	list.reserve (length);
+	
+	for (int i = 1; i <= length; i++) {
+		lua_rawgeti (env, idx, i);
+		if (lua_isnil (env, -1)) {
+			lua_pop (env, 1);
+			length = i - 1;
+			break;
+		}
+		
+		list.append (variantFromStack (runtime, -1, takeOwnership, conversion));
+		lua_pop (env, 1);
+	}
+	
+	// Collect all other pairs
 	lua_pushnil (env); // -1 = first key
-	while (lua_next (env, -2) != 0) {
+	while (lua_next (env, idx) != 0) {
 		
 		// -1 = Value
 		// -2 = Key
-		// -3 = Table
-		// Type of the key. If it's the next index, append it to 'list'.
-		if (lua_isnumber (env, -2) && (num = lua_tonumber (env, -2)) == list.length () + 1) {
-			list.append (variantFromStack (runtime, -1, takeOwnership));
-		} else {
-			QString key = variantFromStack (runtime, -2, takeOwnership).toString ();
-			map.insert (key, variantFromStack (runtime, -1, takeOwnership));
+		if (!isArrayKey (env, -2, length)) {
+			QString key = (lua_type (env, -2) == LUA_TSTRING)
+			              ? LuaStringUtils::toString (env, -2)
+			              : variantFromStack (runtime, -2, takeOwnership, conversion).toString ();
+			pairs.append (qMakePair (key, variantFromStack (runtime, -1, takeOwnership, conversion)));
 		}
 		
 		// Remove the value from stack
 		lua_pop (env, 1);
 	}
 	
-	// 
-	lua_pop (env, 1);
-	
 }
 
-void Nuria::LuaStackUtils::mergeTable (QVariantMap &map, const QVariantList &list) {
-	auto it = map.constBegin ();
+void Nuria::LuaStackUtils::mergeTable (LuaTablePairs &pairs, const QVariantList &list) {
+	pairs.reserve (pairs.size () + list.length ());
 	
+	// Lua indices start at 1
 	for (int i = 0; i < list.length (); i++) {
-		it = map.insert (it, QString::number (i), list.at (i));
+		pairs.append (qMakePair (QString::number (i + 1), list.at (i)));
+	}
+	
+}
+
+QVariantMap Nuria::LuaStackUtils::pairsToMap (LuaTablePairs &pairs) {
+	QVariantMap map;
+	
+	// Sorted pairs can be appended to the map in amortized constant time
+	std::sort (pairs.begin (), pairs.end (), [](const QPair< QString, QVariant > &left,
+	                                            const QPair< QString, QVariant > &right) {
+		return left.first < right.first;
+	});
+	
+	for (const QPair< QString, QVariant > &pair : pairs) {
+		map.insert (map.constEnd (), pair.first, pair.second);
+	}
+	
+	return map;
+}
+
+bool Nuria::LuaStackUtils::isArrayKey (lua_State *env, int idx, int length) {
+	if (lua_type (env, idx) != LUA_TNUMBER) {
+		return false;
+	}
+	
+	lua_Number key = lua_tonumber (env, idx);
+	return (key >= 1 && key <= length && key == lua_Number (int (key)));
+}
+
+bool Nuria::LuaStackUtils::isSequence (lua_State *env, int idx, int &length, int *keyCount) {
+	length = int (lua_objlen (env, idx));
+	bool isArray = (length > 0);
+	int count = 0;
+	
+	lua_pushnil (env);
+	while (lua_next (env, idx) != 0) {
+		lua_pop (env, 1);
+		count++;
+		isArray = isArray && count <= length && isArrayKey (env, -1, length);
+		
+		if (!isArray && !keyCount) {
+			lua_pop (env, 1); // Key of the aborted traversal
+			break;
+		}
+		
+	}
+	
+	if (keyCount) {
+		*keyCount = count;
 	}
 	
+	return (isArray && count == length);
 }
@@ -18,13 +18,21 @@
 #define NURIA_LUASTACKUTILS_HPP
 
 #include <nuria/callback.hpp>
+#include "../nuria/luaruntime.hpp"
 #include "../nuria/luavalue.hpp"
+#include <QVector>
+#include <QPair>
 #include <lua.hpp>
 
 namespace Nuria {
 
+class LuaBuffer;
+class LuaChannel;
 class LuaRuntime;
 
+// Key/value pairs of a table which are not part of its sequence
+typedef QVector< QPair< QString, QVariant > > LuaTablePairs;
+
 class Q_DECL_HIDDEN LuaStackUtils {
 public:
 	
@@ -38,14 +46,38 @@ public:
 	static void pushVariantMapOnStack (LuaRuntime *runtime, const QVariantMap &map);
 	static void pushVariantListOnStack (LuaRuntime *runtime, const QVariantList &list);
 	static void pushCObjectOnStack (LuaRuntime *runtime, const QVariant &variant);
+	static void pushLuaObjectOnStack (LuaObject object);
+	static void pushLuaTableOnStack (LuaRuntime *runtime, const LuaTable &table);
+	static void pushLuaBufferOnStack (LuaRuntime *runtime, const LuaBuffer &buffer);
+	static void pushLuaChannelOnStack (LuaRuntime *runtime, const LuaChannel &channel);
+	static void pushLuaChannelOnStack (LuaRuntime *runtime, lua_State *env, const LuaChannel &channel);
+	static void pushByteArrayOnStack (LuaRuntime *runtime, const QByteArray &data);
+	static void pushKeyOnStack (LuaRuntime *runtime, const QString &key);
 	
 	static QVariant luaValuesToVariant (const LuaValues &values);
 	
 	static QVariant variantFromStack (LuaRuntime *runtime, int idx, bool takeOwnership = false);
-	static QVariant tableFromStack (LuaRuntime *runtime, int idx, bool takeOwnership);
-	static void traverseTable (LuaRuntime *runtime, QVariantMap &map, QVariantList &list, int idx,
-	                           bool takeOwnership);
-	static void mergeTable (QVariantMap &map, const QVariantList &list);
+	static QVariant variantFromStack (LuaRuntime *runtime, int idx, bool takeOwnership,
+	                                  LuaRuntime::StringConversion conversion);
+	static QVariant typedVariantFromStack (LuaRuntime *runtime, int idx, int targetType);
+	static QVariant stringFromStack (LuaRuntime *runtime, int idx, LuaRuntime::StringConversion conversion);
+	static QVariant stringFromBytes (LuaRuntime::StringConversion conversion, const QByteArray &bytes);
+	static QVariant tableFromStack (LuaRuntime *runtime, int idx, bool takeOwnership,
+	                                LuaRuntime::StringConversion conversion);
+	static void traverseTable (LuaRuntime *runtime, LuaTablePairs &pairs, QVariantList &list, int idx,
+	                           bool takeOwnership, LuaRuntime::StringConversion conversion);
+	static void mergeTable (LuaTablePairs &pairs, const QVariantList &list);
+	static QVariantMap pairsToMap (LuaTablePairs &pairs);
+	
+	// Returns true if the key at 'idx' is an integer from 1 to 'length'
+	static bool isArrayKey (lua_State *env, int idx, int length);
+	
+	// Returns true if the table at the absolute index 'idx' only has the
+	// keys 1 to its length. The length alone isn't enough, as it may be any
+	// border of a table with holes. 'length' is set to the length. Stops at
+	// the first other key, unless 'keyCount' is given, which receives the
+	// count of all keys.
+	static bool isSequence (lua_State *env, int idx, int &length, int *keyCount = nullptr);
 		
 	
 };
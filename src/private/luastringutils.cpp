@@ -0,0 +1,117 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "luastringutils.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Strings up to this length (In UTF-16 units) are encoded on the stack
+static const int shortStringLength = 512;
+
+void Nuria::LuaStringUtils::pushString (lua_State *env, const QString &string) {
+	const ushort *data = string.utf16 ();
+	int length = string.length ();
+	
+	if (length <= shortStringLength) {
+		char buffer[shortStringLength * 3];
+		lua_pushlstring (env, buffer, encodeUtf8 (buffer, data, length));
+		return;
+	}
+	
+	// Encode longer strings chunk-wise directly into the buffer of Lua
+	luaL_Buffer buffer;
+	luaL_buffinit (env, &buffer);
+	
+	while (length > 0) {
+		int chunk = qMin (length, int (LUAL_BUFFERSIZE / 3));
+		
+		// Don't split surrogate pairs
+		if (chunk < length && QChar::isHighSurrogate (data[chunk - 1])) {
+			chunk--;
+		}
+		
+		char *out = luaL_prepbuffer (&buffer);
+		luaL_addsize (&buffer, encodeUtf8 (out, data, chunk));
+		data += chunk;
+		length -= chunk;
+	}
+	
+	luaL_pushresult (&buffer);
+}
+
+QString Nuria::LuaStringUtils::toString (lua_State *env, int idx) {
+	size_t len = 0;
+	const char *str = lua_tolstring (env, idx, &len);
+	
+	// QString::fromUtf8() already has a SIMD path for ASCII
+	return (str) ? QString::fromUtf8 (str, int (len)) : QString ();
+}
+
+int Nuria::LuaStringUtils::encodeUtf8 (char *out, const ushort *in, int length) {
+	char *begin = out;
+	int i = 0;
+	
+	while (i < length) {
+#ifdef __SSE2__
+		// Narrow runs of ASCII characters eight at a time
+		const __m128i nonAscii = _mm_set1_epi16 (short (0xff80));
+		const __m128i zero = _mm_setzero_si128 ();
+		
+		for (; i + 8 <= length; i += 8, out += 8) {
+			__m128i chunk = _mm_loadu_si128 (reinterpret_cast< const __m128i * > (in + i));
+			__m128i ascii = _mm_cmpeq_epi16 (_mm_and_si128 (chunk, nonAscii), zero);
+			if (_mm_movemask_epi8 (ascii) != 0xffff) {
+				break;
+			}
+			
+			_mm_storel_epi64 (reinterpret_cast< __m128i * > (out), _mm_packus_epi16 (chunk, chunk));
+		}
+		
+		if (i >= length) {
+			break;
+		}
+#endif
+		
+		ushort c = in[i++];
+		if (c < 0x80) {
+			*out++ = char (c);
+		} else if (c < 0x800) {
+			*out++ = char (0xc0 | (c >> 6));
+			*out++ = char (0x80 | (c & 0x3f));
+		} else if (QChar::isHighSurrogate (c) && i < length && QChar::isLowSurrogate (in[i])) {
+			uint code = QChar::surrogateToUcs4 (c, in[i++]);
+			*out++ = char (0xf0 | (code >> 18));
+			*out++ = char (0x80 | ((code >> 12) & 0x3f));
+			*out++ = char (0x80 | ((code >> 6) & 0x3f));
+			*out++ = char (0x80 | (code & 0x3f));
+		} else {
+			
+			// Lone surrogates are replaced
+			if (QChar::isSurrogate (c)) {
+				c = QChar::ReplacementCharacter;
+			}
+			
+			*out++ = char (0xe0 | (c >> 12));
+			*out++ = char (0x80 | ((c >> 6) & 0x3f));
+			*out++ = char (0x80 | (c & 0x3f));
+		}
+		
+	}
+	
+	return int (out - begin);
+}
@@ -0,0 +1,51 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NURIA_LUASTRINGUTILS_HPP
+#define NURIA_LUASTRINGUTILS_HPP
+
+#include <QString>
+#include <lua.hpp>
+
+namespace Nuria {
+
+/*
+ * Transcoding between QString and Lua strings. Strings are encoded straight
+ * into a stack buffer or the buffer of Lua, without going through a
+ * temporary QByteArray. Runs of ASCII characters are processed in blocks
+ * using SSE2 where available.
+ */
+class Q_DECL_HIDDEN LuaStringUtils {
+public:
+	
+	/** Pushes \a string UTF-8 encoded onto the stack of \a env. */
+	static void pushString (lua_State *env, const QString &string);
+	
+	/** Returns the string at \a idx, which is decoded from UTF-8. */
+	static QString toString (lua_State *env, int idx);
+	
+	/**
+	 * Encodes \a length UTF-16 units from \a in to UTF-8 into \a out,
+	 * which must have space for <tt>length * 3</tt> bytes. Returns the
+	 * count of bytes written.
+	 */
+	static int encodeUtf8 (char *out, const ushort *in, int length);
+	
+};
+
+}
+
+#endif // NURIA_LUASTRINGUTILS_HPP
@@ -18,16 +18,39 @@
 #define NURIA_LUASTRUCTURES_HPP
 
 #include <nuria/metaobject.hpp>
+#include "../nuria/luaclassbinding.hpp"
 
 namespace Nuria {
 
 class Q_DECL_HIDDEN LuaWrapperUserData {
 public:
 	
+	// Tag identifying user data created by us, see LuaRuntimePrivate::wrapperData()
+	static constexpr quint32 Magic = 0x4e4c5755; // "NLWU"
+	
+	quint32 magic; // Always 'Magic'
 	bool owned; // Does Lua own the object?
+	bool inlined = false; // Is 'ptr' stored inside this user data? See LuaRuntimePrivate::pushInlineObject()
 	int reference = 0; // Lua table which extends upon 'ptr'
 	void *ptr = nullptr; // The object
 	MetaObject *meta; // MetaObject of 'ptr'
+	int slot = 0; // Slot in the objects table, 0 if not registered
+	
+	// Child views of a field of another structure, see LuaRuntimePrivate::pushChildView()
+	int parentRef = 0; // Keeps the parent alive
+	int parentField = -1; // Field to write back to, -1 if 'ptr' points into the parent
+	size_t parentOffset = 0; // Offset of 'ptr' in the parent if 'parentField' is -1
+	QVariant *mirror = nullptr; // Value of 'parentField' holding 'ptr', else nullptr
+	
+};
+
+// Natively bound field, see LuaClassBinding. The member pointer follows
+// directly after this structure.
+class Q_DECL_HIDDEN LuaNativeAccessor {
+public:
+	
+	Internal::LuaClassBindingHelper::Getter getter;
+	Internal::LuaClassBindingHelper::Setter setter;
 	
 };
 
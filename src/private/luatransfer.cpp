@@ -0,0 +1,197 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "luatransfer.hpp"
+
+#include <QMetaType>
+
+#include "luametaobjectwrapper.hpp"
+#include "luaruntimeprivate.hpp"
+#include "luastructures.hpp"
+#include "luabytearray.hpp"
+
+// Maximum nesting of tables
+static const int maxDepth = 200;
+
+Nuria::LuaTransfer::LuaTransfer (LuaRuntime *source, LuaRuntime *target)
+	: source (source), target (target), from (source->d_ptr->env), to (target->d_ptr->env)
+{
+
+}
+
+bool Nuria::LuaTransfer::transfer (int idx) {
+	int fromTop = lua_gettop (this->from);
+	int toTop = lua_gettop (this->to);
+	if (idx < 0 && idx > LUA_REGISTRYINDEX) {
+		idx = fromTop + idx + 1;
+	}
+	
+	if (!lua_checkstack (this->to, 4)) {
+		return fail (QStringLiteral("Out of stack space"));
+	}
+	
+	// 
+	lua_newtable (this->to);
+	this->copies = toTop + 1;
+	
+	bool success = copyValue (idx, 0);
+	lua_settop (this->from, fromTop);
+	
+	if (!success) {
+		lua_settop (this->to, toTop);
+		return false;
+	}
+	
+	// Replace the copies table with the result
+	lua_replace (this->to, this->copies);
+	return true;
+}
+
+bool Nuria::LuaTransfer::copyValue (int idx, int depth) {
+	int type = lua_type (this->from, idx);
+	
+	switch (type) {
+	case LUA_TNIL:
+		lua_pushnil (this->to);
+		return true;
+	case LUA_TBOOLEAN:
+		lua_pushboolean (this->to, lua_toboolean (this->from, idx));
+		return true;
+	case LUA_TNUMBER:
+		lua_pushnumber (this->to, lua_tonumber (this->from, idx));
+		return true;
+	case LUA_TSTRING: {
+		size_t length = 0;
+		const char *str = lua_tolstring (this->from, idx, &length);
+		lua_pushlstring (this->to, str, length);
+		return true;
+	}
+	case LUA_TLIGHTUSERDATA:
+		lua_pushlightuserdata (this->to, lua_touserdata (this->from, idx));
+		return true;
+	case LUA_TTABLE:
+		return copyTable (idx, depth + 1);
+	case LUA_TUSERDATA:
+		return copyUserData (idx);
+	}
+	
+	return fail (QStringLiteral("Can't transfer a value of type %1")
+	             .arg (QLatin1String (lua_typename (this->from, type))));
+}
+
+bool Nuria::LuaTransfer::copyTable (int idx, int depth) {
+	if (findCopy (idx)) {
+		return true;
+	}
+	
+	if (depth > maxDepth) {
+		return fail (QStringLiteral("Table is nested too deeply"));
+	}
+	
+	if (!lua_checkstack (this->from, 3) || !lua_checkstack (this->to, 4)) {
+		return fail (QStringLiteral("Out of stack space"));
+	}
+	
+	// Remember the copy before descending, so cycles end up here again
+	lua_createtable (this->to, int (lua_objlen (this->from, idx)), 0);
+	rememberCopy (idx);
+	
+	lua_pushnil (this->from);
+	while (lua_next (this->from, idx) != 0) {
+		int top = lua_gettop (this->from);
+		if (!copyValue (top - 1, depth) || !copyValue (top, depth)) {
+			return false;
+		}
+		
+		lua_rawset (this->to, -3);
+		lua_pop (this->from, 1);
+	}
+	
+	return true;
+}
+
+bool Nuria::LuaTransfer::copyUserData (int idx) {
+	if (findCopy (idx)) {
+		return true;
+	}
+	
+	// Byte arrays share the data
+	LuaByteArray *bytes = LuaByteArray::at (this->from, idx);
+	if (bytes) {
+		LuaByteArray::push (this->to, bytes->data, bytes->offset, bytes->length);
+		rememberCopy (idx);
+		return true;
+	}
+	
+	LuaWrapperUserData *data = this->source->d_ptr->wrapperData (idx);
+	if (!data) {
+		return fail (QStringLiteral("Can't transfer foreign user data"));
+	}
+	
+	this->source->d_ptr->refreshChildView (this->from, data);
+	LuaRuntimePrivate *d = this->target->d_ptr;
+	LuaMetaObjectWrapper *wrapper = d->findOrCreateWrapper (data->meta);
+	bool isQObject = (QMetaType::metaObjectForType (data->meta->pointerMetaTypeId ()) != nullptr);
+	
+	if (!data->ptr) {
+		
+		// The class itself
+		d->pushWrapperObject (data->meta, wrapper->reference ());
+	} else if (!data->owned && data->parentRef == 0) {
+		
+		// Owned by C++, both runtimes can share it
+		d->pushOrCreateUserDataObject (data->ptr, data->meta, wrapper->reference (), false);
+	} else if (d->canStoreInline (data->meta)) {
+		
+		// Owned by the source or a view into another structure: Copy it
+		d->pushInlineObject (data->ptr, data->meta, wrapper->reference ());
+	} else if (!isQObject) {
+		void *copy = QMetaType::create (data->meta->metaTypeId (), data->ptr);
+		if (!copy) {
+			return fail (QStringLiteral("Can't copy a %1").arg (QLatin1String (data->meta->className ())));
+		}
+		
+		d->pushOrCreateUserDataObject (copy, data->meta, wrapper->reference (), true);
+	} else {
+		return fail (QStringLiteral("Can't transfer a QObject owned by the source runtime"));
+	}
+	
+	rememberCopy (idx);
+	return true;
+}
+
+bool Nuria::LuaTransfer::findCopy (int idx) {
+	lua_pushlightuserdata (this->to, (void *)lua_topointer (this->from, idx));
+	lua_rawget (this->to, this->copies);
+	
+	if (lua_isnil (this->to, -1)) {
+		lua_pop (this->to, 1);
+		return false;
+	}
+	
+	return true;
+}
+
+void Nuria::LuaTransfer::rememberCopy (int idx) {
+	lua_pushlightuserdata (this->to, (void *)lua_topointer (this->from, idx));
+	lua_pushvalue (this->to, -2);
+	lua_rawset (this->to, this->copies);
+}
+
+bool Nuria::LuaTransfer::fail (const QString &message) {
+	this->error = message;
+	return false;
+}
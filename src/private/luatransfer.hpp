@@ -0,0 +1,70 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NURIA_LUATRANSFER_HPP
+#define NURIA_LUATRANSFER_HPP
+
+#include <QString>
+#include <lua.hpp>
+
+namespace Nuria {
+
+class LuaRuntime;
+
+/*
+ * Deep-copies values from the stack of one runtime onto the stack of
+ * another one. Each table and user data is copied once, so shared sub-tables
+ * and cycles are preserved. Meta tables of tables are not copied.
+ * 
+ * Wrapped objects owned by C++ are shared. Structures owned by the source
+ * runtime are copied, with the copy being owned by the target runtime.
+ * QObjects owned by the source runtime can't be transferred.
+ */
+class Q_DECL_HIDDEN LuaTransfer {
+public:
+	
+	LuaTransfer (LuaRuntime *source, LuaRuntime *target);
+	
+	/**
+	 * Copies the value at \a idx of the source and pushes it onto the
+	 * stack of the target. On failure, nothing is pushed.
+	 */
+	bool transfer (int idx);
+	
+	QString errorString () const
+	{ return this->error; }
+	
+private:
+	bool copyValue (int idx, int depth);
+	bool copyTable (int idx, int depth);
+	bool copyUserData (int idx);
+	bool findCopy (int idx);
+	void rememberCopy (int idx);
+	bool fail (const QString &message);
+	
+	// 
+	LuaRuntime *source;
+	LuaRuntime *target;
+	lua_State *from;
+	lua_State *to;
+	int copies = 0; // Index of the table in 'to' mapping originals to copies
+	QString error;
+	
+};
+
+}
+
+#endif // NURIA_LUATRANSFER_HPP
@@ -0,0 +1,290 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "luatypeconverters.hpp"
+
+#include <nuria/metaobject.hpp>
+#include <nuria/callback.hpp>
+#include <QStringList>
+#include <QDateTime>
+#include <QUuid>
+#include <QUrl>
+#include <lua.hpp>
+
+#include "luacallbacktrampoline.hpp"
+#include "luabytearray.hpp"
+#include "luastringutils.hpp"
+#include "luastackutils.hpp"
+#include "../nuria/luabuffer.hpp"
+#include "../nuria/luachannel.hpp"
+#include "../nuria/luanativefunction.hpp"
+
+// Helpers to access the value inside a QVariant without converting it
+template< typename T >
+static inline const T &valueOf (const QVariant &variant) {
+	return *static_cast< const T * > (variant.constData ());
+}
+
+static inline lua_State *stateOf (Nuria::LuaRuntime *runtime) {
+	return (lua_State *)runtime->luaState ();
+}
+
+static inline void pushUtf8 (lua_State *env, const QString &string) {
+	Nuria::LuaStringUtils::pushString (env, string);
+}
+
+static inline bool isStringLike (lua_State *env, int idx) {
+	int type = lua_type (env, idx);
+	return (type == LUA_TSTRING || type == LUA_TNUMBER);
+}
+
+static inline QString readUtf8 (lua_State *env, int idx) {
+	return Nuria::LuaStringUtils::toString (env, idx);
+}
+
+// Push converters
+static void pushNil (Nuria::LuaRuntime *runtime, const QVariant &) {
+	lua_pushnil (stateOf (runtime));
+}
+
+static void pushBool (Nuria::LuaRuntime *runtime, const QVariant &value) {
+	lua_pushboolean (stateOf (runtime), valueOf< bool > (value));
+}
+
+template< typename T >
+static void pushNumber (Nuria::LuaRuntime *runtime, const QVariant &value) {
+	lua_pushnumber (stateOf (runtime), lua_Number (valueOf< T > (value)));
+}
+
+static void pushString (Nuria::LuaRuntime *runtime, const QVariant &value) {
+	pushUtf8 (stateOf (runtime), valueOf< QString > (value));
+}
+
+static void pushByteArray (Nuria::LuaRuntime *runtime, const QVariant &value) {
+	Nuria::LuaStackUtils::pushByteArrayOnStack (runtime, valueOf< QByteArray > (value));
+}
+
+static void pushStringLike (Nuria::LuaRuntime *runtime, const QVariant &value) {
+	pushUtf8 (stateOf (runtime), value.toString ());
+}
+
+static void pushDateTime (Nuria::LuaRuntime *runtime, const QVariant &value) {
+	pushUtf8 (stateOf (runtime), valueOf< QDateTime > (value).toString (Qt::ISODate));
+}
+
+static void pushDate (Nuria::LuaRuntime *runtime, const QVariant &value) {
+	pushUtf8 (stateOf (runtime), valueOf< QDate > (value).toString (Qt::ISODate));
+}
+
+static void pushTime (Nuria::LuaRuntime *runtime, const QVariant &value) {
+	pushUtf8 (stateOf (runtime), valueOf< QTime > (value).toString (Qt::ISODate));
+}
+
+static void pushStringList (Nuria::LuaRuntime *runtime, const QVariant &value) {
+	lua_State *env = stateOf (runtime);
+	const QStringList &list = valueOf< QStringList > (value);
+	
+	lua_createtable (env, list.length (), 0);
+	for (int i = 0; i < list.length (); i++) {
+		pushUtf8 (env, list.at (i));
+		lua_rawseti (env, -2, i + 1);
+	}
+	
+}
+
+static void pushVariantList (Nuria::LuaRuntime *runtime, const QVariant &value) {
+	Nuria::LuaStackUtils::pushVariantListOnStack (runtime, valueOf< QVariantList > (value));
+}
+
+static void pushVariantMap (Nuria::LuaRuntime *runtime, const QVariant &value) {
+	Nuria::LuaStackUtils::pushVariantMapOnStack (runtime, valueOf< QVariantMap > (value));
+}
+
+static void pushVariantHash (Nuria::LuaRuntime *runtime, const QVariant &value) {
+	lua_State *env = stateOf (runtime);
+	const QVariantHash &hash = valueOf< QVariantHash > (value);
+	
+	lua_createtable (env, 0, hash.count ());
+	for (auto it = hash.constBegin (), end = hash.constEnd (); it != end; ++it) {
+		Nuria::LuaStackUtils::pushKeyOnStack (runtime, it.key ());
+		Nuria::LuaStackUtils::pushVariantOnStack (runtime, it.value ());
+		lua_rawset (env, -3);
+	}
+	
+}
+
+static void pushPointer (Nuria::LuaRuntime *runtime, const QVariant &value) {
+	lua_pushlightuserdata (stateOf (runtime), valueOf< void * > (value));
+}
+
+static void pushCallback (Nuria::LuaRuntime *runtime, const QVariant &value) {
+	Nuria::LuaCallbackTrampoline::pushCallbackOnStack (runtime, valueOf< Nuria::Callback > (value));
+}
+
+static void pushLuaObject (Nuria::LuaRuntime *runtime, const QVariant &value) {
+	Nuria::LuaObject object = valueOf< Nuria::LuaObject > (value);
+	if (object.isValid ()) {
+		Nuria::LuaStackUtils::pushLuaObjectOnStack (object);
+	} else {
+		lua_pushnil (stateOf (runtime));
+	}
+	
+}
+
+static void pushLuaTable (Nuria::LuaRuntime *runtime, const QVariant &value) {
+	Nuria::LuaStackUtils::pushLuaTableOnStack (runtime, valueOf< Nuria::LuaTable > (value));
+}
+
+static void pushLuaBuffer (Nuria::LuaRuntime *runtime, const QVariant &value) {
+	Nuria::LuaStackUtils::pushLuaBufferOnStack (runtime, valueOf< Nuria::LuaBuffer > (value));
+}
+
+static void pushLuaChannel (Nuria::LuaRuntime *runtime, const QVariant &value) {
+	Nuria::LuaStackUtils::pushLuaChannelOnStack (runtime, valueOf< Nuria::LuaChannel > (value));
+}
+
+// Read converters
+static QVariant readBool (Nuria::LuaRuntime *runtime, int idx) {
+	return bool (lua_toboolean (stateOf (runtime), idx));
+}
+
+template< typename T >
+static QVariant readNumber (Nuria::LuaRuntime *runtime, int idx) {
+	lua_State *env = stateOf (runtime);
+	if (!lua_isnumber (env, idx)) {
+		return Nuria::LuaStackUtils::variantFromStack (runtime, idx);
+	}
+	
+	return QVariant::fromValue (Nuria::Internal::luaNumberCast< T > (lua_tonumber (env, idx)));
+}
+
+static QVariant readString (Nuria::LuaRuntime *runtime, int idx) {
+	lua_State *env = stateOf (runtime);
+	if (isStringLike (env, idx)) {
+		return readUtf8 (env, idx);
+	}
+	
+	Nuria::LuaByteArray *bytes = Nuria::LuaByteArray::at (env, idx);
+	return (bytes) ? QString::fromUtf8 (bytes->constData (), bytes->length) : QVariant ();
+}
+
+static QVariant readByteArray (Nuria::LuaRuntime *runtime, int idx) {
+	QByteArray result;
+	if (!Nuria::LuaByteArray::read (stateOf (runtime), idx, result)) {
+		return QVariant ();
+	}
+	
+	return result;
+}
+
+static QVariant readDateTime (Nuria::LuaRuntime *runtime, int idx) {
+	lua_State *env = stateOf (runtime);
+	return (isStringLike (env, idx)) ? QDateTime::fromString (readUtf8 (env, idx), Qt::ISODate) : QVariant ();
+}
+
+static QVariant readDate (Nuria::LuaRuntime *runtime, int idx) {
+	lua_State *env = stateOf (runtime);
+	return (isStringLike (env, idx)) ? QDate::fromString (readUtf8 (env, idx), Qt::ISODate) : QVariant ();
+}
+
+static QVariant readTime (Nuria::LuaRuntime *runtime, int idx) {
+	lua_State *env = stateOf (runtime);
+	return (isStringLike (env, idx)) ? QTime::fromString (readUtf8 (env, idx), Qt::ISODate) : QVariant ();
+}
+
+static QVariant readUrl (Nuria::LuaRuntime *runtime, int idx) {
+	lua_State *env = stateOf (runtime);
+	return (isStringLike (env, idx)) ? QUrl (readUtf8 (env, idx)) : QVariant ();
+}
+
+static QVariant readUuid (Nuria::LuaRuntime *runtime, int idx) {
+	lua_State *env = stateOf (runtime);
+	return (isStringLike (env, idx)) ? QVariant::fromValue (QUuid (readUtf8 (env, idx))) : QVariant ();
+}
+
+Nuria::LuaTypeConverters Nuria::LuaBuiltinConverters::create () {
+	LuaTypeConverters table (QMetaType::HighestInternalId + 1);
+	
+	insert (table, QMetaType::UnknownType, &pushNil, nullptr);
+	insert (table, QMetaType::Bool, &pushBool, &readBool);
+	
+	// Numbers
+	insert (table, QMetaType::Int, &pushNumber< int >, &readNumber< int >);
+	insert (table, QMetaType::UInt, &pushNumber< uint >, &readNumber< uint >);
+	insert (table, QMetaType::LongLong, &pushNumber< qlonglong >, &readNumber< qlonglong >);
+	insert (table, QMetaType::ULongLong, &pushNumber< qulonglong >, &readNumber< qulonglong >);
+	insert (table, QMetaType::Long, &pushNumber< long >, &readNumber< long >);
+	insert (table, QMetaType::ULong, &pushNumber< ulong >, &readNumber< ulong >);
+	insert (table, QMetaType::Short, &pushNumber< short >, &readNumber< short >);
+	insert (table, QMetaType::UShort, &pushNumber< ushort >, &readNumber< ushort >);
+	insert (table, QMetaType::Char, &pushNumber< char >, &readNumber< char >);
+	insert (table, QMetaType::SChar, &pushNumber< signed char >, &readNumber< signed char >);
+	insert (table, QMetaType::UChar, &pushNumber< uchar >, &readNumber< uchar >);
+	insert (table, QMetaType::Float, &pushNumber< float >, &readNumber< float >);
+	insert (table, QMetaType::Double, &pushNumber< double >, &readNumber< double >);
+	
+	// Strings and types with a canonical string representation
+	insert (table, QMetaType::QString, &pushString, &readString);
+	insert (table, QMetaType::QByteArray, &pushByteArray, &readByteArray);
+	insert (table, QMetaType::QChar, &pushStringLike, &readString);
+	insert (table, QMetaType::QDateTime, &pushDateTime, &readDateTime);
+	insert (table, QMetaType::QDate, &pushDate, &readDate);
+	insert (table, QMetaType::QTime, &pushTime, &readTime);
+	insert (table, QMetaType::QUrl, &pushStringLike, &readUrl);
+	insert (table, QMetaType::QUuid, &pushStringLike, &readUuid);
+	
+	// Containers
+	insert (table, QMetaType::QStringList, &pushStringList, nullptr);
+	insert (table, QMetaType::QVariantList, &pushVariantList, nullptr);
+	insert (table, QMetaType::QVariantMap, &pushVariantMap, nullptr);
+	insert (table, QMetaType::QVariantHash, &pushVariantHash, nullptr);
+	
+	// Others
+	insert (table, QMetaType::VoidStar, &pushPointer, nullptr);
+	insert (table, qMetaTypeId< Callback > (), &pushCallback, nullptr);
+	insert (table, qMetaTypeId< LuaObject > (), &pushLuaObject, nullptr);
+	insert (table, qMetaTypeId< LuaTable > (), &pushLuaTable, nullptr);
+	insert (table, qMetaTypeId< LuaBuffer > (), &pushLuaBuffer, nullptr);
+	insert (table, qMetaTypeId< LuaChannel > (), &pushLuaChannel, nullptr);
+	
+	return table;
+}
+
+void Nuria::LuaBuiltinConverters::resolve (int type, LuaTypeConverter &converter) {
+	QByteArray name (QMetaType::typeName (type));
+	
+	// Pointer types point to the structure with the MetaObject
+	converter.isPointer = name.endsWith ('*');
+	if (converter.isPointer) {
+		name.chop (1);
+	}
+	
+	// 
+	converter.meta = (name.isEmpty ()) ? nullptr : MetaObject::byName (name);
+	converter.resolved = true;
+}
+
+void Nuria::LuaBuiltinConverters::insert (LuaTypeConverters &table, int type, LuaRuntime::PushConverter push,
+                                          LuaRuntime::ReadConverter read) {
+	if (type >= table.size ()) {
+		table.resize (type + 1);
+	}
+	
+	LuaTypeConverter &converter = table[type];
+	converter.push = push;
+	converter.read = read;
+	converter.resolved = true;
+}
@@ -0,0 +1,61 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NURIA_LUATYPECONVERTERS_HPP
+#define NURIA_LUATYPECONVERTERS_HPP
+
+#include "../nuria/luaruntime.hpp"
+#include <QVector>
+
+namespace Nuria {
+
+class MetaObject;
+
+/* Conversion information of a Qt meta type, indexed by its type id. */
+class Q_DECL_HIDDEN LuaTypeConverter {
+public:
+	
+	LuaRuntime::PushConverter push = nullptr;
+	LuaRuntime::ReadConverter read = nullptr;
+	
+	// Only valid if 'resolved' is true
+	MetaObject *meta = nullptr; // MetaObject of the (pointed to) type
+	bool isPointer = false; // Is this a pointer type?
+	bool resolved = false;
+	
+};
+
+typedef QVector< LuaTypeConverter > LuaTypeConverters;
+
+/* internal class providing the built-in converters. */
+class Q_DECL_HIDDEN LuaBuiltinConverters {
+public:
+	
+	/** Returns the converter table for a new runtime. */
+	static LuaTypeConverters create ();
+	
+	/** Resolves the MetaObject of \a type into \a converter. */
+	static void resolve (int type, LuaTypeConverter &converter);
+	
+private:
+	static void insert (LuaTypeConverters &table, int type, LuaRuntime::PushConverter push,
+	                    LuaRuntime::ReadConverter read);
+	
+};
+
+}
+
+#endif // NURIA_LUATYPECONVERTERS_HPP
@@ -0,0 +1,453 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QtTest/QtTest>
+#include <QJsonDocument>
+#include <QObject>
+#include <numeric>
+
+#include <nuria/luaruntime.hpp>
+#include <nuria/luabuffer.hpp>
+#include <nuria/luajson.hpp>
+#include <nuria/luapack.hpp>
+#include <nuria/luaparallel.hpp>
+#include <nuria/luatable.hpp>
+#include <nuria/callback.hpp>
+#include "structures.hpp"
+
+using namespace Nuria;
+
+class LuaRuntimeBenchmark : public QObject {
+	Q_OBJECT
+private slots:
+	
+	// Calling C++ from Lua
+	void callNativeFunction ();
+	void callCallbackFunction ();
+	
+	// Passing data to Lua
+	void pushVariantMap ();
+	
+	// Reading data from Lua
+	void readNumberArray ();
+	void readStringMap ();
+	
+	// Numeric data
+	void writeNumericBuffer ();
+	
+	// JSON
+	void decodeJson ();
+	void decodeJsonThroughVariant ();
+	void encodeJson ();
+	void encodeJsonThroughVariant ();
+	
+	// MessagePack
+	void packValue ();
+	void unpackValue ();
+	
+	// Calling Lua from C++ per row
+	void callPerRow ();
+	void callBatch ();
+	void callBatchBuffer ();
+	
+	// Expressions
+	void evaluateThroughGlobals ();
+	void evaluateExpression ();
+	void evaluateExpressionColumns ();
+	
+	// Wrapped C++ objects
+	void pushCollectObjects ();
+	void createStructures ();
+	
+	// Parallel map
+	void parallelMap_data ();
+	void parallelMap ();
+	
+};
+
+static const char *callLoopScript = "local s = 0\n"
+                                    "for i = 1, 10000 do s = s + add (i, 1) end\n"
+                                    "return s";
+
+static int addNumbers (int a, int b) {
+	return a + b;
+}
+
+void LuaRuntimeBenchmark::callNativeFunction () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	runtime.registerFunction ("add", &addNumbers);
+	
+	QBENCHMARK {
+		runtime.execute (callLoopScript);
+	}
+	
+	QCOMPARE(runtime.lastResult ().toVariant ().toInt (), 50015000);
+}
+
+void LuaRuntimeBenchmark::callCallbackFunction () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	runtime.setGlobal ("add", QVariant::fromValue (Callback::fromLambda ([](int a, int b) { return a + b; })));
+	
+	QBENCHMARK {
+		runtime.execute (callLoopScript);
+	}
+	
+	QCOMPARE(runtime.lastResult ().toVariant ().toInt (), 50015000);
+}
+
+void LuaRuntimeBenchmark::pushVariantMap () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	QVariantMap map;
+	for (int i = 0; i < 20; i++) {
+		map.insert (QStringLiteral("field") + QString::number (i), QStringLiteral("A value of some length"));
+	}
+	
+	QBENCHMARK {
+		for (int i = 0; i < 1000; i++) {
+			runtime.setGlobal ("map", map);
+		}
+		
+	}
+	
+	QVERIFY(runtime.hasGlobal ("map"));
+}
+
+void LuaRuntimeBenchmark::readNumberArray () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	runtime.execute ("numbers = {} for i = 1, 1000000 do numbers[i] = i end");
+	LuaTable numbers = runtime.global ("numbers").table ();
+	
+	QVariant result;
+	QBENCHMARK {
+		result = numbers.toVariant ();
+	}
+	
+	QCOMPARE(result.toList ().length (), 1000000);
+}
+
+void LuaRuntimeBenchmark::readStringMap () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	runtime.execute ("map = {} for i = 1, 100000 do map['key' .. i] = i end");
+	LuaTable map = runtime.global ("map").table ();
+	
+	QVariant result;
+	QBENCHMARK {
+		result = map.toVariant ();
+	}
+	
+	QCOMPARE(result.toMap ().size (), 100000);
+}
+
+void LuaRuntimeBenchmark::writeNumericBuffer () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	QVector< double > samples (10000, 1.0);
+	LuaBuffer buffer = LuaBuffer::wrap (&runtime, samples.data (), samples.size ());
+	runtime.setGlobal ("samples", QVariant::fromValue (buffer));
+	
+	QBENCHMARK {
+		runtime.execute ("for i = 1, #samples do samples[i] = samples[i] + 1 end");
+	}
+	
+	QVERIFY(samples.first () > 1.0);
+}
+
+static QByteArray jsonDocument () {
+	QByteArray json ("[");
+	for (int i = 0; i < 10000; i++) {
+		json += (i ? "," : "");
+		json += "{\"id\":" + QByteArray::number (i) + ",\"name\":\"Item number " +
+		        QByteArray::number (i) + "\",\"price\":" + QByteArray::number (i * 0.25) +
+		        ",\"tags\":[\"a\",\"b\"],\"active\":true}";
+	}
+	
+	return json + "]";
+}
+
+void LuaRuntimeBenchmark::decodeJson () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	QByteArray json = jsonDocument ();
+	
+	LuaValue result;
+	QBENCHMARK {
+		result = LuaJson::decode (&runtime, json);
+	}
+	
+	QCOMPARE(result.type (), LuaValue::Table);
+}
+
+void LuaRuntimeBenchmark::decodeJsonThroughVariant () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	QByteArray json = jsonDocument ();
+	
+	QBENCHMARK {
+		runtime.setGlobal ("data", QJsonDocument::fromJson (json).toVariant ());
+	}
+	
+	QVERIFY(runtime.hasGlobal ("data"));
+}
+
+void LuaRuntimeBenchmark::encodeJson () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	LuaValue data = LuaJson::decode (&runtime, jsonDocument ());
+	
+	QByteArray result;
+	QBENCHMARK {
+		result = LuaJson::encode (data);
+	}
+	
+	QVERIFY(!result.isEmpty ());
+}
+
+void LuaRuntimeBenchmark::encodeJsonThroughVariant () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	LuaValue data = LuaJson::decode (&runtime, jsonDocument ());
+	
+	QByteArray result;
+	QBENCHMARK {
+		result = QJsonDocument::fromVariant (data.table ().toVariant ()).toJson (QJsonDocument::Compact);
+	}
+	
+	QVERIFY(!result.isEmpty ());
+}
+
+void LuaRuntimeBenchmark::packValue () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	LuaValue data = LuaJson::decode (&runtime, jsonDocument ());
+	
+	QByteArray result;
+	QBENCHMARK {
+		result = LuaPack::pack (data);
+	}
+	
+	QVERIFY(!result.isEmpty ());
+}
+
+void LuaRuntimeBenchmark::unpackValue () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	QByteArray packed = LuaPack::pack (LuaJson::decode (&runtime, jsonDocument ()));
+	
+	LuaValue result;
+	QBENCHMARK {
+		result = LuaPack::unpack (&runtime, packed);
+	}
+	
+	QCOMPARE(result.type (), LuaValue::Table);
+}
+
+static const char *scoreScript = "function score (x) return x * 0.5 + 1 end";
+
+static QVariantList rows () {
+	QVariantList list;
+	for (int i = 0; i < 10000; i++) {
+		list.append (double (i));
+	}
+	
+	return list;
+}
+
+void LuaRuntimeBenchmark::callPerRow () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	runtime.execute (scoreScript);
+	QVariantList input = rows ();
+	
+	QVariantList result;
+	QBENCHMARK {
+		result.clear ();
+		for (const QVariant &row : input) {
+			runtime.setGlobal ("row", row);
+			runtime.execute ("return score (row)");
+			result.append (runtime.lastResult ().toVariant ());
+		}
+		
+	}
+	
+	QCOMPARE(result.length (), input.length ());
+}
+
+void LuaRuntimeBenchmark::callBatch () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	runtime.execute (scoreScript);
+	QVariantList input = rows ();
+	
+	QVariantList result;
+	QBENCHMARK {
+		result = runtime.callBatch ("score", input);
+	}
+	
+	QCOMPARE(result.length (), input.length ());
+}
+
+void LuaRuntimeBenchmark::callBatchBuffer () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	runtime.execute (scoreScript);
+	
+	QVector< double > input (10000);
+	QVector< double > output (10000);
+	for (int i = 0; i < input.size (); i++) {
+		input[i] = i;
+	}
+	
+	LuaBuffer in = LuaBuffer::wrap (&runtime, input.data (), input.size ());
+	LuaBuffer out = LuaBuffer::wrap (&runtime, output.data (), output.size ());
+	QBENCHMARK {
+		runtime.callBatch ("score", in, out);
+	}
+	
+	QCOMPARE(output.last (), 9999 * 0.5 + 1);
+}
+
+void LuaRuntimeBenchmark::evaluateThroughGlobals () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	runtime.setGlobal ("threshold", 100);
+	
+	int matches = 0;
+	QBENCHMARK {
+		matches = 0;
+		for (int i = 0; i < 1000; i++) {
+			runtime.setGlobal ("a", i);
+			runtime.setGlobal ("b", 2);
+			runtime.setGlobal ("c", 1);
+			runtime.execute ("return a * b + c > threshold");
+			matches += runtime.lastResult ().toVariant ().toBool ();
+		}
+		
+	}
+	
+	QCOMPARE(matches, 950);
+}
+
+void LuaRuntimeBenchmark::evaluateExpression () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	runtime.setGlobal ("threshold", 100);
+	LuaExpression expr = runtime.compileExpression ("a * b + c > threshold", { "a", "b", "c" });
+	
+	int matches = 0;
+	QBENCHMARK {
+		matches = 0;
+		for (int i = 0; i < 1000; i++) {
+			double values[] = { double (i), 2, 1 };
+			matches += int (expr.evaluate (values));
+		}
+		
+	}
+	
+	QCOMPARE(matches, 950);
+}
+
+void LuaRuntimeBenchmark::evaluateExpressionColumns () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	runtime.setGlobal ("threshold", 100);
+	LuaExpression expr = runtime.compileExpression ("a * b + c > threshold", { "a", "b", "c" });
+	
+	QVector< double > a (1000), b (1000, 2.0), c (1000, 1.0), results (1000);
+	for (int i = 0; i < a.size (); i++) {
+		a[i] = i;
+	}
+	
+	const double *columns[] = { a.constData (), b.constData (), c.constData () };
+	QBENCHMARK {
+		expr.evaluateColumns (columns, a.size (), results.data ());
+	}
+	
+	QCOMPARE(std::accumulate (results.begin (), results.end (), 0.0), 950.0);
+}
+
+static QVariantList objectPointers (QVector< TestStruct > &objects) {
+	QVariantList list;
+	list.reserve (objects.size ());
+	for (TestStruct &object : objects) {
+		list.append (QVariant::fromValue (&object));
+	}
+	
+	return list;
+}
+
+void LuaRuntimeBenchmark::pushCollectObjects () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	QVERIFY(runtime.execute ("live = {}\n"
+	                         "function keep (o) live[#live + 1] = o end\n"
+	                         "function touch (o) return o ~= nil end"));
+	
+	// Keep one million objects alive in Lua
+	QVector< TestStruct > liveObjects (1000000);
+	QVERIFY(!runtime.callBatch ("keep", objectPointers (liveObjects)).isEmpty ());
+	
+	// Push and collect short-lived objects alongside them
+	QVector< TestStruct > objects (10000);
+	QVariantList pointers = objectPointers (objects);
+	QBENCHMARK {
+		runtime.callBatch ("touch", pointers);
+		runtime.collectGarbage ();
+	}
+	
+	QCOMPARE(runtime.global ("live").table ().length (), 1000000);
+}
+
+void LuaRuntimeBenchmark::createStructures () {
+	MetaObject *meta = MetaObject::byName ("TestStruct");
+	if (!meta) {
+		QSKIP("Tria is needed for this benchmark.");
+	}
+	
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	runtime.registerMetaObject (meta, "Test::");
+	
+	QBENCHMARK {
+		runtime.execute ("local sum = 0\n"
+		                 "for i = 1, 10000 do\n"
+		                 "  local s = Test.TestStruct { a = i, b = 1 }\n"
+		                 "  sum = sum + s.a\n"
+		                 "end\n"
+		                 "return sum");
+		runtime.collectGarbage ();
+	}
+	
+	QCOMPARE(runtime.lastResult ().toVariant ().toInt (), 50005000);
+}
+
+static const char *parallelScript = "function work (n)\n"
+                                    "  local s = 0\n"
+                                    "  for i = 1, 1000 do s = s + math.sqrt (n * i) end\n"
+                                    "  return s\n"
+                                    "end";
+
+void LuaRuntimeBenchmark::parallelMap_data () {
+	QTest::addColumn< int > ("threads");
+	
+	QTest::newRow ("1") << 1;
+	QTest::newRow ("2") << 2;
+	QTest::newRow ("4") << 4;
+	QTest::newRow ("cores") << QThread::idealThreadCount ();
+}
+
+void LuaRuntimeBenchmark::parallelMap () {
+	QFETCH(int, threads);
+	
+	QVariantList input;
+	for (int i = 0; i < 100000; i++) {
+		input.append (i);
+	}
+	
+	QVariantList result;
+	QBENCHMARK {
+		result = LuaParallel::map (parallelScript, "work", input, threads);
+	}
+	
+	QCOMPARE(result.length (), input.length ());
+}
+
+QTEST_MAIN(LuaRuntimeBenchmark)
+#include "bench_luaruntime.moc"
@@ -45,6 +45,13 @@ struct NURIA_INTROSPECT TestStruct {
 	
 };
 
+struct NURIA_INTROSPECT DerivedStruct : public TestStruct {
+	int d = 0;
+	
+	DerivedStruct () {}
+	
+};
+
 class NURIA_INTROSPECT TestObject : public QObject {
 	Q_OBJECT
 public:
@@ -71,6 +78,8 @@ struct NURIA_INTROSPECT Complex {
 // Needed for QVariant::fromValue().
 Q_DECLARE_METATYPE(TestObject*)
 Q_DECLARE_METATYPE(TestStruct*)
+Q_DECLARE_METATYPE(DerivedStruct*)
+Q_DECLARE_METATYPE(Complex*)
 Q_DECLARE_METATYPE(TestStruct)
 
 #endif // STRUCTURES_HPP
@@ -16,11 +16,23 @@
 
 #include <QtTest/QtTest>
 #include <QObject>
+#include <thread>
 
+#include <nuria/luaclassbinding.hpp>
+#include <nuria/luatablebuilder.hpp>
+#include <nuria/luabuffer.hpp>
+#include <nuria/luajson.hpp>
+#include <nuria/luapack.hpp>
+#include <nuria/luaparallel.hpp>
+#include <nuria/luapipeline.hpp>
+#include <nuria/luachannel.hpp>
+#include <nuria/luacontainer.hpp>
 #include <nuria/luaruntime.hpp>
+#include <nuria/luascheduler.hpp>
 #include <nuria/metaobject.hpp>
 #include <nuria/logger.hpp>
 #include "structures.hpp"
+#include <lua.hpp>
 
 using namespace Nuria;
 
@@ -47,11 +59,54 @@ private slots:
 	
 	void returnMultipleValues ();
 	
+	// Tables
+	void lazyTableAccess ();
+	void tableOutlivesRuntime ();
+	void iterateTable ();
+	void setGlobalFromTableValue ();
+	void buildTable ();
+	void buildIntoExistingTable ();
+	void numericBuffer ();
+	void largeByteArray ();
+	void unicodeStrings ();
+	void rawByteStrings ();
+	void mixedTableToVariant ();
+	void jsonCodec ();
+	void packCodec ();
+	void packStructure ();
+	void transferTable ();
+	void transferStructure ();
+	void channelBetweenRuntimes ();
+	void channelYieldsInCoroutine ();
+	void channelAcrossThreads ();
+	void postToRuntimeThread ();
+	void schedulerRunsTasks ();
+	void schedulerWakesTasksOnChannel ();
+	void parallelMapReduce ();
+	void pipelineStages ();
+	void callBatch ();
+	void compiledExpression ();
+	void objectPushedAgainAfterCollect ();
+	void objectPushedAgainBeforeFinalizer ();
+	void inlineObjectPushedAgainBeforeFinalizer ();
+	void structureStoredInline ();
+	
 	// Global access
 	void verifyGlobals ();
 	void globalToCode ();
 	void globalFromCode ();
 	
+	// Native functions
+	void registerFreeFunction ();
+	void registerLambda ();
+	void registerFunctionWrongArgumentCount ();
+	
+	// Type converters
+	void builtinConverters ();
+	void registerCustomConverter ();
+	void listContainerProxy ();
+	void hashContainerProxy ();
+	
 	// Complex types (C++ structures -> LUA)
 	void structureToLua ();
 	void pointerToLua ();
@@ -62,9 +117,15 @@ private slots:
 	void returnTestStruct ();
 	void passTestStructToCpp ();
 	void passTestStructToCppAsPointer ();
+	void passDerivedStructAsBasePointer ();
 	void verifyStructureWrapperExistsOnlyOnce ();
 	void createInstanceDeclarative ();
 	void createComplexInstanceDeclarative ();
+	void nativeFieldBinding ();
+	void nativeMethodBinding ();
+	void writeNestedField ();
+	void writeNestedFieldThroughTwoViews ();
+	void writeNativeNestedField ();
 	
 	// Ownership
 	void verifyObjectHandlerBehaviour_data ();
@@ -205,6 +266,880 @@ void LuaRuntimeTest::returnMultipleValues () {
 	QCOMPARE(results.at (2).toVariant ().toInt (), 3);
 }
 
+void LuaRuntimeTest::lazyTableAccess () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	QVERIFY(runtime.execute ("return { name = 'foo', items = { 1, 2, 3 } }"));
+	
+	LuaTable table = runtime.lastResult ().table ();
+	QVERIFY(table.isValid ());
+	QVERIFY(table.contains ("name"));
+	QVERIFY(!table.contains ("nothing"));
+	QCOMPARE(table.value< QString > ("name"), QString ("foo"));
+	QCOMPARE(table.value< int > ("nothing", 42), 42);
+	
+	LuaTable items = table.get ("items").table ();
+	QCOMPARE(items.length (), 3);
+	QCOMPARE(items.value< int > (2), 2);
+	QCOMPARE(items.toVariant ().toList (), QVariantList ({ 1, 2, 3 }));
+}
+
+void LuaRuntimeTest::tableOutlivesRuntime () {
+	LuaValue value;
+	
+	{
+		LuaRuntime runtime (LuaRuntime::AllLibraries);
+		QVERIFY(runtime.execute ("return { 1, 2, 3 }"));
+		value = runtime.lastResult ();
+	}
+	
+	QCOMPARE(value.type (), LuaValue::Table);
+	QCOMPARE(value.toVariant ().toList (), QVariantList ({ 1, 2, 3 }));
+}
+
+void LuaRuntimeTest::iterateTable () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	QVERIFY(runtime.execute ("return { a = 1, b = 2, c = 3 }"));
+	
+	QVariantMap result;
+	LuaTableIterator it = runtime.lastResult ().table ().iterator ();
+	while (it.next ()) {
+		result.insert (it.key ().toVariant ().toString (), it.value ().toVariant ());
+	}
+	
+	QVariantMap expected { { "a", 1 }, { "b", 2 }, { "c", 3 } };
+	QCOMPARE(result, expected);
+	QVERIFY(!it.next ());
+}
+
+void LuaRuntimeTest::setGlobalFromTableValue () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	QVERIFY(runtime.execute ("return { 1, 2 }"));
+	
+	runtime.setGlobal ("foo", runtime.lastResult ());
+	QVERIFY(runtime.execute ("foo[3] = 3"));
+	QCOMPARE(runtime.global ("foo").table ().length (), 3);
+}
+
+void LuaRuntimeTest::buildTable () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	int values[] = { 1, 2, 3 };
+	
+	LuaTableBuilder builder (&runtime, 0, 3);
+	builder.set ("name", QString ("foo"))
+	       .set ("enabled", true)
+	       .beginTable ("values", 3)
+	           .appendArray (values, 3)
+	       .endTable ();
+	
+	runtime.setGlobal ("data", QVariant::fromValue (builder.table ()));
+	QVERIFY(runtime.execute ("return data.name, data.enabled, #data.values, data.values[3]"));
+	
+	LuaValues results = runtime.allResults ();
+	QCOMPARE(results.length (), 4);
+	QCOMPARE(results.at (0).toVariant ().toString (), QString ("foo"));
+	QCOMPARE(results.at (1).toVariant ().toBool (), true);
+	QCOMPARE(results.at (2).toVariant ().toInt (), 3);
+	QCOMPARE(results.at (3).toVariant ().toInt (), 3);
+}
+
+void LuaRuntimeTest::buildIntoExistingTable () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	QVERIFY(runtime.execute ("return { 1, 2, name = 'foo' }"));
+	
+	LuaTableBuilder builder (runtime.lastResult ().table ());
+	builder.append (3)
+	       .set (5, 5)
+	       .append (6)
+	       .set ("name", QString ("bar"));
+	
+	runtime.setGlobal ("data", QVariant::fromValue (builder.table ()));
+	QVERIFY(runtime.execute ("return data[3], data[4], data[6], data.name"));
+	
+	LuaValues results = runtime.allResults ();
+	QCOMPARE(results.at (0).toVariant ().toInt (), 3);
+	QCOMPARE(results.at (1).type (), LuaValue::Nil);
+	QCOMPARE(results.at (2).toVariant ().toInt (), 6);
+	QCOMPARE(results.at (3).toVariant ().toString (), QString ("bar"));
+}
+
+void LuaRuntimeTest::numericBuffer () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	QVector< double > samples { 1, 2, 3 };
+	
+	LuaBuffer buffer = LuaBuffer::wrap (&runtime, samples.data (), samples.size ());
+	runtime.setGlobal ("samples", QVariant::fromValue (buffer));
+	QVERIFY(runtime.execute ("for i = 1, #samples do samples[i] = samples[i] * 2 end "
+	                         "return samples[4]"));
+	QCOMPARE(runtime.lastResult ().type (), LuaValue::Nil);
+	QCOMPARE(samples, QVector< double > ({ 2, 4, 6 }));
+	
+	// Out of range writes fail
+	QVERIFY(!runtime.execute ("samples[4] = 1"));
+	
+	// Values not fitting into integer elements are clamped
+	QVector< qint32 > integers (3);
+	runtime.setGlobal ("integers", QVariant::fromValue (LuaBuffer::wrap (&runtime, integers.data (), 3)));
+	QVERIFY(runtime.execute ("integers[1] = 1e300 integers[2] = -1e300 integers[3] = 0/0"));
+	QCOMPARE(integers, QVector< qint32 > ({ std::numeric_limits< qint32 >::max (),
+	                                        std::numeric_limits< qint32 >::min (), 0 }));
+	
+	// Lua loses access once detached
+	buffer.detach ();
+	QVERIFY(runtime.execute ("return #samples"));
+	QCOMPARE(runtime.lastResult ().toVariant ().toInt (), 0);
+}
+
+void LuaRuntimeTest::largeByteArray () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	QCOMPARE(runtime.byteArrayThreshold (), -1);
+	runtime.setByteArrayThreshold (16);
+	runtime.registerFunction ("size", [](const QByteArray &data) { return data.length (); });
+	
+	QByteArray body ("GET /index.html HTTP/1.1\r\nHost: nuriaproject.org");
+	runtime.setGlobal ("body", body);
+	QVERIFY(runtime.execute ("local first, last = body:find ('\\r\\n')\n"
+	                         "return type (body), #body, body:byte (1), body:sub (5, 15):string (),\n"
+	                         "       first, tostring (body:sub (last + 1)), size (body:sub (1, 3))"));
+	
+	LuaValues results = runtime.allResults ();
+	QCOMPARE(results.length (), 7);
+	QCOMPARE(results.at (0).toVariant ().toString (), QString ("userdata"));
+	QCOMPARE(results.at (1).toVariant ().toInt (), body.length ());
+	QCOMPARE(results.at (2).toVariant ().toInt (), int ('G'));
+	QCOMPARE(results.at (3).toVariant ().toString (), QString ("/index.html"));
+	QCOMPARE(results.at (4).toVariant ().toInt (), 25);
+	QCOMPARE(results.at (5).toVariant ().toString (), QString ("Host: nuriaproject.org"));
+	QCOMPARE(results.at (6).toVariant ().toInt (), 3);
+	
+	// Returned as QByteArray
+	QVERIFY(runtime.execute ("return body"));
+	QCOMPARE(runtime.lastResult ().toVariant ().toByteArray (), body);
+	
+	// Small byte arrays are still passed as string
+	runtime.setGlobal ("small", QByteArray ("foo"));
+	QVERIFY(runtime.execute ("return type (small)"));
+	QCOMPARE(runtime.lastResult ().toVariant ().toString (), QString ("string"));
+}
+
+void LuaRuntimeTest::unicodeStrings () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	QString shortString = QString::fromUtf8 ("Gr\xC3\xBC\xC3\x9F Gott, \xE2\x82\xAC and \xF0\x9F\x98\x80!");
+	QString longString = QString ("abcdefghijklmnopqrstuvwxyz").repeated (100) + shortString;
+	
+	runtime.setGlobal ("short", shortString);
+	runtime.setGlobal ("long", longString);
+	runtime.setGlobal ("map", QVariantMap { { shortString, 1 }, { "key", 2 } });
+	QVERIFY(runtime.execute ("return short, #short, long, #long, map[short], map.key"));
+	
+	LuaValues results = runtime.allResults ();
+	QCOMPARE(results.length (), 6);
+	QCOMPARE(results.at (0).toVariant ().toString (), shortString);
+	QCOMPARE(results.at (1).toVariant ().toInt (), shortString.toUtf8 ().length ());
+	QCOMPARE(results.at (2).toVariant ().toString (), longString);
+	QCOMPARE(results.at (3).toVariant ().toInt (), longString.toUtf8 ().length ());
+	QCOMPARE(results.at (4).toVariant ().toInt (), 1);
+	QCOMPARE(results.at (5).toVariant ().toInt (), 2);
+}
+
+void LuaRuntimeTest::rawByteStrings () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	QVERIFY(runtime.execute ("return '\\255\\000binary', { body = 'abc' }"));
+	
+	// Per call
+	LuaValues results = runtime.allResults ();
+	QCOMPARE(results.at (0).toByteArray (), QByteArray ("\xFF\0binary", 8));
+	QCOMPARE(results.at (0).toVariant ().userType (), int (QMetaType::QString));
+	
+	// Per runtime
+	runtime.setStringConversion (LuaRuntime::ToByteArray);
+	QVERIFY(runtime.execute ("return 'foo', { body = 'abc' }"));
+	results = runtime.allResults ();
+	
+	QCOMPARE(results.at (0).toVariant ().userType (), int (QMetaType::QByteArray));
+	QCOMPARE(results.at (0).toVariant ().toByteArray (), QByteArray ("foo"));
+	QCOMPARE(results.at (1).toVariant ().toMap ().value ("body").userType (), int (QMetaType::QByteArray));
+	
+	// Values keep the policy they were read with
+	runtime.setStringConversion (LuaRuntime::ToQString);
+	QCOMPARE(results.at (0).toVariant ().userType (), int (QMetaType::QByteArray));
+	QCOMPARE(results.at (1).toVariant ().toMap ().value ("body").userType (), int (QMetaType::QByteArray));
+}
+
+void LuaRuntimeTest::mixedTableToVariant () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	QVERIFY(runtime.execute ("return { 'a', 'b', [4] = 'd', name = 'foo', [2.5] = 'x' }"));
+	
+	QVariantMap expected {
+		{ "1", "a" }, { "2", "b" }, { "4", "d" },
+		{ "name", "foo" }, { "2.5", "x" }
+	};
+	
+	QCOMPARE(runtime.lastResult ().toVariant ().toMap (), expected);
+	
+	// Sequences are returned as list
+	QVERIFY(runtime.execute ("return { 1, 2, 3 }"));
+	QCOMPARE(runtime.lastResult ().toVariant ().toList (), QVariantList ({ 1.0, 2.0, 3.0 }));
+}
+
+void LuaRuntimeTest::jsonCodec () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	
+	// Decode in Lua. The last duplicate key wins.
+	QVERIFY(runtime.execute ("local t = Nuria.json.decode [[{\"a\": [1, 2.5, -3e2], \"b\": \"x\\u00e4\\n\","
+	                         " \"c\": null, \"d\": {}, \"a\": [1, true, false]}]]\n"
+	                         "return #t.a, t.a[2], t.b, t.c == Nuria.json.null, next (t.d)"));
+	LuaValues results = runtime.allResults ();
+	QCOMPARE(results.length (), 5);
+	QCOMPARE(results.at (0).toVariant ().toInt (), 3);
+	QCOMPARE(results.at (1).toVariant (), QVariant (true));
+	QCOMPARE(results.at (2).toVariant ().toString (), QStringLiteral("xä\n"));
+	QCOMPARE(results.at (3).toVariant (), QVariant (true));
+	QCOMPARE(results.at (4).type (), LuaValue::Nil);
+	
+	// Encode in Lua
+	QVERIFY(runtime.execute ("return Nuria.json.encode ({ 1, 'two', { x = Nuria.json.null } })"));
+	QCOMPARE(runtime.lastResult ().toByteArray (), QByteArray ("[1,\"two\",{\"x\":null}]"));
+	
+	// Tables with holes and other keys are encoded as object
+	QVERIFY(runtime.execute ("local t = Nuria.json.decode (Nuria.json.encode ({ 1, nil, 3, x = 5 }))\n"
+	                         "return t['1'], t['3'], t.x"));
+	results = runtime.allResults ();
+	QCOMPARE(results.length (), 3);
+	QCOMPARE(results.at (0).toVariant ().toInt (), 1);
+	QCOMPARE(results.at (1).toVariant ().toInt (), 3);
+	QCOMPARE(results.at (2).toVariant ().toInt (), 5);
+	
+	// Errors are returned as nil plus message
+	QVERIFY(runtime.execute ("return Nuria.json.decode ('[1, 2')"));
+	QCOMPARE(runtime.allResults ().length (), 2);
+	QCOMPARE(runtime.allResults ().first ().type (), LuaValue::Nil);
+	
+	QVERIFY(runtime.execute ("local t = {} t.self = t return Nuria.json.encode (t)"));
+	QCOMPARE(runtime.allResults ().length (), 2);
+	QCOMPARE(runtime.allResults ().first ().type (), LuaValue::Nil);
+	
+	// C++ API
+	QString error;
+	QByteArray json ("{\"list\":[1,2,3],\"name\":\"foo\"}");
+	LuaValue value = LuaJson::decode (&runtime, json, &error);
+	QVERIFY(error.isEmpty ());
+	QCOMPARE(value.type (), LuaValue::Table);
+	
+	QVariantMap expected { { "list", QVariantList { 1.0, 2.0, 3.0 } }, { "name", "foo" } };
+	QCOMPARE(value.toVariant ().toMap (), expected);
+	QCOMPARE(LuaJson::decode (&runtime, LuaJson::encode (value)).toVariant ().toMap (), expected);
+	
+	QVERIFY(!LuaJson::decode (&runtime, "[1] x", &error).isValid ());
+	QVERIFY(!error.isEmpty ());
+}
+
+void LuaRuntimeTest::packCodec () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	
+	// Round-trip in Lua
+	QVERIFY(runtime.execute ("local data = Nuria.pack ({ 1, -200, 70000, 2.5, 'foo', true, { x = false } })\n"
+	                         "local t, pos = Nuria.unpack (data)\n"
+	                         "return #data, pos, t[1], t[2], t[3], t[4], t[5], t[6], t[7].x"));
+	LuaValues results = runtime.allResults ();
+	QCOMPARE(results.length (), 9);
+	QCOMPARE(results.at (0).toVariant ().toInt (), 24);
+	QCOMPARE(results.at (1).toVariant ().toInt (), 25);
+	QCOMPARE(results.at (2).toVariant ().toDouble (), 1.0);
+	QCOMPARE(results.at (3).toVariant ().toDouble (), -200.0);
+	QCOMPARE(results.at (4).toVariant ().toDouble (), 70000.0);
+	QCOMPARE(results.at (5).toVariant ().toDouble (), 2.5);
+	QCOMPARE(results.at (6).toVariant ().toString (), QString ("foo"));
+	QCOMPARE(results.at (7).toVariant (), QVariant (true));
+	QCOMPARE(results.at (8).toVariant (), QVariant (false));
+	
+	// Streaming
+	QVERIFY(runtime.execute ("local data = Nuria.pack (1) .. Nuria.pack ('two')\n"
+	                         "local a, pos = Nuria.unpack (data)\n"
+	                         "local b = Nuria.unpack (data, pos)\n"
+	                         "return a, b"));
+	QCOMPARE(runtime.allResults ().at (0).toVariant ().toInt (), 1);
+	QCOMPARE(runtime.allResults ().at (1).toVariant ().toString (), QString ("two"));
+	
+	// Packing inside a coroutine uses the coroutine's stack
+	QVERIFY(runtime.execute ("local pack = coroutine.wrap (function () return Nuria.pack ({ 7, 8 }) end)\n"
+	                         "return Nuria.unpack (pack ('decoy'))"));
+	QCOMPARE(runtime.allResults ().first ().toVariant ().toList (), QVariantList ({ 7.0, 8.0 }));
+	
+	// Errors
+	QVERIFY(runtime.execute ("return Nuria.unpack ('\\x92\\x01')"));
+	QCOMPARE(runtime.allResults ().length (), 2);
+	QCOMPARE(runtime.allResults ().first ().type (), LuaValue::Nil);
+	
+	// C++ API
+	QVERIFY(runtime.execute ("return { name = 'foo', list = { 1, 2, 3 } }"));
+	QByteArray data = LuaPack::pack (runtime.lastResult ());
+	QVERIFY(!data.isEmpty ());
+	
+	QVariantMap expected { { "list", QVariantList { 1.0, 2.0, 3.0 } }, { "name", "foo" } };
+	QCOMPARE(LuaPack::unpack (&runtime, data).toVariant ().toMap (), expected);
+	
+	int offset = 0;
+	QString error;
+	QByteArray stream = data + data;
+	QCOMPARE(LuaPack::unpack (&runtime, stream, &offset, &error).toVariant ().toMap (), expected);
+	QCOMPARE(offset, data.length ());
+	QCOMPARE(LuaPack::unpack (&runtime, stream, &offset, &error).toVariant ().toMap (), expected);
+	QCOMPARE(offset, stream.length ());
+	
+	QVERIFY(!LuaPack::unpack (&runtime, stream, nullptr, &error).isValid ());
+	QVERIFY(!error.isEmpty ());
+}
+
+void LuaRuntimeTest::packStructure () {
+	NEEDS_TRIA;
+	
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	TestStruct test (1, 2);
+	test.c = "foo";
+	runtime.setGlobal ("test", QVariant::fromValue (&test));
+	
+	// Structures are only packed on request
+	QVERIFY(runtime.execute ("return Nuria.pack (test)"));
+	QCOMPARE(runtime.allResults ().first ().type (), LuaValue::Nil);
+	
+	QVERIFY(runtime.execute ("local t = Nuria.unpack (Nuria.pack (test, true))\n"
+	                         "return t.a, t.b, t.c"));
+	QCOMPARE(runtime.allResults ().at (0).toVariant ().toInt (), 1);
+	QCOMPARE(runtime.allResults ().at (1).toVariant ().toInt (), 2);
+	QCOMPARE(runtime.allResults ().at (2).toVariant ().toString (), QString ("foo"));
+}
+
+void LuaRuntimeTest::transferTable () {
+	LuaRuntime source (LuaRuntime::AllLibraries);
+	LuaRuntime target (LuaRuntime::AllLibraries);
+	
+	QVERIFY(source.execute ("local shared = { 1, 2 }\n"
+	                        "t = { a = shared, b = shared, name = 'foo', [true] = 1.5 }\n"
+	                        "t.self = t\n"
+	                        "return t"));
+	
+	QString error;
+	LuaValue copy = LuaRuntime::transfer (source.lastResult (), &target, &error);
+	QVERIFY(error.isEmpty ());
+	QCOMPARE(copy.runtime (), &target);
+	QCOMPARE(copy.type (), LuaValue::Table);
+	
+	// Structure, shared sub-tables and cycles are preserved
+	target.setGlobal ("t", copy);
+	QVERIFY(target.execute ("return t.a == t.b, t.self == t, t.name, t[true], #t.a"));
+	LuaValues results = target.allResults ();
+	QCOMPARE(results.length (), 5);
+	QCOMPARE(results.at (0).toVariant (), QVariant (true));
+	QCOMPARE(results.at (1).toVariant (), QVariant (true));
+	QCOMPARE(results.at (2).toVariant ().toString (), QString ("foo"));
+	QCOMPARE(results.at (3).toVariant ().toDouble (), 1.5);
+	QCOMPARE(results.at (4).toVariant ().toInt (), 2);
+	
+	// The copy is independent
+	QVERIFY(target.execute ("t.a[1] = 100"));
+	QVERIFY(source.execute ("return t.a[1]"));
+	QCOMPARE(source.lastResult ().toVariant ().toInt (), 1);
+	
+	// Functions can't be transferred
+	QVERIFY(source.execute ("return { f = print }"));
+	QVERIFY(!LuaRuntime::transfer (source.lastResult (), &target, &error).isValid ());
+	QVERIFY(!error.isEmpty ());
+}
+
+void LuaRuntimeTest::transferStructure () {
+	NEEDS_TRIA;
+	
+	LuaRuntime source (LuaRuntime::AllLibraries);
+	LuaRuntime target (LuaRuntime::AllLibraries);
+	source.registerMetaObject (MetaObject::byName ("TestStruct"), "Test::");
+	
+	// Owned by C++: Shared
+	TestStruct shared (1, 2);
+	source.setGlobal ("shared", QVariant::fromValue (&shared));
+	LuaValue copy = LuaRuntime::transfer (source.global ("shared"), &target);
+	QCOMPARE(copy.object ().object (), (void *)&shared);
+	QCOMPARE(target.objectOwnership (&shared), LuaRuntime::OwnedByCpp);
+	
+	// Owned by the source: Copied
+	QTest::ignoreMessage (QtDebugMsg, "ctor 3 4");
+	QVERIFY(source.execute ("local t = Test.TestStruct.new (3, 4) return { t, t }"));
+	target.setGlobal ("list", LuaRuntime::transfer (source.lastResult (), &target));
+	
+	QTest::ignoreMessage (QtDebugMsg, "member");
+	QVERIFY(target.execute ("return list[1] == list[2], list[1].a, list[1]:sum ()"));
+	QCOMPARE(target.allResults ().at (0).toVariant (), QVariant (true));
+	QCOMPARE(target.allResults ().at (1).toVariant ().toInt (), 3);
+	QCOMPARE(target.allResults ().at (2).toVariant ().toInt (), 7);
+}
+
+void LuaRuntimeTest::channelBetweenRuntimes () {
+	LuaRuntime sender (LuaRuntime::AllLibraries);
+	LuaRuntime receiver (LuaRuntime::AllLibraries);
+	
+	QVERIFY(sender.execute ("local c = Nuria.channel ('test-channel', 4)\n"
+	                        "assert (c:send ({ name = 'foo', list = { 1, 2 } }))\n"
+	                        "assert (c:trySend (42))\n"
+	                        "return c:count (), c:capacity ()"));
+	QCOMPARE(sender.allResults ().at (0).toVariant ().toInt (), 2);
+	QCOMPARE(sender.allResults ().at (1).toVariant ().toInt (), 4);
+	
+	QVERIFY(receiver.execute ("local c = Nuria.channel ('test-channel')\n"
+	                          "local t = c:receive ()\n"
+	                          "local ok, n = c:tryReceive ()\n"
+	                          "local empty = c:tryReceive ()\n"
+	                          "local _, err = c:receive (10)\n"
+	                          "return t.name, t.list[2], ok, n, empty, err"));
+	LuaValues results = receiver.allResults ();
+	QCOMPARE(results.length (), 6);
+	QCOMPARE(results.at (0).toVariant ().toString (), QString ("foo"));
+	QCOMPARE(results.at (1).toVariant ().toInt (), 2);
+	QCOMPARE(results.at (2).toVariant (), QVariant (true));
+	QCOMPARE(results.at (3).toVariant ().toInt (), 42);
+	QCOMPARE(results.at (4).toVariant (), QVariant (false));
+	QCOMPARE(results.at (5).toVariant ().toString (), QString ("timeout"));
+	
+	// Closing, and access from C++
+	LuaChannel channel = LuaChannel::named ("test-channel");
+	QVERIFY(channel.send (LuaValue (&sender, 7)));
+	channel.close ();
+	QVERIFY(!channel.send (LuaValue (&sender, 8)));
+	
+	bool ok = false;
+	QCOMPARE(channel.receive (&receiver, 0, &ok).toVariant ().toInt (), 7);
+	QVERIFY(ok);
+	
+	QVERIFY(receiver.execute ("return Nuria.channel ('test-channel'):receive ()"));
+	QCOMPARE(receiver.allResults ().at (1).toVariant ().toString (), QString ("closed"));
+}
+
+void LuaRuntimeTest::channelYieldsInCoroutine () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	
+	QVERIFY(runtime.execute ("local c = Nuria.channel (2)\n"
+	                         "local co = coroutine.create (function () return c:receive () end)\n"
+	                         "local _, yielded = coroutine.resume (co)\n"
+	                         "c:send ('hello')\n"
+	                         "local _, value = coroutine.resume (co)\n"
+	                         "return yielded == c, value"));
+	QCOMPARE(runtime.allResults ().at (0).toVariant (), QVariant (true));
+	QCOMPARE(runtime.allResults ().at (1).toVariant ().toString (), QString ("hello"));
+	
+	// Sending from a coroutine sends the coroutine's value
+	QVERIFY(runtime.execute ("local c = Nuria.channel (2)\n"
+	                         "local send = coroutine.wrap (function (v) c:send (v) c:trySend ({ v, 2 }) end)\n"
+	                         "send ('from coroutine')\n"
+	                         "local first = c:receive ()\n"
+	                         "return first, c:receive ()[2]"));
+	QCOMPARE(runtime.allResults ().at (0).toVariant ().toString (), QString ("from coroutine"));
+	QCOMPARE(runtime.allResults ().at (1).toVariant ().toInt (), 2);
+	
+	// Channels created inside a coroutine are returned by it
+	QVERIFY(runtime.execute ("local make = coroutine.wrap (function () return Nuria.channel (1) end)\n"
+	                         "local c = make ()\n"
+	                         "c:send (5)\n"
+	                         "return c:receive ()"));
+	QCOMPARE(runtime.lastResult ().toVariant ().toInt (), 5);
+}
+
+void LuaRuntimeTest::channelAcrossThreads () {
+	LuaChannel channel (16);
+	
+	// Produce from another thread with its own runtime
+	std::thread producer ([channel]() mutable {
+		LuaRuntime runtime (LuaRuntime::Base);
+		for (int i = 1; i <= 1000; i++) {
+			channel.send (LuaValue (&runtime, i));
+		}
+		
+		channel.close ();
+	});
+	
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	runtime.setGlobal ("c", QVariant::fromValue (channel));
+	
+	QVERIFY(runtime.execute ("local sum = 0\n"
+	                         "for v in function () return c:receive () end do sum = sum + v end\n"
+	                         "return sum"));
+	QCOMPARE(runtime.lastResult ().toVariant ().toInt (), 500500);
+	
+	producer.join ();
+}
+
+void LuaRuntimeTest::postToRuntimeThread () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	runtime.setGlobal ("counter", 0);
+	
+	bool foreignExecute = true;
+	int result = -1;
+	QAtomicInt finished;
+	
+	std::thread worker ([&]() {
+		foreignExecute = runtime.execute ("counter = 1000");
+		
+		for (int i = 0; i < 100; i++) {
+			runtime.post ([&runtime, i]() {
+				runtime.setGlobal ("i", i);
+				runtime.execute ("counter = counter + i");
+			});
+			
+		}
+		
+		// Runs after all posted closures
+		runtime.invoke ([&]() { result = runtime.global ("counter").toVariant ().toInt (); });
+		finished.store (1);
+	});
+	
+	QTRY_VERIFY(finished.load ());
+	worker.join ();
+	
+	QVERIFY(!foreignExecute);
+	QCOMPARE(result, 4950);
+}
+
+void LuaRuntimeTest::schedulerRunsTasks () {
+	QMutex mutex;
+	int sum = 0;
+	int finished = 0;
+	QString error;
+	
+	LuaScheduler scheduler (2);
+	QCOMPARE(scheduler.workerCount (), 2);
+	
+	connect (&scheduler, &LuaScheduler::taskFinished, [&](int, const QVariant &result) {
+		QMutexLocker locker (&mutex);
+		sum += result.toInt ();
+		finished++;
+	}, Qt::DirectConnection);
+	
+	connect (&scheduler, &LuaScheduler::taskFailed, [&](int, const QString &message) {
+		QMutexLocker locker (&mutex);
+		error = message;
+		finished++;
+	}, Qt::DirectConnection);
+	
+	// Tasks yield a few times before returning
+	for (int i = 1; i <= 100; i++) {
+		QByteArray script = "for i = 1, 5 do coroutine.yield () end return " + QByteArray::number (i);
+		QCOMPARE(scheduler.spawn (script), i - 1);
+	}
+	
+	scheduler.spawn ("error ('failed')");
+	
+	QTRY_COMPARE(([&]() { QMutexLocker locker (&mutex); return finished; })(), 101);
+	QCOMPARE(sum, 5050);
+	QVERIFY(error.contains ("failed"));
+	
+	qint64 started = 0;
+	for (const LuaScheduler::WorkerStatistics &stats : scheduler.statistics ()) {
+		QCOMPARE(stats.queued, 0);
+		started += stats.started;
+	}
+	
+	QCOMPARE(started, qint64 (101));
+	
+	scheduler.stop ();
+	QCOMPARE(scheduler.spawn ("return 1"), -1);
+}
+
+void LuaRuntimeTest::schedulerWakesTasksOnChannel () {
+	QMutex mutex;
+	int sum = 0;
+	int finished = 0;
+	
+	LuaScheduler scheduler (1);
+	connect (&scheduler, &LuaScheduler::taskFinished, [&](int, const QVariant &result) {
+		QMutexLocker locker (&mutex);
+		sum += result.toInt ();
+		finished++;
+	}, Qt::DirectConnection);
+	
+	// The tasks wait for the channel instead of being polled
+	for (int i = 0; i < 3; i++) {
+		scheduler.spawn ("return Nuria.channel ('schedulerWakesTasksOnChannel'):receive ()");
+	}
+	
+	QTRY_COMPARE(scheduler.statistics ().at (0).running, 3);
+	
+	LuaRuntime runtime (LuaRuntime::Base);
+	LuaChannel channel = LuaChannel::named ("schedulerWakesTasksOnChannel");
+	for (int i = 1; i <= 3; i++) {
+		QVERIFY(channel.send (LuaValue (&runtime, i)));
+	}
+	
+	QTRY_COMPARE(([&]() { QMutexLocker locker (&mutex); return finished; })(), 3);
+	QCOMPARE(sum, 6);
+}
+
+void LuaRuntimeTest::parallelMapReduce () {
+	static const char *script = "function square (x) return x * x end\n"
+	                            "function add (a, b) return a + b end";
+	
+	QVariantList input;
+	for (int i = 1; i <= 1000; i++) {
+		input.append (i);
+	}
+	
+	// Results keep the order of the input
+	QVariantList squares = LuaParallel::map (script, "square", input, 4);
+	QCOMPARE(squares.length (), 1000);
+	QCOMPARE(squares.at (0).toInt (), 1);
+	QCOMPARE(squares.at (999).toInt (), 1000000);
+	
+	QCOMPARE(LuaParallel::mapReduce (script, "square", "add", input, 4).toInt (), 333833500);
+	QCOMPARE(LuaParallel::mapReduce (script, QByteArray (), "add", input, 3).toInt (), 500500);
+	
+	// Errors
+	QString error;
+	QVERIFY(LuaParallel::map (script, "nothing", input, 2, &error).isEmpty ());
+	QVERIFY(error.contains ("nothing"));
+	
+	input.append ("text");
+	QVERIFY(LuaParallel::map (script, "square", input, 2, &error).isEmpty ());
+	QVERIFY(!error.isEmpty ());
+}
+
+void LuaRuntimeTest::pipelineStages () {
+	LuaPipeline pipeline (10, 2);
+	pipeline.addStage ("parse", "function parse (s) return tonumber (s) end", "parse");
+	pipeline.addStage ("filter", "function even (n) if n % 2 == 0 then return n end end", "even");
+	pipeline.addStage ("format", "function format (n) return 'n' .. n end", "format");
+	QVERIFY(pipeline.start ());
+	
+	// Small queues, so the producer has to wait for the consumer
+	QVariantList output;
+	std::thread consumer ([&]() {
+		QVariantList records;
+		while (pipeline.take (records)) {
+			output.append (records);
+		}
+		
+	});
+	
+	for (int i = 1; i <= 1000; i++) {
+		QVERIFY(pipeline.push (QByteArray::number (i)));
+	}
+	
+	pipeline.finish ();
+	consumer.join ();
+	
+	QCOMPARE(output.length (), 500);
+	QCOMPARE(output.first ().toString (), QString ("n2"));
+	QCOMPARE(output.last ().toString (), QString ("n1000"));
+	
+	QVector< LuaPipeline::StageStatistics > stats = pipeline.statistics ();
+	QCOMPARE(stats.length (), 3);
+	QCOMPARE(stats.at (0).name, QByteArray ("parse"));
+	QCOMPARE(stats.at (0).batches, qint64 (100));
+	QCOMPARE(stats.at (1).recordsIn, qint64 (1000));
+	QCOMPARE(stats.at (1).recordsOut, qint64 (500));
+	QCOMPARE(stats.at (2).errors, qint64 (0));
+	QVERIFY(pipeline.errorString ().isEmpty ());
+	QVERIFY(!pipeline.push (1));
+	
+	// Records converted to nil are still passed to the stage
+	LuaPipeline holes (10, 2);
+	holes.addStage ("fill", "function fill (r) return r or 'missing' end", "fill");
+	QVERIFY(holes.start ());
+	QVERIFY(holes.push ("a"));
+	QVERIFY(holes.push (QVariant ()));
+	QVERIFY(holes.push ("b"));
+	holes.finish ();
+	
+	QVariantList records;
+	QVERIFY(holes.take (records));
+	QCOMPARE(records, QVariantList ({ "a", "missing", "b" }));
+}
+
+void LuaRuntimeTest::callBatch () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	QVERIFY(runtime.execute ("function double (x) if x > 0 then return x * 2 end end"));
+	
+	QVariantList results = runtime.callBatch ("double", QVariantList { 1, 2, -1, 4 });
+	QCOMPARE(results.length (), 4);
+	QCOMPARE(results.at (0).toInt (), 2);
+	QCOMPARE(results.at (1).toInt (), 4);
+	QVERIFY(!results.at (2).isValid ());
+	QCOMPARE(results.at (3).toInt (), 8);
+	
+	// Invalid inputs are passed as nil, keeping the following ones in place
+	QVERIFY(runtime.execute ("function increment (x) return (x or 0) + 1 end"));
+	results = runtime.callBatch ("increment", QVariantList { 1, QVariant (), 3 });
+	QCOMPARE(results.length (), 3);
+	QCOMPARE(results.at (0).toInt (), 2);
+	QCOMPARE(results.at (1).toInt (), 1);
+	QCOMPARE(results.at (2).toInt (), 4);
+	
+	// In-place on buffers
+	QVector< double > input { 1.5, 2.5, 3.5 };
+	QVector< double > output (3);
+	LuaBuffer in = LuaBuffer::wrap (&runtime, input.data (), input.size ());
+	LuaBuffer out = LuaBuffer::wrap (&runtime, output.data (), output.size ());
+	QVERIFY(runtime.callBatch ("double", in, out));
+	QCOMPARE(output, QVector< double > ({ 3.0, 5.0, 7.0 }));
+	
+	// Errors
+	QString error;
+	QVERIFY(runtime.callBatch ("nothing", QVariantList { 1 }, &error).isEmpty ());
+	QVERIFY(error.contains ("nothing"));
+	QVERIFY(runtime.callBatch ("double", QVariantList { 1, "a" }, &error).isEmpty ());
+	QVERIFY(!error.isEmpty ());
+	QVERIFY(!runtime.callBatch ("double", in, LuaBuffer (), &error));
+}
+
+void LuaRuntimeTest::compiledExpression () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	runtime.setGlobal ("threshold", 10);
+	
+	LuaExpression expr = runtime.compileExpression ("a * b + c > threshold", { "a", "b", "c" });
+	QVERIFY(expr.isValid ());
+	QCOMPARE(expr.variables (), QStringList ({ "a", "b", "c" }));
+	
+	// Variants and native arrays
+	QCOMPARE(expr.evaluate (QVariantList { 2, 3, 4 }), QVariant (false));
+	QCOMPARE(expr.evaluate (QVariantList { 2, 3, 5 }), QVariant (true));
+	
+	double values[] = { 2, 3, 5 };
+	bool ok = false;
+	QCOMPARE(expr.evaluate (values, &ok), 1.0);
+	QVERIFY(ok);
+	
+	// Columns
+	double a[] = { 1, 2, 3 };
+	double b[] = { 4, 5, 6 };
+	double c[] = { 7, 8, 9 };
+	const double *columns[] = { a, b, c };
+	double results[3];
+	
+	LuaExpression sum = runtime.compileExpression ("a * b + c", { "a", "b", "c" });
+	QVERIFY(sum.evaluateColumns (columns, 3, results));
+	QCOMPARE(results[0], 11.0);
+	QCOMPARE(results[1], 18.0);
+	QCOMPARE(results[2], 27.0);
+	
+	// Errors
+	QString error;
+	QVERIFY(!runtime.compileExpression ("a +", { "a" }, &error).isValid ());
+	QVERIFY(!error.isEmpty ());
+	QVERIFY(!runtime.compileExpression ("a", { "a b" }, &error).isValid ());
+	QVERIFY(error.contains ("a b"));
+	
+	LuaExpression text = runtime.compileExpression ("'x' .. a", { "a" });
+	QVERIFY(!text.evaluateColumns (columns, 3, results, &error));
+	QVERIFY(error.contains ("row 1"));
+	text.evaluate (values, &ok, &error);
+	QVERIFY(!ok);
+	QCOMPARE(error, QString ("Result is not a number"));
+	
+	LuaExpression index = runtime.compileExpression ("a.b", { "a" });
+	index.evaluate (values, &ok, &error);
+	QVERIFY(!ok);
+	QVERIFY(error.contains ("index"));
+}
+
+void LuaRuntimeTest::objectPushedAgainAfterCollect () {
+	NEEDS_TRIA;
+	
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	TestStruct first (1, 2);
+	TestStruct second (3, 4);
+	
+	// Pushing an object twice yields the same user data
+	runtime.setGlobal ("a", QVariant::fromValue (&first));
+	runtime.setGlobal ("b", QVariant::fromValue (&first));
+	QVERIFY(runtime.execute ("return rawequal (a, b)"));
+	QCOMPARE(runtime.lastResult ().toVariant (), QVariant (true));
+	
+	// After collecting, the object is pushed as new user data
+	QVERIFY(runtime.execute ("a = nil b = nil"));
+	runtime.collectGarbage ();
+	runtime.collectGarbage ();
+	
+	runtime.setGlobal ("c", QVariant::fromValue (&second));
+	runtime.setGlobal ("a", QVariant::fromValue (&first));
+	QVERIFY(runtime.execute ("return a.a, c.a"));
+	QCOMPARE(runtime.allResults ().at (0).toVariant ().toInt (), 1);
+	QCOMPARE(runtime.allResults ().at (1).toVariant ().toInt (), 3);
+}
+
+void LuaRuntimeTest::objectPushedAgainBeforeFinalizer () {
+	NEEDS_TRIA;
+	
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	TestStruct first (1, 2);
+	runtime.registerFunction ("pushFirst", [&first]() { return QVariant::fromValue (&first); });
+	
+	// Finalizers run in reverse order of creation, so the one of the proxy
+	// runs while the user data of 'first' is unreachable, but not finalized
+	QVERIFY(runtime.execute ("local object = pushFirst ()\n"
+	                         "local proxy = newproxy (true)\n"
+	                         "getmetatable (proxy).__gc = function () again = pushFirst () end\n"
+	                         "object, proxy = nil, nil\n"
+	                         "collectgarbage () collectgarbage ()\n"
+	                         "return again.a"));
+	QCOMPARE(runtime.lastResult ().toVariant ().toInt (), 1);
+	
+	QVERIFY(runtime.execute ("return rawequal (again, pushFirst ())"));
+	QCOMPARE(runtime.lastResult ().toVariant (), QVariant (true));
+}
+
+void LuaRuntimeTest::inlineObjectPushedAgainBeforeFinalizer () {
+	NEEDS_TRIA;
+	
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	TestStruct *inlined = nullptr;
+	runtime.registerFunction ("pushInlined", [&inlined]() { return QVariant::fromValue (inlined); });
+	
+	runtime.setGlobal ("v", QVariant::fromValue (TestStruct (8, 9)));
+	QVERIFY(runtime.execute ("return v"));
+	inlined = static_cast< TestStruct * > (runtime.lastResult ().object ().object ());
+	QVERIFY(inlined);
+	QVERIFY(runtime.execute ("return nil"));
+	
+	// The value pushed again is a copy, the original goes away with 'v'
+	QVERIFY(runtime.execute ("local proxy = newproxy (true)\n"
+	                         "getmetatable (proxy).__gc = function () again = pushInlined () end\n"
+	                         "v, proxy = nil, nil\n"
+	                         "collectgarbage () collectgarbage ()\n"
+	                         "return again.a, again.b"));
+	QCOMPARE(runtime.allResults ().at (0).toVariant ().toInt (), 8);
+	QCOMPARE(runtime.allResults ().at (1).toVariant ().toInt (), 9);
+}
+
+void LuaRuntimeTest::structureStoredInline () {
+	NEEDS_TRIA;
+	
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	
+	// Copies of values live inside their user data
+	TestStruct value (8, 9);
+	runtime.setGlobal ("v", QVariant::fromValue (value));
+	QVERIFY(runtime.execute ("return v"));
+	LuaObject object = runtime.lastResult ().object ();
+	QVERIFY(object.isValid ());
+	
+	TestStruct *ptr = static_cast< TestStruct * > (object.object ());
+	QCOMPARE(ptr->a, 8);
+	QCOMPARE(quintptr (ptr) % 16, quintptr (0));
+	QCOMPARE(runtime.objectOwnership (ptr), LuaRuntime::OwnedByLua);
+	
+	// Can't be taken by C++
+	runtime.setObjectOwnership (ptr, LuaRuntime::OwnedByCpp);
+	QCOMPARE(runtime.objectOwnership (ptr), LuaRuntime::OwnedByLua);
+	
+	// Changes are visible both ways, but not in the original
+	QTest::ignoreMessage (QtDebugMsg, "member");
+	QVERIFY(runtime.execute ("v.a = 10 return v:sum ()"));
+	QCOMPARE(runtime.lastResult ().toVariant ().toInt (), 19);
+	QCOMPARE(ptr->a, 10);
+	QCOMPARE(ptr->c, QString ("10 + 9 = 19"));
+	QCOMPARE(value.a, 8);
+	
+	object = LuaObject ();
+	QVERIFY(runtime.execute ("v = nil"));
+	runtime.collectGarbage ();
+	runtime.collectGarbage ();
+}
+
 void LuaRuntimeTest::verifyGlobals () {
 	LuaRuntime runtime (LuaRuntime::AllLibraries);
 	
@@ -234,6 +1169,126 @@ void LuaRuntimeTest::globalFromCode () {
 	
 }
 
+static int addNumbers (int a, int b) {
+	return a + b;
+}
+
+void LuaRuntimeTest::registerFreeFunction () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	runtime.registerFunction ("add", &addNumbers);
+	
+	QVERIFY(runtime.execute ("return add (3, 4)"));
+	QCOMPARE(runtime.lastResult ().toVariant ().toInt (), 7);
+	
+	// Numbers out of range are clamped, NaN becomes 0
+	runtime.registerFunction ("identity", [](int value) { return value; });
+	QVERIFY(runtime.execute ("return identity (1e20), identity (-1e20), identity (0 / 0)"));
+	QCOMPARE(runtime.allResults ().at (0).toVariant ().toInt (), std::numeric_limits< int >::max ());
+	QCOMPARE(runtime.allResults ().at (1).toVariant ().toInt (), std::numeric_limits< int >::min ());
+	QCOMPARE(runtime.allResults ().at (2).toVariant ().toInt (), 0);
+}
+
+void LuaRuntimeTest::registerLambda () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	
+	QString suffix ("bar");
+	runtime.registerFunction ("concat", [suffix](const QString &str, int count) {
+		return str.repeated (count) + suffix;
+	});
+	
+	QVERIFY(runtime.execute ("return concat (\"foo\", 2)"));
+	QCOMPARE(runtime.lastResult ().toVariant ().toString (), QString ("foofoobar"));
+}
+
+void LuaRuntimeTest::registerFunctionWrongArgumentCount () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	runtime.registerFunction ("add", &addNumbers);
+	
+	QVERIFY(!runtime.execute ("return add (3)"));
+}
+
+void LuaRuntimeTest::builtinConverters () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	QDateTime dateTime (QDate (2015, 3, 14), QTime (15, 9, 26));
+	
+	runtime.setGlobal ("number", QVariant::fromValue (qint64 (1) << 40));
+	runtime.setGlobal ("dateTime", dateTime);
+	
+	QVERIFY(runtime.execute ("return number + 1, dateTime"));
+	QCOMPARE(runtime.allResults ().at (0).toVariant ().toLongLong (), (qint64 (1) << 40) + 1);
+	QCOMPARE(runtime.allResults ().at (1).toVariant ().toString (), dateTime.toString (Qt::ISODate));
+}
+
+static void pushPoint (LuaRuntime *runtime, const QVariant &value) {
+	lua_State *env = (lua_State *)runtime->luaState ();
+	QPoint point = value.toPoint ();
+	
+	lua_createtable (env, 0, 2);
+	lua_pushnumber (env, point.x ());
+	lua_setfield (env, -2, "x");
+	lua_pushnumber (env, point.y ());
+	lua_setfield (env, -2, "y");
+}
+
+static QVariant readPoint (LuaRuntime *runtime, int idx) {
+	lua_State *env = (lua_State *)runtime->luaState ();
+	
+	lua_getfield (env, idx, "x");
+	lua_getfield (env, (idx < 0) ? idx - 1 : idx, "y");
+	QPoint point (lua_tointeger (env, -2), lua_tointeger (env, -1));
+	lua_pop (env, 2);
+	
+	return point;
+}
+
+void LuaRuntimeTest::registerCustomConverter () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	runtime.registerConverter (QMetaType::QPoint, &pushPoint, &readPoint);
+	runtime.registerFunction ("manhattan", [](const QPoint &point) { return point.manhattanLength (); });
+	
+	runtime.setGlobal ("point", QPoint (3, -4));
+	QVERIFY(runtime.execute ("return point.x, manhattan ({ x = -5, y = 6 })"));
+	QCOMPARE(runtime.allResults ().at (0).toVariant ().toInt (), 3);
+	QCOMPARE(runtime.allResults ().at (1).toVariant ().toInt (), 11);
+}
+
+void LuaRuntimeTest::listContainerProxy () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	LuaContainer< QVector< int > >::registerContainer (&runtime);
+	runtime.registerFunction ("size", [](const QVector< int > &list) { return list.size (); });
+	
+	runtime.setGlobal ("numbers", QVariant::fromValue (QVector< int > { 1, 2, 3, 4 }));
+	QVERIFY(runtime.execute ("local sum = 0\n"
+	                         "for i, n in numbers () do sum = sum + i * n end\n"
+	                         "return #numbers, numbers[2], numbers[5], sum, size (numbers)"));
+	
+	LuaValues results = runtime.allResults ();
+	QCOMPARE(results.length (), 5);
+	QCOMPARE(results.at (0).toVariant ().toInt (), 4);
+	QCOMPARE(results.at (1).toVariant ().toInt (), 2);
+	QVERIFY(!results.at (2).toVariant ().isValid ());
+	QCOMPARE(results.at (3).toVariant ().toInt (), 30);
+	QCOMPARE(results.at (4).toVariant ().toInt (), 4);
+}
+
+void LuaRuntimeTest::hashContainerProxy () {
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	LuaContainer< QHash< QString, int > >::registerContainer (&runtime);
+	
+	QHash< QString, int > hash { { "a", 1 }, { "b", 2 } };
+	runtime.setGlobal ("hash", QVariant::fromValue (hash));
+	QVERIFY(runtime.execute ("local sum = 0\n"
+	                         "for k, v in hash () do sum = sum + v end\n"
+	                         "return hash.a, hash.c, #hash, sum"));
+	
+	LuaValues results = runtime.allResults ();
+	QCOMPARE(results.length (), 4);
+	QCOMPARE(results.at (0).toVariant ().toInt (), 1);
+	QVERIFY(!results.at (1).toVariant ().isValid ());
+	QCOMPARE(results.at (2).toVariant ().toInt (), 2);
+	QCOMPARE(results.at (3).toVariant ().toInt (), 3);
+}
+
 void LuaRuntimeTest::structureToLua () {
 	NEEDS_TRIA;
 	
@@ -432,6 +1487,22 @@ void LuaRuntimeTest::passTestStructToCppAsPointer () {
 	QCOMPARE(f.b, 3);
 }
 
+void LuaRuntimeTest::passDerivedStructAsBasePointer () {
+	NEEDS_TRIA;
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	DerivedStruct derived;
+	derived.a = 3;
+	derived.b = 4;
+	
+	runtime.setGlobal ("derived", QVariant::fromValue (&derived));
+	runtime.setGlobal ("sumOf", QVariant::fromValue (Callback::fromLambda ([](TestStruct *s) {
+		return s->a + s->b;
+	})));
+	
+	QVERIFY(runtime.execute ("return sumOf (derived)"));
+	QCOMPARE(runtime.lastResult ().toVariant ().toInt (), 7);
+}
+
 void LuaRuntimeTest::verifyStructureWrapperExistsOnlyOnce () {
 	NEEDS_TRIA;
 	
@@ -520,6 +1591,108 @@ void LuaRuntimeTest::createComplexInstanceDeclarative () {
 	QCOMPARE(root->next->next->id, 3);
 }
 
+void LuaRuntimeTest::nativeFieldBinding () {
+	NEEDS_TRIA;
+	
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	LuaClassBinding< TestStruct > (&runtime, MetaObject::byName ("TestStruct"))
+	                .field ("a", &TestStruct::a)
+	                .field ("c", &TestStruct::c);
+	
+	TestStruct f;
+	f.a = 1;
+	f.b = 2;
+	f.c = "Hello";
+	
+	runtime.setGlobal ("foo", QVariant::fromValue (&f));
+	QVERIFY(runtime.execute ("foo.a = foo.a + foo.b\n" // 'b' is read through the MetaObject
+	                         "foo.c = foo.c .. ' native'"));
+	
+	QCOMPARE(f.a, 3);
+	QCOMPARE(f.b, 2);
+	QCOMPARE(f.c, QString ("Hello native"));
+}
+
+void LuaRuntimeTest::nativeMethodBinding () {
+	NEEDS_TRIA;
+	
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	LuaClassBinding< TestStruct > (&runtime, MetaObject::byName ("TestStruct"))
+	                .method ("sum", static_cast< int (TestStruct::*)() > (&TestStruct::sum))
+	                .method ("add", static_cast< int (*)(int, int) > (&TestStruct::sum));
+	
+	TestStruct f;
+	f.a = 4;
+	f.b = 3;
+	
+	QTest::ignoreMessage (QtDebugMsg, "member");
+	QTest::ignoreMessage (QtDebugMsg, "static");
+	runtime.setGlobal ("foo", QVariant::fromValue (&f));
+	QVERIFY(runtime.execute ("return foo:sum () + foo.add (1, 2)"));
+	
+	QCOMPARE(runtime.lastResult ().toVariant ().toInt (), 10);
+	QCOMPARE(f.c, QString ("4 + 3 = 7"));
+}
+
+void LuaRuntimeTest::writeNestedField () {
+	NEEDS_TRIA;
+	
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	Complex complex;
+	complex.a.a = 1;
+	complex.a.b = 2;
+	
+	runtime.setGlobal ("complex", QVariant::fromValue (&complex));
+	QVERIFY(runtime.execute ("local a = complex.a\n"
+	                         "a.a = a.a + a.b\n"
+	                         "complex.a.c = 'nested'"));
+	
+	QCOMPARE(complex.a.a, 3);
+	QCOMPARE(complex.a.b, 2);
+	QCOMPARE(complex.a.c, QString ("nested"));
+}
+
+void LuaRuntimeTest::writeNestedFieldThroughTwoViews () {
+	NEEDS_TRIA;
+	
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	Complex complex;
+	complex.a.a = 1;
+	complex.a.b = 2;
+	
+	runtime.setGlobal ("complex", QVariant::fromValue (&complex));
+	QVERIFY(runtime.execute ("local a = complex.a\n"
+	                         "local b = complex.a\n"
+	                         "b.c = 'x'\n"
+	                         "a.a = 5\n"
+	                         "b.b = 7\n"
+	                         "return a.b, b.a"));
+	
+	QCOMPARE(runtime.allResults ().at (0).toVariant ().toInt (), 7);
+	QCOMPARE(runtime.allResults ().at (1).toVariant ().toInt (), 5);
+	QCOMPARE(complex.a.a, 5);
+	QCOMPARE(complex.a.b, 7);
+	QCOMPARE(complex.a.c, QString ("x"));
+}
+
+void LuaRuntimeTest::writeNativeNestedField () {
+	NEEDS_TRIA;
+	
+	LuaRuntime runtime (LuaRuntime::AllLibraries);
+	LuaClassBinding< Complex > (&runtime, MetaObject::byName ("Complex")).field ("a", &Complex::a);
+	
+	Complex complex;
+	complex.a.a = 1;
+	
+	runtime.setGlobal ("complex", QVariant::fromValue (&complex));
+	QVERIFY(runtime.execute ("local a = complex.a\n"
+	                         "complex = nil\n"
+	                         "collectgarbage ()\n"
+	                         "a.a = 5"));
+	
+	QCOMPARE(complex.a.a, 5);
+}
+
 Q_DECLARE_METATYPE(Nuria::LuaRuntime::Ownership)
 Q_DECLARE_METATYPE(Nuria::LuaRuntime::OwnershipFlags)
 